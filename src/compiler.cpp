@@ -2,6 +2,7 @@
 #include "common.h"
 #include "debug.h"
 #include "scanner.h"
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
@@ -23,14 +24,67 @@ static void initCompiler() {
     Variable *boolVar = new Variable();
     boolVar->type = BOOL_VAR;
 
+    Variable *strVar = new Variable();
+    strVar->type = STR_VAR;
+
+    Variable *doubleVar = new Variable();
+    doubleVar->type = DOUBLE_VAR;
+
+    Variable *floatVar = new Variable();
+    floatVar->type = FLOAT_VAR;
+
+    Variable *i64Var = new Variable();
+    i64Var->type = I64_VAR;
+
+    Variable *u8Var = new Variable();
+    u8Var->type = U8_VAR;
+
+    Variable *i16Var = new Variable();
+    i16Var->type = I16_VAR;
+
+    Variable *u32Var = new Variable();
+    u32Var->type = U32_VAR;
+
+    Variable *builderVar = new Variable();
+    builderVar->type = BUILDER_VAR;
+
+    Variable *gridVar = new GridVariable("");
+
     compiler->variables = {{
         {"len", new FuncVariable("len", intVar, {new ArrayVariable("")})},
+        {"len_i64", new FuncVariable("len_i64", i64Var, {new ArrayVariable("")})},
         {"printf", new FuncVariable("printf", nilVar, {})},
         {"keys", new FuncVariable("keys", new ArrayVariable(""), {new MapVariable("")})},
         {"key_exists", new FuncVariable("key_exists", boolVar, {})},
         {"values", new FuncVariable("values", new ArrayVariable(""), {new MapVariable("")})},
         {"append", new FuncVariable("append", new ArrayVariable(""), {})},
         {"readfile", new FuncVariable("readfile", new ArrayVariable(""), {})},
+        {"insert", new FuncVariable("insert", nilVar, {})},
+        {"contains", new FuncVariable("contains", boolVar, {})},
+        {"remove", new FuncVariable("remove", boolVar, {})},
+        {"union", new FuncVariable("union", new SetVariable(""), {})},
+        {"intersection", new FuncVariable("intersection", new SetVariable(""), {})},
+        {"difference", new FuncVariable("difference", new SetVariable(""), {})},
+        {"elements", new FuncVariable("elements", new ArrayVariable(""), {})},
+        {"builder", new FuncVariable("builder", builderVar, {})},
+        {"push", new FuncVariable("push", nilVar, {builderVar, strVar})},
+        {"push_int", new FuncVariable("push_int", nilVar, {builderVar, intVar})},
+        {"push_double", new FuncVariable("push_double", nilVar, {builderVar, doubleVar})},
+        {"build", new FuncVariable("build", strVar, {builderVar})},
+        {"intern", new FuncVariable("intern", strVar, {strVar})},
+        {"move", new FuncVariable("move", nilVar, {})},
+        {"new_grid", new FuncVariable("new_grid", gridVar, {intVar, intVar})},
+        {"rows", new FuncVariable("rows", intVar, {gridVar})},
+        {"cols", new FuncVariable("cols", intVar, {gridVar})},
+        {"fill", new FuncVariable("fill", nilVar, {})},
+        {"copy_row", new FuncVariable("copy_row", nilVar, {})},
+        {"to_int", new FuncVariable("to_int", intVar, {})},
+        {"to_i64", new FuncVariable("to_i64", i64Var, {})},
+        {"to_u8", new FuncVariable("to_u8", u8Var, {})},
+        {"to_i16", new FuncVariable("to_i16", i16Var, {})},
+        {"to_u32", new FuncVariable("to_u32", u32Var, {})},
+        {"to_float", new FuncVariable("to_float", floatVar, {})},
+        {"to_double", new FuncVariable("to_double", doubleVar, {})},
     }};
 }
 
@@ -105,6 +159,21 @@ static VarType getVarType() {
     case TOKEN_INT_TYPE: {
         return INT_VAR;
     }
+    case TOKEN_I64_TYPE: {
+        return I64_VAR;
+    }
+    case TOKEN_U8_TYPE: {
+        return U8_VAR;
+    }
+    case TOKEN_I16_TYPE: {
+        return I16_VAR;
+    }
+    case TOKEN_U32_TYPE: {
+        return U32_VAR;
+    }
+    case TOKEN_FLOAT_TYPE: {
+        return FLOAT_VAR;
+    }
     case TOKEN_DOUBLE_TYPE: {
         return DOUBLE_VAR;
     }
@@ -120,6 +189,15 @@ static VarType getVarType() {
     case TOKEN_MAP_TYPE: {
         return MAP_VAR;
     }
+    case TOKEN_SET_TYPE: {
+        return SET_VAR;
+    }
+    case TOKEN_BUILDER_TYPE: {
+        return BUILDER_VAR;
+    }
+    case TOKEN_GRID_TYPE: {
+        return GRID_VAR;
+    }
     case TOKEN_IDENTIFIER: {
         return STRUCT_VAR;
     }
@@ -136,6 +214,47 @@ static VarType getVarType() {
     exit(1);
 }
 
+static bool isNarrowInt(VarType type) { return type == U8_VAR || type == I16_VAR || type == U32_VAR; }
+
+static bool isIntegerType(VarType type) { return type == INT_VAR || type == I64_VAR || isNarrowInt(type); }
+
+static bool isFloatType(VarType type) { return type == FLOAT_VAR || type == DOUBLE_VAR; }
+
+static long long intLiteralValue(std::string literal, int line = 0) {
+    long long value;
+    if (!parseIntLiteral(literal, value)) {
+        errorAt(("Integer literal " + literal + " doesn't fit in an i64").c_str(), line);
+    }
+    return value;
+}
+
+static bool isLen(std::string callee) { return callee == "len" || callee == "len_i64"; }
+
+static bool isFixedArray(Variable *var) { return var->type == ARRAY_VAR && ((ArrayVariable *)var)->fixedSize > 0; }
+
+// Declared struct variables only carry the struct name, the fields are on the declaration
+static std::vector<Variable *> getStructFields(StructVariable *structVar) {
+    std::vector<Variable *> fields = structVar->fields;
+    for (int i = compiler->variables.size() - 1; fields.empty() && i >= 0; i--) {
+        if (compiler->variables[i].count(structVar->structName) &&
+            compiler->variables[i][structVar->structName]->type == STRUCT_VAR) {
+            fields = ((StructVariable *)compiler->variables[i][structVar->structName])->fields;
+        }
+    }
+    return fields;
+}
+
+static Variable *parseVarType(Variable *var);
+
+// Fixed size arrays live in the frame of the function declaring them, they can't be stored in anything else
+static Variable *parseItemType() {
+    Variable *items = parseVarType(new Variable());
+    if (isFixedArray(items)) {
+        errorAt("Fixed size arrays can only be declared as variables");
+    }
+    return items;
+}
+
 static Variable *parseVarType(Variable *var) {
     advance();
     var->type = getVarType();
@@ -143,7 +262,7 @@ static Variable *parseVarType(Variable *var) {
         ArrayVariable *arrayVar = new ArrayVariable(var->name);
         consume(TOKEN_LEFT_BRACKET, "Need array type");
 
-        arrayVar->items = parseVarType(new Variable());
+        arrayVar->items = parseItemType();
         consume(TOKEN_RIGHT_BRACKET, "Need ']' after array type");
 
         return arrayVar;
@@ -151,15 +270,55 @@ static Variable *parseVarType(Variable *var) {
         MapVariable *mapVar = new MapVariable(var->name);
         consume(TOKEN_LEFT_BRACKET, "Need map type");
 
-        mapVar->keys = parseVarType(new Variable());
+        mapVar->keys = parseItemType();
         consume(TOKEN_COMMA, "Need, before map values");
 
-        mapVar->values = parseVarType(new Variable());
+        mapVar->values = parseItemType();
+        if (isIntegerType(mapVar->keys->type) && mapVar->keys->type != INT_VAR) {
+            errorAt("Integer map keys have to be int");
+        }
         consume(TOKEN_RIGHT_BRACKET, "Need ']' after map type");
 
         return mapVar;
+    } else if (var->type == SET_VAR) {
+        SetVariable *setVar = new SetVariable(var->name);
+        consume(TOKEN_LEFT_BRACKET, "Need set type");
+
+        setVar->items = parseItemType();
+        if (setVar->items->type != INT_VAR && setVar->items->type != STR_VAR) {
+            errorAt("Can only have sets of int or str");
+        }
+        consume(TOKEN_RIGHT_BRACKET, "Need ']' after set type");
+
+        return setVar;
+    } else if (var->type == GRID_VAR) {
+        GridVariable *gridVar = new GridVariable(var->name);
+        consume(TOKEN_LEFT_BRACKET, "Need grid type");
+
+        gridVar->items = parseItemType();
+        VarType itemType = gridVar->items->type;
+        if (itemType != INT_VAR && itemType != DOUBLE_VAR && itemType != BOOL_VAR) {
+            errorAt("Can only have grids of int, double or bool");
+        }
+        consume(TOKEN_RIGHT_BRACKET, "Need ']' after grid type");
+
+        return gridVar;
     } else if (var->type == STRUCT_VAR) {
         return new StructVariable(var->name, parser->previous->lexeme, {});
+    } else if ((isIntegerType(var->type) || isFloatType(var->type) || var->type == BOOL_VAR) &&
+               match(TOKEN_LEFT_BRACKET)) {
+        ArrayVariable *arrayVar = new ArrayVariable(var->name);
+        arrayVar->items = new Variable();
+        arrayVar->items->type = var->type;
+        consume(TOKEN_INT_LITERAL, "Expect size of fixed size array");
+        long long fixedSize = intLiteralValue(parser->previous->lexeme);
+        if (fixedSize <= 0 || fixedSize > INT32_MAX) {
+            errorAt("Fixed size array needs a size above 0 that fits in an int");
+        }
+        arrayVar->fixedSize = fixedSize;
+        consume(TOKEN_RIGHT_BRACKET, "Need ']' after fixed size array size");
+
+        return arrayVar;
     } else {
         return var;
     }
@@ -501,22 +660,22 @@ static void dot(Expr *&expr) {
     }
     case BINARY_EXPR: {
         BinaryExpr *binaryExpr = (BinaryExpr *)expr;
-        identifier(binaryExpr->right);
+        dot(binaryExpr->right);
         break;
     }
     case LOGICAL_EXPR: {
         LogicalExpr *logicalExpr = (LogicalExpr *)expr;
-        identifier(logicalExpr->right);
+        dot(logicalExpr->right);
         break;
     }
     case UNARY_EXPR: {
         UnaryExpr *unaryExpr = (UnaryExpr *)expr;
-        identifier(unaryExpr->right);
+        dot(unaryExpr->right);
         break;
     }
     case COMPARISON_EXPR: {
         ComparisonExpr *comparisonExpr = (ComparisonExpr *)expr;
-        identifier(comparisonExpr->right);
+        dot(comparisonExpr->right);
         break;
     }
     case INDEX_EXPR: {
@@ -671,7 +830,22 @@ static void index(Expr *&expr) {
         break;
     }
     default: {
-        expr = new IndexExpr(expr, expression(nullptr), expr->line);
+        Expr *index = expression(nullptr);
+        if (match(TOKEN_COLON)) {
+            SliceExpr *sliceExpr = new SliceExpr(expr, index, expr->line);
+            sliceExpr->end = expression(nullptr);
+            expr = sliceExpr;
+            consume(TOKEN_RIGHT_BRACKET, "Expect ']' after slice");
+            break;
+        }
+        if (index == nullptr) {
+            errorAt("Expect index");
+        }
+        IndexExpr *indexExpr = new IndexExpr(expr, index, expr->line);
+        if (match(TOKEN_COMMA)) {
+            indexExpr->column = expression(nullptr);
+        }
+        expr = indexExpr;
         consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index");
         break;
     }
@@ -853,11 +1027,29 @@ static Expr *arrayDeclaration() {
     return arrayExpr;
 }
 
+static Expr *setDeclaration(Expr *first, int line) {
+    SetExpr *setExpr = new SetExpr(line);
+    setExpr->items.push_back(first);
+    while (match(TOKEN_COMMA)) {
+        setExpr->items.push_back(expression(nullptr));
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after set items.");
+    return setExpr;
+}
+
 static Expr *mapDeclaration() {
     MapExpr *mapExpr = new MapExpr(parser->previous->line);
     if (parser->current->type != TOKEN_RIGHT_BRACE) {
         do {
             mapExpr->keys.push_back(expression(nullptr));
+            // '{a, b}' without a ':' after the first item is a set literal
+            if (mapExpr->keys.size() == 1 && parser->current->type != TOKEN_COLON) {
+                Expr *first = mapExpr->keys[0];
+                int line = mapExpr->line;
+                delete (mapExpr);
+                return setDeclaration(first, line);
+            }
             consume(TOKEN_COLON, "Expect colon between key and value");
             mapExpr->values.push_back(expression(nullptr));
         } while (match(TOKEN_COMMA));
@@ -894,9 +1086,23 @@ static Stmt *varDeclaration() {
                 }
             }
         }
+    } else if (varStmt->initializer->type == MAP_EXPR && varStmt->var->type == SET_VAR) {
+        // '{}' is parsed as an empty map
+        SetExpr *setExpr = new SetExpr(varStmt->initializer->line);
+        setExpr->setVar = varStmt->var;
+        freeExpr(varStmt->initializer);
+        varStmt->initializer = setExpr;
+    } else if (varStmt->initializer->type == MAP_EXPR && varStmt->var->type == BUILDER_VAR) {
+        // A builder starts out empty, '{}' becomes a call to the internal constructor
+        CallExpr *callExpr = new CallExpr("builder", varStmt->initializer->line);
+        freeExpr(varStmt->initializer);
+        varStmt->initializer = callExpr;
     } else if (varStmt->initializer->type == MAP_EXPR) {
         MapExpr *mapExpr = (MapExpr *)varStmt->initializer;
         mapExpr->mapVar = varStmt->var;
+    } else if (varStmt->initializer->type == SET_EXPR) {
+        SetExpr *setExpr = (SetExpr *)varStmt->initializer;
+        setExpr->setVar = varStmt->var;
     }
 
     consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration");
@@ -920,6 +1126,9 @@ static Stmt *variableStatement(std::string ident) {
     } else if (match(TOKEN_LEFT_BRACKET)) {
         IndexExpr *indexExpr =
             new IndexExpr(new VarExpr(ident, parser->previous->line), expression(nullptr), parser->previous->line);
+        if (match(TOKEN_COMMA)) {
+            indexExpr->column = expression(nullptr);
+        }
         consume(TOKEN_RIGHT_BRACKET, "Expected ']' after index");
         while (match(TOKEN_LEFT_BRACKET)) {
             indexExpr = new IndexExpr(indexExpr, expression(nullptr), parser->previous->line);
@@ -955,6 +1164,25 @@ static Stmt *expressionStatement() {
     return new ExprStmt(expression(nullptr), parser->current->line);
 }
 
+static Stmt *forEachStatement(std::string first, int line) {
+    std::string key = "";
+    std::string item = first;
+    if (match(TOKEN_COMMA)) {
+        consume(TOKEN_IDENTIFIER, "Expect name of the item after ','");
+        key = first;
+        item = parser->previous->lexeme;
+    }
+    consume(TOKEN_IN, "Expect 'in' after loop variables");
+    ForEachStmt *forEachStmt = new ForEachStmt(key, item, expression(nullptr), line);
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after for each");
+
+    consume(TOKEN_LEFT_BRACE, "Expect '{' after 'for()'");
+    while (!match(TOKEN_RIGHT_BRACE)) {
+        forEachStmt->body.push_back(declaration());
+    }
+    return forEachStmt;
+}
+
 static Stmt *forStatement() {
     ForStmt *forStmt = new ForStmt(parser->previous->line);
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
@@ -962,6 +1190,15 @@ static Stmt *forStatement() {
     if (match(TOKEN_SEMICOLON)) {
     } else if (match(TOKEN_VAR)) {
         forStmt->initializer = varDeclaration();
+    } else if (match(TOKEN_IDENTIFIER)) {
+        std::string ident = parser->previous->lexeme;
+        if (parser->current->type == TOKEN_IN || parser->current->type == TOKEN_COMMA) {
+            int line = forStmt->line;
+            delete (forStmt);
+            return forEachStatement(ident, line);
+        }
+        forStmt->initializer = variableStatement(ident);
+        consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
     } else {
         forStmt->initializer = expressionStatement();
         consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
@@ -1024,13 +1261,26 @@ static Stmt *whileStatement() {
     return whileStmt;
 }
 
-static Stmt *structDeclaration() {
+static Stmt *regionStatement() {
+    RegionStmt *regionStmt = new RegionStmt(false, parser->previous->line);
+    consume(TOKEN_LEFT_BRACE, "Expect '{' after 'region'");
+    while (!match(TOKEN_RIGHT_BRACE)) {
+        regionStmt->body.push_back(declaration());
+    }
+    return regionStmt;
+}
+
+static Stmt *structDeclaration(bool soa) {
     int line = parser->previous->line;
     consume(TOKEN_IDENTIFIER, "Expect struct name");
     StructStmt *structStmt = new StructStmt(parser->previous->lexeme, line);
+    structStmt->soa = soa;
     consume(TOKEN_LEFT_BRACE, "Expect '{' before struct body.");
     while (!match(TOKEN_RIGHT_BRACE)) {
         structStmt->fields.push_back(parseVariable());
+        if (isFixedArray(structStmt->fields.back())) {
+            errorAt("Fixed size arrays can only be declared as variables", line);
+        }
         consume(TOKEN_SEMICOLON, "Expect semicolon after struct field identifier");
     }
     consume(TOKEN_SEMICOLON, "Expect ';' after struct end.");
@@ -1048,7 +1298,17 @@ static Stmt *funDeclaration() {
     consume(TOKEN_LEFT_PAREN, "Expect '(' after func name");
     if (!match(TOKEN_RIGHT_PAREN)) {
         do {
+            bool ref = match(TOKEN_REF);
             funcStmt->params.push_back(parseVariable());
+            Variable *param = funcStmt->params.back();
+            if (isFixedArray(param)) {
+                errorAt("Fixed size arrays are passed as 'arr[T]'", line);
+            }
+            if (ref && param->type != ARRAY_VAR && param->type != MAP_VAR && param->type != STRUCT_VAR &&
+                param->type != SET_VAR && param->type != GRID_VAR && param->type != BUILDER_VAR) {
+                errorAt("Only arrays, maps, structs, sets, grids and builders can be passed by 'ref'", line);
+            }
+            param->ref = ref;
         } while (match(TOKEN_COMMA));
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after func params");
     }
@@ -1056,6 +1316,9 @@ static Stmt *funDeclaration() {
     consume(TOKEN_ARROW, "Expect '->' after func params");
 
     funcStmt->returnType = parseVarType(new Variable());
+    if (isFixedArray(funcStmt->returnType)) {
+        errorAt("Fixed size arrays are returned as 'arr[T]'", line);
+    }
 
     if (funcStmt->returnType->type == STRUCT_VAR) {
         funcStmt->returnType->name = parser->previous->lexeme;
@@ -1077,6 +1340,8 @@ static Stmt *statement() {
         return returnStatement();
     } else if (match(TOKEN_WHILE)) {
         return whileStatement();
+    } else if (match(TOKEN_REGION)) {
+        return regionStatement();
     } else if (match(TOKEN_BREAK)) {
         BreakStmt *stmt = new BreakStmt(parser->previous->line);
         consume(TOKEN_SEMICOLON, "Expect ';' after break");
@@ -1094,7 +1359,10 @@ static Stmt *declaration() {
     } else if (match(TOKEN_VAR)) {
         return varDeclaration();
     } else if (match(TOKEN_STRUCT_TYPE)) {
-        return structDeclaration();
+        return structDeclaration(false);
+    } else if (match(TOKEN_SOA)) {
+        consume(TOKEN_STRUCT_TYPE, "Expect 'struct' after 'soa'");
+        return structDeclaration(true);
     } else {
         return statement();
     }
@@ -1106,12 +1374,123 @@ static void initParser() {
     parser->previous = nullptr;
 }
 
+// int widens to i64 implicitly, any other change of integer type needs a to_<type> conversion
+static bool widensTo(VarType from, VarType to) { return from == to || from == INT_VAR && to == I64_VAR; }
+
+static bool isConversionFunc(std::string name) {
+    return name == "to_int" || name == "to_i64" || name == "to_u8" || name == "to_i16" || name == "to_u32" ||
+           name == "to_float" || name == "to_double";
+}
+
+// An integer literal takes the narrow type it's used with as long as it fits, double literals can be floats
+static void matchLiteral(Variable *target, Expr *value, int line) {
+    if (target == nullptr || !isNarrowInt(target->type) && target->type != FLOAT_VAR) {
+        return;
+    }
+    Expr *literal = value;
+    bool negated = value->type == UNARY_EXPR && ((UnaryExpr *)value)->op == NEG_UNARY;
+    if (negated) {
+        literal = ((UnaryExpr *)value)->right;
+    }
+    if (literal->type != LITERAL_EXPR) {
+        return;
+    }
+    LiteralType literalType = ((LiteralExpr *)literal)->literalType;
+    LiteralType expected = target->type == FLOAT_VAR ? DOUBLE_LITERAL : INT_LITERAL;
+    if (literalType != expected) {
+        return;
+    }
+    Variable *literalVar = new Variable();
+    literalVar->type = target->type;
+    literal->evaluatesTo = literalVar;
+    value->evaluatesTo = literalVar;
+    if (target->type == FLOAT_VAR) {
+        return;
+    }
+
+    long long number = intLiteralValue(((LiteralExpr *)literal)->literal, line) * (negated ? -1 : 1);
+    long long min = target->type == I16_VAR ? INT16_MIN : 0;
+    long long max = target->type == U8_VAR ? UINT8_MAX : target->type == I16_VAR ? INT16_MAX : UINT32_MAX;
+    if (number < min || number > max) {
+        errorAt((std::to_string(number) + " doesn't fit in " + debugVarType(target->type)).c_str(), line);
+    }
+}
+
+// Floats never mix with other number types without a conversion
+static void checkNumberStore(Variable *target, Expr *value, int line) {
+    if (target == nullptr) {
+        return;
+    }
+    matchLiteral(target, value, line);
+    VarType from = value->evaluatesTo->type;
+    bool integers = isIntegerType(target->type) && isIntegerType(from);
+    bool numbers = !integers && (isIntegerType(target->type) || isFloatType(target->type)) &&
+                   (isIntegerType(from) || isFloatType(from));
+    bool floats = target->type == FLOAT_VAR || from == FLOAT_VAR;
+    if (integers && !widensTo(from, target->type) || numbers && floats && from != target->type) {
+        std::string to = debugVarType(target->type);
+        errorAt(("Can't store " + std::string(debugVarType(from)) + " in " + to + ", convert it with to_" + to).c_str(),
+                line);
+    }
+}
+
+// Params that aren't 'ref' are read-only, the function only has a pointer to the caller's value
+static bool isReadOnlyParam(Variable *var) {
+    for (auto &declared : compiler->variables.front()) {
+        if (declared.second->type != FUNC_VAR) {
+            continue;
+        }
+        std::vector<Variable *> &params = ((FuncVariable *)declared.second)->params;
+        if (std::find(params.begin(), params.end(), var) != params.end()) {
+            return !var->ref;
+        }
+    }
+    return false;
+}
+
+// A 'ref' param is given the variable itself, the function writes to it when it returns so it can't be passed
+// twice
+static void checkRefArgument(std::vector<Expr *> exprs, int i, int line) {
+    if (exprs[i]->type != VAR_EXPR) {
+        errorAt("Can only pass a variable by 'ref'", line);
+    }
+    Variable *var = exprs[i]->evaluatesTo;
+    if (isFixedArray(var)) {
+        errorAt("Can't pass a fixed size array by 'ref'", line);
+    }
+    if (isReadOnlyParam(var)) {
+        errorAt("Can't pass a param by 'ref' unless it's 'ref' itself", line);
+    }
+    for (int j = 0; j < exprs.size(); ++j) {
+        if (j != i && exprs[j]->type == VAR_EXPR && ((VarExpr *)exprs[j])->name == ((VarExpr *)exprs[i])->name) {
+            errorAt("Can't pass a variable given by 'ref' again in the same call", line);
+        }
+    }
+}
+
+// 'new_grid(rows, cols)' doesn't know its item type, it's taken from the variable, param or return type it's given to
+static void setGridItems(Expr *initializer, Variable *var) {
+    if (initializer->type == CALL_EXPR && ((CallExpr *)initializer)->callee == "new_grid") {
+        if (var == nullptr || var->type != GRID_VAR) {
+            errorAt("Can only store a new grid in a grid variable", initializer->line);
+        }
+        initializer->evaluatesTo = var;
+    }
+}
+
 static void checkParamMatch(std::vector<Variable *> vars, std::vector<Expr *> exprs, int line) {
     if (vars.size() != exprs.size()) {
         errorAt("Number of params doesn't match", line);
     }
     for (int i = 0; i < vars.size(); i++) {
-        if (vars[i]->type != exprs[i]->evaluatesTo->type && vars[i]->type != ARRAY_VAR &&
+        if (vars[i]->ref) {
+            checkRefArgument(exprs, i, line);
+        }
+        matchLiteral(vars[i], exprs[i], line);
+        if (vars[i]->type == GRID_VAR) {
+            setGridItems(exprs[i], vars[i]);
+        }
+        if (!widensTo(exprs[i]->evaluatesTo->type, vars[i]->type) && vars[i]->type != ARRAY_VAR &&
             exprs[i]->evaluatesTo->type != STR_VAR) {
             debugVariable(vars[i]);
             printf(" - ");
@@ -1122,6 +1501,74 @@ static void checkParamMatch(std::vector<Variable *> vars, std::vector<Expr *> ex
     }
 }
 
+static bool isGridFunc(std::string name) { return name == "fill" || name == "copy_row"; }
+
+static void checkGridCall(CallExpr *callExpr) {
+    std::string name = callExpr->callee;
+    int expectedArgs = name == "fill" ? 2 : 4;
+    if (callExpr->arguments.size() != expectedArgs) {
+        errorAt(("Number of params doesn't match, expected " + std::to_string(expectedArgs)).c_str(), callExpr->line);
+    }
+    if (callExpr->arguments[0]->evaluatesTo->type != GRID_VAR) {
+        errorAt("First arg must be grid", callExpr->line);
+    }
+    GridVariable *gridVar = (GridVariable *)callExpr->arguments[0]->evaluatesTo;
+    if (callExpr->arguments[0]->type == VAR_EXPR && isReadOnlyParam(gridVar)) {
+        errorAt("Can only write to the cells of a grid param declared 'ref'", callExpr->line);
+    }
+    if (name == "fill") {
+        if (callExpr->arguments[1]->evaluatesTo->type != gridVar->items->type) {
+            errorAt("Can't fill grid with item of different type", callExpr->line);
+        }
+        return;
+    }
+    Variable *other = callExpr->arguments[2]->evaluatesTo;
+    if (other->type != GRID_VAR || ((GridVariable *)other)->items->type != gridVar->items->type) {
+        errorAt("Can only copy rows between grids of the same type", callExpr->line);
+    }
+    if (callExpr->arguments[1]->evaluatesTo->type != INT_VAR || callExpr->arguments[3]->evaluatesTo->type != INT_VAR) {
+        errorAt("Rows must be int", callExpr->line);
+    }
+}
+
+static bool isSetFunc(std::string name) {
+    return name == "insert" || name == "contains" || name == "remove" || name == "union" || name == "intersection" ||
+           name == "difference" || name == "elements";
+}
+
+static void checkSetCall(CallExpr *callExpr) {
+    std::string name = callExpr->callee;
+    int expectedArgs = name == "elements" ? 1 : 2;
+    if (callExpr->arguments.size() != expectedArgs) {
+        errorAt(("Number of params doesn't match, expected " + std::to_string(expectedArgs)).c_str(), callExpr->line);
+    }
+    if (callExpr->arguments[0]->evaluatesTo->type != SET_VAR) {
+        errorAt("First arg must be set", callExpr->line);
+    }
+    SetVariable *setVar = (SetVariable *)callExpr->arguments[0]->evaluatesTo;
+    if (setVar->items->type != INT_VAR && setVar->items->type != STR_VAR) {
+        errorAt("Can only have sets of int or str", callExpr->line);
+    }
+
+    if (name == "union" || name == "intersection" || name == "difference") {
+        Variable *other = callExpr->arguments[1]->evaluatesTo;
+        if (other->type != SET_VAR || ((SetVariable *)other)->items->type != setVar->items->type) {
+            errorAt("Second arg must be set of the same type", callExpr->line);
+        }
+        callExpr->evaluatesTo = setVar;
+    } else if (name == "elements") {
+        ArrayVariable *arrayVar = new ArrayVariable("");
+        arrayVar->items = setVar->items;
+        callExpr->evaluatesTo = arrayVar;
+    } else if (callExpr->arguments[1]->evaluatesTo->type != setVar->items->type) {
+        errorAt("Set item has different type", callExpr->line);
+    }
+    // Growing the set releases the slots the caller still points to
+    if ((name == "insert" || name == "remove") && callExpr->arguments[0]->type == VAR_EXPR && isReadOnlyParam(setVar)) {
+        errorAt("Can only insert into or remove from a set param declared 'ref'", callExpr->line);
+    }
+}
+
 static void fixExprEvaluatesToExpr(Expr *expr) {
     switch (expr->type) {
     case BINARY_EXPR: {
@@ -1129,6 +1576,8 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
         fixExprEvaluatesToExpr(binaryExpr->left);
         fixExprEvaluatesToExpr(binaryExpr->right);
 
+        matchLiteral(binaryExpr->left->evaluatesTo, binaryExpr->right, binaryExpr->line);
+        matchLiteral(binaryExpr->right->evaluatesTo, binaryExpr->left, binaryExpr->line);
         Variable *leftEvaluation = binaryExpr->left->evaluatesTo;
         Variable *rightEvaluation = binaryExpr->right->evaluatesTo;
 
@@ -1136,11 +1585,14 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
             binaryExpr->evaluatesTo = leftEvaluation;
         }
 
-        else if (leftEvaluation->type == DOUBLE_VAR && rightEvaluation->type == INT_VAR ||
-                 leftEvaluation->type == INT_VAR && rightEvaluation->type == DOUBLE_VAR) {
+        else if (widensTo(leftEvaluation->type, I64_VAR) && widensTo(rightEvaluation->type, I64_VAR)) {
             Variable *var = new Variable();
-            var->type = DOUBLE_VAR;
+            var->type = I64_VAR;
             binaryExpr->evaluatesTo = var;
+        } else if (isFloatType(leftEvaluation->type) && widensTo(rightEvaluation->type, I64_VAR)) {
+            binaryExpr->evaluatesTo = leftEvaluation;
+        } else if (widensTo(leftEvaluation->type, I64_VAR) && isFloatType(rightEvaluation->type)) {
+            binaryExpr->evaluatesTo = rightEvaluation;
         } else {
             errorAt("Unable to do binaryExpr with these types", binaryExpr->line);
         }
@@ -1152,7 +1604,7 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
         fixExprEvaluatesToExpr(incExpr->expr);
 
         VarType varType = incExpr->expr->evaluatesTo->type;
-        if (varType != INT_VAR && varType != DOUBLE_VAR) {
+        if (!isIntegerType(varType) && !isFloatType(varType)) {
             errorAt("Unable to do inc/dec expression on this type", incExpr->line);
         }
 
@@ -1185,7 +1637,9 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
             break;
         }
         case INT_LITERAL: {
-            literalExpr->evaluatesTo->type = INT_VAR;
+            // Literals too big for an int are i64 straight away
+            bool fitsInt = intLiteralValue(literalExpr->literal, literalExpr->line) <= INT32_MAX;
+            literalExpr->evaluatesTo->type = fitsInt ? INT_VAR : I64_VAR;
             break;
         }
         case BOOL_LITERAL: {
@@ -1203,7 +1657,11 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
         ComparisonExpr *comparisonExpr = (ComparisonExpr *)expr;
         fixExprEvaluatesToExpr(comparisonExpr->left);
         fixExprEvaluatesToExpr(comparisonExpr->right);
-        if (comparisonExpr->left->evaluatesTo->type != comparisonExpr->right->evaluatesTo->type) {
+        matchLiteral(comparisonExpr->left->evaluatesTo, comparisonExpr->right, comparisonExpr->line);
+        matchLiteral(comparisonExpr->right->evaluatesTo, comparisonExpr->left, comparisonExpr->line);
+        VarType leftType = comparisonExpr->left->evaluatesTo->type;
+        VarType rightType = comparisonExpr->right->evaluatesTo->type;
+        if (!widensTo(leftType, rightType) && !widensTo(rightType, leftType)) {
             errorAt("Can't do logical expression with different types", comparisonExpr->line);
         }
         comparisonExpr->evaluatesTo = new Variable();
@@ -1218,7 +1676,7 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
         if (unaryExpr->op == BANG_UNARY && evalsTo->type != BOOL_VAR) {
             errorAt("Can't do '!' expr with non bool", unaryExpr->line);
         }
-        if (unaryExpr->op == NEG_UNARY && evalsTo->type != INT_VAR && evalsTo->type != DOUBLE_VAR) {
+        if (unaryExpr->op == NEG_UNARY && !isIntegerType(evalsTo->type) && !isFloatType(evalsTo->type)) {
             errorAt("Can't do '-' expr with non bool", unaryExpr->line);
         }
 
@@ -1235,6 +1693,20 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
         if (variable == nullptr) {
             errorAt("var was nullptr?", 0);
         }
+        if (variable->type == GRID_VAR) {
+            if (indexExpr->column == nullptr) {
+                errorAt("Need both row and column when indexing grid", indexExpr->line);
+            }
+            fixExprEvaluatesToExpr(indexExpr->column);
+            if (evalsTo->type != INT_VAR || indexExpr->column->evaluatesTo->type != INT_VAR) {
+                errorAt("Invalid key type, can only index grid with int", indexExpr->line);
+            }
+            indexExpr->evaluatesTo = ((GridVariable *)variable)->items;
+            break;
+        }
+        if (indexExpr->column != nullptr) {
+            errorAt("Can only index grid with two indices", indexExpr->line);
+        }
         if (variable->type == MAP_VAR) {
             MapVariable *mapVar = (MapVariable *)variable;
             if (evalsTo->type != mapVar->keys->type) {
@@ -1243,13 +1715,13 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
             indexExpr->evaluatesTo = mapVar->values;
         } else if (variable->type == ARRAY_VAR) {
             ArrayVariable *arrayVar = (ArrayVariable *)variable;
-            if (evalsTo->type != INT_VAR) {
-                errorAt("Invalid key type, can only index array with int", indexExpr->line);
+            if (!widensTo(evalsTo->type, I64_VAR)) {
+                errorAt("Invalid key type, can only index array with int or i64", indexExpr->line);
             }
             indexExpr->evaluatesTo = arrayVar->items;
         } else if (variable->type == STR_VAR) {
-            if (evalsTo->type != INT_VAR) {
-                errorAt("Invalid key type, can only index str with int", indexExpr->line);
+            if (!widensTo(evalsTo->type, I64_VAR)) {
+                errorAt("Invalid key type, can only index str with int or i64", indexExpr->line);
             }
             indexExpr->evaluatesTo = variable;
         } else {
@@ -1258,6 +1730,32 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
         }
         break;
     }
+    case SLICE_EXPR: {
+        SliceExpr *sliceExpr = (SliceExpr *)expr;
+        fixExprEvaluatesToExpr(sliceExpr->variable);
+        for (Expr *bound : {sliceExpr->start, sliceExpr->end}) {
+            if (bound == nullptr) {
+                continue;
+            }
+            fixExprEvaluatesToExpr(bound);
+            if (!widensTo(bound->evaluatesTo->type, I64_VAR)) {
+                errorAt("Can only slice with int or i64 bounds", sliceExpr->line);
+            }
+        }
+
+        Variable *variable = sliceExpr->variable->evaluatesTo;
+        if (variable->type == ARRAY_VAR) {
+            // A slice of a fixed size array is a regular array
+            ArrayVariable *arrayVar = new ArrayVariable("");
+            arrayVar->items = ((ArrayVariable *)variable)->items;
+            sliceExpr->evaluatesTo = arrayVar;
+        } else if (variable->type == STR_VAR) {
+            sliceExpr->evaluatesTo = variable;
+        } else {
+            errorAt("Can only slice arrays and strings", sliceExpr->line);
+        }
+        break;
+    }
     case ARRAY_EXPR: {
         ArrayExpr *arrayExpr = (ArrayExpr *)expr;
         for (int i = 0; i < arrayExpr->items.size(); ++i) {
@@ -1265,8 +1763,9 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
             if (arrayExpr->itemType == nullptr) {
                 arrayExpr->itemType = arrayExpr->items[i]->evaluatesTo;
             }
+            matchLiteral(arrayExpr->itemType, arrayExpr->items[i], arrayExpr->line);
 
-            if (arrayExpr->items[i]->evaluatesTo->type != arrayExpr->itemType->type) {
+            if (!widensTo(arrayExpr->items[i]->evaluatesTo->type, arrayExpr->itemType->type)) {
                 errorAt("Mismatch in array item type", arrayExpr->line);
             }
         }
@@ -1287,12 +1786,35 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
         }
         for (auto &item : mapExpr->values) {
             fixExprEvaluatesToExpr(item);
-            if (mapVar->values->type != item->evaluatesTo->type) {
+            matchLiteral(mapVar->values, item, mapExpr->line);
+            if (!widensTo(item->evaluatesTo->type, mapVar->values->type)) {
                 errorAt("Mismatch in key for map expression", mapExpr->line);
             }
         }
         break;
     }
+    case SET_EXPR: {
+        SetExpr *setExpr = (SetExpr *)expr;
+        for (auto &item : setExpr->items) {
+            fixExprEvaluatesToExpr(item);
+        }
+        if (setExpr->setVar == nullptr) {
+            SetVariable *setVar = new SetVariable("");
+            setVar->items = setExpr->items[0]->evaluatesTo;
+            setExpr->setVar = setVar;
+        }
+        SetVariable *setVar = (SetVariable *)setExpr->setVar;
+        if (setVar->items->type != INT_VAR && setVar->items->type != STR_VAR) {
+            errorAt("Can only have sets of int or str", setExpr->line);
+        }
+        for (auto &item : setExpr->items) {
+            if (setVar->items->type != item->evaluatesTo->type) {
+                errorAt("Mismatch in item for set expression", setExpr->line);
+            }
+        }
+        setExpr->evaluatesTo = setVar;
+        break;
+    }
     case CALL_EXPR: {
         CallExpr *callExpr = (CallExpr *)expr;
         for (auto &arg : callExpr->arguments) {
@@ -1324,9 +1846,16 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
                                 errorAt("First arg must be array", callExpr->line);
                             }
                             ArrayVariable *arrayVar = (ArrayVariable *)callExpr->arguments[0]->evaluatesTo;
-                            if (arrayVar->items->type != callExpr->arguments[1]->evaluatesTo->type) {
+                            matchLiteral(arrayVar->items, callExpr->arguments[1], callExpr->line);
+                            if (!widensTo(callExpr->arguments[1]->evaluatesTo->type, arrayVar->items->type)) {
                                 errorAt("Can't append item of different type", callExpr->line);
                             }
+                            if (arrayVar->fixedSize) {
+                                errorAt("Can't append to a fixed size array", callExpr->line);
+                            }
+                            if (callExpr->arguments[0]->type == VAR_EXPR && isReadOnlyParam(arrayVar)) {
+                                errorAt("Can only append to a param declared 'ref'", callExpr->line);
+                            }
 
                         } else if (funcName == "readfile") {
                             if (callExpr->arguments.size() != 1) {
@@ -1348,9 +1877,48 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
                                 errorAt("Can't lookup key of different type", callExpr->line);
                             }
 
+                        } else if (isConversionFunc(funcName)) {
+                            if (callExpr->arguments.size() != 1) {
+                                errorAt("Number of params doesn't match, expected 1", callExpr->line);
+                            }
+                            VarType argType = callExpr->arguments[0]->evaluatesTo->type;
+                            if (!isIntegerType(argType) && !isFloatType(argType)) {
+                                errorAt("Can only convert numbers", callExpr->line);
+                            }
+
+                        } else if (funcName == "move") {
+                            if (callExpr->arguments.size() != 1 || callExpr->arguments[0]->type != VAR_EXPR) {
+                                errorAt("Can only move a variable", callExpr->line);
+                            }
+                            Variable *movedVar = callExpr->arguments[0]->evaluatesTo;
+                            if (movedVar->type != ARRAY_VAR && movedVar->type != STR_VAR) {
+                                errorAt("Can only move arrays and strings", callExpr->line);
+                            }
+                            if (isFixedArray(movedVar)) {
+                                errorAt("Can't move a fixed size array", callExpr->line);
+                            }
+                            callExpr->evaluatesTo = movedVar;
+                            return;
+
+                        } else if (isGridFunc(funcName)) {
+                            callExpr->evaluatesTo = funcVar->returnType;
+                            checkGridCall(callExpr);
+                            return;
+
+                        } else if (isSetFunc(funcName)) {
+                            callExpr->evaluatesTo = funcVar->returnType;
+                            checkSetCall(callExpr);
+                            return;
+
                         } else if (funcName != "printf") {
                             checkParamMatch(funcVar->params, callExpr->arguments, callExpr->line);
                         }
+                        // Growing the buffer frees the one the caller still points to
+                        bool pushes = funcName == "push" || funcName == "push_int" || funcName == "push_double";
+                        if (pushes && callExpr->arguments[0]->type == VAR_EXPR &&
+                            isReadOnlyParam(callExpr->arguments[0]->evaluatesTo)) {
+                            errorAt("Can only push to a builder param declared 'ref'", callExpr->line);
+                        }
                         callExpr->evaluatesTo = funcVar->returnType;
                         return;
                     }
@@ -1375,8 +1943,7 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
 
         switch (var->type) {
         case STRUCT_VAR: {
-            StructVariable *structVar = (StructVariable *)var;
-            for (auto &variable : structVar->fields) {
+            for (auto &variable : getStructFields((StructVariable *)var)) {
                 if (variable->name == dotExpr->field) {
                     dotExpr->evaluatesTo = variable;
                     break;
@@ -1409,41 +1976,1334 @@ static void fixExprEvaluatesToExpr(Expr *expr) {
     }
 }
 
-static void fixExprEvaluatesToStmt(Stmt *stmt) {
+static bool stmtReferences(Stmt *stmt, std::string name);
+
+static bool exprReferences(Expr *expr, std::string name) {
+    if (expr == nullptr) {
+        return false;
+    }
+    switch (expr->type) {
+    case BINARY_EXPR: {
+        BinaryExpr *binaryExpr = (BinaryExpr *)expr;
+        return exprReferences(binaryExpr->left, name) || exprReferences(binaryExpr->right, name);
+    }
+    case INC_EXPR: {
+        return exprReferences(((IncExpr *)expr)->expr, name);
+    }
+    case GROUPING_EXPR: {
+        return exprReferences(((GroupingExpr *)expr)->expression, name);
+    }
+    case LOGICAL_EXPR: {
+        LogicalExpr *logicalExpr = (LogicalExpr *)expr;
+        return exprReferences(logicalExpr->left, name) || exprReferences(logicalExpr->right, name);
+    }
+    case LITERAL_EXPR: {
+        return false;
+    }
+    case COMPARISON_EXPR: {
+        ComparisonExpr *comparisonExpr = (ComparisonExpr *)expr;
+        return exprReferences(comparisonExpr->left, name) || exprReferences(comparisonExpr->right, name);
+    }
+    case UNARY_EXPR: {
+        return exprReferences(((UnaryExpr *)expr)->right, name);
+    }
+    case VAR_EXPR: {
+        return ((VarExpr *)expr)->name == name;
+    }
+    case INDEX_EXPR: {
+        IndexExpr *indexExpr = (IndexExpr *)expr;
+        return exprReferences(indexExpr->variable, name) || exprReferences(indexExpr->index, name) ||
+               exprReferences(indexExpr->column, name);
+    }
+    case SLICE_EXPR: {
+        SliceExpr *sliceExpr = (SliceExpr *)expr;
+        return exprReferences(sliceExpr->variable, name) || exprReferences(sliceExpr->start, name) ||
+               exprReferences(sliceExpr->end, name);
+    }
+    case ARRAY_EXPR: {
+        for (auto &item : ((ArrayExpr *)expr)->items) {
+            if (exprReferences(item, name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    case MAP_EXPR: {
+        MapExpr *mapExpr = (MapExpr *)expr;
+        for (int i = 0; i < mapExpr->keys.size(); ++i) {
+            if (exprReferences(mapExpr->keys[i], name) || exprReferences(mapExpr->values[i], name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    case SET_EXPR: {
+        for (auto &item : ((SetExpr *)expr)->items) {
+            if (exprReferences(item, name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    case CALL_EXPR: {
+        for (auto &arg : ((CallExpr *)expr)->arguments) {
+            if (exprReferences(arg, name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    case DOT_EXPR: {
+        return exprReferences(((DotExpr *)expr)->name, name);
+    }
+    }
+    return true;
+}
+
+static bool stmtsReference(std::vector<Stmt *> stmts, std::string name) {
+    for (auto &stmt : stmts) {
+        if (stmtReferences(stmt, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool stmtReferences(Stmt *stmt, std::string name) {
+    if (stmt == nullptr) {
+        return false;
+    }
     switch (stmt->type) {
     case EXPR_STMT: {
-        ExprStmt *exprStmt = (ExprStmt *)stmt;
-        fixExprEvaluatesToExpr(exprStmt->expression);
-        break;
+        return exprReferences(((ExprStmt *)stmt)->expression, name);
     }
     case COMP_ASSIGN_STMT: {
         CompAssignStmt *compAssignStmt = (CompAssignStmt *)stmt;
-        fixExprEvaluatesToExpr(compAssignStmt->right);
-        break;
+        return compAssignStmt->name == name || exprReferences(compAssignStmt->right, name);
     }
     case ASSIGN_STMT: {
         AssignStmt *assignStmt = (AssignStmt *)stmt;
-        fixExprEvaluatesToExpr(assignStmt->value);
-        fixExprEvaluatesToExpr(assignStmt->variable);
-        break;
+        return exprReferences(assignStmt->variable, name) || exprReferences(assignStmt->value, name);
     }
     case RETURN_STMT: {
-        ReturnStmt *returnStmt = (ReturnStmt *)stmt;
-        fixExprEvaluatesToExpr(returnStmt->value);
-        break;
+        return exprReferences(((ReturnStmt *)stmt)->value, name);
     }
     case VAR_STMT: {
-        VarStmt *varStmt = (VarStmt *)stmt;
-        if (compiler->variables.back().count(varStmt->var->name)) {
-            errorAt(("Can't redeclare a variable in the same scope - " + varStmt->var->name).c_str(), varStmt->line);
-        }
-        fixExprEvaluatesToExpr(varStmt->initializer);
-        compiler->variables.back()[varStmt->var->name] = varStmt->var;
-        break;
+        return exprReferences(((VarStmt *)stmt)->initializer, name);
     }
     case WHILE_STMT: {
         WhileStmt *whileStmt = (WhileStmt *)stmt;
-        fixExprEvaluatesToExpr(whileStmt->condition);
+        return exprReferences(whileStmt->condition, name) || stmtsReference(whileStmt->body, name);
+    }
+    case FOR_STMT: {
+        ForStmt *forStmt = (ForStmt *)stmt;
+        return stmtReferences(forStmt->initializer, name) || exprReferences(forStmt->condition, name) ||
+               stmtReferences(forStmt->increment, name) || stmtsReference(forStmt->body, name);
+    }
+    case FOR_EACH_STMT: {
+        ForEachStmt *forEachStmt = (ForEachStmt *)stmt;
+        return exprReferences(forEachStmt->iterable, name) || stmtsReference(forEachStmt->body, name);
+    }
+    case REGION_STMT: {
+        return stmtsReference(((RegionStmt *)stmt)->body, name);
+    }
+    case IF_STMT: {
+        IfStmt *ifStmt = (IfStmt *)stmt;
+        return exprReferences(ifStmt->condition, name) || stmtsReference(ifStmt->thenBranch, name) ||
+               stmtsReference(ifStmt->elseBranch, name);
+    }
+    case FUNC_STMT:
+    case BREAK_STMT:
+    case STRUCT_STMT: {
+        return false;
+    }
+    }
+    return true;
+}
+
+// Marks array and string variables that are read for the last time by a declaration or assignment.
+// Only variables declared in the same list are considered, a loop around the declaration would read them again
+static void markLastUses(std::vector<Stmt *> stmts) {
+    std::vector<std::string> declared;
+    for (int i = 0; i < stmts.size(); ++i) {
+        Stmt *stmt = stmts[i];
+        Expr *source = nullptr;
+        if (stmt->type == VAR_STMT) {
+            source = ((VarStmt *)stmt)->initializer;
+            declared.push_back(((VarStmt *)stmt)->var->name);
+        } else if (stmt->type == ASSIGN_STMT && ((AssignStmt *)stmt)->variable->type == VAR_EXPR) {
+            source = ((AssignStmt *)stmt)->value;
+        }
+
+        switch (stmt->type) {
+        case WHILE_STMT: {
+            markLastUses(((WhileStmt *)stmt)->body);
+            break;
+        }
+        case FOR_STMT: {
+            markLastUses(((ForStmt *)stmt)->body);
+            break;
+        }
+        case FOR_EACH_STMT: {
+            markLastUses(((ForEachStmt *)stmt)->body);
+            break;
+        }
+        case REGION_STMT: {
+            markLastUses(((RegionStmt *)stmt)->body);
+            break;
+        }
+        case IF_STMT: {
+            markLastUses(((IfStmt *)stmt)->thenBranch);
+            markLastUses(((IfStmt *)stmt)->elseBranch);
+            break;
+        }
+        default: {
+        }
+        }
+
+        if (source == nullptr || source->type != VAR_EXPR) {
+            continue;
+        }
+        VarExpr *varExpr = (VarExpr *)source;
+        VarType varType = varExpr->evaluatesTo->type;
+        // The buffer of a fixed size array is on the stack, it's copied rather than handed over
+        if (varType != ARRAY_VAR && varType != STR_VAR || isFixedArray(varExpr->evaluatesTo)) {
+            continue;
+        }
+        bool isLocal = std::find(declared.begin(), declared.end(), varExpr->name) != declared.end();
+        std::vector<Stmt *> rest = std::vector<Stmt *>(stmts.begin() + i + 1, stmts.end());
+        varExpr->lastUse = isLocal && !stmtsReference(rest, varExpr->name);
+    }
+}
+
+// The items of a fixed size array are stored straight into its buffer, so it needs an array literal that fits
+static void checkFixedArrayInitializer(VarStmt *varStmt) {
+    if (!isFixedArray(varStmt->var)) {
+        return;
+    }
+    ArrayVariable *arrayVar = (ArrayVariable *)varStmt->var;
+    if (varStmt->initializer->type != ARRAY_EXPR) {
+        errorAt("Fixed size array has to be initialised with an array literal", varStmt->line);
+    }
+    ArrayExpr *arrayExpr = (ArrayExpr *)varStmt->initializer;
+    if (arrayExpr->items.size() > arrayVar->fixedSize) {
+        errorAt("Too many items for fixed size array", varStmt->line);
+    }
+    for (auto &item : arrayExpr->items) {
+        if (!widensTo(item->evaluatesTo->type, arrayVar->items->type)) {
+            errorAt("Mismatch in item for fixed size array", varStmt->line);
+        }
+    }
+}
+
+static void collectExprs(Expr *expr, std::vector<Expr *> &exprs) {
+    if (expr == nullptr) {
+        return;
+    }
+    exprs.push_back(expr);
+    switch (expr->type) {
+    case BINARY_EXPR: {
+        collectExprs(((BinaryExpr *)expr)->left, exprs);
+        collectExprs(((BinaryExpr *)expr)->right, exprs);
+        break;
+    }
+    case INC_EXPR: {
+        collectExprs(((IncExpr *)expr)->expr, exprs);
+        break;
+    }
+    case GROUPING_EXPR: {
+        collectExprs(((GroupingExpr *)expr)->expression, exprs);
+        break;
+    }
+    case LOGICAL_EXPR: {
+        collectExprs(((LogicalExpr *)expr)->left, exprs);
+        collectExprs(((LogicalExpr *)expr)->right, exprs);
+        break;
+    }
+    case COMPARISON_EXPR: {
+        collectExprs(((ComparisonExpr *)expr)->left, exprs);
+        collectExprs(((ComparisonExpr *)expr)->right, exprs);
+        break;
+    }
+    case UNARY_EXPR: {
+        collectExprs(((UnaryExpr *)expr)->right, exprs);
+        break;
+    }
+    case INDEX_EXPR: {
+        IndexExpr *indexExpr = (IndexExpr *)expr;
+        collectExprs(indexExpr->variable, exprs);
+        collectExprs(indexExpr->index, exprs);
+        collectExprs(indexExpr->column, exprs);
+        break;
+    }
+    case SLICE_EXPR: {
+        SliceExpr *sliceExpr = (SliceExpr *)expr;
+        collectExprs(sliceExpr->variable, exprs);
+        collectExprs(sliceExpr->start, exprs);
+        collectExprs(sliceExpr->end, exprs);
+        break;
+    }
+    case ARRAY_EXPR: {
+        for (auto &item : ((ArrayExpr *)expr)->items) {
+            collectExprs(item, exprs);
+        }
+        break;
+    }
+    case MAP_EXPR: {
+        MapExpr *mapExpr = (MapExpr *)expr;
+        for (int i = 0; i < mapExpr->keys.size(); ++i) {
+            collectExprs(mapExpr->keys[i], exprs);
+            collectExprs(mapExpr->values[i], exprs);
+        }
+        break;
+    }
+    case SET_EXPR: {
+        for (auto &item : ((SetExpr *)expr)->items) {
+            collectExprs(item, exprs);
+        }
+        break;
+    }
+    case CALL_EXPR: {
+        for (auto &arg : ((CallExpr *)expr)->arguments) {
+            collectExprs(arg, exprs);
+        }
+        break;
+    }
+    case DOT_EXPR: {
+        collectExprs(((DotExpr *)expr)->name, exprs);
+        break;
+    }
+    default: {
+    }
+    }
+}
+
+// Flattens the statements and every statement nested in them, along with all of their expressions
+static void collectStmts(std::vector<Stmt *> stmts, std::vector<Stmt *> &flat, std::vector<Expr *> &exprs) {
+    for (auto &stmt : stmts) {
+        if (stmt == nullptr) {
+            continue;
+        }
+        flat.push_back(stmt);
+        switch (stmt->type) {
+        case EXPR_STMT: {
+            collectExprs(((ExprStmt *)stmt)->expression, exprs);
+            break;
+        }
+        case COMP_ASSIGN_STMT: {
+            collectExprs(((CompAssignStmt *)stmt)->right, exprs);
+            break;
+        }
+        case ASSIGN_STMT: {
+            collectExprs(((AssignStmt *)stmt)->variable, exprs);
+            collectExprs(((AssignStmt *)stmt)->value, exprs);
+            break;
+        }
+        case RETURN_STMT: {
+            collectExprs(((ReturnStmt *)stmt)->value, exprs);
+            break;
+        }
+        case VAR_STMT: {
+            collectExprs(((VarStmt *)stmt)->initializer, exprs);
+            break;
+        }
+        case WHILE_STMT: {
+            collectExprs(((WhileStmt *)stmt)->condition, exprs);
+            collectStmts(((WhileStmt *)stmt)->body, flat, exprs);
+            break;
+        }
+        case FOR_STMT: {
+            ForStmt *forStmt = (ForStmt *)stmt;
+            collectStmts({forStmt->initializer, forStmt->increment}, flat, exprs);
+            collectExprs(forStmt->condition, exprs);
+            collectStmts(forStmt->body, flat, exprs);
+            break;
+        }
+        case FOR_EACH_STMT: {
+            collectExprs(((ForEachStmt *)stmt)->iterable, exprs);
+            collectStmts(((ForEachStmt *)stmt)->body, flat, exprs);
+            break;
+        }
+        case REGION_STMT: {
+            collectStmts(((RegionStmt *)stmt)->body, flat, exprs);
+            break;
+        }
+        case IF_STMT: {
+            IfStmt *ifStmt = (IfStmt *)stmt;
+            collectExprs(ifStmt->condition, exprs);
+            collectStmts(ifStmt->thenBranch, flat, exprs);
+            collectStmts(ifStmt->elseBranch, flat, exprs);
+            break;
+        }
+        default: {
+        }
+        }
+    }
+}
+
+static bool isVarExpr(Expr *expr, std::string name) {
+    return expr != nullptr && expr->type == VAR_EXPR && ((VarExpr *)expr)->name == name;
+}
+
+// Assignments and increments write a variable. Arrays and strings can also be reassigned by whatever they're passed
+// to, except len, printf and append which only reads or grows them. Growing only counts if 'growing' is set
+static bool isWritten(std::string name, std::vector<Stmt *> &stmts, std::vector<Expr *> &exprs, bool growing) {
+    for (auto &stmt : stmts) {
+        if (stmt->type == ASSIGN_STMT && isVarExpr(((AssignStmt *)stmt)->variable, name)) {
+            return true;
+        }
+        if (stmt->type == COMP_ASSIGN_STMT && ((CompAssignStmt *)stmt)->name == name) {
+            return true;
+        }
+    }
+    for (auto &expr : exprs) {
+        if (expr->type == INC_EXPR && isVarExpr(((IncExpr *)expr)->expr, name)) {
+            return true;
+        }
+        if (expr->type != CALL_EXPR) {
+            continue;
+        }
+        CallExpr *callExpr = (CallExpr *)expr;
+        for (int i = 0; i < callExpr->arguments.size(); ++i) {
+            Expr *arg = callExpr->arguments[i];
+            if (!isVarExpr(arg, name) || arg->evaluatesTo->type != ARRAY_VAR && arg->evaluatesTo->type != STR_VAR) {
+                continue;
+            }
+            bool grows = callExpr->callee == "append" && i == 0;
+            if (grows ? growing : !isLen(callExpr->callee) && callExpr->callee != "printf") {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool isLenOf(Expr *expr, std::string name) {
+    if (expr->type != CALL_EXPR || ((CallExpr *)expr)->callee != "len") {
+        return false;
+    }
+    return isVarExpr(((CallExpr *)expr)->arguments[0], name);
+}
+
+// The bound is read every iteration, the hoisted check only holds if it can't change inside the loop
+static bool isLoopInvariant(Expr *bound, std::vector<Stmt *> &stmts, std::vector<Expr *> &exprs) {
+    if (bound->evaluatesTo == nullptr || bound->evaluatesTo->type != INT_VAR) {
+        return false;
+    }
+    if (bound->type == LITERAL_EXPR) {
+        return true;
+    }
+    if (bound->type == VAR_EXPR) {
+        return !isWritten(((VarExpr *)bound)->name, stmts, exprs, true);
+    }
+    if (bound->type == CALL_EXPR && ((CallExpr *)bound)->callee == "len") {
+        Expr *arg = ((CallExpr *)bound)->arguments[0];
+        return arg->type == VAR_EXPR && !isWritten(((VarExpr *)arg)->name, stmts, exprs, true);
+    }
+    return false;
+}
+
+// A hoisted check picks between the loop without checks and the same loop with them, it only pays for the second
+// copy if every iteration indexes. Nothing in a branch, a nested loop or on the right of 'and'/'or' counts, and
+// nothing at all if the body can leave the loop early since it might never get near the bound
+static std::vector<Expr *> collectEveryIteration(std::vector<Stmt *> body, std::vector<Stmt *> &stmts) {
+    std::vector<Expr *> every;
+    for (auto &stmt : stmts) {
+        if (stmt->type == BREAK_STMT || stmt->type == RETURN_STMT) {
+            return every;
+        }
+    }
+    for (auto &stmt : body) {
+        StatementType type = stmt->type;
+        if (type != IF_STMT && type != WHILE_STMT && type != FOR_STMT && type != FOR_EACH_STMT &&
+            type != REGION_STMT) {
+            std::vector<Stmt *> flat;
+            collectStmts({stmt}, flat, every);
+        }
+    }
+    std::vector<Expr *> conditional;
+    for (auto &expr : every) {
+        if (expr->type == LOGICAL_EXPR) {
+            collectExprs(((LogicalExpr *)expr)->right, conditional);
+        }
+    }
+    std::vector<Expr *> unconditional;
+    for (auto &expr : every) {
+        if (std::find(conditional.begin(), conditional.end(), expr) == conditional.end()) {
+            unconditional.push_back(expr);
+        }
+    }
+    return unconditional;
+}
+
+// In 'for (var i = start; i < bound; i++)' where the body never writes i, i is inside [start, bound) in the body.
+// a[i] can't be out of bounds if a isn't shrunk by the body and start >= 0 and bound <= len(a). That's known for
+// 'i < len(a)' starting at a literal, otherwise it's checked once before the loop instead of at every index.
+// If that check fails the loop runs with its checks so it prints and fails at the same iteration it always did
+static void eliminateBoundsChecks(ForStmt *forStmt) {
+    Stmt *initializer = forStmt->initializer;
+    Expr *condition = forStmt->condition;
+    Stmt *increment = forStmt->increment;
+    if (initializer == nullptr || initializer->type != VAR_STMT || condition == nullptr ||
+        condition->type != COMPARISON_EXPR || increment == nullptr || increment->type != EXPR_STMT) {
+        return;
+    }
+    VarStmt *varStmt = (VarStmt *)initializer;
+    ComparisonExpr *comparison = (ComparisonExpr *)condition;
+    Expr *step = ((ExprStmt *)increment)->expression;
+    std::string name = varStmt->var->name;
+    if (varStmt->var->type != INT_VAR || comparison->op != LESS_COMPARISON || !isVarExpr(comparison->left, name) ||
+        step->type != INC_EXPR || ((IncExpr *)step)->op != INC || !isVarExpr(((IncExpr *)step)->expr, name)) {
+        return;
+    }
+
+    std::vector<Stmt *> stmts;
+    std::vector<Expr *> exprs;
+    collectStmts(forStmt->body, stmts, exprs);
+    if (isWritten(name, stmts, exprs, true)) {
+        return;
+    }
+    bool invariant = isLoopInvariant(comparison->right, stmts, exprs);
+    std::vector<Expr *> everyIteration = collectEveryIteration(forStmt->body, stmts);
+    bool startsInside = varStmt->initializer->type == LITERAL_EXPR;
+
+    for (auto &expr : exprs) {
+        if (expr->type != INDEX_EXPR) {
+            continue;
+        }
+        IndexExpr *indexExpr = (IndexExpr *)expr;
+        Expr *array = indexExpr->variable;
+        if (!isVarExpr(indexExpr->index, name) || indexExpr->column != nullptr || array->type != VAR_EXPR ||
+            array->evaluatesTo->type != ARRAY_VAR && array->evaluatesTo->type != STR_VAR) {
+            continue;
+        }
+        std::string arrayName = ((VarExpr *)array)->name;
+        if (isWritten(arrayName, stmts, exprs, false)) {
+            continue;
+        }
+        if (startsInside && isLenOf(comparison->right, arrayName)) {
+            indexExpr->checked = false;
+        } else if (invariant && std::find(everyIteration.begin(), everyIteration.end(), expr) != everyIteration.end()) {
+            indexExpr->checked = false;
+            forStmt->hoisted.push_back(indexExpr);
+            bool hoisted = false;
+            for (auto &checked : forStmt->rangeChecks) {
+                hoisted |= ((VarExpr *)checked)->name == arrayName;
+            }
+            if (!hoisted) {
+                forStmt->rangeChecks.push_back(array);
+            }
+        }
+    }
+}
+
+static void checkLoopItems(Variable *items, int line) {
+    VarType type = items->type;
+    if (type == MAP_VAR || type == SET_VAR || type == GRID_VAR || type == BUILDER_VAR) {
+        errorAt("Can't loop over maps, sets or grids stored in an array or map, index them instead", line);
+    }
+}
+
+// Arrays give their items, strings their bytes and maps their keys, a second name gets the index or the value. Sets
+// give their items in slot order and have nothing to key them by
+static void setForEachVariables(ForEachStmt *forEachStmt) {
+    Variable *iterable = forEachStmt->iterable->evaluatesTo;
+    Variable *intVar = new Variable();
+    intVar->type = INT_VAR;
+    switch (iterable->type) {
+    case ARRAY_VAR: {
+        forEachStmt->keyVar = intVar;
+        forEachStmt->itemVar = ((ArrayVariable *)iterable)->items;
+        break;
+    }
+    case STR_VAR: {
+        forEachStmt->keyVar = intVar;
+        forEachStmt->itemVar = new Variable();
+        forEachStmt->itemVar->type = U8_VAR;
+        break;
+    }
+    case MAP_VAR: {
+        MapVariable *mapVar = (MapVariable *)iterable;
+        forEachStmt->keyVar = mapVar->keys;
+        forEachStmt->itemVar = forEachStmt->key.empty() ? mapVar->keys : mapVar->values;
+        break;
+    }
+    case SET_VAR: {
+        if (!forEachStmt->key.empty()) {
+            errorAt("A set only gives its items, loop over it with a single name", forEachStmt->line);
+        }
+        forEachStmt->itemVar = ((SetVariable *)iterable)->items;
+        break;
+    }
+    default: {
+        errorAt("Can only loop over arrays, strings, maps and sets", forEachStmt->line);
+    }
+    }
+    checkLoopItems(forEachStmt->itemVar, forEachStmt->line);
+    if (forEachStmt->key == forEachStmt->item) {
+        errorAt("Loop variables need different names", forEachStmt->line);
+    }
+    std::map<std::string, Variable *> scope = compiler->variables.back();
+    if (scope.count(forEachStmt->item) || scope.count(forEachStmt->key)) {
+        errorAt("Loop variable is already declared in this scope", forEachStmt->line);
+    }
+}
+
+static bool isScalar(VarType type) { return isIntegerType(type) || isFloatType(type) || type == BOOL_VAR; }
+
+static bool isAggregate(Variable *var) {
+    return var != nullptr && !isScalar(var->type) && var->type != FUNC_VAR && var->type != NIL_VAR;
+}
+
+// Values that don't point to other allocations, copying their own buffer to the heap is enough to keep them
+static bool isFlat(Variable *var) {
+    switch (var->type) {
+    case STR_VAR: {
+        return true;
+    }
+    case ARRAY_VAR: {
+        Variable *items = ((ArrayVariable *)var)->items;
+        return isScalar(items->type) || items->type == STRUCT_VAR && isFlat(items);
+    }
+    case STRUCT_VAR: {
+        for (auto &field : getStructFields((StructVariable *)var)) {
+            if (!isScalar(field->type)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    default: {
+        return isScalar(var->type);
+    }
+    }
+}
+
+// The variable that's stored into or indexed, 'a' in 'a[i].x'
+static VarExpr *rootVariable(Expr *expr) {
+    while (expr->type == INDEX_EXPR || expr->type == DOT_EXPR) {
+        expr = expr->type == INDEX_EXPR ? ((IndexExpr *)expr)->variable : ((DotExpr *)expr)->name;
+    }
+    return expr->type == VAR_EXPR ? (VarExpr *)expr : nullptr;
+}
+
+static bool isRegionLocal(std::string name, std::vector<std::string> &locals) {
+    return std::find(locals.begin(), locals.end(), name) != locals.end();
+}
+
+static bool isOutsideAggregate(Expr *expr, std::vector<std::string> &locals) {
+    VarExpr *root = rootVariable(expr);
+    return root != nullptr && !isRegionLocal(root->name, locals) && isAggregate(root->evaluatesTo);
+}
+
+// Like isWritten, anything an aggregate is passed to can store into it except len, printf and contains
+static bool callsWithOutside(std::vector<Expr *> &exprs, std::vector<std::string> &locals) {
+    for (auto &expr : exprs) {
+        if (expr->type != CALL_EXPR) {
+            continue;
+        }
+        CallExpr *callExpr = (CallExpr *)expr;
+        std::string callee = callExpr->callee;
+        if (isLen(callee) || callee == "printf" || callee == "contains") {
+            continue;
+        }
+        for (auto &arg : callExpr->arguments) {
+            if (isOutsideAggregate(arg, locals)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool storesOutside(Stmt *stmt, std::vector<std::string> &locals) {
+    std::vector<Stmt *> flat;
+    std::vector<Expr *> exprs;
+    collectStmts({stmt}, flat, exprs);
+    if (stmt->type == ASSIGN_STMT && isOutsideAggregate(((AssignStmt *)stmt)->variable, locals)) {
+        return true;
+    }
+    if (stmt->type == COMP_ASSIGN_STMT) {
+        std::string name = ((CompAssignStmt *)stmt)->name;
+        std::map<std::string, Variable *> &scope = compiler->variables.back();
+        if (!isRegionLocal(name, locals) && scope.count(name) && isAggregate(scope[name])) {
+            return true;
+        }
+    }
+    return callsWithOutside(exprs, locals);
+}
+
+static void checkRegionCondition(Expr *condition, std::vector<std::string> &locals, int line) {
+    std::vector<Expr *> exprs;
+    collectExprs(condition, exprs);
+    if (callsWithOutside(exprs, locals)) {
+        errorAt("Can only store into variables from outside a region in a statement of its own", line);
+    }
+}
+
+// Region values read by a statement that stores outside of it are copied to the heap first. Reading a number out
+// of one doesn't need a copy, everything else has to be flat or it would still point into the arena
+static void copyOutOfRegion(Stmt *stmt, std::vector<std::string> &locals) {
+    std::vector<Stmt *> flat;
+    std::vector<Expr *> exprs;
+    collectStmts({stmt}, flat, exprs);
+    std::vector<Expr *> readOnly;
+    for (auto &expr : exprs) {
+        bool readsScalar = (expr->type == INDEX_EXPR || expr->type == DOT_EXPR) && expr->evaluatesTo &&
+                           isScalar(expr->evaluatesTo->type);
+        if (readsScalar) {
+            readOnly.push_back(rootVariable(expr));
+        } else if (expr->type == CALL_EXPR && isLen(((CallExpr *)expr)->callee)) {
+            readOnly.push_back(((CallExpr *)expr)->arguments[0]);
+        }
+    }
+    for (auto &expr : exprs) {
+        if (expr->type != VAR_EXPR || std::find(readOnly.begin(), readOnly.end(), expr) != readOnly.end()) {
+            continue;
+        }
+        VarExpr *varExpr = (VarExpr *)expr;
+        if (!isRegionLocal(varExpr->name, locals) || !isAggregate(varExpr->evaluatesTo)) {
+            continue;
+        }
+        if (!isFlat(varExpr->evaluatesTo)) {
+            errorAt(("Can't store " + varExpr->name + " outside of the region, it holds references").c_str(),
+                    stmt->line);
+        }
+        VarType type = varExpr->evaluatesTo->type;
+        varExpr->copyOut = type == STR_VAR || type == ARRAY_VAR;
+    }
+}
+
+// Statements that store outside of the region are wrapped in a suspended region. The body of a nested region was
+// already wrapped, statements in there are only checked against this region's variables
+static void suspendRegionEscapes(std::vector<Stmt *> &body, std::vector<std::string> &locals, bool inLoop,
+                                 bool suspended) {
+    for (auto &stmt : body) {
+        switch (stmt->type) {
+        case RETURN_STMT: {
+            errorAt("Can't return from inside a region", stmt->line);
+        }
+        case BREAK_STMT: {
+            if (!inLoop) {
+                errorAt("Can't break out of a region", stmt->line);
+            }
+            break;
+        }
+        case FUNC_STMT: {
+            errorAt("Can't declare a function in a region", stmt->line);
+        }
+        case STRUCT_STMT: {
+            break;
+        }
+        case WHILE_STMT: {
+            WhileStmt *whileStmt = (WhileStmt *)stmt;
+            checkRegionCondition(whileStmt->condition, locals, stmt->line);
+            suspendRegionEscapes(whileStmt->body, locals, true, suspended);
+            break;
+        }
+        case FOR_STMT: {
+            ForStmt *forStmt = (ForStmt *)stmt;
+            checkRegionCondition(forStmt->condition, locals, stmt->line);
+            for (auto &clause : {forStmt->initializer, forStmt->increment}) {
+                if (clause != nullptr && storesOutside(clause, locals)) {
+                    errorAt("Can only store into variables from outside a region in a statement of its own",
+                            stmt->line);
+                }
+            }
+            suspendRegionEscapes(forStmt->body, locals, true, suspended);
+            break;
+        }
+        case FOR_EACH_STMT: {
+            ForEachStmt *forEachStmt = (ForEachStmt *)stmt;
+            checkRegionCondition(forEachStmt->iterable, locals, stmt->line);
+            suspendRegionEscapes(forEachStmt->body, locals, true, suspended);
+            break;
+        }
+        case IF_STMT: {
+            IfStmt *ifStmt = (IfStmt *)stmt;
+            checkRegionCondition(ifStmt->condition, locals, stmt->line);
+            suspendRegionEscapes(ifStmt->thenBranch, locals, inLoop, suspended);
+            suspendRegionEscapes(ifStmt->elseBranch, locals, inLoop, suspended);
+            break;
+        }
+        case REGION_STMT: {
+            RegionStmt *regionStmt = (RegionStmt *)stmt;
+            suspendRegionEscapes(regionStmt->body, locals, inLoop, suspended || regionStmt->suspended);
+            break;
+        }
+        default: {
+            if (!storesOutside(stmt, locals)) {
+                break;
+            }
+            copyOutOfRegion(stmt, locals);
+            if (!suspended) {
+                RegionStmt *wrapper = new RegionStmt(true, stmt->line);
+                wrapper->body.push_back(stmt);
+                stmt = wrapper;
+            }
+        }
+        }
+    }
+}
+
+// Nothing can be redeclared in a scope, so a name declared anywhere in the region always means the region's variable
+static void checkRegion(RegionStmt *regionStmt) {
+    std::vector<Stmt *> flat;
+    std::vector<Expr *> exprs;
+    collectStmts(regionStmt->body, flat, exprs);
+    std::vector<std::string> locals;
+    for (auto &stmt : flat) {
+        if (stmt->type == VAR_STMT) {
+            locals.push_back(((VarStmt *)stmt)->var->name);
+        } else if (stmt->type == FOR_EACH_STMT) {
+            locals.push_back(((ForEachStmt *)stmt)->key);
+            locals.push_back(((ForEachStmt *)stmt)->item);
+        }
+    }
+    suspendRegionEscapes(regionStmt->body, locals, false, false);
+}
+
+static FuncVariable *lookupFunction(std::string name) {
+    for (auto &scope : compiler->variables) {
+        if (scope.count(name) && scope[name]->type == FUNC_VAR) {
+            return (FuncVariable *)scope[name];
+        }
+    }
+    return nullptr;
+}
+
+// Most builtins only read what they're passed or copy it, append and insert keep the item but not the array or set
+static bool keepsArgument(std::string callee, int arg) {
+    if (callee == "append" || callee == "insert") {
+        return arg == 1;
+    }
+    return !(isLen(callee) || callee == "printf" || callee == "contains" || callee == "key_exists" ||
+             callee == "move" || callee == "push" || callee == "intern" || callee == "readfile" || callee == "remove" ||
+             callee == "union" || callee == "intersection" || callee == "difference" || callee == "elements" ||
+             callee == "push_int" || callee == "push_double" || callee == "build");
+}
+
+// Arrays and maps box a string or array with a count of its own, so the variable can still release its buffer
+static bool isBoxedWithCount(Expr *item) {
+    Variable *var = item->evaluatesTo;
+    return var && (var->type == STR_VAR || var->type == ARRAY_VAR && !isFixedArray(var));
+}
+
+// Collects the variables whose buffer can end up stored without a count of its own. 'stores' is set when whatever
+// the expression is passed to keeps its value, indexing or reading a field only keeps what's in the buffer. Unless
+// 'counted' is set, an item that's boxed with a count is collected as well
+static void collectEscapes(Expr *expr, bool stores, bool counted, std::vector<std::string> &escaped) {
+    if (expr == nullptr) {
+        return;
+    }
+    switch (expr->type) {
+    case VAR_EXPR: {
+        if (stores) {
+            escaped.push_back(((VarExpr *)expr)->name);
+        }
+        break;
+    }
+    case GROUPING_EXPR: {
+        collectEscapes(((GroupingExpr *)expr)->expression, stores, counted, escaped);
+        break;
+    }
+    case ARRAY_EXPR: {
+        for (auto &item : ((ArrayExpr *)expr)->items) {
+            collectEscapes(item, !counted || !isBoxedWithCount(item), counted, escaped);
+        }
+        break;
+    }
+    case SET_EXPR: {
+        for (auto &item : ((SetExpr *)expr)->items) {
+            collectEscapes(item, true, counted, escaped);
+        }
+        break;
+    }
+    case MAP_EXPR: {
+        MapExpr *mapExpr = (MapExpr *)expr;
+        for (int i = 0; i < mapExpr->keys.size(); ++i) {
+            collectEscapes(mapExpr->keys[i], !counted || !isBoxedWithCount(mapExpr->keys[i]), counted, escaped);
+            collectEscapes(mapExpr->values[i], !counted || !isBoxedWithCount(mapExpr->values[i]), counted, escaped);
+        }
+        break;
+    }
+    case CALL_EXPR: {
+        CallExpr *callExpr = (CallExpr *)expr;
+        // keys and values hand out the map's own arrays
+        bool aliases = callExpr->callee == "keys" || callExpr->callee == "values";
+        FuncVariable *funcVar = lookupFunction(callExpr->callee);
+        for (int i = 0; i < callExpr->arguments.size(); ++i) {
+            bool storesArg = aliases ? stores : keepsArgument(callExpr->callee, i);
+            if (!aliases && funcVar && i < funcVar->storesParams.size()) {
+                storesArg = funcVar->storesParams[i];
+            } else if (callExpr->callee == "append" && counted && isBoxedWithCount(callExpr->arguments[i])) {
+                storesArg = false;
+            }
+            collectEscapes(callExpr->arguments[i], storesArg, counted, escaped);
+        }
+        break;
+    }
+    case BINARY_EXPR: {
+        collectEscapes(((BinaryExpr *)expr)->left, false, counted, escaped);
+        collectEscapes(((BinaryExpr *)expr)->right, false, counted, escaped);
+        break;
+    }
+    case COMPARISON_EXPR: {
+        collectEscapes(((ComparisonExpr *)expr)->left, false, counted, escaped);
+        collectEscapes(((ComparisonExpr *)expr)->right, false, counted, escaped);
+        break;
+    }
+    case LOGICAL_EXPR: {
+        collectEscapes(((LogicalExpr *)expr)->left, false, counted, escaped);
+        collectEscapes(((LogicalExpr *)expr)->right, false, counted, escaped);
+        break;
+    }
+    case UNARY_EXPR: {
+        collectEscapes(((UnaryExpr *)expr)->right, false, counted, escaped);
+        break;
+    }
+    case INDEX_EXPR: {
+        IndexExpr *indexExpr = (IndexExpr *)expr;
+        collectEscapes(indexExpr->variable, false, counted, escaped);
+        collectEscapes(indexExpr->index, false, counted, escaped);
+        collectEscapes(indexExpr->column, false, counted, escaped);
+        break;
+    }
+    case SLICE_EXPR: {
+        SliceExpr *sliceExpr = (SliceExpr *)expr;
+        collectEscapes(sliceExpr->variable, false, counted, escaped);
+        collectEscapes(sliceExpr->start, false, counted, escaped);
+        collectEscapes(sliceExpr->end, false, counted, escaped);
+        break;
+    }
+    case DOT_EXPR: {
+        collectEscapes(((DotExpr *)expr)->name, false, counted, escaped);
+        break;
+    }
+    default: {
+    }
+    }
+}
+
+// Declarations and assignments share a string or array variable they're given with a count, maps are copied as is.
+// Anything stored into a field isn't counted, neither is an item unless it's boxed with a count
+static void collectStmtEscapes(Stmt *stmt, bool counted, std::vector<std::string> &escaped) {
+    switch (stmt->type) {
+    case EXPR_STMT: {
+        collectEscapes(((ExprStmt *)stmt)->expression, false, counted, escaped);
+        break;
+    }
+    case COMP_ASSIGN_STMT: {
+        collectEscapes(((CompAssignStmt *)stmt)->right, false, counted, escaped);
+        break;
+    }
+    case ASSIGN_STMT: {
+        AssignStmt *assignStmt = (AssignStmt *)stmt;
+        bool isMap = assignStmt->variable->evaluatesTo->type == MAP_VAR;
+        if (assignStmt->variable->type == VAR_EXPR) {
+            collectEscapes(assignStmt->variable, isMap, counted, escaped);
+            collectEscapes(assignStmt->value, isMap, counted, escaped);
+        } else {
+            bool boxed = assignStmt->variable->type == INDEX_EXPR && isBoxedWithCount(assignStmt->value);
+            collectEscapes(assignStmt->variable, false, counted, escaped);
+            collectEscapes(assignStmt->value, !counted || !boxed, counted, escaped);
+        }
+        break;
+    }
+    case RETURN_STMT: {
+        collectEscapes(((ReturnStmt *)stmt)->value, false, counted, escaped);
+        break;
+    }
+    case VAR_STMT: {
+        VarStmt *varStmt = (VarStmt *)stmt;
+        collectEscapes(varStmt->initializer, varStmt->var->type == MAP_VAR, counted, escaped);
+        break;
+    }
+    case WHILE_STMT: {
+        collectEscapes(((WhileStmt *)stmt)->condition, false, counted, escaped);
+        break;
+    }
+    case FOR_STMT: {
+        collectEscapes(((ForStmt *)stmt)->condition, false, counted, escaped);
+        break;
+    }
+    case FOR_EACH_STMT: {
+        collectEscapes(((ForEachStmt *)stmt)->iterable, false, counted, escaped);
+        break;
+    }
+    case IF_STMT: {
+        collectEscapes(((IfStmt *)stmt)->condition, false, counted, escaped);
+        break;
+    }
+    default: {
+    }
+    }
+}
+
+static bool isEscaped(std::string name, std::vector<std::string> &escaped) {
+    return std::find(escaped.begin(), escaped.end(), name) != escaped.end();
+}
+
+static bool isReleasedType(Variable *var) {
+    return var->type == STR_VAR || var->type == MAP_VAR || var->type == GRID_VAR || var->type == SET_VAR ||
+           var->type == BUILDER_VAR || var->type == ARRAY_VAR && !isFixedArray(var);
+}
+
+// Indexing or reading a field gives the item itself rather than a value of its own, those aren't released. A grid is
+// copied out of anything it's read from
+static bool givesOwnValue(VarStmt *varStmt) {
+    if (varStmt->var->type == GRID_VAR) {
+        return true;
+    }
+    switch (varStmt->initializer->type) {
+    case VAR_EXPR:
+    case CALL_EXPR:
+    case BINARY_EXPR:
+    case LITERAL_EXPR:
+    case ARRAY_EXPR:
+    case SLICE_EXPR: {
+        return varStmt->var->type != MAP_VAR;
+    }
+    case MAP_EXPR:
+    case SET_EXPR: {
+        return true;
+    }
+    default: {
+        return false;
+    }
+    }
+}
+
+static bool isItemOf(Expr *expr, std::string name) {
+    if (expr->type != INDEX_EXPR && expr->type != DOT_EXPR) {
+        return false;
+    }
+    VarExpr *root = rootVariable(expr);
+    return root != nullptr && root->name == name;
+}
+
+// Assigning or incrementing an item of the variable writes it, so does passing it to a function that writes its items
+static bool writesItems(std::string name, std::vector<Stmt *> &stmts, std::vector<Expr *> &exprs) {
+    for (auto &stmt : stmts) {
+        if (stmt->type == ASSIGN_STMT && isItemOf(((AssignStmt *)stmt)->variable, name)) {
+            return true;
+        }
+    }
+    for (auto &expr : exprs) {
+        if (expr->type == INC_EXPR && isItemOf(((IncExpr *)expr)->expr, name)) {
+            return true;
+        }
+        if (expr->type != CALL_EXPR) {
+            continue;
+        }
+        CallExpr *callExpr = (CallExpr *)expr;
+        FuncVariable *funcVar = lookupFunction(callExpr->callee);
+        if (funcVar == nullptr) {
+            continue;
+        }
+        std::vector<bool> &writesParams = funcVar->writesParams;
+        for (int i = 0; i < callExpr->arguments.size() && i < writesParams.size(); ++i) {
+            if (writesParams[i] && isVarExpr(callExpr->arguments[i], name)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Marks the string, array, map, grid, set and builder variables that can release their buffer when they're
+// reassigned, declared again or the function returns. Nothing can be redeclared in a scope so a name that escapes
+// anywhere isn't released at all. The function's params are borrowed, the callers are told which ones it keeps
+static void markReleasedVariables(std::vector<Stmt *> body, FuncVariable *funcVar) {
+    std::vector<Stmt *> flat;
+    std::vector<Expr *> exprs;
+    collectStmts(body, flat, exprs);
+    std::vector<std::string> escaped;
+    for (auto &stmt : flat) {
+        collectStmtEscapes(stmt, true, escaped);
+    }
+    for (auto &stmt : flat) {
+        if (stmt->type == VAR_STMT) {
+            VarStmt *varStmt = (VarStmt *)stmt;
+            varStmt->released =
+                isReleasedType(varStmt->var) && givesOwnValue(varStmt) && !isEscaped(varStmt->var->name, escaped);
+        } else if (stmt->type == FOR_EACH_STMT) {
+            ForEachStmt *forEachStmt = (ForEachStmt *)stmt;
+            forEachStmt->released = !isEscaped(forEachStmt->item, escaped) && !isEscaped(forEachStmt->key, escaped);
+        }
+    }
+    if (funcVar == nullptr) {
+        return;
+    }
+    for (auto &param : funcVar->params) {
+        funcVar->storesParams.push_back(isEscaped(param->name, escaped));
+        funcVar->writesParams.push_back(writesItems(param->name, flat, exprs));
+    }
+}
+
+#define STACK_ARRAY_ITEMS 64
+
+static bool isReturnedOrSliced(std::string name, std::vector<Stmt *> &stmts, std::vector<Expr *> &exprs) {
+    for (auto &stmt : stmts) {
+        if (stmt->type == RETURN_STMT && isVarExpr(((ReturnStmt *)stmt)->value, name)) {
+            return true;
+        }
+    }
+    for (auto &expr : exprs) {
+        if (expr->type == SLICE_EXPR && isVarExpr(((SliceExpr *)expr)->variable, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A small literal of numbers that's never grown, reassigned, passed on or stored anywhere can't outlive the function,
+// it's declared as a fixed size array instead so the items are in the entry block rather than on the heap.
+// Strings that small are already kept inline
+static void placeOnStack(std::vector<Stmt *> body) {
+    std::vector<Stmt *> flat;
+    std::vector<Expr *> exprs;
+    collectStmts(body, flat, exprs);
+    std::vector<std::string> escaped;
+    for (auto &stmt : flat) {
+        collectStmtEscapes(stmt, false, escaped);
+    }
+    for (auto &stmt : flat) {
+        if (stmt->type != VAR_STMT) {
+            continue;
+        }
+        VarStmt *varStmt = (VarStmt *)stmt;
+        if (varStmt->var->type != ARRAY_VAR || isFixedArray(varStmt->var) || varStmt->initializer->type != ARRAY_EXPR) {
+            continue;
+        }
+        ArrayVariable *arrayVar = (ArrayVariable *)varStmt->var;
+        int size = ((ArrayExpr *)varStmt->initializer)->items.size();
+        std::string name = arrayVar->name;
+        if (size == 0 || size > STACK_ARRAY_ITEMS || !isScalar(arrayVar->items->type) || isEscaped(name, escaped) ||
+            isWritten(name, flat, exprs, true) || isReturnedOrSliced(name, flat, exprs)) {
+            continue;
+        }
+        arrayVar->fixedSize = size;
+        arrayVar->onStack = true;
+    }
+}
+
+// 'kept' is set when whatever the expression is passed to holds on to its value. Only concatenations and calls give a
+// value of their own, anything else belongs to a variable
+static void markTemporaries(Expr *expr, bool kept) {
+    if (expr == nullptr) {
+        return;
+    }
+    Variable *var = expr->evaluatesTo;
+    bool owned = var && (var->type == STR_VAR || var->type == SET_VAR || var->type == BUILDER_VAR ||
+                         var->type == ARRAY_VAR && !isFixedArray(var));
+    switch (expr->type) {
+    case GROUPING_EXPR: {
+        markTemporaries(((GroupingExpr *)expr)->expression, kept);
+        break;
+    }
+    case BINARY_EXPR: {
+        expr->dropped = owned && !kept;
+        markTemporaries(((BinaryExpr *)expr)->left, false);
+        markTemporaries(((BinaryExpr *)expr)->right, false);
+        break;
+    }
+    case COMPARISON_EXPR: {
+        markTemporaries(((ComparisonExpr *)expr)->left, false);
+        markTemporaries(((ComparisonExpr *)expr)->right, false);
+        break;
+    }
+    case LOGICAL_EXPR: {
+        markTemporaries(((LogicalExpr *)expr)->left, false);
+        markTemporaries(((LogicalExpr *)expr)->right, false);
+        break;
+    }
+    case UNARY_EXPR: {
+        markTemporaries(((UnaryExpr *)expr)->right, false);
+        break;
+    }
+    case CALL_EXPR: {
+        CallExpr *callExpr = (CallExpr *)expr;
+        expr->dropped = owned && !kept;
+        FuncVariable *funcVar = lookupFunction(callExpr->callee);
+        for (int i = 0; i < callExpr->arguments.size(); ++i) {
+            bool keepsArg = callExpr->callee == "move" || keepsArgument(callExpr->callee, i);
+            if (funcVar && i < funcVar->storesParams.size()) {
+                keepsArg = funcVar->storesParams[i];
+            }
+            markTemporaries(callExpr->arguments[i], keepsArg);
+        }
+        break;
+    }
+    case INDEX_EXPR: {
+        IndexExpr *indexExpr = (IndexExpr *)expr;
+        markTemporaries(indexExpr->variable, true);
+        markTemporaries(indexExpr->index, false);
+        markTemporaries(indexExpr->column, false);
+        break;
+    }
+    case SLICE_EXPR: {
+        SliceExpr *sliceExpr = (SliceExpr *)expr;
+        markTemporaries(sliceExpr->variable, true);
+        markTemporaries(sliceExpr->start, false);
+        markTemporaries(sliceExpr->end, false);
+        break;
+    }
+    case ARRAY_EXPR: {
+        for (auto &item : ((ArrayExpr *)expr)->items) {
+            markTemporaries(item, true);
+        }
+        break;
+    }
+    case SET_EXPR: {
+        for (auto &item : ((SetExpr *)expr)->items) {
+            markTemporaries(item, true);
+        }
+        break;
+    }
+    case MAP_EXPR: {
+        MapExpr *mapExpr = (MapExpr *)expr;
+        for (int i = 0; i < mapExpr->keys.size(); ++i) {
+            markTemporaries(mapExpr->keys[i], true);
+            markTemporaries(mapExpr->values[i], true);
+        }
+        break;
+    }
+    case DOT_EXPR: {
+        markTemporaries(((DotExpr *)expr)->name, true);
+        break;
+    }
+    default: {
+    }
+    }
+}
+
+// Values that are only read by an operator, a condition or a call that doesn't keep them are freed at the end of the
+// statement, their owner is known so nothing is counted. Whatever's declared, assigned or returned is kept
+static void markStmtTemporaries(std::vector<Stmt *> body) {
+    std::vector<Stmt *> flat;
+    std::vector<Expr *> exprs;
+    collectStmts(body, flat, exprs);
+    for (auto &stmt : flat) {
+        switch (stmt->type) {
+        case EXPR_STMT: {
+            markTemporaries(((ExprStmt *)stmt)->expression, false);
+            break;
+        }
+        case COMP_ASSIGN_STMT: {
+            markTemporaries(((CompAssignStmt *)stmt)->right, true);
+            break;
+        }
+        case ASSIGN_STMT: {
+            markTemporaries(((AssignStmt *)stmt)->variable, true);
+            markTemporaries(((AssignStmt *)stmt)->value, true);
+            break;
+        }
+        case RETURN_STMT: {
+            markTemporaries(((ReturnStmt *)stmt)->value, true);
+            break;
+        }
+        case VAR_STMT: {
+            markTemporaries(((VarStmt *)stmt)->initializer, true);
+            break;
+        }
+        case WHILE_STMT: {
+            markTemporaries(((WhileStmt *)stmt)->condition, false);
+            break;
+        }
+        case FOR_STMT: {
+            markTemporaries(((ForStmt *)stmt)->condition, false);
+            break;
+        }
+        case FOR_EACH_STMT: {
+            markTemporaries(((ForEachStmt *)stmt)->iterable, true);
+            break;
+        }
+        case IF_STMT: {
+            markTemporaries(((IfStmt *)stmt)->condition, false);
+            break;
+        }
+        default: {
+        }
+        }
+    }
+}
+
+static void setReturnedGridItems(FuncStmt *funcStmt) {
+    std::vector<Stmt *> flat;
+    std::vector<Expr *> exprs;
+    collectStmts(funcStmt->body, flat, exprs);
+    for (auto &stmt : flat) {
+        if (stmt->type == RETURN_STMT) {
+            setGridItems(((ReturnStmt *)stmt)->value, funcStmt->returnType);
+        }
+    }
+}
+
+static void fixExprEvaluatesToStmt(Stmt *stmt) {
+    switch (stmt->type) {
+    case EXPR_STMT: {
+        ExprStmt *exprStmt = (ExprStmt *)stmt;
+        fixExprEvaluatesToExpr(exprStmt->expression);
+        break;
+    }
+    case COMP_ASSIGN_STMT: {
+        CompAssignStmt *compAssignStmt = (CompAssignStmt *)stmt;
+        fixExprEvaluatesToExpr(compAssignStmt->right);
+        std::map<std::string, Variable *> &scope = compiler->variables.back();
+        if (scope.count(compAssignStmt->name)) {
+            checkNumberStore(scope[compAssignStmt->name], compAssignStmt->right, compAssignStmt->line);
+        }
+        break;
+    }
+    case ASSIGN_STMT: {
+        AssignStmt *assignStmt = (AssignStmt *)stmt;
+        fixExprEvaluatesToExpr(assignStmt->value);
+        fixExprEvaluatesToExpr(assignStmt->variable);
+        setGridItems(assignStmt->value, assignStmt->variable->evaluatesTo);
+        checkNumberStore(assignStmt->variable->evaluatesTo, assignStmt->value, assignStmt->line);
+        if (assignStmt->variable->type == VAR_EXPR && isFixedArray(assignStmt->variable->evaluatesTo)) {
+            errorAt("Can't assign to a fixed size array, assign to its items instead", assignStmt->line);
+        }
+        // Items of an array param are the caller's and can be written, the param and its fields are read-only
+        Expr *target = assignStmt->variable;
+        if (target->type == DOT_EXPR) {
+            target = ((DotExpr *)target)->name;
+        }
+        if (target->type == VAR_EXPR && isReadOnlyParam(target->evaluatesTo) &&
+            (target->evaluatesTo->type == ARRAY_VAR || target->evaluatesTo->type == MAP_VAR ||
+             target->evaluatesTo->type == STRUCT_VAR || target->evaluatesTo->type == SET_VAR ||
+             target->evaluatesTo->type == GRID_VAR || target->evaluatesTo->type == BUILDER_VAR)) {
+            errorAt("Can only assign to a param declared 'ref'", assignStmt->line);
+        }
+        // A grid is a value like a set, its cells are only the caller's to write through 'ref'
+        Expr *indexed = target->type == INDEX_EXPR ? ((IndexExpr *)target)->variable : nullptr;
+        if (indexed && indexed->type == VAR_EXPR && indexed->evaluatesTo->type == GRID_VAR &&
+            isReadOnlyParam(indexed->evaluatesTo)) {
+            errorAt("Can only write to the cells of a grid param declared 'ref'", assignStmt->line);
+        }
+        break;
+    }
+    case RETURN_STMT: {
+        ReturnStmt *returnStmt = (ReturnStmt *)stmt;
+        fixExprEvaluatesToExpr(returnStmt->value);
+        break;
+    }
+    case VAR_STMT: {
+        VarStmt *varStmt = (VarStmt *)stmt;
+        if (compiler->variables.back().count(varStmt->var->name)) {
+            errorAt(("Can't redeclare a variable in the same scope - " + varStmt->var->name).c_str(), varStmt->line);
+        }
+        fixExprEvaluatesToExpr(varStmt->initializer);
+        setGridItems(varStmt->initializer, varStmt->var);
+        checkFixedArrayInitializer(varStmt);
+        checkNumberStore(varStmt->var, varStmt->initializer, varStmt->line);
+        compiler->variables.back()[varStmt->var->name] = varStmt->var;
+        break;
+    }
+    case WHILE_STMT: {
+        WhileStmt *whileStmt = (WhileStmt *)stmt;
+        fixExprEvaluatesToExpr(whileStmt->condition);
         for (auto &bodyStmt : whileStmt->body) {
             fixExprEvaluatesToStmt(bodyStmt);
         }
@@ -1457,6 +3317,28 @@ static void fixExprEvaluatesToStmt(Stmt *stmt) {
         for (auto &bodyStmt : forStmt->body) {
             fixExprEvaluatesToStmt(bodyStmt);
         }
+        eliminateBoundsChecks(forStmt);
+        break;
+    }
+    case FOR_EACH_STMT: {
+        ForEachStmt *forEachStmt = (ForEachStmt *)stmt;
+        fixExprEvaluatesToExpr(forEachStmt->iterable);
+        setForEachVariables(forEachStmt);
+        // The body can change what's looped over, the items are read through the variable again then
+        Expr *iterable = forEachStmt->iterable;
+        forEachStmt->reloads =
+            iterable->type == VAR_EXPR && stmtsReference(forEachStmt->body, ((VarExpr *)iterable)->name);
+
+        // The loop variables and everything declared in the body go out of scope after the loop
+        std::map<std::string, Variable *> enclosingScope = compiler->variables.back();
+        if (!forEachStmt->key.empty()) {
+            compiler->variables.back()[forEachStmt->key] = forEachStmt->keyVar;
+        }
+        compiler->variables.back()[forEachStmt->item] = forEachStmt->itemVar;
+        for (auto &bodyStmt : forEachStmt->body) {
+            fixExprEvaluatesToStmt(bodyStmt);
+        }
+        compiler->variables.back() = enclosingScope;
         break;
     }
     case IF_STMT: {
@@ -1475,8 +3357,8 @@ static void fixExprEvaluatesToStmt(Stmt *stmt) {
         if (compiler->variables.back().count(funcStmt->name)) {
             errorAt("Func name is already declared in this scope", funcStmt->line);
         }
-        compiler->variables.back()[funcStmt->name] =
-            new FuncVariable(funcStmt->name, funcStmt->returnType, funcStmt->params);
+        FuncVariable *funcVar = new FuncVariable(funcStmt->name, funcStmt->returnType, funcStmt->params);
+        compiler->variables.back()[funcStmt->name] = funcVar;
         // ToDo Please change this xD
         compiler->variables.push_back({});
         for (auto &param : funcStmt->params) {
@@ -1485,12 +3367,28 @@ static void fixExprEvaluatesToStmt(Stmt *stmt) {
         for (auto &bodyStmt : funcStmt->body) {
             fixExprEvaluatesToStmt(bodyStmt);
         }
+        setReturnedGridItems(funcStmt);
+        placeOnStack(funcStmt->body);
+        markLastUses(funcStmt->body);
+        markReleasedVariables(funcStmt->body, funcVar);
+        markStmtTemporaries(funcStmt->body);
         compiler->variables.pop_back();
         break;
     }
     case BREAK_STMT: {
         break;
     }
+    case REGION_STMT: {
+        RegionStmt *regionStmt = (RegionStmt *)stmt;
+        // Everything declared in the region is freed with it, so it goes out of scope as well
+        std::map<std::string, Variable *> enclosingScope = compiler->variables.back();
+        for (auto &bodyStmt : regionStmt->body) {
+            fixExprEvaluatesToStmt(bodyStmt);
+        }
+        checkRegion(regionStmt);
+        compiler->variables.back() = enclosingScope;
+        break;
+    }
     case STRUCT_STMT: {
         StructStmt *structStmt = (StructStmt *)stmt;
         if (compiler->variables.back().count(structStmt->name)) {
@@ -1515,6 +3413,10 @@ Compiler *compile(std::string source) {
         fixExprEvaluatesToStmt(stmt);
         compiler->statements.push_back(stmt);
     }
+    placeOnStack(compiler->statements);
+    markLastUses(compiler->statements);
+    markReleasedVariables(compiler->statements, nullptr);
+    markStmtTemporaries(compiler->statements);
     // debugStatements(compiler->statements);
 
     delete (scanner);
@@ -163,6 +163,24 @@ void debugExpression(Expr *expr) {
         debugExpression(indexExpr->variable);
         printf("[");
         debugExpression(indexExpr->index);
+        if (indexExpr->column != nullptr) {
+            printf(", ");
+            debugExpression(indexExpr->column);
+        }
+        printf("]");
+        break;
+    }
+    case SLICE_EXPR: {
+        SliceExpr *sliceExpr = (SliceExpr *)expr;
+        debugExpression(sliceExpr->variable);
+        printf("[");
+        if (sliceExpr->start != nullptr) {
+            debugExpression(sliceExpr->start);
+        }
+        printf(":");
+        if (sliceExpr->end != nullptr) {
+            debugExpression(sliceExpr->end);
+        }
         printf("]");
         break;
     }
@@ -181,6 +199,19 @@ void debugExpression(Expr *expr) {
         printf("}");
         break;
     }
+    case SET_EXPR: {
+        SetExpr *setExpr = (SetExpr *)expr;
+
+        printf("{");
+        for (int i = 0; i < setExpr->items.size(); i++) {
+            debugExpression(setExpr->items[i]);
+            if (i < setExpr->items.size() - 1) {
+                printf(", ");
+            }
+        }
+        printf("}");
+        break;
+    }
     case DOT_EXPR: {
         DotExpr *dotExpr = (DotExpr *)expr;
         debugExpression(dotExpr->name);
@@ -200,12 +231,36 @@ const char *debugVarType(VarType varType) {
     case INT_VAR: {
         return "int";
     }
+    case I64_VAR: {
+        return "i64";
+    }
+    case U8_VAR: {
+        return "u8";
+    }
+    case I16_VAR: {
+        return "i16";
+    }
+    case U32_VAR: {
+        return "u32";
+    }
+    case FLOAT_VAR: {
+        return "float";
+    }
     case DOUBLE_VAR: {
         return "double";
     }
     case MAP_VAR: {
         return "map";
     }
+    case SET_VAR: {
+        return "set";
+    }
+    case BUILDER_VAR: {
+        return "builder";
+    }
+    case GRID_VAR: {
+        return "grid";
+    }
     case STRUCT_VAR: {
         return "struct";
     }
@@ -229,6 +284,11 @@ void debugVariable(Variable *var) {
     switch (var->type) {
     case ARRAY_VAR: {
         ArrayVariable *arrayVar = (ArrayVariable *)var;
+        if (arrayVar->fixedSize) {
+            debugVariable(arrayVar->items);
+            printf("[%d]", arrayVar->fixedSize);
+            break;
+        }
         printf("arr");
         printf("[");
         debugVariable(arrayVar->items);
@@ -245,6 +305,22 @@ void debugVariable(Variable *var) {
         printf("]");
         break;
     }
+    case SET_VAR: {
+        SetVariable *setVar = (SetVariable *)var;
+        printf("set");
+        printf("[");
+        debugVariable(setVar->items);
+        printf("]");
+        break;
+    }
+    case GRID_VAR: {
+        GridVariable *gridVar = (GridVariable *)var;
+        printf("grid");
+        printf("[");
+        debugVariable(gridVar->items);
+        printf("]");
+        break;
+    }
     case STRUCT_VAR: {
         StructVariable *structVar = (StructVariable *)var;
         printf("struct '%s'", structVar->structName.c_str());
@@ -323,9 +399,29 @@ void debugStatement(Stmt *statement) {
         printf("}\n");
         break;
     }
+    case FOR_EACH_STMT: {
+        ForEachStmt *forEachStmt = (ForEachStmt *)statement;
+        printf("for(");
+        if (!forEachStmt->key.empty()) {
+            printf("%s, ", forEachStmt->key.c_str());
+        }
+        printf("%s in ", forEachStmt->item.c_str());
+        debugExpression(forEachStmt->iterable);
+        printf(")\n{\n");
+        debugStatements(forEachStmt->body);
+        printf("}\n");
+        break;
+    }
+    case REGION_STMT: {
+        RegionStmt *regionStmt = (RegionStmt *)statement;
+        printf("%sregion\n{\n", regionStmt->suspended ? "suspended " : "");
+        debugStatements(regionStmt->body);
+        printf("}\n");
+        break;
+    }
     case STRUCT_STMT: {
         StructStmt *structStmt = (StructStmt *)statement;
-        printf("struct %s\n{\n", structStmt->name.c_str());
+        printf("%sstruct %s\n{\n", structStmt->soa ? "soa " : "", structStmt->name.c_str());
         for (int i = 0; i < structStmt->fields.size(); i++) {
             debugVariable(structStmt->fields[i]);
             printf(";\n");
@@ -367,6 +463,9 @@ void debugStatement(Stmt *statement) {
         FuncStmt *funcStmt = (FuncStmt *)statement;
         printf("fun %s(", funcStmt->name.c_str());
         for (int i = 0; i < funcStmt->params.size(); i++) {
+            if (funcStmt->params[i]->ref) {
+                printf("ref ");
+            }
             debugVariable(funcStmt->params[i]);
             if (i != funcStmt->params.size() - 1) {
                 printf(",");
@@ -522,6 +621,26 @@ void debugToken(Token *token) {
         printf("TOKEN_INT_TYPE");
         break;
     }
+    case TOKEN_I64_TYPE: {
+        printf("TOKEN_I64_TYPE");
+        break;
+    }
+    case TOKEN_U8_TYPE: {
+        printf("TOKEN_U8_TYPE");
+        break;
+    }
+    case TOKEN_I16_TYPE: {
+        printf("TOKEN_I16_TYPE");
+        break;
+    }
+    case TOKEN_U32_TYPE: {
+        printf("TOKEN_U32_TYPE");
+        break;
+    }
+    case TOKEN_FLOAT_TYPE: {
+        printf("TOKEN_FLOAT_TYPE");
+        break;
+    }
     case TOKEN_DOUBLE_TYPE: {
         printf("TOKEN_DOUBLE_TYPE");
         break;
@@ -534,6 +653,18 @@ void debugToken(Token *token) {
         printf("TOKEN_MAP");
         break;
     }
+    case TOKEN_SET_TYPE: {
+        printf("TOKEN_SET");
+        break;
+    }
+    case TOKEN_BUILDER_TYPE: {
+        printf("TOKEN_BUILDER");
+        break;
+    }
+    case TOKEN_GRID_TYPE: {
+        printf("TOKEN_GRID");
+        break;
+    }
     case TOKEN_ARRAY_TYPE: {
         printf("TOKEN_ARRAY");
         break;
@@ -570,6 +701,10 @@ void debugToken(Token *token) {
         printf("TOKEN_IF");
         break;
     }
+    case TOKEN_IN: {
+        printf("TOKEN_IN");
+        break;
+    }
     case TOKEN_RETURN: {
         printf("TOKEN_RETURN");
         break;
@@ -598,6 +733,18 @@ void debugToken(Token *token) {
         printf("TOKEN_BREAK");
         break;
     }
+    case TOKEN_SOA: {
+        printf("TOKEN_SOA");
+        break;
+    }
+    case TOKEN_REGION: {
+        printf("TOKEN_REGION");
+        break;
+    }
+    case TOKEN_REF: {
+        printf("TOKEN_REF");
+        break;
+    }
     case TOKEN_ERROR: {
         printf("TOKEN_ERROR");
         break;
@@ -11,6 +11,7 @@ void debugStatements(std::vector<Stmt *> statements);
 void debugStatement(Stmt *statement);
 void debugExpression(Expr *expr);
 void debugVariable(Variable *var);
+const char *debugVarType(VarType varType);
 void debugToken(Token *token);
 
 #endif
@@ -1,4 +1,11 @@
 #include "expr.h"
+#include <cerrno>
+
+bool parseIntLiteral(std::string literal, long long &value) {
+    errno = 0;
+    value = strtoll(literal.c_str(), nullptr, 10);
+    return errno != ERANGE;
+}
 
 void freeExpr(Expr *expr) {
     switch (expr->type) {
@@ -53,9 +60,24 @@ void freeExpr(Expr *expr) {
         IndexExpr *indexExpr = (IndexExpr *)expr;
         freeExpr(indexExpr->variable);
         freeExpr(indexExpr->index);
+        if (indexExpr->column != nullptr) {
+            freeExpr(indexExpr->column);
+        }
         delete (indexExpr);
         break;
     }
+    case SLICE_EXPR: {
+        SliceExpr *sliceExpr = (SliceExpr *)expr;
+        freeExpr(sliceExpr->variable);
+        if (sliceExpr->start != nullptr) {
+            freeExpr(sliceExpr->start);
+        }
+        if (sliceExpr->end != nullptr) {
+            freeExpr(sliceExpr->end);
+        }
+        delete (sliceExpr);
+        break;
+    }
     case ARRAY_EXPR: {
         ArrayExpr *arrayExpr = (ArrayExpr *)expr;
         for (auto &exp : arrayExpr->items) {
@@ -75,6 +97,14 @@ void freeExpr(Expr *expr) {
         delete (mapExpr);
         break;
     }
+    case SET_EXPR: {
+        SetExpr *setExpr = (SetExpr *)expr;
+        for (auto &exp : setExpr->items) {
+            freeExpr(exp);
+        }
+        delete (setExpr);
+        break;
+    }
     case CALL_EXPR: {
         CallExpr *callExpr = (CallExpr *)expr;
         for (auto &exp : callExpr->arguments) {
@@ -17,8 +17,10 @@ enum ExprType {
     INDEX_EXPR,
     ARRAY_EXPR,
     MAP_EXPR,
+    SET_EXPR,
     CALL_EXPR,
     DOT_EXPR,
+    SLICE_EXPR,
 };
 
 enum UnaryOp { BANG_UNARY, NEG_UNARY, PLUS_UNARY };
@@ -47,9 +49,11 @@ enum IncOp { INC, DEC };
 class Expr {
   private:
   public:
-    Variable *evaluatesTo;
+    Variable *evaluatesTo = nullptr;
     ExprType type;
     int line;
+    // Set on a string or array nothing keeps, it's freed once the statement reading it is done
+    bool dropped = false;
 };
 
 class IncExpr : public Expr {
@@ -105,6 +109,19 @@ class MapExpr : public Expr {
     }
 };
 
+class SetExpr : public Expr {
+  private:
+  public:
+    std::vector<Expr *> items;
+    Variable *setVar;
+    SetExpr(int line) {
+        this->type = SET_EXPR;
+        this->items = std::vector<Expr *>();
+        this->setVar = nullptr;
+        this->line = line;
+    }
+};
+
 class ArrayExpr : public Expr {
   private:
   public:
@@ -178,6 +195,10 @@ class VarExpr : public Expr {
   private:
   public:
     std::string name;
+    // Set when nothing reads the variable after this, its buffer can be taken instead of shared
+    bool lastUse = false;
+    // Set when a value declared in a region is stored outside of it, it's read as a copy on the heap
+    bool copyOut = false;
     VarExpr(std::string name, int line) {
         this->name = name;
         this->type = VAR_EXPR;
@@ -216,14 +237,38 @@ class IndexExpr : public Expr {
   public:
     Expr *variable;
     Expr *index;
+    // Second index, only grids are indexed by two
+    Expr *column;
+    // Cleared when the enclosing loop proves the index is inside the array
+    bool checked;
     IndexExpr(Expr *variable, Expr *index, int line) {
         this->type = INDEX_EXPR;
         this->index = index;
+        this->column = nullptr;
+        this->checked = true;
+        this->variable = variable;
+        this->line = line;
+    }
+};
+
+// a[start:end], either bound can be left out. Evaluates to an array or str viewing the same buffer
+class SliceExpr : public Expr {
+  private:
+  public:
+    Expr *variable;
+    Expr *start;
+    Expr *end;
+    SliceExpr(Expr *variable, Expr *start, int line) {
+        this->type = SLICE_EXPR;
         this->variable = variable;
+        this->start = start;
+        this->end = nullptr;
         this->line = line;
     }
 };
 
 void freeExpr(Expr *expr);
+// Integer literals are at most an i64, returns false if the literal doesn't fit
+bool parseIntLiteral(std::string literal, long long &value);
 
 #endif
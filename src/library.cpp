@@ -1,9 +1,317 @@
 #include "library.h"
+#include "llvm/IR/MDBuilder.h"
+
+// Every runtime failure ends up here. It's kept out of line and marked cold so a check only costs a compare and a
+// branch that's laid out as not taken, the messages are stored once instead of at every check
+static llvm::Function *createRuntimeError(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::Type *int64Type = llvmBuilder->getInt64Ty();
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getVoidTy(),
+                                {llvmBuilder->getInt32Ty(), llvmBuilder->getInt32Ty(), int64Type, int64Type,
+                                 int64Type, int64Type},
+                                false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "runtimeError", *llvmCompiler->module);
+    function->addFnAttr(llvm::Attribute::NoInline);
+    function->addFnAttr(llvm::Attribute::Cold);
+    function->addFnAttr(llvm::Attribute::NoReturn);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    // Indexed by RuntimeError
+    std::vector<std::string> messages = {
+        "Trying to index outside of array\nsize: %ld\nidx: %ld\n",
+        "Trying to index outside of grid\nsize: %ld x %ld\nidx: %ld, %ld\n",
+        "Key didn't exist\n",
+        "Can't slice [%ld:%ld] out of size %ld\n",
+        "Can't copy row %ld to row %ld\n",
+        "Length %ld doesn't fit in an int, use len_i64\n",
+    };
+    std::vector<llvm::Constant *> messagePtrs;
+    for (auto &message : messages) {
+        messagePtrs.push_back(builder->CreateGlobalStringPtr(message));
+    }
+    llvm::ArrayType *messagesType = llvm::ArrayType::get(builder->getPtrTy(), messagePtrs.size());
+    llvm::GlobalVariable *messageTable =
+        new llvm::GlobalVariable(*llvmCompiler->module, messagesType, true, llvm::GlobalValue::PrivateLinkage,
+                                 llvm::ConstantArray::get(messagesType, messagePtrs), "runtimeErrors");
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *line = arg++;
+    llvm::Value *error = arg++;
+    std::vector<llvm::Value *> params = {nullptr, arg++, arg++, arg++, arg};
+    builder->CreateCall(llvmCompiler->libraryFuncs["printf"], {builder->CreateGlobalStringPtr("[line %d] "), line});
+    llvm::Value *messagePtr = builder->CreateInBoundsGEP(messagesType, messageTable, {builder->getInt32(0), error});
+    params[0] = builder->CreateLoad(builder->getPtrTy(), messagePtr);
+    builder->CreateCall(llvmCompiler->libraryFuncs["printf"], params);
+    builder->CreateCall(llvmCompiler->libraryFuncs["exit"], {builder->getInt32(1)});
+    builder->CreateUnreachable();
+
+    return function;
+}
+
+void checkRuntimeError(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *failed, RuntimeError error,
+                       llvm::Value *line, std::vector<llvm::Value *> args) {
+    llvm::Function *function = builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock *errorBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "error", function);
+    llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+    llvm::MDNode *unlikely = llvm::MDBuilder(*llvmCompiler->ctx).createBranchWeights(1, 1 << 20);
+    builder->CreateCondBr(failed, errorBlock, mergeBlock, unlikely);
+
+    builder->SetInsertPoint(errorBlock);
+    std::vector<llvm::Value *> params = {line, builder->getInt32(error)};
+    for (int i = 0; i < 4; ++i) {
+        params.push_back(i < args.size() ? builder->CreateSExt(args[i], builder->getInt64Ty()) : builder->getInt64(0));
+    }
+    builder->CreateCall(llvmCompiler->internalFuncs["runtimeError"], params);
+    builder->CreateUnreachable();
+
+    builder->SetInsertPoint(mergeBlock);
+}
+
+// Allocations inside a region come from a bump arena of chunks {prev, end, data...}, leaving the region drops every
+// chunk that was added in it at once. Each allocation is preceded by its size so it can be grown out of the arena,
+// arena allocations have the top bit of the size set so releasing one doesn't have to look for its chunk
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_HEADER_SIZE 16
+#define ARENA_ALLOCATION (1ull << 63)
+
+static llvm::Value *getArenaGlobal(LLVMCompiler *llvmCompiler, std::string name) {
+    return llvmCompiler->module->getNamedGlobal(name);
+}
+
+static llvm::Function *createAllocate(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    for (std::string name : {"arenaChunk", "arenaTop", "arenaEnd"}) {
+        new llvm::GlobalVariable(*llvmCompiler->module, llvmBuilder->getPtrTy(), false,
+                                 llvm::GlobalValue::InternalLinkage,
+                                 llvm::Constant::getNullValue(llvmBuilder->getPtrTy()), name);
+    }
+    new llvm::GlobalVariable(*llvmCompiler->module, llvmBuilder->getInt32Ty(), false,
+                             llvm::GlobalValue::InternalLinkage, llvmBuilder->getInt32(0), "regionDepth");
+
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getPtrTy(), {llvmBuilder->getInt64Ty()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "allocate", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::BasicBlock *heapBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "heap", function);
+    llvm::BasicBlock *arenaBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "arena", function);
+    llvm::BasicBlock *growBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "grow", function);
+    llvm::BasicBlock *bumpBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "bump", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *size = function->arg_begin();
+    llvm::Value *chunkPtr = getArenaGlobal(llvmCompiler, "arenaChunk");
+    llvm::Value *topPtr = getArenaGlobal(llvmCompiler, "arenaTop");
+    llvm::Value *endPtr = getArenaGlobal(llvmCompiler, "arenaEnd");
+    llvm::Value *depth = builder->CreateLoad(builder->getInt32Ty(), getArenaGlobal(llvmCompiler, "regionDepth"));
+    builder->CreateCondBr(builder->CreateICmpEQ(depth, builder->getInt32(0)), heapBlock, arenaBlock);
+
+    builder->SetInsertPoint(heapBlock);
+    llvm::Value *heapAllocation =
+        builder->CreateCall(llvmCompiler->libraryFuncs["malloc"], {builder->CreateAdd(size, builder->getInt64(8))});
+    builder->CreateStore(size, heapAllocation);
+    builder->CreateRet(builder->CreateInBoundsGEP(builder->getInt8Ty(), heapAllocation, builder->getInt32(8)));
+
+    // The size header plus the allocation rounded up to 8 bytes
+    builder->SetInsertPoint(arenaBlock);
+    llvm::Value *needed = builder->CreateAnd(builder->CreateAdd(size, builder->getInt64(15)), builder->getInt64(~7));
+    llvm::Value *top = builder->CreatePtrToInt(builder->CreateLoad(builder->getPtrTy(), topPtr), builder->getInt64Ty());
+    llvm::Value *end = builder->CreatePtrToInt(builder->CreateLoad(builder->getPtrTy(), endPtr), builder->getInt64Ty());
+    builder->CreateCondBr(builder->CreateICmpUGE(builder->CreateSub(end, top), needed), bumpBlock, growBlock);
+
+    builder->SetInsertPoint(growBlock);
+    llvm::Value *chunkSize = builder->CreateAdd(needed, builder->getInt64(ARENA_HEADER_SIZE));
+    chunkSize = builder->CreateSelect(builder->CreateICmpUGT(chunkSize, builder->getInt64(ARENA_CHUNK_SIZE)),
+                                      chunkSize, builder->getInt64(ARENA_CHUNK_SIZE));
+    llvm::Value *chunk = builder->CreateCall(llvmCompiler->libraryFuncs["malloc"], {chunkSize});
+    llvm::Value *chunkEnd = builder->CreateInBoundsGEP(builder->getInt8Ty(), chunk, chunkSize);
+    builder->CreateStore(builder->CreateLoad(builder->getPtrTy(), chunkPtr), chunk);
+    builder->CreateStore(chunkEnd, builder->CreateInBoundsGEP(builder->getPtrTy(), chunk, builder->getInt32(1)));
+    builder->CreateStore(chunk, chunkPtr);
+    builder->CreateStore(builder->CreateInBoundsGEP(builder->getInt8Ty(), chunk, builder->getInt32(ARENA_HEADER_SIZE)),
+                         topPtr);
+    builder->CreateStore(chunkEnd, endPtr);
+    builder->CreateBr(bumpBlock);
+
+    builder->SetInsertPoint(bumpBlock);
+    llvm::Value *allocation = builder->CreateLoad(builder->getPtrTy(), topPtr);
+    builder->CreateStore(builder->CreateOr(size, builder->getInt64(ARENA_ALLOCATION)), allocation);
+    builder->CreateStore(builder->CreateInBoundsGEP(builder->getInt8Ty(), allocation, needed), topPtr);
+    builder->CreateRet(builder->CreateInBoundsGEP(builder->getInt8Ty(), allocation, builder->getInt32(8)));
+
+    return function;
+}
+
+static llvm::Value *getAllocationHeader(llvm::IRBuilder<> *builder, llvm::Value *ptr) {
+    return builder->CreateInBoundsGEP(builder->getInt8Ty(), ptr, builder->getInt32(-8));
+}
+
+// Allocations from every region's arena are tagged, not just the innermost one's
+static llvm::Function *createInArena(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getInt1Ty(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "inArena", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *header =
+        builder->CreateLoad(builder->getInt64Ty(), getAllocationHeader(builder, function->arg_begin()));
+    builder->CreateRet(builder->CreateICmpSLT(header, builder->getInt64(0)));
+
+    return function;
+}
+
+// An arena allocation can't be grown in place, it's copied into a new allocation instead
+static llvm::Function *createReallocate(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmBuilder->getPtrTy(), {llvmBuilder->getPtrTy(), llvmBuilder->getInt64Ty()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "reallocate", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::BasicBlock *newBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "new", function);
+    llvm::BasicBlock *checkBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "check", function);
+    llvm::BasicBlock *heapBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "heap", function);
+    llvm::BasicBlock *arenaBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "arena", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *ptr = arg++;
+    llvm::Value *size = arg;
+    builder->CreateCondBr(builder->CreateIsNull(ptr), newBlock, checkBlock);
+
+    builder->SetInsertPoint(newBlock);
+    builder->CreateRet(builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {size}));
+
+    builder->SetInsertPoint(checkBlock);
+    builder->CreateCondBr(builder->CreateCall(llvmCompiler->internalFuncs["inArena"], {ptr}), arenaBlock, heapBlock);
+
+    builder->SetInsertPoint(heapBlock);
+    llvm::Value *heapAllocation = builder->CreateCall(
+        llvmCompiler->libraryFuncs["realloc"],
+        {getAllocationHeader(builder, ptr), builder->CreateAdd(size, builder->getInt64(8))});
+    builder->CreateStore(size, heapAllocation);
+    builder->CreateRet(builder->CreateInBoundsGEP(builder->getInt8Ty(), heapAllocation, builder->getInt32(8)));
+
+    builder->SetInsertPoint(arenaBlock);
+    llvm::Value *oldSize = builder->CreateLoad(builder->getInt64Ty(), getAllocationHeader(builder, ptr));
+    oldSize = builder->CreateAnd(oldSize, builder->getInt64(~ARENA_ALLOCATION));
+    llvm::Value *copied = builder->CreateSelect(builder->CreateICmpULT(oldSize, size), oldSize, size);
+    llvm::Value *newPtr = builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {size});
+    builder->CreateMemCpy(newPtr, llvm::MaybeAlign(8), ptr, llvm::MaybeAlign(8), copied);
+    builder->CreateRet(newPtr);
+
+    return function;
+}
+
+// Arena allocations are freed with their region, releasing null does nothing
+static llvm::Function *createRelease(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "release", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::BasicBlock *checkBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "check", function);
+    llvm::BasicBlock *heapBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "heap", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *ptr = function->arg_begin();
+    builder->CreateCondBr(builder->CreateIsNull(ptr), exitBlock, checkBlock);
+
+    builder->SetInsertPoint(checkBlock);
+    builder->CreateCondBr(builder->CreateCall(llvmCompiler->internalFuncs["inArena"], {ptr}), exitBlock, heapBlock);
+
+    builder->SetInsertPoint(heapBlock);
+    builder->CreateCall(llvmCompiler->libraryFuncs["free"], {getAllocationHeader(builder, ptr)});
+    builder->CreateBr(exitBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+llvm::Value *suspendRegions(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder) {
+    llvm::Value *depthPtr = getArenaGlobal(llvmCompiler, "regionDepth");
+    llvm::Value *depth = builder->CreateLoad(builder->getInt32Ty(), depthPtr);
+    builder->CreateStore(builder->getInt32(0), depthPtr);
+    return depth;
+}
+
+void resumeRegions(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *depth) {
+    builder->CreateStore(depth, getArenaGlobal(llvmCompiler, "regionDepth"));
+}
+
+// The state is where the region saves the arena it was entered with
+static llvm::Function *createEnterRegion(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "enterRegion", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *state = function->arg_begin();
+    std::vector<std::string> names = {"arenaChunk", "arenaTop", "arenaEnd"};
+    for (int i = 0; i < names.size(); ++i) {
+        llvm::Value *value = builder->CreateLoad(builder->getPtrTy(), getArenaGlobal(llvmCompiler, names[i]));
+        builder->CreateStore(value, builder->CreateInBoundsGEP(builder->getPtrTy(), state, builder->getInt32(i)));
+    }
+    llvm::Value *depthPtr = getArenaGlobal(llvmCompiler, "regionDepth");
+    builder->CreateStore(builder->CreateAdd(builder->CreateLoad(builder->getInt32Ty(), depthPtr), builder->getInt32(1)),
+                         depthPtr);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+static llvm::Function *createExitRegion(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "exitRegion", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
+    llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *state = function->arg_begin();
+    llvm::Value *chunkPtr = getArenaGlobal(llvmCompiler, "arenaChunk");
+    llvm::Value *savedChunk = builder->CreateLoad(builder->getPtrTy(), state);
+    builder->CreateBr(headerBlock);
+
+    // Every chunk added since the region was entered is in front of the saved one
+    builder->SetInsertPoint(headerBlock);
+    llvm::Value *chunk = builder->CreateLoad(builder->getPtrTy(), chunkPtr);
+    builder->CreateCondBr(builder->CreateICmpEQ(chunk, savedChunk), exitBlock, bodyBlock);
+
+    builder->SetInsertPoint(bodyBlock);
+    builder->CreateStore(builder->CreateLoad(builder->getPtrTy(), chunk), chunkPtr);
+    builder->CreateCall(llvmCompiler->libraryFuncs["free"], {chunk});
+    builder->CreateBr(headerBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    std::vector<std::string> names = {"arenaChunk", "arenaTop", "arenaEnd"};
+    for (int i = 1; i < names.size(); ++i) {
+        llvm::Value *value = builder->CreateLoad(
+            builder->getPtrTy(), builder->CreateInBoundsGEP(builder->getPtrTy(), state, builder->getInt32(i)));
+        builder->CreateStore(value, getArenaGlobal(llvmCompiler, names[i]));
+    }
+    llvm::Value *depthPtr = getArenaGlobal(llvmCompiler, "regionDepth");
+    builder->CreateStore(builder->CreateSub(builder->CreateLoad(builder->getInt32Ty(), depthPtr), builder->getInt32(1)),
+                         depthPtr);
+    builder->CreateRetVoid();
+
+    return function;
+}
 
 static llvm::Function *createIndexStrMap(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
     // Fix func type
     llvm::FunctionType *funcType = llvm::FunctionType::get(
-        llvmBuilder->getPtrTy(), {llvmCompiler->internalStructs["map"], llvmCompiler->internalStructs["array"]}, false);
+        llvmBuilder->getPtrTy(),
+        {llvmCompiler->internalStructs["map"], llvmBuilder->getPtrTy(), llvmBuilder->getInt32Ty(),
+         llvmBuilder->getInt32Ty()},
+        false);
     llvm::Function *function =
         llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "indexStrMap", *llvmCompiler->module);
     llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
@@ -11,33 +319,244 @@ static llvm::Function *createIndexStrMap(LLVMCompiler *llvmCompiler, llvm::IRBui
 
     llvm::Function::arg_iterator arg = function->arg_begin();
     llvm::Value *mapArg = arg++;
-    llvm::Value *keyArg = arg;
+    llvm::Value *keyArg = arg++;
+    llvm::Value *valueSize = arg++;
+    llvm::Value *line = arg;
 
     llvm::Value *keyPtr = builder->CreateExtractValue(mapArg, 0);
     llvm::Value *loadedKeyArray = builder->CreateLoad(llvmCompiler->internalStructs["array"], keyPtr);
 
     llvm::Value *keyExists = builder->CreateCall(llvmCompiler->internalFuncs["findStrKey"], {loadedKeyArray, keyArg});
 
-    llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", function);
-    llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+    checkRuntimeError(llvmCompiler, builder, builder->CreateICmpEQ(keyExists, builder->getInt64(-1)), KEY_ERROR, line,
+                      {});
 
-    // Enter then block
-    builder->CreateCondBr(builder->CreateICmpNE(keyExists, builder->getInt32(-1)), thenBlock, mergeBlock);
-    builder->SetInsertPoint(thenBlock);
     // Index the value array
-
     llvm::Value *valuePtr = builder->CreateExtractValue(mapArg, 1);
     llvm::Value *loadedValuePtr = builder->CreateLoad(llvmCompiler->internalStructs["array"], valuePtr);
     llvm::Value *extractedArray = builder->CreateExtractValue(loadedValuePtr, 0);
 
-    llvm::Value *value = builder->CreateInBoundsGEP(builder->getInt32Ty(), extractedArray, keyExists);
+    // Values are stored at their own size, the caller knows what that is
+    llvm::Value *value =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), extractedArray, getByteSize(builder, keyExists, valueSize));
     builder->CreateRet(value);
 
+    return function;
+}
+
+llvm::Value *getStringData(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *stringPtr) {
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(stringType, stringPtr, 0));
+    llvm::Value *smallData = builder->CreateStructGEP(stringType, stringPtr, 3);
+    return builder->CreateSelect(builder->CreateIsNull(data), smallData, data);
+}
+
+// The inline buffer is unused when the contents are on the heap, the first byte then marks data that isn't owned by
+// the string (literals and interned strings) and has to be copied before it's written to
+llvm::Value *getStringSharedFlag(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *stringPtr) {
+    return builder->CreateStructGEP(llvmCompiler->internalStructs["string"], stringPtr, 3);
+}
+
+// Str and array sizes are i64 while the other counts are i32, a count times the item size is always widened since byte
+// sizes are size_t like the libc calls take
+llvm::Value *getByteSize(llvm::IRBuilder<> *builder, llvm::Value *count, llvm::Value *itemSize) {
+    llvm::Value *size = builder->CreateZExtOrTrunc(count, builder->getInt64Ty());
+    if (itemSize != nullptr) {
+        size = builder->CreateMul(size, builder->CreateZExtOrTrunc(itemSize, builder->getInt64Ty()));
+    }
+    return size;
+}
+
+// Heap strings keep the pointer to their reference count in the inline buffer after the shared flag, the buffer
+// starts 4 bytes short of an 8 byte boundary
+static llvm::Value *getStringRefs(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *stringPtr) {
+    return builder->CreateInBoundsGEP(builder->getInt8Ty(), getStringSharedFlag(llvmCompiler, builder, stringPtr),
+                                      builder->getInt32(4));
+}
+
+static void initHeapString(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *stringPtr) {
+    builder->CreateStore(builder->getInt8(0), getStringSharedFlag(llvmCompiler, builder, stringPtr));
+    builder->CreateStore(llvm::Constant::getNullValue(builder->getPtrTy()),
+                         getStringRefs(llvmCompiler, builder, stringPtr));
+}
+
+// The count of a shared buffer sits next to where the whole buffer starts and its size, slices point into the buffer
+// and share its count so whichever owner is last frees all of it
+llvm::StructType *getRefsType(llvm::IRBuilder<> *builder) {
+    return llvm::StructType::get(builder->getInt32Ty(), builder->getInt64Ty(), builder->getPtrTy());
+}
+
+// A null reference count means the buffer has a single owner, sharing it allocates a count starting at 2
+static void addReference(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Function *function,
+                         llvm::Value *refsPtr, llvm::Value *data, llvm::Value *size) {
+    llvm::BasicBlock *newBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "new", function);
+    llvm::BasicBlock *incrementBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "increment", function);
+    llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+
+    llvm::Value *refs = builder->CreateLoad(builder->getPtrTy(), refsPtr);
+    builder->CreateCondBr(builder->CreateIsNull(refs), newBlock, incrementBlock);
+
+    builder->SetInsertPoint(newBlock);
+    llvm::StructType *refsType = getRefsType(builder);
+    uint64_t refsSize = llvmCompiler->module->getDataLayout().getTypeAllocSize(refsType);
+    llvm::Value *newRefs = builder->CreateCall(llvmCompiler->libraryFuncs["malloc"], {builder->getInt64(refsSize)});
+    builder->CreateStore(builder->getInt32(2), newRefs);
+    builder->CreateStore(size, builder->CreateStructGEP(refsType, newRefs, 1));
+    builder->CreateStore(data, builder->CreateStructGEP(refsType, newRefs, 2));
+    builder->CreateStore(newRefs, refsPtr);
+    builder->CreateBr(mergeBlock);
+
+    builder->SetInsertPoint(incrementBlock);
+    builder->CreateStore(builder->CreateAdd(builder->CreateLoad(builder->getInt32Ty(), refs), builder->getInt32(1)),
+                         refs);
+    builder->CreateBr(mergeBlock);
+
     builder->SetInsertPoint(mergeBlock);
-    llvm::Value *exitStr = builder->CreateGlobalString("Key didn't exist\n");
-    builder->CreateCall(llvmCompiler->libraryFuncs["printf"], {exitStr});
-    builder->CreateCall(llvmCompiler->libraryFuncs["exit"], {builder->getInt32(1)});
-    builder->CreateUnreachable();
+}
+
+// Leaves the builder in a block that runs if the buffer is shared with another owner or the header only sees part of
+// it. The caller copies what it sees there, drops its old reference and branches to the returned block, which runs in
+// every case
+static llvm::BasicBlock *releaseSharedReference(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder,
+                                                llvm::Function *function, llvm::Value *refsPtr, llvm::Value *data,
+                                                llvm::Value *size) {
+    llvm::BasicBlock *countedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "counted", function);
+    llvm::BasicBlock *copyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "copy", function);
+    llvm::BasicBlock *lastBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "last", function);
+    llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+
+    llvm::Value *refs = builder->CreateLoad(builder->getPtrTy(), refsPtr);
+    builder->CreateCondBr(builder->CreateIsNull(refs), mergeBlock, countedBlock);
+
+    builder->SetInsertPoint(countedBlock);
+    llvm::StructType *refsType = getRefsType(builder);
+    llvm::Value *count = builder->CreateLoad(builder->getInt32Ty(), refs);
+    llvm::Value *base = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(refsType, refs, 2));
+    llvm::Value *total = builder->CreateLoad(builder->getInt64Ty(), builder->CreateStructGEP(refsType, refs, 1));
+    llvm::Value *whole = builder->CreateAnd(builder->CreateICmpEQ(base, data), builder->CreateICmpEQ(total, size));
+    builder->CreateCondBr(builder->CreateAnd(builder->CreateICmpEQ(count, builder->getInt32(1)), whole), lastBlock,
+                          copyBlock);
+
+    // Every other owner already made its own copy
+    builder->SetInsertPoint(lastBlock);
+    builder->CreateCall(llvmCompiler->libraryFuncs["free"], {refs});
+    builder->CreateStore(llvm::Constant::getNullValue(builder->getPtrTy()), refsPtr);
+    builder->CreateBr(mergeBlock);
+
+    builder->SetInsertPoint(copyBlock);
+    return mergeBlock;
+}
+
+static llvm::Value *getStringSize(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *stringPtr) {
+    return builder->CreateLoad(builder->getInt64Ty(),
+                               builder->CreateStructGEP(llvmCompiler->internalStructs["string"], stringPtr, 1));
+}
+
+// The contents of a small string live in the header, so it needs an address before the data can be read
+static llvm::Value *spillString(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *str) {
+    llvm::AllocaInst *stringInstance = builder->CreateAlloca(llvmCompiler->internalStructs["string"], nullptr);
+    builder->CreateStore(str, stringInstance);
+    return stringInstance;
+}
+
+// Points the string at its inline buffer if the size fits, otherwise at a new heap buffer.
+// Returns where the contents should be written, the caller writes the terminator
+static llvm::Value *allocateStringData(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder,
+                                       llvm::Function *function, llvm::Value *stringPtr, llvm::Value *size) {
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+    llvm::BasicBlock *smallBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "small", function);
+    llvm::BasicBlock *heapBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "heap", function);
+    llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+
+    llvm::Value *dataPtr = builder->CreateStructGEP(stringType, stringPtr, 0);
+    builder->CreateCondBr(builder->CreateICmpSLE(size, builder->getInt64(SMALL_STRING_SIZE)), smallBlock, heapBlock);
+
+    builder->SetInsertPoint(smallBlock);
+    builder->CreateStore(llvm::Constant::getNullValue(builder->getPtrTy()), dataPtr);
+    builder->CreateBr(mergeBlock);
+
+    builder->SetInsertPoint(heapBlock);
+    llvm::Value *heapData = builder->CreateCall(llvmCompiler->internalFuncs["allocate"],
+                                                {builder->CreateAdd(getByteSize(builder, size), builder->getInt64(1))});
+    builder->CreateStore(heapData, dataPtr);
+    initHeapString(llvmCompiler, builder, stringPtr);
+    builder->CreateBr(mergeBlock);
+
+    builder->SetInsertPoint(mergeBlock);
+    builder->CreateStore(size, builder->CreateStructGEP(stringType, stringPtr, 1));
+    builder->CreateStore(builder->getInt32(0), builder->CreateStructGEP(stringType, stringPtr, 2));
+    return getStringData(llvmCompiler, builder, stringPtr);
+}
+
+static llvm::Function *createNewString(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmCompiler->internalStructs["string"], {llvmBuilder->getPtrTy(), llvmBuilder->getInt64Ty()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "newString", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *source = arg++;
+    llvm::Value *size = arg;
+
+    llvm::AllocaInst *newString = builder->CreateAlloca(llvmCompiler->internalStructs["string"], nullptr);
+    llvm::Value *newStringData = allocateStringData(llvmCompiler, builder, function, newString, size);
+    builder->CreateMemCpy(newStringData, llvm::MaybeAlign(1), source, llvm::MaybeAlign(1), size);
+    builder->CreateStore(builder->getInt8(0), builder->CreateInBoundsGEP(builder->getInt8Ty(), newStringData, size));
+    builder->CreateRet(builder->CreateLoad(llvmCompiler->internalStructs["string"], newString));
+
+    return function;
+}
+
+static llvm::Function *createConcatStrings(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmCompiler->internalStructs["string"], {llvmBuilder->getPtrTy(), llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "concatStrings", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *left = arg++;
+    llvm::Value *right = arg;
+
+    llvm::Value *leftSize = getStringSize(llvmCompiler, builder, left);
+    llvm::Value *rightSize = getStringSize(llvmCompiler, builder, right);
+    llvm::Value *newSize = builder->CreateAdd(leftSize, rightSize);
+
+    llvm::AllocaInst *newString = builder->CreateAlloca(llvmCompiler->internalStructs["string"], nullptr);
+    llvm::Value *newStringData = allocateStringData(llvmCompiler, builder, function, newString, newSize);
+
+    builder->CreateMemCpy(newStringData, llvm::MaybeAlign(1), getStringData(llvmCompiler, builder, left),
+                          llvm::MaybeAlign(1), leftSize);
+    llvm::Value *rightData = builder->CreateInBoundsGEP(builder->getInt8Ty(), newStringData, leftSize);
+    builder->CreateMemCpy(rightData, llvm::MaybeAlign(1), getStringData(llvmCompiler, builder, right),
+                          llvm::MaybeAlign(1), rightSize);
+    builder->CreateStore(builder->getInt8(0), builder->CreateInBoundsGEP(builder->getInt8Ty(), newStringData, newSize));
+    builder->CreateRet(builder->CreateLoad(llvmCompiler->internalStructs["string"], newString));
+
+    return function;
+}
+
+// Strings carry their length and aren't guaranteed to be NUL terminated, returns a terminated copy the caller releases
+// once it's done with it
+static llvm::Function *createCString(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getPtrTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "cString", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *str = function->arg_begin();
+    llvm::Value *strPtr = getStringData(llvmCompiler, builder, str);
+    llvm::Value *strSize = getStringSize(llvmCompiler, builder, str);
+
+    llvm::Value *newStringSize = builder->CreateAdd(getByteSize(builder, strSize), builder->getInt64(1));
+    llvm::Value *newStringPtr = builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {newStringSize});
+    builder->CreateMemCpy(newStringPtr, llvm::MaybeAlign(1), strPtr, llvm::MaybeAlign(1), strSize);
+    builder->CreateStore(builder->getInt8(0), builder->CreateInBoundsGEP(builder->getInt8Ty(), newStringPtr, strSize));
+    builder->CreateRet(newStringPtr);
 
     return function;
 }
@@ -46,18 +565,18 @@ static llvm::Function *createReadFile(LLVMCompiler *llvmCompiler, llvm::IRBuilde
     // allocate "r" string
 
     llvm::FunctionType *funcType =
-        llvm::FunctionType::get(llvmCompiler->internalStructs["array"], {llvmBuilder->getPtrTy()}, false);
+        llvm::FunctionType::get(llvmCompiler->internalStructs["string"], {llvmBuilder->getPtrTy()}, false);
     llvm::Function *function =
         llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "readFile", *llvmCompiler->module);
     llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
     llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
 
     llvm::Value *arg = function->arg_begin();
-    llvm::Value *loadedArg = builder->CreateLoad(llvmCompiler->internalStructs["array"], arg);
-    llvm::Value *strPtr = builder->CreateExtractValue(loadedArg, 0);
+    llvm::Value *strPtr = builder->CreateCall(llvmCompiler->internalFuncs["cString"], {arg});
 
     llvm::Value *openedFilePtr =
         builder->CreateCall(llvmCompiler->libraryFuncs["fopen"], {strPtr, builder->CreateGlobalStringPtr("r")});
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {strPtr});
 
     llvm::Value *filePtrCmp = builder->CreateICmpEQ(openedFilePtr, llvm::Constant::getNullValue(builder->getPtrTy()));
 
@@ -73,28 +592,30 @@ static llvm::Function *createReadFile(LLVMCompiler *llvmCompiler, llvm::IRBuilde
 
     builder->SetInsertPoint(mergeBlock);
     builder->CreateCall(llvmCompiler->libraryFuncs["fseek"],
-                        {openedFilePtr, builder->getInt32(0), builder->getInt32(2)});
+                        {openedFilePtr, builder->getInt64(0), builder->getInt32(2)});
     llvm::Value *fileSize = builder->CreateCall(llvmCompiler->libraryFuncs["ftell"], {openedFilePtr});
     builder->CreateCall(llvmCompiler->libraryFuncs["fseek"],
-                        {openedFilePtr, builder->getInt32(0), builder->getInt32(0)});
+                        {openedFilePtr, builder->getInt64(0), builder->getInt32(0)});
 
-    llvm::Value *newStringPtr =
-        builder->CreateCall(llvmCompiler->libraryFuncs["malloc"], {fileSize});
+    // Keep a terminator after the content so printing it doesn't need a copy
+    llvm::Value *newStringPtr = builder->CreateCall(llvmCompiler->internalFuncs["allocate"],
+                                                    {builder->CreateAdd(fileSize, builder->getInt64(1))});
     builder->CreateCall(llvmCompiler->libraryFuncs["fread"],
-                        {newStringPtr, builder->getInt32(1), fileSize, openedFilePtr});
-    llvm::Value *newStringPtrGep = builder->CreateInBoundsGEP(builder->getInt8Ty(), newStringPtr, builder->CreateSub(fileSize, builder->getInt32(1)));
+                        {newStringPtr, builder->getInt64(1), fileSize, openedFilePtr});
+    llvm::Value *newStringPtrGep = builder->CreateInBoundsGEP(builder->getInt8Ty(), newStringPtr, fileSize);
     builder->CreateStore(builder->getInt8(0), newStringPtrGep);
 
     builder->CreateCall(llvmCompiler->libraryFuncs["fclose"], {openedFilePtr});
 
-    llvm::AllocaInst *newString = builder->CreateAlloca(llvmCompiler->internalStructs["array"], nullptr);
-    llvm::Value *loadedAllocatedString = builder->CreateLoad(llvmCompiler->internalStructs["array"], newString);
+    // Files are rarely small enough to be stored inline, hand over the buffer as is
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+    llvm::AllocaInst *newString = builder->CreateAlloca(stringType, nullptr);
+    builder->CreateStore(newStringPtr, builder->CreateStructGEP(stringType, newString, 0));
+    builder->CreateStore(fileSize, builder->CreateStructGEP(stringType, newString, 1));
+    builder->CreateStore(builder->getInt32(0), builder->CreateStructGEP(stringType, newString, 2));
+    initHeapString(llvmCompiler, builder, newString);
 
-    llvm::Value *newStringAfterInsertedStringPtr = builder->CreateInsertValue(loadedAllocatedString, newStringPtr, 0);
-    llvm::Value *newStringAfterInsertedStringSize =
-        builder->CreateInsertValue(newStringAfterInsertedStringPtr, fileSize, 1);
-
-    builder->CreateRet(newStringAfterInsertedStringSize);
+    builder->CreateRet(builder->CreateLoad(stringType, newString));
 
     return function;
 }
@@ -132,7 +653,7 @@ static llvm::Function *createGetValues(LLVMCompiler *llvmCompiler, llvm::IRBuild
 }
 
 static llvm::Function *createLen(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
-    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getInt32Ty(), {llvmBuilder->getPtrTy()}, false);
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getInt64Ty(), {llvmBuilder->getPtrTy()}, false);
     llvm::Function *function =
         llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "len", *llvmCompiler->module);
     llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
@@ -148,7 +669,9 @@ static llvm::Function *createLen(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *
 static llvm::Function *createIndexIntMap(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
     // Fix func type
     llvm::FunctionType *funcType = llvm::FunctionType::get(
-        llvmBuilder->getPtrTy(), {llvmCompiler->internalStructs["map"], llvm::Type::getInt32Ty(*llvmCompiler->ctx)},
+        llvmBuilder->getPtrTy(),
+        {llvmCompiler->internalStructs["map"], llvmBuilder->getInt32Ty(), llvmBuilder->getInt32Ty(),
+         llvmBuilder->getInt32Ty()},
         false);
     llvm::Function *function =
         llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "indexIntMap", *llvmCompiler->module);
@@ -157,34 +680,28 @@ static llvm::Function *createIndexIntMap(LLVMCompiler *llvmCompiler, llvm::IRBui
 
     llvm::Function::arg_iterator arg = function->arg_begin();
     llvm::Value *mapArg = arg++;
-    llvm::Value *keyArg = arg;
+    llvm::Value *keyArg = arg++;
+    llvm::Value *valueSize = arg++;
+    llvm::Value *line = arg;
 
     llvm::Value *keyPtr = builder->CreateExtractValue(mapArg, 0);
     llvm::Value *loadedKeyArray = builder->CreateLoad(llvmCompiler->internalStructs["array"], keyPtr);
 
     llvm::Value *keyExists = builder->CreateCall(llvmCompiler->internalFuncs["findIntKey"], {loadedKeyArray, keyArg});
 
-    llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", function);
-    llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+    checkRuntimeError(llvmCompiler, builder, builder->CreateICmpEQ(keyExists, builder->getInt64(-1)), KEY_ERROR, line,
+                      {});
 
-    // Enter then block
-    builder->CreateCondBr(builder->CreateICmpNE(keyExists, builder->getInt32(-1)), thenBlock, mergeBlock);
-    builder->SetInsertPoint(thenBlock);
     // Index the value array
-
     llvm::Value *valuePtr = builder->CreateExtractValue(mapArg, 1);
     llvm::Value *loadedValuePtr = builder->CreateLoad(llvmCompiler->internalStructs["array"], valuePtr);
     llvm::Value *extractedArray = builder->CreateExtractValue(loadedValuePtr, 0);
 
-    llvm::Value *value = builder->CreateInBoundsGEP(builder->getInt32Ty(), extractedArray, keyExists);
+    // Values are stored at their own size, the caller knows what that is
+    llvm::Value *value =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), extractedArray, getByteSize(builder, keyExists, valueSize));
     builder->CreateRet(value);
 
-    builder->SetInsertPoint(mergeBlock);
-    llvm::Value *exitStr = builder->CreateGlobalString("Key didn't exist\n");
-    builder->CreateCall(llvmCompiler->libraryFuncs["printf"], {exitStr});
-    builder->CreateCall(llvmCompiler->libraryFuncs["exit"], {builder->getInt32(1)});
-    builder->CreateUnreachable();
-
     return function;
 }
 
@@ -192,8 +709,8 @@ static llvm::Function *createFindStrKey(LLVMCompiler *llvmCompiler) {
 
     // Fix func type
     llvm::FunctionType *funcType = llvm::FunctionType::get(
-        llvm::Type::getInt32Ty(*llvmCompiler->ctx),
-        {llvmCompiler->internalStructs["array"], llvmCompiler->internalStructs["array"]}, false);
+        llvm::Type::getInt64Ty(*llvmCompiler->ctx),
+        {llvmCompiler->internalStructs["array"], llvm::PointerType::getUnqual(*llvmCompiler->ctx)}, false);
     llvm::Function *function =
         llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "findStrKey", *llvmCompiler->module);
     llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
@@ -205,8 +722,8 @@ static llvm::Function *createFindStrKey(LLVMCompiler *llvmCompiler) {
 
     llvm::Value *key = arg;
 
-    llvm::AllocaInst *loopVariable = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
-    builder->CreateStore(builder->getInt32(0), loopVariable);
+    llvm::AllocaInst *loopVariable = builder->CreateAlloca(builder->getInt64Ty(), nullptr);
+    builder->CreateStore(builder->getInt64(0), loopVariable);
 
     llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
     llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", function);
@@ -214,47 +731,34 @@ static llvm::Function *createFindStrKey(LLVMCompiler *llvmCompiler) {
 
     builder->CreateBr(headerBlock);
     builder->SetInsertPoint(headerBlock);
-    builder->CreateCondBr(builder->CreateICmpSLT(builder->CreateLoad(builder->getInt32Ty(), loopVariable), arraySize),
+    builder->CreateCondBr(builder->CreateICmpSLT(builder->CreateLoad(builder->getInt64Ty(), loopVariable), arraySize),
                           bodyBlock, exitBlock);
     builder->SetInsertPoint(bodyBlock);
 
     // Index the key array
-    llvm::Value *loadedLoopVariable = builder->CreateLoad(builder->getInt32Ty(), loopVariable);
+    llvm::Value *loadedLoopVariable = builder->CreateLoad(builder->getInt64Ty(), loopVariable);
     llvm::Value *index = builder->CreateInBoundsGEP(builder->getPtrTy(), arrayPtr, loadedLoopVariable);
     llvm::Value *loadedKeyPtr = builder->CreateLoad(builder->getPtrTy(), index);
-    llvm::Value *loadedKey = builder->CreateLoad(llvmCompiler->internalStructs["array"], loadedKeyPtr);
 
     llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", function);
     llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
 
     // Enter then block
-    // This should be strcmp
-    llvm::Value *key1Length = builder->CreateExtractValue(loadedKey, 1);
-    llvm::Value *key2Length = builder->CreateExtractValue(key, 1);
-
-    builder->CreateCondBr(builder->CreateICmpEQ(key1Length, key2Length), thenBlock, mergeBlock);
+    llvm::Value *isEqual = builder->CreateCall(llvmCompiler->internalFuncs["strEquals"], {loadedKeyPtr, key});
+    builder->CreateCondBr(isEqual, thenBlock, mergeBlock);
     builder->SetInsertPoint(thenBlock);
 
-    llvm::BasicBlock *strCmpThenBlock1 = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", function);
-
-    llvm::Value *key1StrPtr = builder->CreateExtractValue(loadedKey, 0);
-    llvm::Value *key2StrPtr = builder->CreateExtractValue(key, 0);
-    llvm::Value *memcmpValue =
-        builder->CreateCall(llvmCompiler->libraryFuncs["memcmp"], {key1StrPtr, key2StrPtr, key1Length});
-    builder->CreateCondBr(builder->CreateICmpEQ(memcmpValue, builder->getInt32(0)), strCmpThenBlock1, mergeBlock);
-    builder->SetInsertPoint(strCmpThenBlock1);
-
     // Return the index of the key
     builder->CreateRet(loadedLoopVariable);
 
     builder->SetInsertPoint(mergeBlock);
     llvm::Value *newLoopVariable =
-        builder->CreateAdd(builder->CreateLoad(builder->getInt32Ty(), loopVariable), builder->getInt32(1));
+        builder->CreateAdd(builder->CreateLoad(builder->getInt64Ty(), loopVariable), builder->getInt64(1));
     builder->CreateStore(newLoopVariable, loopVariable);
     builder->CreateBr(headerBlock);
 
     builder->SetInsertPoint(exitBlock);
-    builder->CreateRet(builder->getInt32(-1));
+    builder->CreateRet(builder->getInt64(-1));
 
     return function;
 }
@@ -263,7 +767,7 @@ static llvm::Function *createFindIntKey(LLVMCompiler *llvmCompiler) {
 
     // Fix func type
     llvm::FunctionType *funcType = llvm::FunctionType::get(
-        llvm::Type::getInt32Ty(*llvmCompiler->ctx),
+        llvm::Type::getInt64Ty(*llvmCompiler->ctx),
         {llvmCompiler->internalStructs["array"], llvm::Type::getInt32Ty(*llvmCompiler->ctx)}, false);
     llvm::Function *function =
         llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "findIntKey", *llvmCompiler->module);
@@ -277,8 +781,8 @@ static llvm::Function *createFindIntKey(LLVMCompiler *llvmCompiler) {
 
     llvm::Value *key = arg;
 
-    llvm::AllocaInst *loopVariable = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
-    builder->CreateStore(builder->getInt32(0), loopVariable);
+    llvm::AllocaInst *loopVariable = builder->CreateAlloca(builder->getInt64Ty(), nullptr);
+    builder->CreateStore(builder->getInt64(0), loopVariable);
 
     llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
     llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", function);
@@ -286,12 +790,12 @@ static llvm::Function *createFindIntKey(LLVMCompiler *llvmCompiler) {
 
     builder->CreateBr(headerBlock);
     builder->SetInsertPoint(headerBlock);
-    builder->CreateCondBr(builder->CreateICmpSLE(builder->CreateLoad(builder->getInt32Ty(), loopVariable), arraySize),
+    builder->CreateCondBr(builder->CreateICmpSLT(builder->CreateLoad(builder->getInt64Ty(), loopVariable), arraySize),
                           bodyBlock, exitBlock);
     builder->SetInsertPoint(bodyBlock);
 
     // Index the key array
-    llvm::Value *loadedLoopVariable = builder->CreateLoad(builder->getInt32Ty(), loopVariable);
+    llvm::Value *loadedLoopVariable = builder->CreateLoad(builder->getInt64Ty(), loopVariable);
     llvm::Value *index = builder->CreateInBoundsGEP(builder->getInt32Ty(), arrayPtr, loadedLoopVariable);
     llvm::Value *loadedKey = builder->CreateLoad(builder->getInt32Ty(), index);
 
@@ -305,12 +809,12 @@ static llvm::Function *createFindIntKey(LLVMCompiler *llvmCompiler) {
 
     builder->SetInsertPoint(mergeBlock);
     llvm::Value *newLoopVariable =
-        builder->CreateAdd(builder->CreateLoad(builder->getInt32Ty(), loopVariable), builder->getInt32(1));
+        builder->CreateAdd(builder->CreateLoad(builder->getInt64Ty(), loopVariable), builder->getInt64(1));
     builder->CreateStore(newLoopVariable, loopVariable);
     builder->CreateBr(headerBlock);
 
     builder->SetInsertPoint(exitBlock);
-    builder->CreateRet(builder->getInt32(-1));
+    builder->CreateRet(builder->getInt64(-1));
 
     return function;
 }
@@ -333,7 +837,7 @@ static llvm::Function *createIntKeyExists(LLVMCompiler *llvmCompiler, llvm::IRBu
 
     llvm::Value *keyExists = builder->CreateCall(llvmCompiler->internalFuncs["findIntKey"], {keys, key});
 
-    llvm::Value *cmp = builder->CreateICmpEQ(keyExists, builder->getInt32(-1));
+    llvm::Value *cmp = builder->CreateICmpEQ(keyExists, builder->getInt64(-1));
     llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", function);
     llvm::BasicBlock *elseBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "else", function);
 
@@ -357,15 +861,14 @@ static llvm::Function *createStrKeyExists(LLVMCompiler *llvmCompiler, llvm::IRBu
     llvm::Function::arg_iterator arg = function->arg_begin();
     llvm::Value *mapPtr = arg++;
     llvm::Value *map = builder->CreateLoad(llvmCompiler->internalStructs["map"], mapPtr);
-    llvm::Value *keyPtr = arg;
-    llvm::Value *key = builder->CreateLoad(llvmCompiler->internalStructs["array"], keyPtr);
+    llvm::Value *key = arg;
 
     llvm::Value *keysPtr = builder->CreateExtractValue(map, 0);
     llvm::Value *keys = builder->CreateLoad(llvmCompiler->internalStructs["array"], keysPtr);
 
     llvm::Value *keyExists = builder->CreateCall(llvmCompiler->internalFuncs["findStrKey"], {keys, key});
 
-    llvm::Value *cmp = builder->CreateICmpEQ(keyExists, builder->getInt32(-1));
+    llvm::Value *cmp = builder->CreateICmpEQ(keyExists, builder->getInt64(-1));
     llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", function);
     llvm::BasicBlock *elseBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "else", function);
 
@@ -379,71 +882,1761 @@ static llvm::Function *createStrKeyExists(LLVMCompiler *llvmCompiler, llvm::IRBu
     return function;
 }
 
-void addInternalFuncs(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+static llvm::Function *createHashInt(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getInt32Ty(), {llvmBuilder->getInt32Ty()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "hashInt", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
 
-    llvmCompiler->internalFuncs = {};
-    llvmCompiler->internalFuncs["findStrKey"] = createFindStrKey(llvmCompiler);
-    llvmCompiler->internalFuncs["indexStrMap"] = createIndexStrMap(llvmCompiler, llvmBuilder);
-    llvmCompiler->internalFuncs["findIntKey"] = createFindIntKey(llvmCompiler);
-    llvmCompiler->internalFuncs["indexIntMap"] = createIndexIntMap(llvmCompiler, llvmBuilder);
-    llvmCompiler->internalFuncs["strKeyExists"] = createStrKeyExists(llvmCompiler, llvmBuilder);
-    llvmCompiler->internalFuncs["intKeyExists"] = createIntKeyExists(llvmCompiler, llvmBuilder);
-    llvmCompiler->internalFuncs["len"] = createLen(llvmCompiler, llvmBuilder);
-    llvmCompiler->internalFuncs["keys"] = createGetKeys(llvmCompiler, llvmBuilder);
-    llvmCompiler->internalFuncs["values"] = createGetValues(llvmCompiler, llvmBuilder);
-    llvmCompiler->internalFuncs["readfile"] = createReadFile(llvmCompiler, llvmBuilder);
+    // Fibonacci hashing, fold the high bits down since the slot is picked with a mask
+    llvm::Value *hash = builder->CreateMul(function->arg_begin(), builder->getInt32(0x9E3779B1));
+    hash = builder->CreateXor(hash, builder->CreateLShr(hash, 16));
+    builder->CreateRet(hash);
+
+    return function;
 }
 
-void addLibraryFuncs(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder) {
-    llvmCompiler->libraryFuncs = {};
+static llvm::Function *createHashStr(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getInt32Ty(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "hashStr", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
 
-    std::vector<llvm::Type *> args = {builder->getPtrTy()};
-    llvm::FunctionType *type = llvm::FunctionType::get(builder->getVoidTy(), args, true);
-    llvm::FunctionCallee func = llvmCompiler->module->getOrInsertFunction("printf", type);
-    llvmCompiler->libraryFuncs["printf"] = func;
+    llvm::Value *str = function->arg_begin();
+    llvm::Value *hashPtr = builder->CreateStructGEP(llvmCompiler->internalStructs["string"], str, 2);
+    llvm::Value *cachedHash = builder->CreateLoad(builder->getInt32Ty(), hashPtr);
 
-    args = {builder->getPtrTy(), builder->getPtrTy()};
-    type = llvm::FunctionType::get(builder->getPtrTy(), args, true);
-    func = llvmCompiler->module->getOrInsertFunction("strcat", type);
-    llvmCompiler->libraryFuncs["strcat"] = func;
+    llvm::BasicBlock *cachedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "cached", function);
+    llvm::BasicBlock *computeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "compute", function);
+    builder->CreateCondBr(builder->CreateICmpNE(cachedHash, builder->getInt32(0)), cachedBlock, computeBlock);
 
-    args = {builder->getInt32Ty()};
-    type = llvm::FunctionType::get(builder->getPtrTy(), args, true);
-    func = llvmCompiler->module->getOrInsertFunction("malloc", type);
-    llvmCompiler->libraryFuncs["malloc"] = func;
+    builder->SetInsertPoint(cachedBlock);
+    builder->CreateRet(cachedHash);
 
-    args = {builder->getPtrTy(), builder->getInt32Ty()};
-    type = llvm::FunctionType::get(builder->getPtrTy(), args, true);
-    func = llvmCompiler->module->getOrInsertFunction("realloc", type);
-    llvmCompiler->libraryFuncs["realloc"] = func;
+    builder->SetInsertPoint(computeBlock);
+    llvm::Value *strPtr = getStringData(llvmCompiler, builder, str);
+    llvm::Value *strSize = getStringSize(llvmCompiler, builder, str);
 
-    args = {builder->getPtrTy(), builder->getPtrTy(), builder->getInt32Ty()};
-    type = llvm::FunctionType::get(builder->getInt32Ty(), args, true);
-    func = llvmCompiler->module->getOrInsertFunction("memcmp", type);
-    llvmCompiler->libraryFuncs["memcmp"] = func;
+    // FNV-1a
+    llvm::AllocaInst *hash = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
+    builder->CreateStore(builder->getInt32(0x811C9DC5), hash);
+    llvm::AllocaInst *loopVariable = builder->CreateAlloca(builder->getInt64Ty(), nullptr);
+    builder->CreateStore(builder->getInt64(0), loopVariable);
 
-    args = {builder->getInt32Ty()};
-    type = llvm::FunctionType::get(builder->getVoidTy(), args, true);
-    func = llvmCompiler->module->getOrInsertFunction("exit", type);
-    llvmCompiler->libraryFuncs["exit"] = func;
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
+    llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
 
-    args = {builder->getPtrTy(), builder->getPtrTy()};
-    type = llvm::FunctionType::get(builder->getPtrTy(), args, true);
-    func = llvmCompiler->module->getOrInsertFunction("fopen", type);
-    llvmCompiler->libraryFuncs["fopen"] = func;
+    builder->CreateBr(headerBlock);
+    builder->SetInsertPoint(headerBlock);
+    builder->CreateCondBr(builder->CreateICmpSLT(builder->CreateLoad(builder->getInt64Ty(), loopVariable), strSize),
+                          bodyBlock, exitBlock);
 
-    args = {builder->getPtrTy(), builder->getInt32Ty(), builder->getInt32Ty()};
-    type = llvm::FunctionType::get(builder->getInt32Ty(), args, true);
-    func = llvmCompiler->module->getOrInsertFunction("fseek", type);
-    llvmCompiler->libraryFuncs["fseek"] = func;
+    builder->SetInsertPoint(bodyBlock);
+    llvm::Value *loadedLoopVariable = builder->CreateLoad(builder->getInt64Ty(), loopVariable);
+    llvm::Value *charPtr = builder->CreateInBoundsGEP(builder->getInt8Ty(), strPtr, loadedLoopVariable);
+    llvm::Value *loadedChar =
+        builder->CreateZExt(builder->CreateLoad(builder->getInt8Ty(), charPtr), builder->getInt32Ty());
+    llvm::Value *newHash = builder->CreateXor(builder->CreateLoad(builder->getInt32Ty(), hash), loadedChar);
+    builder->CreateStore(builder->CreateMul(newHash, builder->getInt32(0x01000193)), hash);
+    builder->CreateStore(builder->CreateAdd(loadedLoopVariable, builder->getInt64(1)), loopVariable);
+    builder->CreateBr(headerBlock);
 
-    args = {builder->getPtrTy()};
-    type = llvm::FunctionType::get(builder->getInt32Ty(), args, true);
-    func = llvmCompiler->module->getOrInsertFunction("ftell", type);
-    llvmCompiler->libraryFuncs["ftell"] = func;
+    // 0 is reserved for a missing hash, matches hashStringLiteral
+    builder->SetInsertPoint(exitBlock);
+    llvm::Value *loadedHash = builder->CreateLoad(builder->getInt32Ty(), hash);
+    loadedHash = builder->CreateSelect(builder->CreateICmpEQ(loadedHash, builder->getInt32(0)), builder->getInt32(1),
+                                       loadedHash);
+    builder->CreateStore(loadedHash, hashPtr);
+    builder->CreateRet(loadedHash);
 
-    args = {builder->getPtrTy(), builder->getInt32Ty(), builder->getInt32Ty(), builder->getPtrTy()};
+    return function;
+}
+
+static llvm::Function *createStrEquals(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getInt1Ty(), {llvmBuilder->getPtrTy(), llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "strEquals", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *left = arg++;
+    llvm::Value *right = arg;
+
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+    llvm::BasicBlock *hashBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "hash", function);
+    llvm::BasicBlock *dataBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "data", function);
+    llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", function);
+    llvm::BasicBlock *equalBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "equal", function);
+    llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+
+    llvm::Value *leftSize = getStringSize(llvmCompiler, builder, left);
+    builder->CreateCondBr(builder->CreateICmpEQ(leftSize, getStringSize(llvmCompiler, builder, right)), hashBlock,
+                          mergeBlock);
+
+    // Two cached hashes that differ can't be the same string
+    builder->SetInsertPoint(hashBlock);
+    llvm::Value *leftHash = builder->CreateLoad(builder->getInt32Ty(), builder->CreateStructGEP(stringType, left, 2));
+    llvm::Value *rightHash = builder->CreateLoad(builder->getInt32Ty(), builder->CreateStructGEP(stringType, right, 2));
+    llvm::Value *bothCached = builder->CreateAnd(builder->CreateICmpNE(leftHash, builder->getInt32(0)),
+                                                 builder->CreateICmpNE(rightHash, builder->getInt32(0)));
+    builder->CreateCondBr(builder->CreateAnd(bothCached, builder->CreateICmpNE(leftHash, rightHash)), mergeBlock,
+                          dataBlock);
+
+    // Interned strings share their heap data so they compare by pointer
+    builder->SetInsertPoint(dataBlock);
+    llvm::Value *leftData = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(stringType, left, 0));
+    llvm::Value *rightData = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(stringType, right, 0));
+    llvm::Value *sameData =
+        builder->CreateAnd(builder->CreateIsNotNull(leftData), builder->CreateICmpEQ(leftData, rightData));
+    builder->CreateCondBr(sameData, equalBlock, thenBlock);
+
+    builder->SetInsertPoint(equalBlock);
+    builder->CreateRet(builder->getInt1(1));
+
+    builder->SetInsertPoint(thenBlock);
+    llvm::Value *memcmpValue = builder->CreateCall(
+        llvmCompiler->libraryFuncs["memcmp"],
+        {getStringData(llvmCompiler, builder, left), getStringData(llvmCompiler, builder, right),
+         getByteSize(builder, leftSize)});
+    builder->CreateRet(builder->CreateICmpEQ(memcmpValue, builder->getInt32(0)));
+
+    builder->SetInsertPoint(mergeBlock);
+    builder->CreateRet(builder->getInt1(0));
+
+    return function;
+}
+
+// Gives the string its own copy of the data unless it's the only owner, used before the string is written to
+static llvm::Function *createUnshareString(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "unshareString", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *str = function->arg_begin();
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+    llvm::AllocaInst *previous = builder->CreateAlloca(stringType, nullptr);
+
+    llvm::BasicBlock *heapBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "heap", function);
+    llvm::BasicBlock *staticBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "static", function);
+    llvm::BasicBlock *ownedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "owned", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(stringType, str, 0));
+    builder->CreateCondBr(builder->CreateIsNull(data), exitBlock, heapBlock);
+
+    builder->SetInsertPoint(heapBlock);
+    llvm::Value *shared = builder->CreateLoad(builder->getInt8Ty(), getStringSharedFlag(llvmCompiler, builder, str));
+    builder->CreateCondBr(builder->CreateICmpNE(shared, builder->getInt8(0)), staticBlock, ownedBlock);
+
+    // Literals and interned strings are never written to, always copy them
+    builder->SetInsertPoint(staticBlock);
+    llvm::Value *size = getStringSize(llvmCompiler, builder, str);
+    builder->CreateStore(builder->CreateCall(llvmCompiler->internalFuncs["newString"], {data, size}), str);
+    builder->CreateBr(exitBlock);
+
+    builder->SetInsertPoint(ownedBlock);
+    size = getStringSize(llvmCompiler, builder, str);
+    llvm::BasicBlock *mergeBlock = releaseSharedReference(llvmCompiler, builder, function,
+                                                          getStringRefs(llvmCompiler, builder, str), data, size);
+    builder->CreateStore(builder->CreateLoad(stringType, str), previous);
+    builder->CreateStore(builder->CreateCall(llvmCompiler->internalFuncs["newString"], {data, size}), str);
+    builder->CreateCall(llvmCompiler->internalFuncs["dropString"], {previous});
+    builder->CreateBr(mergeBlock);
+    builder->SetInsertPoint(mergeBlock);
+    builder->CreateBr(exitBlock);
+
+    // The contents are about to change so the cached hash is stale
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateStore(builder->getInt32(0), builder->CreateStructGEP(stringType, str, 2));
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+// Copies the string header, heap data is shared with the source until either of them is written to
+static llvm::Function *createShareString(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "shareString", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *destination = arg++;
+    llvm::Value *source = arg;
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+
+    llvm::BasicBlock *heapBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "heap", function);
+    llvm::BasicBlock *ownedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "owned", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+
+    // Inline contents are copied along with the header and static data is copied on write anyway
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(stringType, source, 0));
+    builder->CreateCondBr(builder->CreateIsNull(data), exitBlock, heapBlock);
+
+    builder->SetInsertPoint(heapBlock);
+    llvm::Value *shared =
+        builder->CreateLoad(builder->getInt8Ty(), getStringSharedFlag(llvmCompiler, builder, source));
+    builder->CreateCondBr(builder->CreateICmpNE(shared, builder->getInt8(0)), exitBlock, ownedBlock);
+
+    builder->SetInsertPoint(ownedBlock);
+    addReference(llvmCompiler, builder, function, getStringRefs(llvmCompiler, builder, source), data,
+                 getStringSize(llvmCompiler, builder, source));
+    builder->CreateBr(exitBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateStore(builder->CreateLoad(stringType, source), destination);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+// Unsigned compares catch negative bounds as well, leaves the builder in the block where the bounds are valid
+static void checkSliceBounds(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *start,
+                             llvm::Value *end, llvm::Value *size, llvm::Value *line) {
+    llvm::Value *outOfBounds =
+        builder->CreateOr(builder->CreateICmpUGT(start, end), builder->CreateICmpUGT(end, size));
+    checkRuntimeError(llvmCompiler, builder, outOfBounds, SLICE_ERROR, line, {start, end, size});
+}
+
+// Heap contents are shared with the slice, which points into the source's buffer and holds a reference to it. Static
+// data is viewed and inline contents are copied
+static llvm::Function *createSliceString(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        stringType,
+        {llvmBuilder->getPtrTy(), llvmBuilder->getInt64Ty(), llvmBuilder->getInt64Ty(), llvmBuilder->getInt32Ty()},
+        false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "sliceString", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *source = arg++;
+    llvm::Value *start = arg++;
+    llvm::Value *end = arg++;
+    llvm::Value *line = arg;
+
+    checkSliceBounds(llvmCompiler, builder, start, end, getStringSize(llvmCompiler, builder, source), line);
+    llvm::Value *size = builder->CreateSub(end, start);
+    llvm::Value *startPtr =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), getStringData(llvmCompiler, builder, source), start);
+
+    llvm::BasicBlock *inlineBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "inline", function);
+    llvm::BasicBlock *heapBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "heap", function);
+    llvm::BasicBlock *ownedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "owned", function);
+    llvm::BasicBlock *viewBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "view", function);
+    llvm::AllocaInst *slice = builder->CreateAlloca(stringType, nullptr);
+    builder->CreateStore(startPtr, builder->CreateStructGEP(stringType, slice, 0));
+    builder->CreateStore(size, builder->CreateStructGEP(stringType, slice, 1));
+    builder->CreateStore(builder->getInt32(0), builder->CreateStructGEP(stringType, slice, 2));
+
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(stringType, source, 0));
+    builder->CreateCondBr(builder->CreateIsNull(data), inlineBlock, heapBlock);
+
+    builder->SetInsertPoint(inlineBlock);
+    builder->CreateRet(builder->CreateCall(llvmCompiler->internalFuncs["newString"], {startPtr, size}));
+
+    builder->SetInsertPoint(heapBlock);
+    llvm::Value *shared =
+        builder->CreateLoad(builder->getInt8Ty(), getStringSharedFlag(llvmCompiler, builder, source));
+    builder->CreateCondBr(builder->CreateICmpNE(shared, builder->getInt8(0)), viewBlock, ownedBlock);
+
+    builder->SetInsertPoint(ownedBlock);
+    llvm::Value *refsPtr = getStringRefs(llvmCompiler, builder, source);
+    addReference(llvmCompiler, builder, function, refsPtr, data, getStringSize(llvmCompiler, builder, source));
+    initHeapString(llvmCompiler, builder, slice);
+    llvm::Value *refs = builder->CreateLoad(builder->getPtrTy(), refsPtr);
+    builder->CreateStore(refs, getStringRefs(llvmCompiler, builder, slice));
+    builder->CreateRet(builder->CreateLoad(stringType, slice));
+
+    builder->SetInsertPoint(viewBlock);
+    builder->CreateStore(builder->getInt8(1), getStringSharedFlag(llvmCompiler, builder, slice));
+    builder->CreateRet(builder->CreateLoad(stringType, slice));
+
+    return function;
+}
+
+// Arrays keep a pointer to their reference count next to the size
+static llvm::Function *createShareArray(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "shareArray", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *destination = arg++;
+    llvm::Value *source = arg;
+    llvm::StructType *arrayType = llvmCompiler->internalStructs["array"];
+
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(arrayType, source, 0));
+    llvm::Value *size = builder->CreateLoad(builder->getInt64Ty(), builder->CreateStructGEP(arrayType, source, 1));
+    addReference(llvmCompiler, builder, function, builder->CreateStructGEP(arrayType, source, 2), data, size);
+    builder->CreateStore(builder->CreateLoad(arrayType, source), destination);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+// The slice points into the source buffer and shares its count, dropping the slice gives up its reference to the
+// buffer
+static llvm::Function *createSliceArray(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *arrayType = llvmCompiler->internalStructs["array"];
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        arrayType,
+        {llvmBuilder->getPtrTy(), llvmBuilder->getInt64Ty(), llvmBuilder->getInt64Ty(), llvmBuilder->getInt32Ty(),
+         llvmBuilder->getInt32Ty()},
+        false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "sliceArray", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *source = arg++;
+    llvm::Value *start = arg++;
+    llvm::Value *end = arg++;
+    llvm::Value *itemSize = arg++;
+    llvm::Value *line = arg;
+
+    llvm::Value *size = builder->CreateLoad(builder->getInt64Ty(), builder->CreateStructGEP(arrayType, source, 1));
+    checkSliceBounds(llvmCompiler, builder, start, end, size, line);
+
+    llvm::Value *refsPtr = builder->CreateStructGEP(arrayType, source, 2);
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(arrayType, source, 0));
+    addReference(llvmCompiler, builder, function, refsPtr, data, size);
+    llvm::Value *refs = builder->CreateLoad(builder->getPtrTy(), refsPtr);
+    data = builder->CreateInBoundsGEP(builder->getInt8Ty(), data, getByteSize(builder, start, itemSize));
+    llvm::Value *slice = llvm::UndefValue::get(arrayType);
+    slice = builder->CreateInsertValue(slice, data, 0);
+    slice = builder->CreateInsertValue(slice, builder->CreateSub(end, start), 1);
+    slice = builder->CreateInsertValue(slice, refs, 2);
+    builder->CreateRet(slice);
+
+    return function;
+}
+
+class BoxLoop {
+  public:
+    llvm::Value *itemPtr;
+    llvm::Value *box;
+    llvm::BasicBlock *latchBlock;
+    llvm::BasicBlock *exitBlock;
+};
+
+// Leaves the builder in a block that runs once for every box in the buffer, empty items are skipped
+static BoxLoop beginBoxLoop(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Function *function,
+                            llvm::Value *data, llvm::Value *size) {
+    BoxLoop loop;
+    llvm::AllocaInst *indexPtr = builder->CreateAlloca(builder->getInt64Ty(), nullptr);
+    builder->CreateStore(builder->getInt64(0), indexPtr);
+
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
+    llvm::BasicBlock *checkBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "check", function);
+    llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", function);
+    loop.latchBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "latch", function);
+    loop.exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+
+    builder->CreateBr(headerBlock);
+    builder->SetInsertPoint(headerBlock);
+    llvm::Value *index = builder->CreateLoad(builder->getInt64Ty(), indexPtr);
+    builder->CreateCondBr(builder->CreateICmpSLT(index, size), checkBlock, loop.exitBlock);
+
+    builder->SetInsertPoint(checkBlock);
+    loop.itemPtr = builder->CreateInBoundsGEP(builder->getPtrTy(), data, index);
+    loop.box = builder->CreateLoad(builder->getPtrTy(), loop.itemPtr);
+    builder->CreateCondBr(builder->CreateIsNull(loop.box), loop.latchBlock, bodyBlock);
+
+    builder->SetInsertPoint(loop.latchBlock);
+    builder->CreateStore(builder->CreateAdd(index, builder->getInt64(1)), indexPtr);
+    builder->CreateBr(headerBlock);
+
+    builder->SetInsertPoint(bodyBlock);
+    return loop;
+}
+
+static void endBoxLoop(llvm::IRBuilder<> *builder, BoxLoop loop) {
+    builder->CreateBr(loop.latchBlock);
+    builder->SetInsertPoint(loop.exitBlock);
+}
+
+static llvm::Value *getItemKind(llvm::IRBuilder<> *builder, llvm::Value *items) {
+    return builder->CreateAnd(items, builder->getInt32((1 << ITEM_KIND_BITS) - 1));
+}
+
+// A copied buffer gets boxes of its own, each sharing what the box it was copied from holds
+static llvm::Function *createShareItems(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), llvmBuilder->getInt64Ty(), llvmBuilder->getInt32Ty()},
+        false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "shareItems", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::BasicBlock *boxesBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "boxes", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *data = arg++;
+    llvm::Value *size = arg++;
+    llvm::Value *items = arg;
+    const llvm::DataLayout &dataLayout = llvmCompiler->module->getDataLayout();
+
+    llvm::Value *kind = getItemKind(builder, items);
+    builder->CreateCondBr(builder->CreateICmpEQ(kind, builder->getInt32(PLAIN_ITEMS)), exitBlock, boxesBlock);
+
+    builder->SetInsertPoint(boxesBlock);
+    BoxLoop loop = beginBoxLoop(llvmCompiler, builder, function, data, size);
+    llvm::BasicBlock *strBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "str", function);
+    llvm::BasicBlock *arrayBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "array", function);
+    llvm::BasicBlock *sharedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "shared", function);
+    builder->CreateCondBr(builder->CreateICmpEQ(kind, builder->getInt32(STR_ITEMS)), strBlock, arrayBlock);
+
+    builder->SetInsertPoint(strBlock);
+    llvm::Value *strBox = builder->CreateCall(
+        llvmCompiler->internalFuncs["allocate"],
+        {builder->getInt64(dataLayout.getTypeAllocSize(llvmCompiler->internalStructs["string"]))});
+    builder->CreateCall(llvmCompiler->internalFuncs["shareString"], {strBox, loop.box});
+    builder->CreateBr(sharedBlock);
+
+    builder->SetInsertPoint(arrayBlock);
+    llvm::Value *arrayBox = builder->CreateCall(
+        llvmCompiler->internalFuncs["allocate"],
+        {builder->getInt64(dataLayout.getTypeAllocSize(llvmCompiler->internalStructs["array"]))});
+    builder->CreateCall(llvmCompiler->internalFuncs["shareArray"], {arrayBox, loop.box});
+    builder->CreateBr(sharedBlock);
+
+    builder->SetInsertPoint(sharedBlock);
+    llvm::PHINode *box = builder->CreatePHI(builder->getPtrTy(), 2);
+    box->addIncoming(strBox, strBlock);
+    box->addIncoming(arrayBox, arrayBlock);
+    builder->CreateStore(box, loop.itemPtr);
+    endBoxLoop(builder, loop);
+    builder->CreateBr(exitBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+static llvm::Function *createUnshareArray(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), llvmBuilder->getInt64Ty(), llvmBuilder->getInt32Ty()},
+        false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "unshareArray", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *arrayPtr = arg++;
+    llvm::Value *sizeInBytes = arg++;
+    llvm::Value *items = arg;
+    llvm::StructType *arrayType = llvmCompiler->internalStructs["array"];
+    llvm::AllocaInst *previous = builder->CreateAlloca(arrayType, nullptr);
+
+    llvm::Value *dataPtr = builder->CreateStructGEP(arrayType, arrayPtr, 0);
+    llvm::Value *refsPtr = builder->CreateStructGEP(arrayType, arrayPtr, 2);
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), dataPtr);
+    llvm::Value *size = builder->CreateLoad(builder->getInt64Ty(), builder->CreateStructGEP(arrayType, arrayPtr, 1));
+    llvm::BasicBlock *mergeBlock = releaseSharedReference(llvmCompiler, builder, function, refsPtr, data, size);
+    builder->CreateStore(builder->CreateLoad(arrayType, arrayPtr), previous);
+    llvm::Value *newData = builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {sizeInBytes});
+    builder->CreateMemCpy(newData, llvm::MaybeAlign(4), data, llvm::MaybeAlign(4), sizeInBytes);
+    builder->CreateCall(llvmCompiler->internalFuncs["shareItems"], {newData, size, items});
+    builder->CreateCall(llvmCompiler->internalFuncs["dropArray"], {previous, items});
+    builder->CreateStore(newData, dataPtr);
+    builder->CreateStore(llvm::Constant::getNullValue(builder->getPtrTy()), refsPtr);
+    builder->CreateBr(mergeBlock);
+
+    builder->SetInsertPoint(mergeBlock);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+class DroppedBuffer {
+  public:
+    llvm::Value *data;
+    llvm::Value *size;
+    llvm::BasicBlock *mergeBlock;
+};
+
+// Gives up an owner's reference to a buffer, the last owner frees the count. Leaves the builder in the block where the
+// buffer has no other owner, the caller frees the whole buffer there and branches to the merge block, which runs in
+// every case
+static DroppedBuffer dropReference(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Function *function,
+                                   llvm::Value *refsPtr, llvm::Value *data, llvm::Value *size) {
+    llvm::BasicBlock *countedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "counted", function);
+    llvm::BasicBlock *sharedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "shared", function);
+    llvm::BasicBlock *lastBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "last", function);
+    llvm::BasicBlock *freeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "free", function);
+    DroppedBuffer buffer;
+    buffer.mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+
+    llvm::BasicBlock *ownerBlock = builder->GetInsertBlock();
+    llvm::Value *refs = builder->CreateLoad(builder->getPtrTy(), refsPtr);
+    builder->CreateCondBr(builder->CreateIsNull(refs), freeBlock, countedBlock);
+
+    builder->SetInsertPoint(countedBlock);
+    llvm::Value *count = builder->CreateLoad(builder->getInt32Ty(), refs);
+    builder->CreateCondBr(builder->CreateICmpSGT(count, builder->getInt32(1)), sharedBlock, lastBlock);
+
+    builder->SetInsertPoint(sharedBlock);
+    builder->CreateStore(builder->CreateSub(count, builder->getInt32(1)), refs);
+    builder->CreateBr(buffer.mergeBlock);
+
+    builder->SetInsertPoint(lastBlock);
+    llvm::StructType *refsType = getRefsType(builder);
+    llvm::Value *base = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(refsType, refs, 2));
+    llvm::Value *total = builder->CreateLoad(builder->getInt64Ty(), builder->CreateStructGEP(refsType, refs, 1));
+    builder->CreateCall(llvmCompiler->libraryFuncs["free"], {refs});
+    builder->CreateBr(freeBlock);
+
+    builder->SetInsertPoint(freeBlock);
+    llvm::PHINode *bufferData = builder->CreatePHI(builder->getPtrTy(), 2);
+    bufferData->addIncoming(data, ownerBlock);
+    bufferData->addIncoming(base, lastBlock);
+    llvm::PHINode *bufferSize = builder->CreatePHI(builder->getInt64Ty(), 2);
+    bufferSize->addIncoming(size, ownerBlock);
+    bufferSize->addIncoming(total, lastBlock);
+    buffer.data = bufferData;
+    buffer.size = bufferSize;
+    return buffer;
+}
+
+// Inline contents have nothing to free and static data isn't owned. The header is cleared so dropping it again does
+// nothing
+static llvm::Function *createDropString(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "dropString", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *str = function->arg_begin();
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+
+    llvm::BasicBlock *heapBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "heap", function);
+    llvm::BasicBlock *ownedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "owned", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(stringType, str, 0));
+    builder->CreateCondBr(builder->CreateIsNull(data), exitBlock, heapBlock);
+
+    builder->SetInsertPoint(heapBlock);
+    llvm::Value *shared = builder->CreateLoad(builder->getInt8Ty(), getStringSharedFlag(llvmCompiler, builder, str));
+    builder->CreateCondBr(builder->CreateICmpNE(shared, builder->getInt8(0)), exitBlock, ownedBlock);
+
+    builder->SetInsertPoint(ownedBlock);
+    DroppedBuffer buffer = dropReference(llvmCompiler, builder, function, getStringRefs(llvmCompiler, builder, str),
+                                         data, getStringSize(llvmCompiler, builder, str));
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {buffer.data});
+    builder->CreateBr(buffer.mergeBlock);
+    builder->SetInsertPoint(buffer.mergeBlock);
+    builder->CreateBr(exitBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateStore(llvm::Constant::getNullValue(stringType), str);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+// The owner that frees the buffer drops what its boxes hold and frees the boxes too. An empty map has no arrays to drop
+static llvm::Function *createDropArray(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), llvmBuilder->getInt32Ty()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "dropArray", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *arrayPtr = arg++;
+    llvm::Value *items = arg;
+    llvm::StructType *arrayType = llvmCompiler->internalStructs["array"];
+
+    llvm::BasicBlock *arrayBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "array", function);
+    llvm::BasicBlock *boxesBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "boxes", function);
+    llvm::BasicBlock *bufferBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "buffer", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+    builder->CreateCondBr(builder->CreateIsNull(arrayPtr), exitBlock, arrayBlock);
+
+    builder->SetInsertPoint(arrayBlock);
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(arrayType, arrayPtr, 0));
+    llvm::Value *size = builder->CreateLoad(builder->getInt64Ty(), builder->CreateStructGEP(arrayType, arrayPtr, 1));
+    DroppedBuffer buffer =
+        dropReference(llvmCompiler, builder, function, builder->CreateStructGEP(arrayType, arrayPtr, 2), data, size);
+    llvm::Value *kind = getItemKind(builder, items);
+    builder->CreateCondBr(builder->CreateICmpEQ(kind, builder->getInt32(PLAIN_ITEMS)), bufferBlock, boxesBlock);
+
+    builder->SetInsertPoint(boxesBlock);
+    BoxLoop loop = beginBoxLoop(llvmCompiler, builder, function, buffer.data, buffer.size);
+    llvm::BasicBlock *strBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "str", function);
+    llvm::BasicBlock *nestedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "nested", function);
+    llvm::BasicBlock *droppedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "dropped", function);
+    builder->CreateCondBr(builder->CreateICmpEQ(kind, builder->getInt32(STR_ITEMS)), strBlock, nestedBlock);
+
+    builder->SetInsertPoint(strBlock);
+    builder->CreateCall(llvmCompiler->internalFuncs["dropString"], {loop.box});
+    builder->CreateBr(droppedBlock);
+
+    builder->SetInsertPoint(nestedBlock);
+    builder->CreateCall(function, {loop.box, builder->CreateLShr(items, builder->getInt32(ITEM_KIND_BITS))});
+    builder->CreateBr(droppedBlock);
+
+    builder->SetInsertPoint(droppedBlock);
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {loop.box});
+    endBoxLoop(builder, loop);
+    builder->CreateBr(bufferBlock);
+
+    builder->SetInsertPoint(bufferBlock);
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {buffer.data});
+    builder->CreateBr(buffer.mergeBlock);
+
+    builder->SetInsertPoint(buffer.mergeBlock);
+    builder->CreateStore(llvm::Constant::getNullValue(arrayType), arrayPtr);
+    builder->CreateBr(exitBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+// The intern table is an open addressed array of pointers to strings it owns, null marks an empty slot
+static llvm::Value *getInternTableField(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, uint field) {
+    llvm::GlobalVariable *internTable = llvmCompiler->module->getNamedGlobal("internTable");
+    llvm::StructType *tableType = (llvm::StructType *)internTable->getValueType();
+    return builder->CreateStructGEP(tableType, internTable, field);
+}
+
+static llvm::Function *createInternGrow(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *tableType =
+        llvm::StructType::create(*llvmCompiler->ctx, {llvmBuilder->getPtrTy(), llvmBuilder->getInt32Ty(),
+                                                      llvmBuilder->getInt32Ty()}, "internTableType");
+    new llvm::GlobalVariable(*llvmCompiler->module, tableType, false, llvm::GlobalValue::InternalLinkage,
+                             llvm::Constant::getNullValue(tableType), "internTable");
+
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getVoidTy(), {}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "internGrow", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *slotsPtr = getInternTableField(llvmCompiler, builder, 0);
+    llvm::Value *capacityPtr = getInternTableField(llvmCompiler, builder, 2);
+    llvm::Value *slots = builder->CreateLoad(builder->getPtrTy(), slotsPtr);
+    llvm::Value *capacity = builder->CreateLoad(builder->getInt32Ty(), capacityPtr);
+
+    llvm::Value *newCapacity =
+        builder->CreateSelect(builder->CreateICmpEQ(capacity, builder->getInt32(0)), builder->getInt32(64),
+                              builder->CreateMul(capacity, builder->getInt32(2)));
+    llvm::Value *newSlotsSize = getByteSize(builder, newCapacity, builder->getInt32(8));
+    llvm::Value *newSlots = builder->CreateCall(llvmCompiler->libraryFuncs["malloc"], {newSlotsSize});
+    builder->CreateMemSet(newSlots, builder->getInt8(0), newSlotsSize, llvm::MaybeAlign(8));
+    llvm::Value *mask = builder->CreateSub(newCapacity, builder->getInt32(1));
+
+    llvm::AllocaInst *loopVariable = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
+    builder->CreateStore(builder->getInt32(0), loopVariable);
+    llvm::AllocaInst *newIndex = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
+
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
+    llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", function);
+    llvm::BasicBlock *hashBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "hash", function);
+    llvm::BasicBlock *probeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "probe", function);
+    llvm::BasicBlock *nextBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "next", function);
+    llvm::BasicBlock *storeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "store", function);
+    llvm::BasicBlock *latchBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "latch", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+
+    builder->CreateBr(headerBlock);
+    builder->SetInsertPoint(headerBlock);
+    llvm::Value *index = builder->CreateLoad(builder->getInt32Ty(), loopVariable);
+    builder->CreateCondBr(builder->CreateICmpSLT(index, capacity), bodyBlock, exitBlock);
+
+    // Every string is unique so they only need a free slot, the hash is already cached
+    builder->SetInsertPoint(bodyBlock);
+    llvm::Value *str =
+        builder->CreateLoad(builder->getPtrTy(), builder->CreateInBoundsGEP(builder->getPtrTy(), slots, index));
+    builder->CreateCondBr(builder->CreateIsNull(str), latchBlock, hashBlock);
+
+    builder->SetInsertPoint(hashBlock);
+    llvm::Value *hash = builder->CreateCall(llvmCompiler->internalFuncs["hashStr"], {str});
+    builder->CreateStore(builder->CreateAnd(hash, mask), newIndex);
+    builder->CreateBr(probeBlock);
+
+    builder->SetInsertPoint(probeBlock);
+    llvm::Value *loadedNewIndex = builder->CreateLoad(builder->getInt32Ty(), newIndex);
+    llvm::Value *newSlotPtr = builder->CreateInBoundsGEP(builder->getPtrTy(), newSlots, loadedNewIndex);
+    builder->CreateCondBr(builder->CreateIsNull(builder->CreateLoad(builder->getPtrTy(), newSlotPtr)), storeBlock,
+                          nextBlock);
+
+    builder->SetInsertPoint(nextBlock);
+    builder->CreateStore(builder->CreateAnd(builder->CreateAdd(loadedNewIndex, builder->getInt32(1)), mask), newIndex);
+    builder->CreateBr(probeBlock);
+
+    builder->SetInsertPoint(storeBlock);
+    builder->CreateStore(str, newSlotPtr);
+    builder->CreateBr(latchBlock);
+
+    builder->SetInsertPoint(latchBlock);
+    builder->CreateStore(builder->CreateAdd(index, builder->getInt32(1)), loopVariable);
+    builder->CreateBr(headerBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateCall(llvmCompiler->libraryFuncs["free"], {slots});
+    builder->CreateStore(newSlots, slotsPtr);
+    builder->CreateStore(newCapacity, capacityPtr);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+// Returns the table's copy of the string, adding one if it isn't there yet
+static llvm::Function *createInternStr(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getPtrTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "internStr", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *str = function->arg_begin();
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+    llvm::Value *usedPtr = getInternTableField(llvmCompiler, builder, 1);
+    llvm::Value *capacityPtr = getInternTableField(llvmCompiler, builder, 2);
+
+    llvm::BasicBlock *growBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "grow", function);
+    llvm::BasicBlock *probeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "probe", function);
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
+    llvm::BasicBlock *occupiedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "occupied", function);
+    llvm::BasicBlock *foundBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "found", function);
+    llvm::BasicBlock *nextBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "next", function);
+    llvm::BasicBlock *insertBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "insert", function);
+    llvm::BasicBlock *sharedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "shared", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+
+    // Keep the load factor below 3/4, an empty table has a capacity of 0 and grows on the first call
+    llvm::Value *used = builder->CreateAdd(builder->CreateLoad(builder->getInt32Ty(), usedPtr), builder->getInt32(1));
+    llvm::Value *capacity = builder->CreateLoad(builder->getInt32Ty(), capacityPtr);
+    builder->CreateCondBr(builder->CreateICmpUGT(builder->CreateMul(used, builder->getInt32(4)),
+                                                 builder->CreateMul(capacity, builder->getInt32(3))),
+                          growBlock, probeBlock);
+
+    builder->SetInsertPoint(growBlock);
+    builder->CreateCall(llvmCompiler->internalFuncs["internGrow"], {});
+    builder->CreateBr(probeBlock);
+
+    builder->SetInsertPoint(probeBlock);
+    llvm::Value *slots = builder->CreateLoad(builder->getPtrTy(), getInternTableField(llvmCompiler, builder, 0));
+    llvm::Value *mask =
+        builder->CreateSub(builder->CreateLoad(builder->getInt32Ty(), capacityPtr), builder->getInt32(1));
+    llvm::Value *hash = builder->CreateCall(llvmCompiler->internalFuncs["hashStr"], {str});
+    llvm::AllocaInst *loopVariable = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
+    builder->CreateStore(builder->CreateAnd(hash, mask), loopVariable);
+    builder->CreateBr(headerBlock);
+
+    builder->SetInsertPoint(headerBlock);
+    llvm::Value *index = builder->CreateLoad(builder->getInt32Ty(), loopVariable);
+    llvm::Value *slotPtr = builder->CreateInBoundsGEP(builder->getPtrTy(), slots, index);
+    llvm::Value *slot = builder->CreateLoad(builder->getPtrTy(), slotPtr);
+    builder->CreateCondBr(builder->CreateIsNull(slot), insertBlock, occupiedBlock);
+
+    builder->SetInsertPoint(occupiedBlock);
+    builder->CreateCondBr(builder->CreateCall(llvmCompiler->internalFuncs["strEquals"], {slot, str}), foundBlock,
+                          nextBlock);
+
+    builder->SetInsertPoint(foundBlock);
+    builder->CreateRet(slot);
+
+    builder->SetInsertPoint(nextBlock);
+    builder->CreateStore(builder->CreateAnd(builder->CreateAdd(index, builder->getInt32(1)), mask), loopVariable);
+    builder->CreateBr(headerBlock);
+
+    builder->SetInsertPoint(insertBlock);
+    uint32_t stringSize = llvmCompiler->module->getDataLayout().getTypeAllocSize(stringType);
+    llvm::Value *newStringPtr =
+        builder->CreateCall(llvmCompiler->libraryFuncs["malloc"], {builder->getInt64(stringSize)});
+    // Interned strings live as long as the program, they're never put in a region's arena
+    llvm::Value *depth = suspendRegions(llvmCompiler, builder);
+    llvm::Value *newString = builder->CreateCall(
+        llvmCompiler->internalFuncs["newString"],
+        {getStringData(llvmCompiler, builder, str), getStringSize(llvmCompiler, builder, str)});
+    resumeRegions(llvmCompiler, builder, depth);
+    builder->CreateStore(newString, newStringPtr);
+    builder->CreateStore(hash, builder->CreateStructGEP(stringType, newStringPtr, 2));
+    builder->CreateStore(newStringPtr, slotPtr);
+    builder->CreateStore(used, usedPtr);
+
+    llvm::Value *newData =
+        builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(stringType, newStringPtr, 0));
+    builder->CreateCondBr(builder->CreateIsNull(newData), exitBlock, sharedBlock);
+
+    // Copies of the header share the data with the table
+    builder->SetInsertPoint(sharedBlock);
+    builder->CreateStore(builder->getInt8(1), getStringSharedFlag(llvmCompiler, builder, newStringPtr));
+    builder->CreateBr(exitBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateRet(newStringPtr);
+
+    return function;
+}
+
+static llvm::Function *createIntern(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmCompiler->internalStructs["string"], {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "intern", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *internedString =
+        builder->CreateCall(llvmCompiler->internalFuncs["internStr"], {function->arg_begin()});
+    builder->CreateRet(builder->CreateLoad(llvmCompiler->internalStructs["string"], internedString));
+
+    return function;
+}
+
+static llvm::Value *getSetField(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *setPtr,
+                                uint field) {
+    llvm::StructType *setType = llvmCompiler->internalStructs["set"];
+    return builder->CreateLoad(setType->getElementType(field), builder->CreateStructGEP(setType, setPtr, field));
+}
+
+static void storeSetField(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *setPtr,
+                          llvm::Value *value, uint field) {
+    builder->CreateStore(value, builder->CreateStructGEP(llvmCompiler->internalStructs["set"], setPtr, field));
+}
+
+static llvm::Type *getSetItemType(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, bool strItems) {
+    return strItems ? (llvm::Type *)llvmCompiler->internalStructs["string"] : builder->getInt32Ty();
+}
+
+class SetLoop {
+  public:
+    llvm::AllocaInst *index;
+    llvm::BasicBlock *latchBlock;
+    llvm::BasicBlock *exitBlock;
+};
+
+// Leaves the builder in a block that runs once for every occupied slot in the set
+static SetLoop beginSetLoop(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Function *function,
+                            llvm::Value *setPtr) {
+    SetLoop loop;
+    llvm::Value *states = getSetField(llvmCompiler, builder, setPtr, 1);
+    llvm::Value *capacity = getSetField(llvmCompiler, builder, setPtr, 4);
+
+    loop.index = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
+    builder->CreateStore(builder->getInt32(0), loop.index);
+
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
+    llvm::BasicBlock *checkBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "check", function);
+    llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", function);
+    loop.latchBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "latch", function);
+    loop.exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+
+    builder->CreateBr(headerBlock);
+    builder->SetInsertPoint(headerBlock);
+    llvm::Value *index = builder->CreateLoad(builder->getInt32Ty(), loop.index);
+    builder->CreateCondBr(builder->CreateICmpSLT(index, capacity), checkBlock, loop.exitBlock);
+
+    builder->SetInsertPoint(checkBlock);
+    llvm::Value *state =
+        builder->CreateLoad(builder->getInt8Ty(), builder->CreateInBoundsGEP(builder->getInt8Ty(), states, index));
+    builder->CreateCondBr(builder->CreateICmpEQ(state, builder->getInt8(1)), bodyBlock, loop.latchBlock);
+
+    builder->SetInsertPoint(loop.latchBlock);
+    builder->CreateStore(builder->CreateAdd(index, builder->getInt32(1)), loop.index);
+    builder->CreateBr(headerBlock);
+
+    builder->SetInsertPoint(bodyBlock);
+    return loop;
+}
+
+static void endSetLoop(llvm::IRBuilder<> *builder, SetLoop loop) {
+    builder->CreateBr(loop.latchBlock);
+    builder->SetInsertPoint(loop.exitBlock);
+}
+
+static llvm::Value *loadSetItem(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *setPtr,
+                                llvm::Type *itemType, llvm::Value *index) {
+    llvm::Value *slots = getSetField(llvmCompiler, builder, setPtr, 0);
+    return builder->CreateLoad(itemType, builder->CreateInBoundsGEP(itemType, slots, index));
+}
+
+static llvm::Function *createSetInit(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), llvmBuilder->getInt32Ty(), llvmBuilder->getInt32Ty()},
+        false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "setInit", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *setPtr = arg++;
+    llvm::Value *itemSize = arg++;
+    llvm::Value *capacity = arg;
+
+    llvm::Value *slots =
+        builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {getByteSize(builder, capacity, itemSize)});
+    llvm::Value *states =
+        builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {getByteSize(builder, capacity)});
+    builder->CreateMemSet(states, builder->getInt8(0), capacity, llvm::MaybeAlign(1));
+
+    storeSetField(llvmCompiler, builder, setPtr, slots, 0);
+    storeSetField(llvmCompiler, builder, setPtr, states, 1);
+    storeSetField(llvmCompiler, builder, setPtr, builder->getInt32(0), 2);
+    storeSetField(llvmCompiler, builder, setPtr, builder->getInt32(0), 3);
+    storeSetField(llvmCompiler, builder, setPtr, capacity, 4);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+static llvm::Function *createSetCopy(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), llvmBuilder->getPtrTy(), llvmBuilder->getInt32Ty()},
+        false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "setCopy", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *destination = arg++;
+    llvm::Value *source = arg++;
+    llvm::Value *itemSize = arg;
+
+    llvm::Value *capacity = getSetField(llvmCompiler, builder, source, 4);
+    llvm::Value *slotsSize = getByteSize(builder, capacity, itemSize);
+
+    llvm::Value *slots = builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {slotsSize});
+    builder->CreateMemCpy(slots, llvm::MaybeAlign(4), getSetField(llvmCompiler, builder, source, 0),
+                          llvm::MaybeAlign(4), slotsSize);
+    llvm::Value *states =
+        builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {getByteSize(builder, capacity)});
+    builder->CreateMemCpy(states, llvm::MaybeAlign(1), getSetField(llvmCompiler, builder, source, 1),
+                          llvm::MaybeAlign(1), capacity);
+
+    storeSetField(llvmCompiler, builder, destination, slots, 0);
+    storeSetField(llvmCompiler, builder, destination, states, 1);
+    storeSetField(llvmCompiler, builder, destination, getSetField(llvmCompiler, builder, source, 2), 2);
+    storeSetField(llvmCompiler, builder, destination, getSetField(llvmCompiler, builder, source, 3), 3);
+    storeSetField(llvmCompiler, builder, destination, capacity, 4);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+// A set doesn't own its str items, they're the strings that were inserted. Only the slots and states are freed
+static llvm::Function *createDropSet(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "dropSet", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *setPtr = function->arg_begin();
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {getSetField(llvmCompiler, builder, setPtr, 0)});
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {getSetField(llvmCompiler, builder, setPtr, 1)});
+    builder->CreateStore(llvm::Constant::getNullValue(llvmCompiler->internalStructs["set"]), setPtr);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+// Linear probing, returns the slot holding the item or the first free slot it could be inserted at
+static llvm::Function *createSetProbe(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder, bool strItems) {
+    llvm::Type *itemType = getSetItemType(llvmCompiler, llvmBuilder, strItems);
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getInt32Ty(), {llvmBuilder->getPtrTy(), itemType}, false);
+    llvm::Function *function = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
+                                                      strItems ? "setProbeStr" : "setProbeInt", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *setPtr = arg++;
+    llvm::Value *item = arg;
+    if (strItems) {
+        item = spillString(llvmCompiler, builder, item);
+    }
+
+    llvm::Value *slots = getSetField(llvmCompiler, builder, setPtr, 0);
+    llvm::Value *states = getSetField(llvmCompiler, builder, setPtr, 1);
+    llvm::Value *mask = builder->CreateSub(getSetField(llvmCompiler, builder, setPtr, 4), builder->getInt32(1));
+
+    llvm::Value *hash = builder->CreateCall(llvmCompiler->internalFuncs[strItems ? "hashStr" : "hashInt"], {item});
+
+    llvm::AllocaInst *firstFree = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
+    builder->CreateStore(builder->getInt32(-1), firstFree);
+    llvm::AllocaInst *loopVariable = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
+    builder->CreateStore(builder->CreateAnd(hash, mask), loopVariable);
+
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
+    llvm::BasicBlock *emptyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "empty", function);
+    llvm::BasicBlock *removedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "removed", function);
+    llvm::BasicBlock *occupiedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "occupied", function);
+    llvm::BasicBlock *foundBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "found", function);
+    llvm::BasicBlock *nextBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "next", function);
+
+    builder->CreateBr(headerBlock);
+    builder->SetInsertPoint(headerBlock);
+    llvm::Value *index = builder->CreateLoad(builder->getInt32Ty(), loopVariable);
+    llvm::Value *state =
+        builder->CreateLoad(builder->getInt8Ty(), builder->CreateInBoundsGEP(builder->getInt8Ty(), states, index));
+    llvm::SwitchInst *stateSwitch = builder->CreateSwitch(state, occupiedBlock, 2);
+    stateSwitch->addCase(builder->getInt8(0), emptyBlock);
+    stateSwitch->addCase(builder->getInt8(2), removedBlock);
+
+    // Hitting an empty slot means the item isn't in the set
+    builder->SetInsertPoint(emptyBlock);
+    llvm::Value *loadedFirstFree = builder->CreateLoad(builder->getInt32Ty(), firstFree);
+    builder->CreateRet(
+        builder->CreateSelect(builder->CreateICmpEQ(loadedFirstFree, builder->getInt32(-1)), index, loadedFirstFree));
+
+    // Keep probing past removed items but remember the first one so it can be reused
+    builder->SetInsertPoint(removedBlock);
+    loadedFirstFree = builder->CreateLoad(builder->getInt32Ty(), firstFree);
+    builder->CreateStore(
+        builder->CreateSelect(builder->CreateICmpEQ(loadedFirstFree, builder->getInt32(-1)), index, loadedFirstFree),
+        firstFree);
+    builder->CreateBr(nextBlock);
+
+    builder->SetInsertPoint(occupiedBlock);
+    llvm::Value *slotPtr = builder->CreateInBoundsGEP(itemType, slots, index);
+    llvm::Value *isEqual = strItems ? builder->CreateCall(llvmCompiler->internalFuncs["strEquals"], {slotPtr, item})
+                                    : builder->CreateICmpEQ(builder->CreateLoad(itemType, slotPtr), item);
+    builder->CreateCondBr(isEqual, foundBlock, nextBlock);
+
+    builder->SetInsertPoint(foundBlock);
+    builder->CreateRet(index);
+
+    builder->SetInsertPoint(nextBlock);
+    builder->CreateStore(builder->CreateAnd(builder->CreateAdd(index, builder->getInt32(1)), mask), loopVariable);
+    builder->CreateBr(headerBlock);
+
+    return function;
+}
+
+static llvm::Function *createSetGrow(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder, bool strItems) {
+    llvm::Type *itemType = getSetItemType(llvmCompiler, llvmBuilder, strItems);
+    uint32_t itemSize = llvmCompiler->module->getDataLayout().getTypeAllocSize(itemType);
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
+                                                      strItems ? "setGrowStr" : "setGrowInt", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *setPtr = function->arg_begin();
+    llvm::Value *capacity = getSetField(llvmCompiler, builder, setPtr, 4);
+
+    llvm::AllocaInst *newSet = builder->CreateAlloca(llvmCompiler->internalStructs["set"], nullptr);
+    builder->CreateCall(llvmCompiler->internalFuncs["setInit"],
+                        {newSet, builder->getInt32(itemSize), builder->CreateMul(capacity, builder->getInt32(2))});
+    llvm::Value *newSlots = getSetField(llvmCompiler, builder, newSet, 0);
+    llvm::Value *newStates = getSetField(llvmCompiler, builder, newSet, 1);
+
+    // Every item is unique so they only need a free slot, removed slots are dropped here
+    SetLoop loop = beginSetLoop(llvmCompiler, builder, function, setPtr);
+    llvm::Value *item =
+        loadSetItem(llvmCompiler, builder, setPtr, itemType, builder->CreateLoad(builder->getInt32Ty(), loop.index));
+    llvm::Value *newIndex =
+        builder->CreateCall(llvmCompiler->internalFuncs[strItems ? "setProbeStr" : "setProbeInt"], {newSet, item});
+    builder->CreateStore(item, builder->CreateInBoundsGEP(itemType, newSlots, newIndex));
+    builder->CreateStore(builder->getInt8(1), builder->CreateInBoundsGEP(builder->getInt8Ty(), newStates, newIndex));
+    endSetLoop(builder, loop);
+
+    llvm::Value *size = getSetField(llvmCompiler, builder, setPtr, 2);
+    storeSetField(llvmCompiler, builder, newSet, size, 2);
+    storeSetField(llvmCompiler, builder, newSet, size, 3);
+
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {getSetField(llvmCompiler, builder, setPtr, 0)});
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {getSetField(llvmCompiler, builder, setPtr, 1)});
+    builder->CreateStore(builder->CreateLoad(llvmCompiler->internalStructs["set"], newSet), setPtr);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+static llvm::Function *createSetInsert(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder, bool strItems) {
+    llvm::Type *itemType = getSetItemType(llvmCompiler, llvmBuilder, strItems);
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), itemType}, false);
+    llvm::Function *function = llvm::Function::Create(
+        funcType, llvm::Function::ExternalLinkage, strItems ? "setInsertStr" : "setInsertInt", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *setPtr = arg++;
+    llvm::Value *item = arg;
+
+    llvm::BasicBlock *checkBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "check", function);
+    llvm::BasicBlock *growBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "grow", function);
+    llvm::BasicBlock *insertBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "insert", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+
+    // An item that's already there doesn't take a slot, so it's looked up before growing
+    llvm::Function *probe = llvmCompiler->internalFuncs[strItems ? "setProbeStr" : "setProbeInt"];
+    llvm::Value *foundIndex = builder->CreateCall(probe, {setPtr, item});
+    llvm::Value *foundState = builder->CreateLoad(
+        builder->getInt8Ty(),
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), getSetField(llvmCompiler, builder, setPtr, 1), foundIndex));
+    builder->CreateCondBr(builder->CreateICmpEQ(foundState, builder->getInt8(1)), exitBlock, checkBlock);
+
+    // Keep the load factor, including removed slots, below 3/4
+    builder->SetInsertPoint(checkBlock);
+    llvm::Value *used = builder->CreateAdd(getSetField(llvmCompiler, builder, setPtr, 3), builder->getInt32(1));
+    llvm::Value *capacity = getSetField(llvmCompiler, builder, setPtr, 4);
+    builder->CreateCondBr(builder->CreateICmpUGT(builder->CreateMul(used, builder->getInt32(4)),
+                                                 builder->CreateMul(capacity, builder->getInt32(3))),
+                          growBlock, insertBlock);
+
+    // The slots moved, the item goes in the first empty one of the new table
+    builder->SetInsertPoint(growBlock);
+    builder->CreateCall(llvmCompiler->internalFuncs[strItems ? "setGrowStr" : "setGrowInt"], {setPtr});
+    llvm::Value *grownIndex = builder->CreateCall(probe, {setPtr, item});
+    builder->CreateBr(insertBlock);
+
+    builder->SetInsertPoint(insertBlock);
+    llvm::PHINode *index = builder->CreatePHI(builder->getInt32Ty(), 2);
+    index->addIncoming(foundIndex, checkBlock);
+    index->addIncoming(grownIndex, growBlock);
+    llvm::PHINode *state = builder->CreatePHI(builder->getInt8Ty(), 2);
+    state->addIncoming(foundState, checkBlock);
+    state->addIncoming(builder->getInt8(0), growBlock);
+    llvm::Value *statePtr =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), getSetField(llvmCompiler, builder, setPtr, 1), index);
+    llvm::Value *slots = getSetField(llvmCompiler, builder, setPtr, 0);
+    builder->CreateStore(item, builder->CreateInBoundsGEP(itemType, slots, index));
+    builder->CreateStore(builder->getInt8(1), statePtr);
+
+    llvm::Value *wasEmpty =
+        builder->CreateZExt(builder->CreateICmpEQ(state, builder->getInt8(0)), builder->getInt32Ty());
+    storeSetField(llvmCompiler, builder, setPtr,
+                  builder->CreateAdd(getSetField(llvmCompiler, builder, setPtr, 2), builder->getInt32(1)), 2);
+    storeSetField(llvmCompiler, builder, setPtr,
+                  builder->CreateAdd(getSetField(llvmCompiler, builder, setPtr, 3), wasEmpty), 3);
+    builder->CreateBr(exitBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+static llvm::Function *createSetContains(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder, bool strItems) {
+    llvm::Type *itemType = getSetItemType(llvmCompiler, llvmBuilder, strItems);
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getInt1Ty(), {llvmBuilder->getPtrTy(), itemType}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
+                               strItems ? "setContainsStr" : "setContainsInt", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *setPtr = arg++;
+    llvm::Value *item = arg;
+
+    llvm::Value *index =
+        builder->CreateCall(llvmCompiler->internalFuncs[strItems ? "setProbeStr" : "setProbeInt"], {setPtr, item});
+    llvm::Value *statePtr =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), getSetField(llvmCompiler, builder, setPtr, 1), index);
+    builder->CreateRet(builder->CreateICmpEQ(builder->CreateLoad(builder->getInt8Ty(), statePtr), builder->getInt8(1)));
+
+    return function;
+}
+
+static llvm::Function *createSetRemove(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder, bool strItems) {
+    llvm::Type *itemType = getSetItemType(llvmCompiler, llvmBuilder, strItems);
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getInt1Ty(), {llvmBuilder->getPtrTy(), itemType}, false);
+    llvm::Function *function = llvm::Function::Create(
+        funcType, llvm::Function::ExternalLinkage, strItems ? "setRemoveStr" : "setRemoveInt", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *setPtr = arg++;
+    llvm::Value *item = arg;
+
+    llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", function);
+    llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+
+    llvm::Value *index =
+        builder->CreateCall(llvmCompiler->internalFuncs[strItems ? "setProbeStr" : "setProbeInt"], {setPtr, item});
+    llvm::Value *statePtr =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), getSetField(llvmCompiler, builder, setPtr, 1), index);
+    llvm::Value *state = builder->CreateLoad(builder->getInt8Ty(), statePtr);
+    builder->CreateCondBr(builder->CreateICmpEQ(state, builder->getInt8(1)), thenBlock, mergeBlock);
+
+    // Mark the slot as removed so probing continues past it
+    builder->SetInsertPoint(thenBlock);
+    builder->CreateStore(builder->getInt8(2), statePtr);
+    storeSetField(llvmCompiler, builder, setPtr,
+                  builder->CreateSub(getSetField(llvmCompiler, builder, setPtr, 2), builder->getInt32(1)), 2);
+    builder->CreateRet(builder->getInt1(1));
+
+    builder->SetInsertPoint(mergeBlock);
+    builder->CreateRet(builder->getInt1(0));
+
+    return function;
+}
+
+enum SetOp { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
+
+static llvm::Function *createSetBulkOp(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder, bool strItems,
+                                       SetOp op, std::string name) {
+    llvm::Type *itemType = getSetItemType(llvmCompiler, llvmBuilder, strItems);
+    uint32_t itemSize = llvmCompiler->module->getDataLayout().getTypeAllocSize(itemType);
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmCompiler->internalStructs["set"], {llvmBuilder->getPtrTy(), llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, name, *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *leftPtr = arg++;
+    llvm::Value *rightPtr = arg;
+
+    llvm::Function *insertFunc = llvmCompiler->internalFuncs[strItems ? "setInsertStr" : "setInsertInt"];
+    llvm::Function *containsFunc = llvmCompiler->internalFuncs[strItems ? "setContainsStr" : "setContainsInt"];
+
+    llvm::AllocaInst *result = builder->CreateAlloca(llvmCompiler->internalStructs["set"], nullptr);
+    builder->CreateCall(llvmCompiler->internalFuncs["setInit"],
+                        {result, builder->getInt32(itemSize), builder->getInt32(8)});
+
+    SetLoop loop = beginSetLoop(llvmCompiler, builder, function, leftPtr);
+    llvm::Value *item =
+        loadSetItem(llvmCompiler, builder, leftPtr, itemType, builder->CreateLoad(builder->getInt32Ty(), loop.index));
+    if (op == SET_UNION) {
+        builder->CreateCall(insertFunc, {result, item});
+    } else {
+        llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", function);
+        llvm::Value *inRight = builder->CreateCall(containsFunc, {rightPtr, item});
+        if (op == SET_DIFFERENCE) {
+            builder->CreateCondBr(inRight, loop.latchBlock, thenBlock);
+        } else {
+            builder->CreateCondBr(inRight, thenBlock, loop.latchBlock);
+        }
+        builder->SetInsertPoint(thenBlock);
+        builder->CreateCall(insertFunc, {result, item});
+    }
+    endSetLoop(builder, loop);
+
+    if (op == SET_UNION) {
+        loop = beginSetLoop(llvmCompiler, builder, function, rightPtr);
+        item = loadSetItem(llvmCompiler, builder, rightPtr, itemType,
+                           builder->CreateLoad(builder->getInt32Ty(), loop.index));
+        builder->CreateCall(insertFunc, {result, item});
+        endSetLoop(builder, loop);
+    }
+
+    builder->CreateRet(builder->CreateLoad(llvmCompiler->internalStructs["set"], result));
+
+    return function;
+}
+
+static llvm::Function *createSetElements(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder, bool strItems) {
+    llvm::Type *itemType = getSetItemType(llvmCompiler, llvmBuilder, strItems);
+    uint32_t itemSize = llvmCompiler->module->getDataLayout().getTypeAllocSize(itemType);
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmCompiler->internalStructs["array"], {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
+                               strItems ? "setElementsStr" : "setElementsInt", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *setPtr = function->arg_begin();
+    llvm::Value *size = getSetField(llvmCompiler, builder, setPtr, 2);
+
+    // arr[str] holds pointers to the strings
+    llvm::Type *elementType = strItems ? builder->getPtrTy() : itemType;
+    uint32_t elementSize = llvmCompiler->module->getDataLayout().getTypeAllocSize(elementType);
+    llvm::Value *arrayPtr = builder->CreateCall(llvmCompiler->internalFuncs["allocate"],
+                                                {getByteSize(builder, size, builder->getInt32(elementSize))});
+
+    llvm::AllocaInst *arrayIndex = builder->CreateAlloca(builder->getInt32Ty(), nullptr);
+    builder->CreateStore(builder->getInt32(0), arrayIndex);
+
+    SetLoop loop = beginSetLoop(llvmCompiler, builder, function, setPtr);
+    llvm::Value *item =
+        loadSetItem(llvmCompiler, builder, setPtr, itemType, builder->CreateLoad(builder->getInt32Ty(), loop.index));
+    // The array drops its strings when it's done with them, so each box gets its own copy
+    if (strItems) {
+        llvm::Value *strPtr =
+            builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {builder->getInt64(itemSize)});
+        llvm::Value *itemPtr = builder->CreateInBoundsGEP(itemType, getSetField(llvmCompiler, builder, setPtr, 0),
+                                                         builder->CreateLoad(builder->getInt32Ty(), loop.index));
+        builder->CreateStore(builder->CreateCall(llvmCompiler->internalFuncs["newString"],
+                                                 {getStringData(llvmCompiler, builder, itemPtr),
+                                                  getStringSize(llvmCompiler, builder, itemPtr)}),
+                             strPtr);
+        item = strPtr;
+    }
+    llvm::Value *loadedArrayIndex = builder->CreateLoad(builder->getInt32Ty(), arrayIndex);
+    builder->CreateStore(item, builder->CreateInBoundsGEP(elementType, arrayPtr, loadedArrayIndex));
+    builder->CreateStore(builder->CreateAdd(loadedArrayIndex, builder->getInt32(1)), arrayIndex);
+    endSetLoop(builder, loop);
+
+    llvm::Value *array = llvm::UndefValue::get(llvmCompiler->internalStructs["array"]);
+    array = builder->CreateInsertValue(array, arrayPtr, 0);
+    array = builder->CreateInsertValue(array, builder->CreateSExt(size, builder->getInt64Ty()), 1);
+    array = builder->CreateInsertValue(array, llvm::Constant::getNullValue(builder->getPtrTy()), 2);
+    builder->CreateRet(array);
+
+    return function;
+}
+
+static llvm::Function *createNewBuilder(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *builderType = llvmCompiler->internalStructs["builder"];
+    llvm::FunctionType *funcType = llvm::FunctionType::get(builderType, {}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "newBuilder", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *newBuilder = llvm::UndefValue::get(builderType);
+    newBuilder = builder->CreateInsertValue(
+        newBuilder, builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {builder->getInt64(16)}), 0);
+    newBuilder = builder->CreateInsertValue(newBuilder, builder->getInt64(0), 1);
+    newBuilder = builder->CreateInsertValue(newBuilder, builder->getInt64(16), 2);
+    builder->CreateRet(newBuilder);
+
+    return function;
+}
+
+// Makes sure there is room for 'extra' more bytes, doubling the capacity so pushing stays amortized O(1)
+static llvm::Function *createBuilderReserve(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *builderType = llvmCompiler->internalStructs["builder"];
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), llvmBuilder->getInt64Ty()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "builderReserve", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *builderPtr = arg++;
+    llvm::Value *extra = arg;
+
+    llvm::Value *loadedBuilder = builder->CreateLoad(builderType, builderPtr);
+    llvm::Value *needed = builder->CreateAdd(builder->CreateExtractValue(loadedBuilder, 1), extra);
+    llvm::Value *capacity = builder->CreateExtractValue(loadedBuilder, 2);
+
+    llvm::BasicBlock *growBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "grow", function);
+    llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", function);
+    builder->CreateCondBr(builder->CreateICmpSGT(needed, capacity), growBlock, mergeBlock);
+
+    builder->SetInsertPoint(growBlock);
+    llvm::Value *doubled = builder->CreateMul(capacity, builder->getInt64(2));
+    llvm::Value *newCapacity = builder->CreateSelect(builder->CreateICmpSGT(needed, doubled), needed, doubled);
+    llvm::Value *newPtr =
+        builder->CreateCall(llvmCompiler->internalFuncs["reallocate"],
+                            {builder->CreateExtractValue(loadedBuilder, 0), getByteSize(builder, newCapacity)});
+    builder->CreateStore(newPtr, builder->CreateStructGEP(builderType, builderPtr, 0));
+    builder->CreateStore(newCapacity, builder->CreateStructGEP(builderType, builderPtr, 2));
+    builder->CreateBr(mergeBlock);
+
+    builder->SetInsertPoint(mergeBlock);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+static llvm::Function *createBuilderPush(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *builderType = llvmCompiler->internalStructs["builder"];
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), llvmCompiler->internalStructs["string"]}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "push", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *builderPtr = arg++;
+    llvm::Value *str = spillString(llvmCompiler, builder, arg);
+    llvm::Value *strSize = getStringSize(llvmCompiler, builder, str);
+
+    builder->CreateCall(llvmCompiler->internalFuncs["builderReserve"], {builderPtr, strSize});
+
+    llvm::Value *loadedBuilder = builder->CreateLoad(builderType, builderPtr);
+    llvm::Value *size = builder->CreateExtractValue(loadedBuilder, 1);
+    llvm::Value *endPtr =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), builder->CreateExtractValue(loadedBuilder, 0), size);
+    builder->CreateMemCpy(endPtr, llvm::MaybeAlign(1), getStringData(llvmCompiler, builder, str), llvm::MaybeAlign(1),
+                          strSize);
+    builder->CreateStore(builder->CreateAdd(size, strSize), builder->CreateStructGEP(builderType, builderPtr, 1));
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+// Formats the value straight into the buffer, the first snprintf only measures it
+static llvm::Function *createBuilderPushFormatted(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder,
+                                                  std::string name, llvm::Type *valueType, std::string format) {
+    llvm::StructType *builderType = llvmCompiler->internalStructs["builder"];
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), valueType}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, name, *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *builderPtr = arg++;
+    llvm::Value *value = arg;
+
+    llvm::Value *formatPtr = builder->CreateGlobalStringPtr(format);
+    llvm::Value *nullPtr = llvm::Constant::getNullValue(builder->getPtrTy());
+    llvm::Value *formattedSize = builder->CreateSExt(
+        builder->CreateCall(llvmCompiler->libraryFuncs["snprintf"], {nullPtr, builder->getInt64(0), formatPtr, value}),
+        builder->getInt64Ty());
+    // snprintf always writes a terminator
+    llvm::Value *bufferSize = builder->CreateAdd(formattedSize, builder->getInt64(1));
+    builder->CreateCall(llvmCompiler->internalFuncs["builderReserve"], {builderPtr, bufferSize});
+
+    llvm::Value *loadedBuilder = builder->CreateLoad(builderType, builderPtr);
+    llvm::Value *size = builder->CreateExtractValue(loadedBuilder, 1);
+    llvm::Value *endPtr =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), builder->CreateExtractValue(loadedBuilder, 0), size);
+    builder->CreateCall(llvmCompiler->libraryFuncs["snprintf"],
+                        {endPtr, getByteSize(builder, bufferSize), formatPtr, value});
+    builder->CreateStore(builder->CreateAdd(size, formattedSize), builder->CreateStructGEP(builderType, builderPtr, 1));
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+static llvm::Function *createBuild(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *builderType = llvmCompiler->internalStructs["builder"];
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmCompiler->internalStructs["string"], {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "build", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *loadedBuilder = builder->CreateLoad(builderType, function->arg_begin());
+    llvm::Value *size = builder->CreateExtractValue(loadedBuilder, 1);
+
+    // Copy out so the builder can keep being pushed to
+    builder->CreateRet(builder->CreateCall(llvmCompiler->internalFuncs["newString"],
+                                           {builder->CreateExtractValue(loadedBuilder, 0), size}));
+
+    return function;
+}
+
+static llvm::Function *createDropBuilder(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *builderType = llvmCompiler->internalStructs["builder"];
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "dropBuilder", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Value *builderPtr = function->arg_begin();
+    llvm::Value *bufferPtr = builder->CreateStructGEP(builderType, builderPtr, 0);
+    llvm::Value *buffer = builder->CreateLoad(builder->getPtrTy(), bufferPtr);
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {buffer});
+    builder->CreateStore(llvm::Constant::getNullValue(builderType), builderPtr);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+static llvm::Function *createNewGrid(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *gridType = llvmCompiler->internalStructs["grid"];
+    llvm::FunctionType *funcType = llvm::FunctionType::get(
+        gridType, {llvmBuilder->getInt32Ty(), llvmBuilder->getInt32Ty(), llvmBuilder->getInt32Ty()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "newGrid", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *rows = arg++;
+    llvm::Value *cols = arg++;
+    llvm::Value *itemSize = arg;
+
+    llvm::Value *sizeInBytes = builder->CreateMul(getByteSize(builder, rows, cols), getByteSize(builder, itemSize));
+    llvm::Value *data = builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {sizeInBytes});
+    builder->CreateMemSet(data, builder->getInt8(0), sizeInBytes, llvm::MaybeAlign(8));
+
+    llvm::Value *grid = llvm::UndefValue::get(gridType);
+    grid = builder->CreateInsertValue(grid, data, 0);
+    grid = builder->CreateInsertValue(grid, rows, 1);
+    grid = builder->CreateInsertValue(grid, cols, 2);
+    builder->CreateRet(grid);
+
+    return function;
+}
+
+static llvm::Function *createCopyGrid(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *gridType = llvmCompiler->internalStructs["grid"];
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(gridType, {llvmBuilder->getPtrTy(), llvmBuilder->getInt32Ty()}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "copyGrid", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *grid = builder->CreateLoad(gridType, arg++);
+    llvm::Value *itemSize = arg;
+
+    llvm::Value *rows = builder->CreateExtractValue(grid, 1);
+    llvm::Value *cols = builder->CreateExtractValue(grid, 2);
+    llvm::Value *sizeInBytes = builder->CreateMul(getByteSize(builder, rows, cols), getByteSize(builder, itemSize));
+    llvm::Value *data = builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {sizeInBytes});
+    builder->CreateMemCpy(data, llvm::MaybeAlign(8), builder->CreateExtractValue(grid, 0), llvm::MaybeAlign(8),
+                          sizeInBytes);
+    builder->CreateRet(builder->CreateInsertValue(grid, data, 0));
+
+    return function;
+}
+
+// Rows are contiguous so a row is copied with a single memmove, dst and src may be the same grid
+static llvm::Function *createCopyGridRow(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+    llvm::StructType *gridType = llvmCompiler->internalStructs["grid"];
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getVoidTy(),
+                                {llvmBuilder->getPtrTy(), llvmBuilder->getInt32Ty(), llvmBuilder->getPtrTy(),
+                                 llvmBuilder->getInt32Ty(), llvmBuilder->getInt32Ty(), llvmBuilder->getInt32Ty()},
+                                false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "copyGridRow", *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *dst = builder->CreateLoad(gridType, arg++);
+    llvm::Value *dstRow = arg++;
+    llvm::Value *src = builder->CreateLoad(gridType, arg++);
+    llvm::Value *srcRow = arg++;
+    llvm::Value *itemSize = arg++;
+    llvm::Value *line = arg;
+
+    llvm::Value *cols = builder->CreateExtractValue(dst, 2);
+    // Unsigned compares catch negative rows as well
+    llvm::Value *outOfBounds = builder->CreateOr(builder->CreateICmpUGE(dstRow, builder->CreateExtractValue(dst, 1)),
+                                                 builder->CreateICmpUGE(srcRow, builder->CreateExtractValue(src, 1)));
+    outOfBounds = builder->CreateOr(outOfBounds, builder->CreateICmpNE(cols, builder->CreateExtractValue(src, 2)));
+    checkRuntimeError(llvmCompiler, builder, outOfBounds, COPY_ROW_ERROR, line, {srcRow, dstRow});
+
+    // A row's offset can pass what an i32 holds in a large grid, the byte offsets are computed in i64
+    llvm::Type *i64 = builder->getInt64Ty();
+    llvm::Value *rowSize = builder->CreateMul(builder->CreateSExt(cols, i64), builder->CreateSExt(itemSize, i64));
+    llvm::Value *dstPtr =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), builder->CreateExtractValue(dst, 0),
+                                   builder->CreateMul(builder->CreateSExt(dstRow, i64), rowSize));
+    llvm::Value *srcPtr =
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), builder->CreateExtractValue(src, 0),
+                                   builder->CreateMul(builder->CreateSExt(srcRow, i64), rowSize));
+    builder->CreateMemMove(dstPtr, llvm::MaybeAlign(1), srcPtr, llvm::MaybeAlign(1), rowSize);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+static llvm::Function *createFillGrid(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder,
+                                      llvm::Type *itemType, std::string name) {
+    llvm::StructType *gridType = llvmCompiler->internalStructs["grid"];
+    llvm::FunctionType *funcType =
+        llvm::FunctionType::get(llvmBuilder->getVoidTy(), {llvmBuilder->getPtrTy(), itemType}, false);
+    llvm::Function *function =
+        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, name, *llvmCompiler->module);
+    llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "entry", function);
+    llvm::IRBuilder<> *builder = new llvm::IRBuilder<>(entryBlock);
+
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *grid = builder->CreateLoad(gridType, arg++);
+    llvm::Value *value = arg;
+    llvm::Value *data = builder->CreateExtractValue(grid, 0);
+    llvm::Type *i64 = builder->getInt64Ty();
+    llvm::Value *rows = builder->CreateSExt(builder->CreateExtractValue(grid, 1), i64);
+    llvm::Value *size = builder->CreateMul(rows, builder->CreateSExt(builder->CreateExtractValue(grid, 2), i64));
+
+    llvm::AllocaInst *loopVariable = builder->CreateAlloca(builder->getInt64Ty(), nullptr);
+    builder->CreateStore(builder->getInt64(0), loopVariable);
+
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", function);
+    llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", function);
+
+    builder->CreateBr(headerBlock);
+    builder->SetInsertPoint(headerBlock);
+    builder->CreateCondBr(builder->CreateICmpSLT(builder->CreateLoad(builder->getInt64Ty(), loopVariable), size),
+                          bodyBlock, exitBlock);
+
+    builder->SetInsertPoint(bodyBlock);
+    llvm::Value *loadedLoopVariable = builder->CreateLoad(builder->getInt64Ty(), loopVariable);
+    builder->CreateStore(value, builder->CreateInBoundsGEP(itemType, data, loadedLoopVariable));
+    builder->CreateStore(builder->CreateAdd(loadedLoopVariable, builder->getInt64(1)), loopVariable);
+    builder->CreateBr(headerBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    builder->CreateRetVoid();
+
+    return function;
+}
+
+void addInternalFuncs(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *llvmBuilder) {
+
+    llvmCompiler->internalFuncs = {};
+    llvmCompiler->internalFuncs["runtimeError"] = createRuntimeError(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["allocate"] = createAllocate(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["inArena"] = createInArena(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["reallocate"] = createReallocate(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["release"] = createRelease(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["enterRegion"] = createEnterRegion(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["exitRegion"] = createExitRegion(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["newString"] = createNewString(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["concatStrings"] = createConcatStrings(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["hashStr"] = createHashStr(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["strEquals"] = createStrEquals(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["dropString"] = createDropString(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["dropArray"] = createDropArray(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["unshareString"] = createUnshareString(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["shareString"] = createShareString(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["sliceString"] = createSliceString(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["shareArray"] = createShareArray(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["shareItems"] = createShareItems(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["unshareArray"] = createUnshareArray(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["sliceArray"] = createSliceArray(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["internGrow"] = createInternGrow(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["internStr"] = createInternStr(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["intern"] = createIntern(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["findStrKey"] = createFindStrKey(llvmCompiler);
+    llvmCompiler->internalFuncs["indexStrMap"] = createIndexStrMap(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["findIntKey"] = createFindIntKey(llvmCompiler);
+    llvmCompiler->internalFuncs["indexIntMap"] = createIndexIntMap(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["strKeyExists"] = createStrKeyExists(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["intKeyExists"] = createIntKeyExists(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["len"] = createLen(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["keys"] = createGetKeys(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["values"] = createGetValues(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["cString"] = createCString(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["readfile"] = createReadFile(llvmCompiler, llvmBuilder);
+
+    llvmCompiler->internalFuncs["hashInt"] = createHashInt(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["setInit"] = createSetInit(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["setCopy"] = createSetCopy(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["dropSet"] = createDropSet(llvmCompiler, llvmBuilder);
+    for (bool strItems : {false, true}) {
+        std::string suffix = strItems ? "Str" : "Int";
+        llvmCompiler->internalFuncs["setProbe" + suffix] = createSetProbe(llvmCompiler, llvmBuilder, strItems);
+        llvmCompiler->internalFuncs["setGrow" + suffix] = createSetGrow(llvmCompiler, llvmBuilder, strItems);
+        llvmCompiler->internalFuncs["setInsert" + suffix] = createSetInsert(llvmCompiler, llvmBuilder, strItems);
+        llvmCompiler->internalFuncs["setContains" + suffix] = createSetContains(llvmCompiler, llvmBuilder, strItems);
+        llvmCompiler->internalFuncs["setRemove" + suffix] = createSetRemove(llvmCompiler, llvmBuilder, strItems);
+        llvmCompiler->internalFuncs["setUnion" + suffix] =
+            createSetBulkOp(llvmCompiler, llvmBuilder, strItems, SET_UNION, "setUnion" + suffix);
+        llvmCompiler->internalFuncs["setIntersection" + suffix] =
+            createSetBulkOp(llvmCompiler, llvmBuilder, strItems, SET_INTERSECTION, "setIntersection" + suffix);
+        llvmCompiler->internalFuncs["setDifference" + suffix] =
+            createSetBulkOp(llvmCompiler, llvmBuilder, strItems, SET_DIFFERENCE, "setDifference" + suffix);
+        llvmCompiler->internalFuncs["setElements" + suffix] = createSetElements(llvmCompiler, llvmBuilder, strItems);
+    }
+
+    llvmCompiler->internalFuncs["builder"] = createNewBuilder(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["builderReserve"] = createBuilderReserve(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["push"] = createBuilderPush(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["push_int"] =
+        createBuilderPushFormatted(llvmCompiler, llvmBuilder, "push_int", llvmBuilder->getInt32Ty(), "%d");
+    llvmCompiler->internalFuncs["push_double"] =
+        createBuilderPushFormatted(llvmCompiler, llvmBuilder, "push_double", llvmBuilder->getDoubleTy(), "%lf");
+    llvmCompiler->internalFuncs["build"] = createBuild(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["dropBuilder"] = createDropBuilder(llvmCompiler, llvmBuilder);
+
+    llvmCompiler->internalFuncs["newGrid"] = createNewGrid(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["copyGrid"] = createCopyGrid(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["copyGridRow"] = createCopyGridRow(llvmCompiler, llvmBuilder);
+    llvmCompiler->internalFuncs["fillGridInt"] =
+        createFillGrid(llvmCompiler, llvmBuilder, llvmBuilder->getInt32Ty(), "fillGridInt");
+    llvmCompiler->internalFuncs["fillGridDouble"] =
+        createFillGrid(llvmCompiler, llvmBuilder, llvmBuilder->getDoubleTy(), "fillGridDouble");
+    llvmCompiler->internalFuncs["fillGridBool"] =
+        createFillGrid(llvmCompiler, llvmBuilder, llvmBuilder->getInt1Ty(), "fillGridBool");
+}
+
+void addLibraryFuncs(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder) {
+    llvmCompiler->libraryFuncs = {};
+
+    std::vector<llvm::Type *> args = {builder->getPtrTy()};
+    llvm::FunctionType *type = llvm::FunctionType::get(builder->getVoidTy(), args, true);
+    llvm::FunctionCallee func = llvmCompiler->module->getOrInsertFunction("printf", type);
+    llvmCompiler->libraryFuncs["printf"] = func;
+
+    // Sizes and offsets are size_t and long
+    args = {builder->getInt64Ty()};
+    type = llvm::FunctionType::get(builder->getPtrTy(), args, false);
+    func = llvmCompiler->module->getOrInsertFunction("malloc", type);
+    llvmCompiler->libraryFuncs["malloc"] = func;
+
+    args = {builder->getPtrTy(), builder->getInt64Ty()};
+    type = llvm::FunctionType::get(builder->getPtrTy(), args, false);
+    func = llvmCompiler->module->getOrInsertFunction("realloc", type);
+    llvmCompiler->libraryFuncs["realloc"] = func;
+
+    args = {builder->getPtrTy()};
+    type = llvm::FunctionType::get(builder->getVoidTy(), args, false);
+    func = llvmCompiler->module->getOrInsertFunction("free", type);
+    llvmCompiler->libraryFuncs["free"] = func;
+
+    args = {builder->getPtrTy(), builder->getInt64Ty(), builder->getPtrTy()};
     type = llvm::FunctionType::get(builder->getInt32Ty(), args, true);
+    func = llvmCompiler->module->getOrInsertFunction("snprintf", type);
+    llvmCompiler->libraryFuncs["snprintf"] = func;
+
+    args = {builder->getPtrTy(), builder->getPtrTy(), builder->getInt64Ty()};
+    type = llvm::FunctionType::get(builder->getInt32Ty(), args, false);
+    func = llvmCompiler->module->getOrInsertFunction("memcmp", type);
+    llvmCompiler->libraryFuncs["memcmp"] = func;
+
+    args = {builder->getInt32Ty()};
+    type = llvm::FunctionType::get(builder->getVoidTy(), args, true);
+    func = llvmCompiler->module->getOrInsertFunction("exit", type);
+    llvmCompiler->libraryFuncs["exit"] = func;
+
+    args = {builder->getPtrTy(), builder->getPtrTy()};
+    type = llvm::FunctionType::get(builder->getPtrTy(), args, true);
+    func = llvmCompiler->module->getOrInsertFunction("fopen", type);
+    llvmCompiler->libraryFuncs["fopen"] = func;
+
+    args = {builder->getPtrTy(), builder->getInt64Ty(), builder->getInt32Ty()};
+    type = llvm::FunctionType::get(builder->getInt32Ty(), args, false);
+    func = llvmCompiler->module->getOrInsertFunction("fseek", type);
+    llvmCompiler->libraryFuncs["fseek"] = func;
+
+    args = {builder->getPtrTy()};
+    type = llvm::FunctionType::get(builder->getInt64Ty(), args, false);
+    func = llvmCompiler->module->getOrInsertFunction("ftell", type);
+    llvmCompiler->libraryFuncs["ftell"] = func;
+
+    args = {builder->getPtrTy(), builder->getInt64Ty(), builder->getInt64Ty(), builder->getPtrTy()};
+    type = llvm::FunctionType::get(builder->getInt64Ty(), args, false);
     func = llvmCompiler->module->getOrInsertFunction("fread", type);
     llvmCompiler->libraryFuncs["fread"] = func;
 
@@ -456,9 +2649,32 @@ void addLibraryFuncs(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder) {
 void addInternalStructs(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder) {
     llvmCompiler->internalStructs = {};
 
-    std::vector<llvm::Type *> fieldTypes = {builder->getPtrTy(), builder->getInt32Ty()};
+    // data, size, reference count
+    // The reference count is null while the data has a single owner
+    std::vector<llvm::Type *> fieldTypes = {builder->getPtrTy(), builder->getInt64Ty(), builder->getPtrTy()};
     llvmCompiler->internalStructs["array"] = llvm::StructType::create(fieldTypes, "array");
 
+    // data, size, hash, inline buffer
+    // data is null when the contents fit in the inline buffer, data and size line up with array so len works on both
+    // A hash of 0 means it hasn't been computed yet
+    fieldTypes = {builder->getPtrTy(), builder->getInt64Ty(), builder->getInt32Ty(),
+                  llvm::ArrayType::get(builder->getInt8Ty(), SMALL_STRING_SIZE + 1)};
+    llvmCompiler->internalStructs["string"] = llvm::StructType::create(*llvmCompiler->ctx, fieldTypes, "string");
+
     fieldTypes = {builder->getPtrTy(), builder->getPtrTy()};
     llvmCompiler->internalStructs["map"] = llvm::StructType::create(*llvmCompiler->ctx, fieldTypes, "map");
+
+    // slots, slot states (0 empty, 1 occupied, 2 removed), size, used slots, capacity
+    fieldTypes = {builder->getPtrTy(), builder->getPtrTy(), builder->getInt32Ty(), builder->getInt32Ty(),
+                  builder->getInt32Ty()};
+    llvmCompiler->internalStructs["set"] = llvm::StructType::create(*llvmCompiler->ctx, fieldTypes, "set");
+
+    // buffer, size, capacity
+    fieldTypes = {builder->getPtrTy(), builder->getInt64Ty(), builder->getInt64Ty()};
+    llvmCompiler->internalStructs["builder"] = llvm::StructType::create(*llvmCompiler->ctx, fieldTypes, "builder");
+
+    // data, rows, cols
+    // Items are stored row major in one buffer, a row is cols items long
+    fieldTypes = {builder->getPtrTy(), builder->getInt32Ty(), builder->getInt32Ty()};
+    llvmCompiler->internalStructs["grid"] = llvm::StructType::create(*llvmCompiler->ctx, fieldTypes, "grid");
 }
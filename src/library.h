@@ -1,5 +1,29 @@
 #include "llvm.h"
 
+// Strings up to this size are stored in the string header instead of on the heap
+#define SMALL_STRING_SIZE 15
+
+llvm::Value *getStringData(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *stringPtr);
+llvm::Value *getStringSharedFlag(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *stringPtr);
+llvm::Value *getByteSize(llvm::IRBuilder<> *builder, llvm::Value *count, llvm::Value *itemSize = nullptr);
+// {count, size of the whole buffer, where the whole buffer starts}
+llvm::StructType *getRefsType(llvm::IRBuilder<> *builder);
+
+// What a runtime check failed on, the error handler has a message for each
+enum RuntimeError { INDEX_ERROR, GRID_INDEX_ERROR, KEY_ERROR, SLICE_ERROR, COPY_ROW_ERROR, LENGTH_ERROR };
+
+// What the boxes of an array hold, two bits for every level. The items of an array of arrays are in the bits above
+enum ItemKind { PLAIN_ITEMS, STR_ITEMS, ARRAY_ITEMS };
+#define ITEM_KIND_BITS 2
+
+// Leaves the builder where 'failed' is false, otherwise the error is reported with its line and the program exits
+void checkRuntimeError(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *failed, RuntimeError error,
+                       llvm::Value *line, std::vector<llvm::Value *> args);
+
+// Allocations between these go on the heap even inside a region, for values that outlive it
+llvm::Value *suspendRegions(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder);
+void resumeRegions(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder, llvm::Value *depth);
+
 void addInternalFuncs(LLVMCompiler *llvmCompiler, llvm::IRBuilder<>* builder);
 void addLibraryFuncs(LLVMCompiler *llvmCompiler, llvm::IRBuilder<> *builder);
 void addInternalStructs(LLVMCompiler * llvmCompiler, llvm::IRBuilder<>* builder);
@@ -15,20 +15,38 @@ static llvm::Type *lookupArrayItemType(Variable *var) {
     case INT_VAR: {
         return builder->getInt32Ty();
     }
+    case I64_VAR: {
+        return builder->getInt64Ty();
+    }
+    case U8_VAR: {
+        return builder->getInt8Ty();
+    }
+    case I16_VAR: {
+        return builder->getInt16Ty();
+    }
+    case U32_VAR: {
+        return builder->getInt32Ty();
+    }
     case BOOL_VAR: {
         return builder->getInt1Ty();
     }
     case STR_VAR: {
         return builder->getInt8Ty();
     }
+    case FLOAT_VAR: {
+        return builder->getFloatTy();
+    }
     case DOUBLE_VAR: {
         return builder->getDoubleTy();
     }
     case ARRAY_VAR: {
         ArrayVariable *arrayVariable = (ArrayVariable *)var;
-        if (arrayVariable->items->type == ARRAY_VAR || arrayVariable->items->type == STR_VAR) {
+        if (arrayVariable->items->type == ARRAY_VAR) {
             return llvmCompiler->internalStructs["array"];
         }
+        if (arrayVariable->items->type == STR_VAR) {
+            return llvmCompiler->internalStructs["string"];
+        }
         return lookupArrayItemType(arrayVariable->items);
     }
     case STRUCT_VAR: {
@@ -41,6 +59,15 @@ static llvm::Type *lookupArrayItemType(Variable *var) {
     case MAP_VAR: {
         return llvmCompiler->internalStructs["map"];
     }
+    case SET_VAR: {
+        return llvmCompiler->internalStructs["set"];
+    }
+    case BUILDER_VAR: {
+        return llvmCompiler->internalStructs["builder"];
+    }
+    case GRID_VAR: {
+        return llvmCompiler->internalStructs["grid"];
+    }
     default: {
     }
     }
@@ -83,6 +110,21 @@ static llvm::Type *getTypeFromVariable(Variable *itemType) {
         case INT_VAR: {
             return builder->getInt32Ty();
         }
+        case I64_VAR: {
+            return builder->getInt64Ty();
+        }
+        case U8_VAR: {
+            return builder->getInt8Ty();
+        }
+        case I16_VAR: {
+            return builder->getInt16Ty();
+        }
+        case U32_VAR: {
+            return builder->getInt32Ty();
+        }
+        case FLOAT_VAR: {
+            return builder->getFloatTy();
+        }
         case DOUBLE_VAR: {
             return builder->getDoubleTy();
         }
@@ -93,7 +135,7 @@ static llvm::Type *getTypeFromVariable(Variable *itemType) {
             return llvmCompiler->internalStructs["array"];
         }
         case STR_VAR: {
-            return llvmCompiler->internalStructs["array"];
+            return llvmCompiler->internalStructs["string"];
         }
         case STRUCT_VAR: {
             StructVariable *structVar = (StructVariable *)itemType;
@@ -102,6 +144,15 @@ static llvm::Type *getTypeFromVariable(Variable *itemType) {
         case MAP_VAR: {
             return llvmCompiler->internalStructs["map"];
         }
+        case SET_VAR: {
+            return llvmCompiler->internalStructs["set"];
+        }
+        case BUILDER_VAR: {
+            return llvmCompiler->internalStructs["builder"];
+        }
+        case GRID_VAR: {
+            return llvmCompiler->internalStructs["grid"];
+        }
         default: {
         }
         }
@@ -109,14 +160,14 @@ static llvm::Type *getTypeFromVariable(Variable *itemType) {
     return nullptr;
 }
 
-void initCompiler(std::vector<std::map<std::string, Variable *>> variables) {
+void initCompiler(std::vector<std::map<std::string, Variable *>> variables, bool unchecked) {
     llvmCompiler = new LLVMCompiler;
     llvmCompiler->variables = variables;
+    llvmCompiler->unchecked = unchecked;
     llvmCompiler->ctx = new llvm::LLVMContext();
     llvmCompiler->module = new llvm::Module("Bonobo", *llvmCompiler->ctx);
     llvmCompiler->callableFunctions = std::vector<llvm::Function *>();
     llvmCompiler->structs = std::map<std::string, LLVMStruct *>();
-    llvmCompiler->strings = {};
 
     llvm::FunctionType *funcType = llvm::FunctionType::get(llvm::Type::getInt32Ty(*llvmCompiler->ctx), false);
     llvmFunction = new LLVMFunction(nullptr, funcType, "main", {}, llvmCompiler->ctx, llvmCompiler->module);
@@ -126,8 +177,13 @@ void initCompiler(std::vector<std::map<std::string, Variable *>> variables) {
     addInternalFuncs(llvmCompiler, builder);
 }
 
+static void releaseSlots(int from);
+
+// Main's locals are released before it returns like any other function's
 static void endCompiler() {
+    releaseSlots(0);
     builder->CreateRet(builder->getInt32(0));
+    llvmFunction->allocaPoint->eraseFromParent();
 
     std::error_code errorCode;
     llvm::raw_fd_ostream outLL("./out.ll", errorCode);
@@ -141,10 +197,19 @@ static void endCompiler() {
     }
 }
 
-llvm::Value *callMalloc(llvm::Value *size) { return builder->CreateCall(llvmCompiler->libraryFuncs["malloc"], {size}); }
+// Loops reuse the slot instead of growing the stack and mem2reg can promote it. Whatever's stored in it is written
+// where the slot is used, every time that runs
+static llvm::AllocaInst *createEntryAlloca(llvm::Type *type, std::string name = "") {
+    llvm::IRBuilder<> entryBuilder(llvmFunction->allocaPoint);
+    return entryBuilder.CreateAlloca(type, nullptr, name);
+}
+
+llvm::Value *callMalloc(llvm::Value *size) {
+    return builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {getByteSize(builder, size)});
+}
 
 llvm::Value *callMalloc(int size) {
-    return builder->CreateCall(llvmCompiler->libraryFuncs["malloc"], {builder->getInt32(size)});
+    return builder->CreateCall(llvmCompiler->internalFuncs["allocate"], {builder->getInt64(size)});
 }
 
 static bool nameIsAlreadyDeclared(std::string name) {
@@ -173,20 +238,33 @@ static bool nameIsAlreadyDeclared(std::string name) {
     return false;
 }
 
-// Returns true if you return inside of the branch
+static void releaseTemporaries();
+
+// Returns true if you return inside of the branch. What's declared in it is released when it ends, a break releases
+// everything the loop body and the branches inside it declared and a return releases it all anyway
 static bool compileIfBranch(std::vector<Stmt *> branch) {
+    std::vector<int> &branches = llvmFunction->branches;
+    branches.push_back(llvmFunction->released.size());
+    bool returned = false;
     for (auto &stmt : branch) {
         if (stmt->type == BREAK_STMT) {
+            releaseSlots(branches[llvmFunction->exitBlock->branches]);
             llvmFunction->broke = true;
             builder->CreateBr(llvmFunction->exitBlock->exitBlock);
+            branches.pop_back();
             return false;
         }
         compileStatement(stmt);
         if (stmt->type == RETURN_STMT) {
-            return true;
+            returned = true;
+            break;
         }
     }
-    return false;
+    if (!returned) {
+        releaseSlots(branches.back());
+    }
+    branches.pop_back();
+    return returned;
 }
 
 static void enterMergeBlock(bool returned, llvm::BasicBlock *mergeBlock) {
@@ -199,24 +277,87 @@ static void enterMergeBlock(bool returned, llvm::BasicBlock *mergeBlock) {
 
 static void enterElseBlock(bool returned, llvm::BasicBlock *elseBlock, llvm::BasicBlock *mergeBlock) {}
 
+// Arrays, maps, structs, sets and grids are too big to copy on every call. A builder's buffer moves when it grows,
+// a copy of the header would be left pointing at the old one
+static bool isPassedByPointer(Variable *var) {
+    return var && (var->type == ARRAY_VAR || var->type == MAP_VAR || var->type == STRUCT_VAR || var->type == SET_VAR ||
+                   var->type == GRID_VAR || var->type == BUILDER_VAR);
+}
+
+// The slot holds the caller's header, so the items and buffers are the caller's and only the header is copied back
+static void enterRefArguments(FuncStmt *funcStmt, std::map<std::string, int> &funcArgs) {
+    for (auto &param : funcStmt->params) {
+        if (!param->ref) {
+            continue;
+        }
+        llvm::Type *type = getTypeFromVariable(param);
+        llvm::Argument *arg = llvmFunction->function->getArg(funcArgs[param->name]);
+        llvm::AllocaInst *slot = createEntryAlloca(type, param->name);
+        builder->CreateStore(builder->CreateLoad(type, arg), slot);
+        llvmFunction->scopedVariables.back().push_back(slot);
+        llvmFunction->refArguments.push_back({slot, arg});
+        llvmFunction->functionArguments.erase(param->name);
+    }
+}
+
+// Runs before every return, after the returned value is read
+static void storeRefArguments() {
+    for (auto &refArgument : llvmFunction->refArguments) {
+        llvm::AllocaInst *slot = refArgument.first;
+        builder->CreateStore(builder->CreateLoad(slot->getAllocatedType(), slot), refArgument.second);
+    }
+}
+
 static llvm::IRBuilder<> *enterFuncScope(FuncStmt *funcStmt) {
+    // Ret type, aggregates are written to memory the caller passes as the first argument
+    llvm::Type *returnType = getTypeFromVariable(funcStmt->returnType);
+    if (funcStmt->returnType->type == NIL_VAR) {
+        returnType = builder->getVoidTy();
+    }
+    bool sret = isPassedByPointer(funcStmt->returnType);
+
     // Fix params
-    std::vector<llvm::Type *> params = std::vector<llvm::Type *>(funcStmt->params.size());
+    std::vector<llvm::Type *> params;
     std::map<std::string, int> funcArgs;
+    std::map<std::string, llvm::Type *> pointerArgs;
+    if (sret) {
+        params.push_back(builder->getPtrTy());
+    }
     for (int i = 0; i < funcStmt->params.size(); ++i) {
-        params[i] = getTypeFromVariable(funcStmt->params[i]);
-        funcArgs[funcStmt->params[i]->name] = i;
+        Variable *param = funcStmt->params[i];
+        funcArgs[param->name] = params.size();
+        if (isPassedByPointer(param)) {
+            if (!param->ref) {
+                pointerArgs[param->name] = getTypeFromVariable(param);
+            }
+            params.push_back(builder->getPtrTy());
+        } else {
+            params.push_back(getTypeFromVariable(param));
+        }
     }
 
-    // Ret type
-    llvm::Type *returnType = getTypeFromVariable(funcStmt->returnType);
-
     // Fix func type
-    llvm::FunctionType *funcType = llvm::FunctionType::get(returnType, params, false);
+    llvm::FunctionType *funcType = llvm::FunctionType::get(sret ? builder->getVoidTy() : returnType, params, false);
     llvmFunction =
         new LLVMFunction(llvmFunction, funcType, funcStmt->name, funcArgs, llvmCompiler->ctx, llvmCompiler->module);
+    llvmFunction->pointerArguments = pointerArgs;
+    llvm::Function *function = llvmFunction->function;
+    if (sret) {
+        function->addParamAttr(0, llvm::Attribute::getWithStructRetType(*llvmCompiler->ctx, returnType));
+        function->addParamAttr(0, llvm::Attribute::NoAlias);
+        llvmFunction->returnSlot = function->getArg(0);
+    }
+    for (auto &pointerArg : pointerArgs) {
+        function->addParamAttr(funcArgs[pointerArg.first], llvm::Attribute::ReadOnly);
+    }
+    for (auto &param : funcStmt->params) {
+        if (isPassedByPointer(param)) {
+            function->addParamAttr(funcArgs[param->name], llvm::Attribute::NoCapture);
+        }
+    }
     llvm::IRBuilder<> *prevBuilder = builder;
     builder = new llvm::IRBuilder<>(llvmFunction->entryBlock);
+    enterRefArguments(funcStmt, funcArgs);
     return prevBuilder;
 }
 
@@ -231,38 +372,216 @@ static llvm::Function *lookupFunction(std::string name) {
     return llvmFunction->function->getName() == name ? llvmFunction->function : nullptr;
 }
 
-static void callAppend(llvm::Value *arrayArgPtr, llvm::Value *valueArg) {
+static LLVMStruct *lookupStructByType(llvm::Type *type) {
+    for (auto &strukt : llvmCompiler->structs) {
+        if (strukt.second->structType == type) {
+            return strukt.second;
+        }
+    }
+    return nullptr;
+}
+
+static bool isUserStructTy(llvm::Type *type) { return lookupStructByType(type) != nullptr; }
+
+// Columns are placed by decreasing alignment, that keeps every column aligned whatever the size of the array
+static void layoutColumns(LLVMStruct *strukt) {
+    const llvm::DataLayout &dataLayout = llvmCompiler->module->getDataLayout();
+    strukt->soa = true;
+    strukt->columnOffsets = std::vector<uint32_t>(strukt->fields.size());
+    for (uint32_t alignment = 16; alignment > 0; alignment /= 2) {
+        for (int i = 0; i < strukt->fields.size(); ++i) {
+            llvm::Type *fieldType = strukt->structType->getElementType(i);
+            if (dataLayout.getABITypeAlign(fieldType).value() == alignment) {
+                strukt->columnOffsets[i] = strukt->columnStride;
+                strukt->columnOrder.push_back(i);
+                strukt->columnStride += dataLayout.getTypeAllocSize(fieldType);
+            }
+        }
+    }
+}
+
+static LLVMStruct *lookupSoaStruct(Variable *var) {
+    if (var == nullptr || var->type != ARRAY_VAR || ((ArrayVariable *)var)->items->type != STRUCT_VAR) {
+        return nullptr;
+    }
+    std::string structName = ((StructVariable *)((ArrayVariable *)var)->items)->structName;
+    if (llvmCompiler->structs.count(structName) && llvmCompiler->structs[structName]->soa) {
+        return llvmCompiler->structs[structName];
+    }
+    return nullptr;
+}
+
+static int lookupStructField(LLVMStruct *strukt, std::string field) {
+    for (int i = 0; i < strukt->fields.size(); i++) {
+        if (strukt->fields[i] == field) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Columns are laid out for the next power of two items, an append only moves them when the size crosses one
+static llvm::Value *getSoaCapacity(llvm::Value *size) {
+    size = builder->CreateZExtOrTrunc(size, builder->getInt64Ty());
+    llvm::Value *leadingZeros =
+        builder->CreateBinaryIntrinsic(llvm::Intrinsic::ctlz, builder->CreateSub(size, builder->getInt64(1)),
+                                       builder->getFalse());
+    llvm::Value *capacity =
+        builder->CreateShl(builder->getInt64(1), builder->CreateSub(builder->getInt64(64), leadingZeros));
+    return builder->CreateSelect(builder->CreateICmpEQ(size, builder->getInt64(0)), builder->getInt64(0), capacity);
+}
+
+static llvm::Value *getSoaFieldPointer(LLVMStruct *strukt, llvm::Value *data, llvm::Value *size, llvm::Value *index,
+                                       int field) {
+    llvm::Value *columnOffset =
+        getByteSize(builder, getSoaCapacity(size), builder->getInt32(strukt->columnOffsets[field]));
+    llvm::Value *column = builder->CreateInBoundsGEP(builder->getInt8Ty(), data, columnOffset);
+    return builder->CreateInBoundsGEP(strukt->structType->getElementType(field), column, index);
+}
+
+static void storeSoaElement(LLVMStruct *strukt, llvm::Value *data, llvm::Value *size, llvm::Value *index,
+                            llvm::Value *element) {
+    for (int i = 0; i < strukt->fields.size(); ++i) {
+        builder->CreateStore(builder->CreateExtractValue(element, i),
+                             getSoaFieldPointer(strukt, data, size, index, i));
+    }
+}
+
+static llvm::Value *loadSoaElement(LLVMStruct *strukt, llvm::Value *array, llvm::Value *index) {
+    llvm::Value *data = builder->CreateExtractValue(array, 0);
+    llvm::Value *size = builder->CreateExtractValue(array, 1);
+    llvm::Value *element = llvm::UndefValue::get(strukt->structType);
+    for (int i = 0; i < strukt->fields.size(); ++i) {
+        llvm::Value *field = builder->CreateLoad(strukt->structType->getElementType(i),
+                                                 getSoaFieldPointer(strukt, data, size, index, i));
+        element = builder->CreateInsertValue(element, field, i);
+    }
+    return element;
+}
+
+// User structs are stored inline, the other aggregates are stored as pointers
+static llvm::Type *getArrayElementType(llvm::Type *itemType) {
+    if (itemType->isStructTy() && !isUserStructTy(itemType)) {
+        return builder->getPtrTy();
+    }
+    return itemType;
+}
+
+static uint32_t getArrayItemStride(llvm::Type *itemType) {
+    LLVMStruct *strukt = lookupStructByType(itemType);
+    if (strukt && strukt->soa) {
+        return strukt->columnStride;
+    }
+    return llvmCompiler->module->getDataLayout().getTypeAllocSize(getArrayElementType(itemType));
+}
+
+// Strings and arrays are boxed, what the runtime does with the boxes of every level is packed into one int
+static uint32_t getItemKinds(Variable *items) {
+    if (items == nullptr) {
+        return PLAIN_ITEMS;
+    }
+    if (items->type == STR_VAR) {
+        return STR_ITEMS;
+    }
+    ArrayVariable *arrayVar = (ArrayVariable *)items;
+    if (items->type == ARRAY_VAR && arrayVar->fixedSize == 0) {
+        return ARRAY_ITEMS | getItemKinds(arrayVar->items) << ITEM_KIND_BITS;
+    }
+    return PLAIN_ITEMS;
+}
+
+static uint32_t getArrayItemKinds(Variable *var) {
+    return var && var->type == ARRAY_VAR ? getItemKinds(((ArrayVariable *)var)->items) : PLAIN_ITEMS;
+}
+
+// The buffer of a soa array holds its capacity, any other array's only its items
+static llvm::Value *getArraySizeInBytes(llvm::Type *itemType, llvm::Value *arraySize) {
+    LLVMStruct *strukt = lookupStructByType(itemType);
+    if (strukt && strukt->soa) {
+        arraySize = getSoaCapacity(arraySize);
+    }
+    return getByteSize(builder, arraySize, builder->getInt32(getArrayItemStride(itemType)));
+}
+
+// Gives the array its own copy of a shared buffer before it's written to
+static void unshareArray(llvm::Value *arrayPtr, llvm::Type *itemType, Variable *items) {
+    llvm::StructType *arrayType = llvmCompiler->internalStructs["array"];
+    llvm::Value *size = builder->CreateLoad(builder->getInt64Ty(), builder->CreateStructGEP(arrayType, arrayPtr, 1));
+    builder->CreateCall(llvmCompiler->internalFuncs["unshareArray"],
+                        {arrayPtr, getArraySizeInBytes(itemType, size), builder->getInt32(getItemKinds(items))});
+}
+
+// Only grows the buffer when the capacity doesn't fit another item, the columns move up to their offsets for the new
+// capacity then, last column first so none is overwritten
+static llvm::Value *growSoaArray(LLVMStruct *strukt, llvm::Value *arrayPtr, llvm::Value *arraySize,
+                                 llvm::Value *newSize) {
+    llvm::BasicBlock *appendBlock = builder->GetInsertBlock();
+    llvm::BasicBlock *growBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "grow", llvmFunction->function);
+    llvm::BasicBlock *storeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "store", llvmFunction->function);
+    llvm::Value *capacity = getSoaCapacity(newSize);
+    builder->CreateCondBr(builder->CreateICmpNE(getSoaCapacity(arraySize), capacity), growBlock, storeBlock);
+
+    builder->SetInsertPoint(growBlock);
+    llvm::Value *capacityInBytes = getByteSize(builder, capacity, builder->getInt32(strukt->columnStride));
+    llvm::Value *reallocatedPtr =
+        builder->CreateCall(llvmCompiler->internalFuncs["reallocate"], {arrayPtr, capacityInBytes});
+    for (int i = strukt->columnOrder.size() - 1; i >= 0; --i) {
+        int field = strukt->columnOrder[i];
+        uint32_t fieldSize =
+            llvmCompiler->module->getDataLayout().getTypeAllocSize(strukt->structType->getElementType(field));
+        llvm::Value *source = getSoaFieldPointer(strukt, reallocatedPtr, arraySize, builder->getInt32(0), field);
+        llvm::Value *dest = getSoaFieldPointer(strukt, reallocatedPtr, newSize, builder->getInt32(0), field);
+        builder->CreateMemMove(dest, llvm::MaybeAlign(), source, llvm::MaybeAlign(),
+                               getByteSize(builder, arraySize, builder->getInt32(fieldSize)));
+    }
+    builder->CreateBr(storeBlock);
+
+    builder->SetInsertPoint(storeBlock);
+    llvm::PHINode *data = builder->CreatePHI(builder->getPtrTy(), 2);
+    data->addIncoming(arrayPtr, appendBlock);
+    data->addIncoming(reallocatedPtr, growBlock);
+    return data;
+}
+
+static void callAppend(llvm::Value *arrayArgPtr, llvm::Value *valueArg, Variable *items) {
     llvm::Type *itemType = valueArg->getType();
+    uint32_t itemStride = getArrayItemStride(itemType);
+    unshareArray(arrayArgPtr, itemType, items);
 
     llvm::Value *arrayArg = builder->CreateLoad(llvmCompiler->internalStructs["array"], arrayArgPtr);
     llvm::Value *arrayPtr = builder->CreateExtractValue(arrayArg, 0);
 
     llvm::Value *arraySize = builder->CreateExtractValue(arrayArg, 1);
 
-    llvm::Value *newSize = builder->CreateAdd(arraySize, builder->getInt32(1));
-
-    // Call realloc to increase the size of the ptr
-    llvm::Value *reallocatedPtr = builder->CreateCall(llvmCompiler->libraryFuncs["realloc"], {arrayPtr, newSize});
+    llvm::Value *newSize = builder->CreateAdd(arraySize, builder->getInt64(1));
 
-    // Copy over the last item
-    llvm::Value *reallocatedArrayGEP = builder->CreateInBoundsGEP(itemType, reallocatedPtr, arraySize);
-    builder->CreateStore(valueArg, reallocatedArrayGEP);
+    LLVMStruct *strukt = lookupStructByType(itemType);
+    llvm::Value *reallocatedPtr;
+    if (strukt && strukt->soa) {
+        reallocatedPtr = growSoaArray(strukt, arrayPtr, arraySize, newSize);
+        storeSoaElement(strukt, reallocatedPtr, newSize, arraySize, valueArg);
+    } else {
+        // Call realloc to increase the size of the ptr
+        llvm::Value *newSizeInBytes = getByteSize(builder, newSize, builder->getInt32(itemStride));
+        reallocatedPtr = builder->CreateCall(llvmCompiler->internalFuncs["reallocate"], {arrayPtr, newSizeInBytes});
+        // Copy over the last item
+        llvm::Value *reallocatedArrayGEP = builder->CreateInBoundsGEP(itemType, reallocatedPtr, arraySize);
+        builder->CreateStore(valueArg, reallocatedArrayGEP);
+    }
 
     llvm::Value *tmpArr1 = builder->CreateInsertValue(arrayArg, reallocatedPtr, 0);
-    llvm::Value *tmpArr2 = builder->CreateInsertValue(arrayArg, newSize, 1);
+    llvm::Value *tmpArr2 = builder->CreateInsertValue(tmpArr1, newSize, 1);
     builder->CreateStore(tmpArr2, arrayArgPtr);
 }
 
 static llvm::Value *lookupValue(std::string name, int line) {
     if (llvmFunction->enclosing && llvmFunction->functionArguments.count(name)) {
-        int i = 0;
-        for (llvm::Function::arg_iterator arg = llvmFunction->function->arg_begin();
-             arg != llvmFunction->function->arg_end(); ++arg) {
-            if (i == llvmFunction->functionArguments[name]) {
-                return arg;
-            }
-            ++i;
+        llvm::Argument *arg = llvmFunction->function->getArg(llvmFunction->functionArguments[name]);
+        // Read where it's used, the pointer is never written through or kept
+        if (llvmFunction->pointerArguments.count(name)) {
+            return builder->CreateLoad(llvmFunction->pointerArguments[name], arg);
         }
+        return arg;
     }
     for (int i = llvmFunction->scopedVariables.size() - 1; i >= 0; i--) {
         std::vector<llvm::AllocaInst *> scopeVars = llvmFunction->scopedVariables[i];
@@ -277,8 +596,10 @@ static llvm::Value *lookupValue(std::string name, int line) {
     exit(1);
 }
 
+// What the body declared is released at the end of every iteration, a break already released it
 static void compileLoopExit(llvm::BasicBlock *headerBlock, llvm::BasicBlock *exitBlock, Stmt *stmt = nullptr) {
     if (!llvmFunction->broke) {
+        releaseSlots(llvmFunction->branches.back());
         if (stmt != nullptr) {
             compileStatement(stmt);
         }
@@ -286,13 +607,17 @@ static void compileLoopExit(llvm::BasicBlock *headerBlock, llvm::BasicBlock *exi
         builder->CreateBr(headerBlock);
     }
 
+    llvmFunction->branches.pop_back();
     llvmFunction->exitBlock = llvmFunction->exitBlock->prev;
     builder->SetInsertPoint(exitBlock);
 }
 
+// The body opens a branch of its own so a break inside of it releases what the body declared as well
 static void compileLoopBody(llvm::BasicBlock *headerBlock, llvm::BasicBlock *exitBlock, std::vector<Stmt *> body) {
+    llvmFunction->branches.push_back(llvmFunction->released.size());
     for (auto &stmt : body) {
         if (stmt->type == BREAK_STMT) {
+            releaseSlots(llvmFunction->branches.back());
             llvmFunction->broke = true;
             builder->CreateBr(exitBlock);
             break;
@@ -306,15 +631,33 @@ static void compileLoopHeader(llvm::BasicBlock *headerBlock, llvm::BasicBlock *e
     builder->CreateBr(headerBlock);
     builder->SetInsertPoint(headerBlock);
 
-    llvmFunction->exitBlock = new ExitBlock(llvmFunction->exitBlock, exitBlock);
-    builder->CreateCondBr(compileExpression(condition), bodyBlock, exitBlock);
+    llvmFunction->exitBlock = new ExitBlock(llvmFunction->exitBlock, exitBlock, llvmFunction->branches.size());
+    llvm::Value *loopCondition = compileExpression(condition);
+    releaseTemporaries();
+    builder->CreateCondBr(loopCondition, bodyBlock, exitBlock);
     builder->SetInsertPoint(bodyBlock);
 }
 
+// An int stored where an i64 is expected is sign extended, the type pass already rejected anything narrowing
+static llvm::Value *widenInteger(llvm::Value *value, llvm::Type *type) {
+    llvm::Type *valueType = value->getType();
+    llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(value);
+    if (allocaInst) {
+        valueType = allocaInst->getAllocatedType();
+    }
+    if (!type->isIntegerTy(64) || !valueType->isIntegerTy(32)) {
+        return value;
+    }
+    if (allocaInst) {
+        value = builder->CreateLoad(valueType, allocaInst);
+    }
+    return builder->CreateSExt(value, type);
+}
+
 static void storeStructField(llvm::StructType *structType, llvm::Value *structInstance, llvm::Value *toStore,
                              uint field) {
     llvm::Value *gep = builder->CreateStructGEP(structType, structInstance, field);
-    builder->CreateStore(toStore, gep);
+    builder->CreateStore(widenInteger(toStore, structType->getElementType(field)), gep);
 }
 
 static void storeArraySizeInStruct(llvm::Value *size, llvm::Value *arrayInstance) {
@@ -323,6 +666,17 @@ static void storeArraySizeInStruct(llvm::Value *size, llvm::Value *arrayInstance
 
 static void storeArrayInStruct(llvm::Value *arrayToStore, llvm::Value *arrayInstance) {
     storeStructField(llvmCompiler->internalStructs["array"], arrayInstance, arrayToStore, 0);
+    storeStructField(llvmCompiler->internalStructs["array"], arrayInstance,
+                     llvm::Constant::getNullValue(builder->getPtrTy()), 2);
+}
+
+// FNV-1a like hashStr, so literals start out with their hash cached
+static uint32_t hashStringLiteral(std::string literal) {
+    uint32_t hash = 0x811C9DC5;
+    for (unsigned char c : literal) {
+        hash = (hash ^ c) * 0x01000193;
+    }
+    return hash == 0 ? 1 : hash;
 }
 
 static llvm::Value *compileLiteral(LiteralExpr *expr) {
@@ -330,23 +684,41 @@ static llvm::Value *compileLiteral(LiteralExpr *expr) {
     switch (expr->literalType) {
     case STR_LITERAL: {
 
-        llvm::AllocaInst *stringInstance =
-            builder->CreateAlloca(llvmCompiler->internalStructs["array"], nullptr, "string");
-        llvmCompiler->strings.push_back(stringInstance);
+        llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+        llvm::AllocaInst *stringInstance = createEntryAlloca(stringType, "string");
 
-        storeArrayInStruct(builder->CreateGlobalString(stringLiteral), stringInstance);
-        storeArraySizeInStruct(builder->getInt32(stringLiteral.size() + 1), stringInstance);
+        // Short literals are copied into the header, the rest point to a global shared by equal literals
+        llvm::Value *data = llvm::Constant::getNullValue(builder->getPtrTy());
+        if (stringLiteral.size() <= SMALL_STRING_SIZE) {
+            stringLiteral.resize(SMALL_STRING_SIZE + 1, '\0');
+            builder->CreateStore(llvm::ConstantDataArray::getString(*llvmCompiler->ctx, stringLiteral, false),
+                                 builder->CreateStructGEP(stringType, stringInstance, 3));
+        } else {
+            if (!llvmCompiler->stringLiterals.count(stringLiteral)) {
+                llvmCompiler->stringLiterals[stringLiteral] = builder->CreateGlobalString(stringLiteral);
+            }
+            data = llvmCompiler->stringLiterals[stringLiteral];
+            builder->CreateStore(builder->getInt8(1), getStringSharedFlag(llvmCompiler, builder, stringInstance));
+        }
+        storeStructField(stringType, stringInstance, data, 0);
+        storeStructField(stringType, stringInstance, builder->getInt64(expr->literal.size()), 1);
+        storeStructField(stringType, stringInstance, builder->getInt32(hashStringLiteral(expr->literal)), 2);
 
         return stringInstance;
     }
     case INT_LITERAL: {
-        return builder->getInt32(stoi(stringLiteral));
+        // The type pass gives literals the integer type they're used as
+        long long value;
+        if (!parseIntLiteral(stringLiteral, value)) {
+            errorAt(expr->line, ("Integer literal " + stringLiteral + " doesn't fit in an i64").c_str());
+        }
+        return llvm::ConstantInt::get(getTypeFromVariable(expr->evaluatesTo), value, true);
     }
     case BOOL_LITERAL: {
         return stringLiteral == "true" ? builder->getInt1(1) : builder->getInt1(0);
     }
     case DOUBLE_LITERAL: {
-        return llvm::ConstantFP::get(builder->getDoubleTy(), stod(stringLiteral));
+        return llvm::ConstantFP::get(getTypeFromVariable(expr->evaluatesTo), stod(stringLiteral));
     }
     }
 }
@@ -358,7 +730,7 @@ static llvm::Value *loadArrayFromArrayStruct(llvm::Value *arrayPtr) {
 
 static llvm::Value *loadArraySizeFromArrayStruct(llvm::Value *arrayPtr) {
     llvm::Value *ptr = builder->CreateStructGEP(llvmCompiler->internalStructs["array"], arrayPtr, 1);
-    return builder->CreateLoad(builder->getInt32Ty(), ptr);
+    return builder->CreateLoad(builder->getInt64Ty(), ptr);
 }
 
 static llvm::Value *loadAllocaInst(llvm::Value *value) {
@@ -368,20 +740,13 @@ static llvm::Value *loadAllocaInst(llvm::Value *value) {
     return value;
 }
 
-static uint32_t getStructSize(llvm::StructType *structType) {
-    uint32_t size = 0;
-    for (auto &subtype : structType->subtypes()) {
-        size += subtype->isStructTy() ? getStructSize(llvm::dyn_cast<llvm::StructType>(subtype))
-                                      : subtype->getPrimitiveSizeInBits();
+// Scalars are stored by value, only aggregates are passed around as pointers to their allocation
+static llvm::Value *loadScalar(llvm::Value *value) {
+    llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(value);
+    if (allocaInst && !allocaInst->getAllocatedType()->isAggregateType()) {
+        return builder->CreateLoad(allocaInst->getAllocatedType(), allocaInst);
     }
-    return size;
-}
-
-static llvm::Value *getArraySizeInBytes(llvm::Type *itemType, llvm::Value *arraySize) {
-    uint32_t size = itemType->isStructTy() ? size = getStructSize(llvm::dyn_cast<llvm::StructType>(itemType))
-                                           : itemType->getPrimitiveSizeInBits() / 8;
-
-    return builder->CreateMul(arraySize, builder->getInt32(size));
+    return value;
 }
 
 static void copyArray(llvm::AllocaInst *allocaVar, llvm::Value *value, Variable *var) {
@@ -389,58 +754,408 @@ static void copyArray(llvm::AllocaInst *allocaVar, llvm::Value *value, Variable
     llvm::Value *sourceArrayPtr = builder->CreateExtractValue(value, 0);
 
     llvm::Type *itemType = lookupArrayItemType(var);
-    // if the itemType is int8Ty, then no need to get it, it's just sourceArraySize
-    llvm::Value *arraySize =
-        itemType == builder->getInt8Ty() ? sourceArraySize : getArraySizeInBytes(itemType, sourceArraySize);
+    llvm::Value *arraySize = getArraySizeInBytes(itemType, sourceArraySize);
 
     llvm::Value *arrayAllocation = callMalloc(arraySize);
     builder->CreateMemCpy(arrayAllocation, llvm::MaybeAlign(4), sourceArrayPtr, llvm::MaybeAlign(4), arraySize);
+    builder->CreateCall(llvmCompiler->internalFuncs["shareItems"],
+                        {arrayAllocation, sourceArraySize, builder->getInt32(getArrayItemKinds(var))});
 
     storeArrayInStruct(arrayAllocation, allocaVar);
     storeArraySizeInStruct(sourceArraySize, allocaVar);
 }
 
-static void copyAllocation(llvm::AllocaInst *destination, llvm::AllocaInst *source, Variable *var) {
+// The runtime wants a pointer to a set or grid, one that was loaded is stored to the stack again
+static llvm::Value *getAggregatePointer(llvm::Value *aggregate) {
+    if (aggregate->getType()->isPointerTy()) {
+        return aggregate;
+    }
+    llvm::AllocaInst *instance = createEntryAlloca(aggregate->getType());
+    builder->CreateStore(aggregate, instance);
+    return instance;
+}
 
-    if (source->getAllocatedType()->isStructTy() && var->type != STRUCT_VAR) {
-        copyArray(destination, builder->CreateLoad(source->getAllocatedType(), source), var);
-    } else {
-        builder->CreateMemCpy(destination, llvm::MaybeAlign(8), source, llvm::MaybeAlign(8), 16);
+static uint32_t getSetItemSize(Variable *var) {
+    llvm::Type *itemType = getTypeFromVariable(((SetVariable *)var)->items);
+    return llvmCompiler->module->getDataLayout().getTypeAllocSize(itemType);
+}
+
+static void copySet(llvm::Value *destination, llvm::Value *source, Variable *var) {
+    builder->CreateCall(llvmCompiler->internalFuncs["setCopy"],
+                        {destination, source, builder->getInt32(getSetItemSize(var))});
+}
+
+static uint32_t getGridItemSize(Variable *var) {
+    llvm::Type *itemType = getTypeFromVariable(((GridVariable *)var)->items);
+    return llvmCompiler->module->getDataLayout().getTypeAllocSize(itemType);
+}
+
+static void copyGrid(llvm::Value *destination, llvm::Value *source, Variable *var) {
+    builder->CreateStore(
+        builder->CreateCall(llvmCompiler->internalFuncs["copyGrid"], {source, builder->getInt32(getGridItemSize(var))}),
+        destination);
+}
+
+// A builder owns its buffer and appends to it in place, a copy gets a buffer of its own with the same capacity
+static void copyBuilder(llvm::Value *destination, llvm::Value *source) {
+    llvm::StructType *builderType = llvmCompiler->internalStructs["builder"];
+    llvm::Value *loaded = builder->CreateLoad(builderType, source);
+    llvm::Value *size = builder->CreateExtractValue(loaded, 1);
+    llvm::Value *buffer = callMalloc(builder->CreateExtractValue(loaded, 2));
+    builder->CreateMemCpy(buffer, llvm::MaybeAlign(1), builder->CreateExtractValue(loaded, 0), llvm::MaybeAlign(1),
+                          getByteSize(builder, size));
+    builder->CreateStore(builder->CreateInsertValue(loaded, buffer, 0), destination);
+}
+
+static llvm::Value *getStringPointer(llvm::Value *str) {
+    if (str->getType()->isPointerTy()) {
+        return str;
     }
+    llvm::AllocaInst *stringInstance = createEntryAlloca(llvmCompiler->internalStructs["string"], "string");
+    builder->CreateStore(str, stringInstance);
+    return stringInstance;
 }
 
-static void storeArrayAtIndex(llvm::Type *elementType, llvm::Value *value, llvm::Value *arrayPtr, int idx) {
-    if (elementType->isStructTy()) {
-        elementType = builder->getPtrTy();
+static llvm::Value *loadStringSize(llvm::Value *stringPtr) {
+    llvm::Value *sizePtr = builder->CreateStructGEP(llvmCompiler->internalStructs["string"], stringPtr, 1);
+    return builder->CreateLoad(builder->getInt64Ty(), sizePtr);
+}
+
+// Strings and arrays share their buffer with the copy, whichever is written to first makes its own copy
+static void shareString(llvm::Value *destination, llvm::Value *source) {
+    builder->CreateCall(llvmCompiler->internalFuncs["shareString"], {destination, source});
+}
+
+static void shareArray(llvm::Value *destination, llvm::Value *source) {
+    builder->CreateCall(llvmCompiler->internalFuncs["shareArray"], {destination, source});
+}
+
+// Only variables are declared as fixed size arrays
+static bool isFixedArray(Expr *expr) {
+    Variable *var = expr->type == VAR_EXPR ? expr->evaluatesTo : nullptr;
+    return var && var->type == ARRAY_VAR && ((ArrayVariable *)var)->fixedSize > 0;
+}
+
+// The buffer is allocated once in the entry block, the declaration only initialises it
+static llvm::AllocaInst *createFixedArray(VarStmt *varStmt) {
+    ArrayVariable *arrayVar = (ArrayVariable *)varStmt->var;
+    llvm::Type *itemType = getTypeFromVariable(arrayVar->items);
+    llvm::ArrayType *bufferType = llvm::ArrayType::get(itemType, arrayVar->fixedSize);
+    llvm::AllocaInst *buffer = createEntryAlloca(bufferType, "buffer");
+
+    ArrayExpr *arrayExpr = (ArrayExpr *)varStmt->initializer;
+    if (arrayExpr->items.size() < arrayVar->fixedSize) {
+        uint64_t bufferSize = llvmCompiler->module->getDataLayout().getTypeAllocSize(bufferType);
+        builder->CreateMemSet(buffer, builder->getInt8(0), bufferSize, buffer->getAlign());
     }
-    llvm::Value *arrayInboundPtr = builder->CreateInBoundsGEP(elementType, arrayPtr, builder->getInt32(idx));
-    builder->CreateStore(value, arrayInboundPtr);
+    for (int i = 0; i < arrayExpr->items.size(); ++i) {
+        llvm::Value *item = loadAllocaInst(widenInteger(compileExpression(arrayExpr->items[i]), itemType));
+        builder->CreateStore(item, builder->CreateInBoundsGEP(itemType, buffer, builder->getInt32(i)));
+    }
+
+    llvm::AllocaInst *arrayInstance = createEntryAlloca(llvmCompiler->internalStructs["array"], varStmt->var->name);
+    storeArrayInStruct(buffer, arrayInstance);
+    storeArraySizeInStruct(builder->getInt64(arrayVar->fixedSize), arrayInstance);
+    return arrayInstance;
+}
+
+// Callees can't grow or keep a stack buffer, they get a view that's counted as shared so it's copied on write
+static llvm::AllocaInst *shareFixedArray(llvm::AllocaInst *arrayPtr) {
+    llvm::StructType *arrayType = llvmCompiler->internalStructs["array"];
+    llvm::Value *array = builder->CreateLoad(arrayType, arrayPtr);
+    llvm::StructType *refsType = getRefsType(builder);
+    llvm::AllocaInst *refs = createEntryAlloca(refsType);
+    builder->CreateStore(builder->getInt32(2), builder->CreateStructGEP(refsType, refs, 0));
+    builder->CreateStore(builder->CreateExtractValue(array, 1), builder->CreateStructGEP(refsType, refs, 1));
+    builder->CreateStore(builder->CreateExtractValue(array, 0), builder->CreateStructGEP(refsType, refs, 2));
+    llvm::AllocaInst *view = createEntryAlloca(arrayType);
+    builder->CreateStore(builder->CreateInsertValue(array, refs, 2), view);
+    return view;
+}
+
+// Anything that outlives the declaring function gets the items on the heap
+static llvm::AllocaInst *copyFixedArray(llvm::AllocaInst *arrayPtr, Variable *var) {
+    llvm::AllocaInst *arrayInstance = createEntryAlloca(llvmCompiler->internalStructs["array"]);
+    copyArray(arrayInstance, builder->CreateLoad(llvmCompiler->internalStructs["array"], arrayPtr), var);
+    return arrayInstance;
+}
+
+// The source isn't read again, either because of last use analysis or an explicit move
+static bool isMove(Expr *expr) {
+    if (expr->type == VAR_EXPR) {
+        return ((VarExpr *)expr)->lastUse;
+    }
+    return expr->type == CALL_EXPR && ((CallExpr *)expr)->callee == "move";
+}
+
+// Hands the buffer over to a new allocation and leaves the variable empty
+static llvm::Value *moveVariable(llvm::Value *variable) {
+    llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(variable);
+    if (allocaInst == nullptr) {
+        return variable;
+    }
+    llvm::Type *type = allocaInst->getAllocatedType();
+    llvm::AllocaInst *moved = createEntryAlloca(type);
+    builder->CreateStore(builder->CreateLoad(type, allocaInst), moved);
+    builder->CreateStore(llvm::Constant::getNullValue(type), allocaInst);
+    return moved;
 }
 
 static bool isStringTy(llvm::Value *value) {
-    for (auto &str : llvmCompiler->strings) {
-        if (str == value) {
-            return true;
-        }
+    if (llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(value)) {
+        return allocaInst->getAllocatedType() == llvmCompiler->internalStructs["string"];
     }
-    return false;
+    return value->getType() == llvmCompiler->internalStructs["string"];
 }
 
-static llvm::Value *concatStrings(llvm::Value *left, llvm::Value *right) {
-    llvm::StructType *stringStruct = llvmCompiler->internalStructs["array"];
+// Values that were just created and aren't stored anywhere else, they're moved into a variable rather than shared.
+// keys and values hand out the map's own arrays
+static bool isFresh(Expr *expr) {
+    switch (expr->type) {
+    case CALL_EXPR: {
+        std::string callee = ((CallExpr *)expr)->callee;
+        return callee != "keys" && callee != "values";
+    }
+    case BINARY_EXPR:
+    case LITERAL_EXPR:
+    case ARRAY_EXPR:
+    case SLICE_EXPR: {
+        return true;
+    }
+    case VAR_EXPR: {
+        return ((VarExpr *)expr)->copyOut;
+    }
+    default: {
+        return false;
+    }
+    }
+}
+
+// Functions return a copy or a local they gave up, the caller owns it
+static bool isOwnedResult(Expr *expr) {
+    return expr->type == CALL_EXPR && lookupFunction(((CallExpr *)expr)->callee) != nullptr;
+}
+
+// Containers of strings, arrays and maps hold pointers to their headers. A slot is reused every time its statement
+// runs, so the item gets a header of its own on the heap. New values and fixed arrays, which were copied already, are
+// moved into it. A variable shares its buffer with the box. A header that was loaded from somewhere can't count the
+// reference and a temporary is freed after the statement, those are copied
+static llvm::Value *boxItem(llvm::Value *value, Expr *expr) {
+    llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(value);
+    llvm::Type *type = allocaInst ? allocaInst->getAllocatedType() : value->getType();
+    if (!type->isStructTy() || isUserStructTy(type)) {
+        return value;
+    }
+    llvm::StructType *stringType = llvmCompiler->internalStructs["string"];
+    llvm::StructType *arrayType = llvmCompiler->internalStructs["array"];
+    llvm::Value *box = callMalloc(llvmCompiler->module->getDataLayout().getTypeAllocSize(type));
+    bool moved = isFresh(expr) && !expr->dropped || isFixedArray(expr);
+    if (moved || type != stringType && type != arrayType) {
+        builder->CreateStore(allocaInst ? builder->CreateLoad(type, allocaInst) : value, box);
+    } else if (allocaInst && !expr->dropped) {
+        type == stringType ? shareString(box, allocaInst) : shareArray(box, allocaInst);
+    } else if (type == stringType) {
+        llvm::Value *stringPtr = getStringPointer(value);
+        builder->CreateStore(builder->CreateCall(llvmCompiler->internalFuncs["newString"],
+                                                 {getStringData(llvmCompiler, builder, stringPtr),
+                                                  loadStringSize(stringPtr)}),
+                             box);
+    } else {
+        llvm::AllocaInst *copy = createEntryAlloca(arrayType);
+        copyArray(copy, allocaInst ? builder->CreateLoad(arrayType, allocaInst) : value, expr->evaluatesTo);
+        builder->CreateStore(builder->CreateLoad(arrayType, copy), box);
+    }
+    return box;
+}
+
+// An overwritten item gives up what its box held along with the box
+static void dropBox(llvm::Value *box, Variable *items) {
+    if (items->type == STR_VAR) {
+        builder->CreateCall(llvmCompiler->internalFuncs["dropString"], {box});
+    } else if (getItemKinds(items) != PLAIN_ITEMS) {
+        builder->CreateCall(llvmCompiler->internalFuncs["dropArray"],
+                            {box, builder->getInt32(getArrayItemKinds(items))});
+    } else {
+        return;
+    }
+    builder->CreateCall(llvmCompiler->internalFuncs["release"], {box});
+}
+
+// A released variable's slot starts out empty in the entry block, so releasing it before the first store does nothing
+static llvm::AllocaInst *createReleasedSlot(Variable *var, std::string name) {
+    llvm::Type *type = getTypeFromVariable(var);
+    llvm::AllocaInst *slot = createEntryAlloca(type, name);
+    llvm::IRBuilder<> entryBuilder(llvmFunction->allocaPoint);
+    entryBuilder.CreateStore(llvm::Constant::getNullValue(type), slot);
+    llvmFunction->released.push_back(slot);
+    llvmFunction->slotVariables[slot] = var;
+    return slot;
+}
+
+static bool isReleased(llvm::Value *value) {
+    std::vector<llvm::AllocaInst *> &released = llvmFunction->released;
+    return std::find(released.begin(), released.end(), value) != released.end();
+}
+
+// Gives up the reference held in the slot and leaves it empty, a map holds one to both of its arrays and owns their
+// headers. Sets, grids and builders are never shared so they're freed outright
+static void releaseSlot(llvm::AllocaInst *slot) {
+    llvm::Type *type = slot->getAllocatedType();
+    Variable *var = llvmFunction->slotVariables.count(slot) ? llvmFunction->slotVariables[slot] : nullptr;
+    if (type == llvmCompiler->internalStructs["string"]) {
+        builder->CreateCall(llvmCompiler->internalFuncs["dropString"], {slot});
+    } else if (type == llvmCompiler->internalStructs["array"]) {
+        builder->CreateCall(llvmCompiler->internalFuncs["dropArray"],
+                            {slot, builder->getInt32(getArrayItemKinds(var))});
+    } else if (type == llvmCompiler->internalStructs["map"]) {
+        MapVariable *mapVar = var && var->type == MAP_VAR ? (MapVariable *)var : nullptr;
+        for (int field = 0; field < 2; ++field) {
+            llvm::Value *arrayPtr = builder->CreateStructGEP(type, slot, field);
+            llvm::Value *header = builder->CreateLoad(builder->getPtrTy(), arrayPtr);
+            uint32_t items = mapVar ? getItemKinds(field == 0 ? mapVar->keys : mapVar->values) : PLAIN_ITEMS;
+            builder->CreateCall(llvmCompiler->internalFuncs["dropArray"], {header, builder->getInt32(items)});
+            builder->CreateCall(llvmCompiler->internalFuncs["release"], {header});
+        }
+        builder->CreateStore(llvm::Constant::getNullValue(type), slot);
+    } else if (type == llvmCompiler->internalStructs["grid"]) {
+        llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(type, slot, 0));
+        builder->CreateCall(llvmCompiler->internalFuncs["release"], {data});
+        builder->CreateStore(llvm::Constant::getNullValue(type), slot);
+    } else if (type == llvmCompiler->internalStructs["set"]) {
+        builder->CreateCall(llvmCompiler->internalFuncs["dropSet"], {slot});
+    } else if (type == llvmCompiler->internalStructs["builder"]) {
+        builder->CreateCall(llvmCompiler->internalFuncs["dropBuilder"], {slot});
+    }
+}
+
+// The caller owns what's returned. A released variable hands its value over, anything else that isn't new is copied
+static llvm::Value *giveToCaller(Expr *expr, llvm::Value *value) {
+    if (isReleased(value)) {
+        llvm::AllocaInst *slot = (llvm::AllocaInst *)value;
+        value = builder->CreateLoad(slot->getAllocatedType(), slot);
+        builder->CreateStore(llvm::Constant::getNullValue(slot->getAllocatedType()), slot);
+        return value;
+    }
+    if (isFresh(expr)) {
+        return value;
+    }
+    llvm::StructType *arrayType = llvmCompiler->internalStructs["array"];
+    if (isStringTy(value)) {
+        llvm::Value *stringPtr = getStringPointer(value);
+        return builder->CreateCall(llvmCompiler->internalFuncs["newString"],
+                                   {getStringData(llvmCompiler, builder, stringPtr), loadStringSize(stringPtr)});
+    }
+    llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(value);
+    if (value->getType() == arrayType || allocaInst && allocaInst->getAllocatedType() == arrayType) {
+        llvm::AllocaInst *copy = createEntryAlloca(arrayType);
+        copyArray(copy, loadAllocaInst(value), expr->evaluatesTo);
+        return copy;
+    }
+    if (expr->evaluatesTo->type == GRID_VAR) {
+        llvm::AllocaInst *copy = createEntryAlloca(llvmCompiler->internalStructs["grid"]);
+        copyGrid(copy, getAggregatePointer(value), expr->evaluatesTo);
+        return copy;
+    }
+    if (expr->evaluatesTo->type == SET_VAR) {
+        llvm::AllocaInst *copy = createEntryAlloca(llvmCompiler->internalStructs["set"]);
+        copySet(copy, getAggregatePointer(value), expr->evaluatesTo);
+        return copy;
+    }
+    if (expr->evaluatesTo->type == BUILDER_VAR) {
+        llvm::AllocaInst *copy = createEntryAlloca(llvmCompiler->internalStructs["builder"]);
+        copyBuilder(copy, getAggregatePointer(value));
+        return copy;
+    }
+    return value;
+}
+
+// Keeps a value to release later, what a released variable held before it's stored to or a call result nothing kept
+static llvm::AllocaInst *savePrevious(llvm::Value *value, Variable *var) {
+    llvm::AllocaInst *previous = createEntryAlloca(value->getType());
+    builder->CreateStore(value, previous);
+    llvmFunction->slotVariables[previous] = var;
+    return previous;
+}
+
+static void releaseSlots(int from) {
+    for (int i = from; i < llvmFunction->released.size(); ++i) {
+        releaseSlot(llvmFunction->released[i]);
+    }
+}
 
-    llvm::Value *leftSize = loadArraySizeFromArrayStruct(left);
-    llvm::Value *newSize = builder->CreateAdd(leftSize, loadArraySizeFromArrayStruct(right));
+// Runs once the statement that created the temporaries is done with them. A slice taken from one keeps the buffer
+// alive through its reference
+static void releaseTemporaries() {
+    for (auto &temporary : llvmFunction->temporaries) {
+        builder->CreateCall(llvmCompiler->internalFuncs["dropString"], {temporary});
+    }
+    for (auto &result : llvmFunction->results) {
+        releaseSlot(result);
+    }
+    llvmFunction->temporaries.clear();
+    llvmFunction->results.clear();
+}
 
-    llvm::AllocaInst *concStringInstance = builder->CreateAlloca(stringStruct, nullptr, "string");
-    llvm::Value *mallocResult = builder->CreateCall(llvmCompiler->libraryFuncs["malloc"], {newSize});
+// A string value has no header to count the reference in, so it's copied unless it was just created by a call
+static void storeStringValue(llvm::Value *destination, llvm::Value *value, Expr *expr) {
+    if (expr->type != CALL_EXPR) {
+        llvm::Value *stringPtr = getStringPointer(value);
+        value = builder->CreateCall(llvmCompiler->internalFuncs["newString"],
+                                    {getStringData(llvmCompiler, builder, stringPtr), loadStringSize(stringPtr)});
+    }
+    builder->CreateStore(value, destination);
+}
 
-    storeArraySizeInStruct(newSize, concStringInstance);
-    storeArrayInStruct(mallocResult, concStringInstance);
+// The statement reading it runs with the regions suspended, so the copy is on the heap and outlives the region
+static llvm::Value *copyOutOfRegion(llvm::Value *value, Variable *var) {
+    if (var->type == STR_VAR) {
+        llvm::Value *stringPtr = getStringPointer(value);
+        llvm::AllocaInst *copy = createEntryAlloca(llvmCompiler->internalStructs["string"]);
+        builder->CreateStore(builder->CreateCall(llvmCompiler->internalFuncs["newString"],
+                                                 {getStringData(llvmCompiler, builder, stringPtr),
+                                                  loadStringSize(stringPtr)}),
+                             copy);
+        return copy;
+    }
+    llvm::StructType *arrayType = llvmCompiler->internalStructs["array"];
+    llvm::AllocaInst *copy = createEntryAlloca(arrayType);
+    builder->CreateStore(llvm::Constant::getNullValue(arrayType), copy);
+    copyArray(copy, builder->CreateLoad(arrayType, value), var);
+    return copy;
+}
 
-    builder->CreateMemCpy(mallocResult, llvm::MaybeAlign(1), loadArrayFromArrayStruct(left), llvm::MaybeAlign(1),
-                          leftSize);
-    builder->CreateCall(llvmCompiler->libraryFuncs["strcat"], {mallocResult, loadArrayFromArrayStruct(right)});
+static void copyAllocation(llvm::AllocaInst *destination, llvm::AllocaInst *source, Variable *var) {
+
+    if (var->type == STR_VAR) {
+        shareString(destination, source);
+    } else if (var->type == SET_VAR) {
+        copySet(destination, source, var);
+    } else if (var->type == GRID_VAR) {
+        copyGrid(destination, source, var);
+    } else if (var->type == BUILDER_VAR) {
+        copyBuilder(destination, source);
+    } else if (source->getAllocatedType() == llvmCompiler->internalStructs["array"]) {
+        shareArray(destination, source);
+    } else if (source->getAllocatedType()->isStructTy() && var->type != STRUCT_VAR) {
+        copyArray(destination, builder->CreateLoad(source->getAllocatedType(), source), var);
+    } else {
+        builder->CreateMemCpy(destination, llvm::MaybeAlign(8), source, llvm::MaybeAlign(8), 16);
+    }
+}
+
+static void storeArrayAtIndex(llvm::Type *elementType, llvm::Value *value, Expr *expr, llvm::Value *arrayPtr,
+                              int idx) {
+    value = isUserStructTy(elementType) ? loadAllocaInst(value) : boxItem(value, expr);
+    elementType = getArrayElementType(elementType);
+    llvm::Value *arrayInboundPtr = builder->CreateInBoundsGEP(elementType, arrayPtr, builder->getInt32(idx));
+    builder->CreateStore(widenInteger(loadScalar(value), elementType), arrayInboundPtr);
+}
+
+static llvm::Value *concatStrings(llvm::Value *left, llvm::Value *right) {
+    llvm::AllocaInst *concStringInstance = createEntryAlloca(llvmCompiler->internalStructs["string"], "string");
+    llvm::Value *concString = builder->CreateCall(llvmCompiler->internalFuncs["concatStrings"],
+                                                  {getStringPointer(left), getStringPointer(right)});
+    builder->CreateStore(concString, concStringInstance);
 
     return concStringInstance;
 }
@@ -448,7 +1163,7 @@ static llvm::Value *concatStrings(llvm::Value *left, llvm::Value *right) {
 static llvm::Value *createStruct(CallExpr *callExpr) {
     std::string name = callExpr->callee;
     LLVMStruct *strukt = llvmCompiler->structs[name];
-    llvm::AllocaInst *structInstance = builder->CreateAlloca(strukt->structType, nullptr, name);
+    llvm::AllocaInst *structInstance = createEntryAlloca(strukt->structType, name);
 
     if (callExpr->arguments.size() != strukt->fields.size()) {
         printf("Strukt has different amount of args, expected: "
@@ -458,8 +1173,12 @@ static llvm::Value *createStruct(CallExpr *callExpr) {
     }
 
     for (int i = 0; i < callExpr->arguments.size(); ++i) {
-        llvm::Value *paramValue = compileExpression(callExpr->arguments[i]);
-        if (strukt->structType->getContainedType(i) != paramValue->getType()) {
+        llvm::Type *fieldType = strukt->structType->getContainedType(i);
+        llvm::Value *paramValue = widenInteger(compileExpression(callExpr->arguments[i]), fieldType);
+        if (!fieldType->isStructTy()) {
+            paramValue = loadAllocaInst(paramValue);
+        }
+        if (fieldType != paramValue->getType()) {
             printf("Param %d does match it's type\n", i);
             exit(1);
         }
@@ -468,17 +1187,25 @@ static llvm::Value *createStruct(CallExpr *callExpr) {
     return structInstance;
 }
 
-static void castIntDouble(llvm::Value *&left, llvm::Value *&right) {
+// An int mixed with a float or double is converted to the other side's type
+static void castIntFloat(llvm::Value *&left, llvm::Value *&right) {
     if (left->getType()->isIntegerTy()) {
-        left = builder->CreateUIToFP(left, builder->getDoubleTy());
+        left = builder->CreateUIToFP(left, right->getType());
     } else if (right->getType()->isIntegerTy()) {
-        right = builder->CreateUIToFP(right, builder->getDoubleTy());
+        right = builder->CreateUIToFP(right, left->getType());
     }
 }
 
+// Mixing int and i64 does the operation in 64 bits
+static void castIntWidths(llvm::Value *&left, llvm::Value *&right) {
+    left = widenInteger(left, right->getType());
+    right = widenInteger(right, left->getType());
+}
+
 static llvm::Value *binaryOp(llvm::Value *left, llvm::Value *right, BinaryOp op, int line) {
     left = loadAllocaInst(left);
     right = loadAllocaInst(right);
+    castIntWidths(left, right);
 
     if (left->getType()->isIntegerTy() && right->getType()->isIntegerTy()) {
         switch (op) {
@@ -497,8 +1224,8 @@ static llvm::Value *binaryOp(llvm::Value *left, llvm::Value *right, BinaryOp op,
         }
     }
 
-    castIntDouble(left, right);
-    if (left->getType()->isDoubleTy() && right->getType()->isDoubleTy()) {
+    castIntFloat(left, right);
+    if (left->getType()->isFloatingPointTy() && left->getType() == right->getType()) {
         switch (op) {
         case ADD: {
             return builder->CreateFAdd(left, right);
@@ -517,49 +1244,92 @@ static llvm::Value *binaryOp(llvm::Value *left, llvm::Value *right, BinaryOp op,
     errorAt(line, "Can't do binary op");
     exit(1);
 }
-static void checkIndexOutOfBounds(llvm::Value *loadedArrayStruct, llvm::Value *index) {
+static void exitIfOutOfBounds(llvm::Value *outOfBounds, llvm::Value *size, llvm::Value *index, int line) {
+    checkRuntimeError(llvmCompiler, builder, outOfBounds, INDEX_ERROR, builder->getInt32(line), {size, index});
+}
 
-    // Check here whether or not it's out of bounds
-    //    Just if index >= size
-    //        then branch is just exiting?
+// One unsigned compare catches negative indices as well, nothing is checked when built with --unchecked
+static void checkIndexOutOfBounds(llvm::Value *loadedArrayStruct, llvm::Value *index, int line) {
+    if (llvmCompiler->unchecked) {
+        return;
+    }
     llvm::Value *arraySize = builder->CreateExtractValue(loadedArrayStruct, 1);
-    // Check less then array size
-    llvm::Value *condition1 = builder->CreateICmpSGE(index, arraySize);
-    llvm::BasicBlock *thenBlock1 = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", llvmFunction->function);
-    llvm::BasicBlock *mergeBlock1 = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", llvmFunction->function);
-
-    builder->CreateCondBr(condition1, thenBlock1, mergeBlock1);
+    index = widenInteger(index, builder->getInt64Ty());
+    exitIfOutOfBounds(builder->CreateICmpUGE(index, arraySize), arraySize, index, line);
+}
 
-    builder->SetInsertPoint(thenBlock1);
-    llvm::Value *exitString = builder->CreateGlobalStringPtr("Trying to index outside of array\nsize: %d\nidx: %d\n");
-    builder->CreateCall(llvmCompiler->libraryFuncs["printf"], {exitString, arraySize, index});
-    builder->CreateRet(builder->getInt32(1));
+static llvm::Value *getArrayIndex(llvm::Type *type, llvm::Value *loadedArrayStruct, llvm::Value *index,
+                                  int fixedSize = 0, int line = 0, bool checked = true) {
+    LLVMStruct *strukt = lookupStructByType(type);
+    if (strukt && strukt->soa) {
+        errorAt(0, "Can't take a pointer to an element of a soa array");
+    }
+    type = getArrayElementType(type);
+    llvm::ConstantInt *constantIndex = llvm::dyn_cast<llvm::ConstantInt>(index);
+    if (fixedSize && constantIndex) {
+        // The size of a fixed size array is known, a constant index is checked now instead of at runtime
+        int64_t idx = constantIndex->getSExtValue();
+        if (idx < 0 || idx >= fixedSize) {
+            errorAt(line, ("Index " + std::to_string(idx) + " is outside of fixed size array of size " +
+                           std::to_string(fixedSize))
+                              .c_str());
+        }
+    } else if (fixedSize && checked) {
+        checkIndexOutOfBounds(builder->CreateInsertValue(loadedArrayStruct, builder->getInt64(fixedSize), 1), index,
+                              line);
+    } else if (checked) {
+        checkIndexOutOfBounds(loadedArrayStruct, index, line);
+    }
 
-    builder->SetInsertPoint(mergeBlock1);
+    return builder->CreateInBoundsGEP(type, builder->CreateExtractValue(loadedArrayStruct, 0), index);
+}
 
-    // Check not negative
-    llvm::Value *condition2 = builder->CreateICmpSLT(index, builder->getInt32(0));
-    llvm::BasicBlock *mergeBlock2 = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", llvmFunction->function);
-    builder->CreateCondBr(condition2, thenBlock1, mergeBlock2);
-    builder->SetInsertPoint(mergeBlock2);
+// g[i, j] checks both indices with one branch and is a single GEP into the row major buffer
+static llvm::Value *getPointerToGridIndex(IndexExpr *indexExpr) {
+    GridVariable *gridVar = (GridVariable *)indexExpr->variable->evaluatesTo;
+    llvm::Value *grid = compileExpression(indexExpr->variable);
+    if (grid->getType()->isPointerTy()) {
+        grid = builder->CreateLoad(llvmCompiler->internalStructs["grid"], grid);
+    }
+    llvm::Value *row = loadAllocaInst(compileExpression(indexExpr->index));
+    llvm::Value *col = loadAllocaInst(compileExpression(indexExpr->column));
+    llvm::Value *rows = builder->CreateExtractValue(grid, 1);
+    llvm::Value *cols = builder->CreateExtractValue(grid, 2);
+
+    // Unsigned compares catch negative indices as well
+    llvm::Value *outOfBounds =
+        builder->CreateOr(builder->CreateICmpUGE(row, rows), builder->CreateICmpUGE(col, cols));
+    checkRuntimeError(llvmCompiler, builder, outOfBounds, GRID_INDEX_ERROR, builder->getInt32(indexExpr->line),
+                      {rows, cols, row, col});
+    // rows * cols can pass what an i32 holds even though both indices fit, the offset is computed in i64
+    llvm::Type *i64 = builder->getInt64Ty();
+    llvm::Value *offset = builder->CreateMul(builder->CreateSExt(row, i64), builder->CreateSExt(cols, i64));
+    llvm::Value *index = builder->CreateAdd(offset, builder->CreateSExt(col, i64));
+    return builder->CreateInBoundsGEP(getTypeFromVariable(gridVar->items), builder->CreateExtractValue(grid, 0), index);
 }
 
-static llvm::Value *getArrayIndex(llvm::Type *type, llvm::Value *loadedArrayStruct, llvm::Value *index) {
-    if (type == llvmCompiler->internalStructs["array"] || type->isStructTy()) {
-        type = builder->getPtrTy();
+// Loads the array a soa element is indexed from and checks the index against it
+static llvm::Value *loadSoaArray(IndexExpr *indexExpr, llvm::Value *&index) {
+    llvm::Value *array = compileExpression(indexExpr->variable);
+    if (array->getType()->isPointerTy()) {
+        array = builder->CreateLoad(llvmCompiler->internalStructs["array"], array);
     }
-    checkIndexOutOfBounds(loadedArrayStruct, index);
-
-    return builder->CreateInBoundsGEP(type, builder->CreateExtractValue(loadedArrayStruct, 0), index);
+    index = loadAllocaInst(compileExpression(indexExpr->index));
+    if (indexExpr->checked) {
+        checkIndexOutOfBounds(array, index, indexExpr->line);
+    }
+    return array;
 }
 
-static llvm::Value *indexMap(llvm::Value *map, llvm::Value *index, Variable *var) {
+static llvm::Value *indexMap(llvm::Value *map, llvm::Value *index, Variable *var, int line) {
     MapVariable *mapVar = (MapVariable *)var;
+    llvm::Value *valueSize = builder->getInt32(getArrayItemStride(getTypeFromVariable(mapVar->values)));
     if (mapVar->keys->type == STR_VAR) {
         return builder->CreateCall(llvmCompiler->internalFuncs["indexStrMap"],
-                                   {map, builder->CreateLoad(llvmCompiler->internalStructs["array"], index)});
+                                   {map, getStringPointer(index), valueSize, builder->getInt32(line)});
     } else {
-        return builder->CreateCall(llvmCompiler->internalFuncs["indexIntMap"], {map, index});
+        return builder->CreateCall(llvmCompiler->internalFuncs["indexIntMap"],
+                                   {map, index, valueSize, builder->getInt32(line)});
     }
 }
 
@@ -569,7 +1339,8 @@ static llvm::Value *getIndexValue(IndexExpr *indexExpr, Variable *&var) {
         return loadIndex((IndexExpr *)indexExpr->variable, var);
     } else if (varType == VAR_EXPR) {
         VarExpr *varExpr = (VarExpr *)indexExpr->variable;
-        var = findVariableByName(varExpr->name);
+        // Locals of a function aren't in the global scope anymore, the type pass already resolved them
+        var = varExpr->evaluatesTo ? varExpr->evaluatesTo : findVariableByName(varExpr->name);
         return compileExpression(varExpr);
     } else if (varType == CALL_EXPR) {
         CallExpr *callExpr = (CallExpr *)indexExpr->variable;
@@ -585,24 +1356,37 @@ static llvm::Value *getIndexValue(IndexExpr *indexExpr, Variable *&var) {
 static llvm::Value *getPointerToArrayIndex(IndexExpr *indexExpr, Variable *&var) {
     // This should be a func that also checks out of bounds
     llvm::Value *indexValue = getIndexValue(indexExpr, var);
-    llvm::Value *index = compileExpression(indexExpr->index);
+    llvm::Value *index = loadAllocaInst(compileExpression(indexExpr->index));
 
     if (llvm::AllocaInst *castedVar = llvm::dyn_cast<llvm::AllocaInst>(indexValue)) {
-        var = findVariableByName(castedVar->getName().str());
+        if (var == nullptr) {
+            var = findVariableByName(castedVar->getName().str());
+        }
         if (castedVar->getAllocatedType() == llvmCompiler->internalStructs["map"]) {
             indexValue = builder->CreateLoad(llvmCompiler->internalStructs["map"], castedVar);
         } else if (castedVar->getAllocatedType() == llvmCompiler->internalStructs["array"]) {
+            ArrayVariable *arrayVar = (ArrayVariable *)var;
             return getArrayIndex(lookupArrayItemType(var),
-                                 builder->CreateLoad(castedVar->getAllocatedType(), castedVar), index);
+                                 builder->CreateLoad(castedVar->getAllocatedType(), castedVar), index,
+                                 arrayVar->onStack ? 0 : arrayVar->fixedSize, indexExpr->line, indexExpr->checked);
+        }
+    }
+
+    if (isStringTy(indexValue)) {
+        llvm::Value *stringPtr = getStringPointer(indexValue);
+        if (indexExpr->checked) {
+            checkIndexOutOfBounds(builder->CreateLoad(llvmCompiler->internalStructs["string"], stringPtr), index,
+                                  indexExpr->line);
         }
+        return builder->CreateInBoundsGEP(builder->getInt8Ty(), getStringData(llvmCompiler, builder, stringPtr), index);
     }
 
     if (indexValue->getType() == llvmCompiler->internalStructs["array"]) {
         var = ((ArrayVariable *)var)->items;
-        return getArrayIndex(lookupArrayItemType(var), indexValue, index);
+        return getArrayIndex(lookupArrayItemType(var), indexValue, index, 0, indexExpr->line, indexExpr->checked);
 
     } else if (indexValue->getType() == llvmCompiler->internalStructs["map"]) {
-        return indexMap(indexValue, index, var);
+        return indexMap(indexValue, index, var, indexExpr->line);
     }
 
     errorAt(indexExpr->line,
@@ -612,9 +1396,23 @@ static llvm::Value *getPointerToArrayIndex(IndexExpr *indexExpr, Variable *&var)
 }
 
 llvm::Value *loadIndex(IndexExpr *indexExpr, Variable *&var) {
+    if (indexExpr->variable->evaluatesTo->type == GRID_VAR) {
+        var = indexExpr->variable->evaluatesTo;
+        return builder->CreateLoad(getTypeFromVariable(indexExpr->evaluatesTo), getPointerToGridIndex(indexExpr));
+    }
+    if (LLVMStruct *strukt = lookupSoaStruct(indexExpr->variable->evaluatesTo)) {
+        llvm::Value *index = nullptr;
+        llvm::Value *array = loadSoaArray(indexExpr, index);
+        var = indexExpr->variable->evaluatesTo;
+        return loadSoaElement(strukt, array, index);
+    }
     llvm::Value *idxPtr = getPointerToArrayIndex(indexExpr, var);
     if (var->type == MAP_VAR) {
         llvm::Type *type = getTypeFromVariable(indexExpr->evaluatesTo);
+        // Boxed values are read through the pointer in the slot
+        if (getArrayElementType(type) != type) {
+            idxPtr = builder->CreateLoad(builder->getPtrTy(), idxPtr);
+        }
         return builder->CreateLoad(type, idxPtr);
     }
 
@@ -628,7 +1426,7 @@ llvm::Value *loadIndex(IndexExpr *indexExpr, Variable *&var) {
                 builder->CreateInBoundsGEP(arrayItemType, loadedPtr, {builder->getInt32(0), builder->getInt32(0)});
             return builder->CreateLoad(arrayItemType, loadedArrayPtr);
         }
-        if (arrayVar->items->type == STRUCT_VAR || arrayVar->items->type == MAP_VAR) {
+        if (arrayVar->items->type == MAP_VAR) {
             llvm::Value *loadedStructPtr = builder->CreateLoad(builder->getPtrTy(), idxPtr);
             return builder->CreateLoad(arrayItemType, loadedStructPtr);
         }
@@ -652,9 +1450,11 @@ static llvm::Type *getTypeFromNestedIndexExpr(Expr *expr) {
     return getTypeFromNestedIndexExpr(indexExpr->variable);
 }
 
-static void assignToMap(IndexExpr *indexVar, llvm::Value *value) {
+// Keys and values are boxed like the items of an array, an overwritten value drops its box
+static void assignToMap(IndexExpr *indexVar, llvm::Value *value, Expr *valueExpr) {
+    value = boxItem(value, valueExpr);
     MapVariable *mapVar = (MapVariable *)indexVar->variable->evaluatesTo;
-    llvm::Type *mapValueType = getTypeFromVariable(mapVar->values);
+    llvm::Type *mapValueType = getArrayElementType(getTypeFromVariable(mapVar->values));
     llvm::Value *mapPtr = compileExpression(indexVar->variable);
     llvm::Value *map = builder->CreateLoad(llvmCompiler->internalStructs["map"], mapPtr);
 
@@ -668,12 +1468,11 @@ static void assignToMap(IndexExpr *indexVar, llvm::Value *value) {
 
     llvm::Value *keyExists = nullptr;
     if (mapVar->keys->type == STR_VAR) {
-        keyExists = builder->CreateCall(llvmCompiler->internalFuncs["findStrKey"], {keys, key});
+        keyExists = builder->CreateCall(llvmCompiler->internalFuncs["findStrKey"], {keys, getStringPointer(key)});
     } else {
-
         keyExists = builder->CreateCall(llvmCompiler->internalFuncs["findIntKey"], {keys, key});
     }
-    llvm::Value *cmp = builder->CreateICmpEQ(keyExists, builder->getInt32(-1));
+    llvm::Value *cmp = builder->CreateICmpEQ(keyExists, builder->getInt64(-1));
     llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", llvmFunction->function);
     llvm::BasicBlock *elseBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "else", llvmFunction->function);
     llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "merge", llvmFunction->function);
@@ -681,8 +1480,8 @@ static void assignToMap(IndexExpr *indexVar, llvm::Value *value) {
     builder->CreateCondBr(cmp, thenBlock, elseBlock);
     builder->SetInsertPoint(thenBlock);
     // insert
-    callAppend(keysPtr, key);
-    callAppend(valuesPtr, value);
+    callAppend(keysPtr, boxItem(key, indexVar->index), mapVar->keys);
+    callAppend(valuesPtr, value, mapVar->values);
     builder->CreateBr(mergeBlock);
 
     // overwrite
@@ -690,43 +1489,156 @@ static void assignToMap(IndexExpr *indexVar, llvm::Value *value) {
     llvm::Value *extractedArray = builder->CreateExtractValue(values, 0);
 
     llvm::Value *valueGEP = builder->CreateInBoundsGEP(mapValueType, extractedArray, keyExists);
+    llvm::Value *previous = builder->CreateLoad(mapValueType, valueGEP);
     builder->CreateStore(value, valueGEP);
+    dropBox(previous, mapVar->values);
 
     builder->CreateBr(mergeBlock);
     builder->SetInsertPoint(mergeBlock);
 }
 
+static void unshareIndexedArray(IndexExpr *indexExpr) {
+    if (indexExpr->variable->evaluatesTo->type != ARRAY_VAR || isFixedArray(indexExpr->variable)) {
+        return;
+    }
+    llvm::AllocaInst *arrayPtr = llvm::dyn_cast<llvm::AllocaInst>(compileExpression(indexExpr->variable));
+    if (arrayPtr && arrayPtr->getAllocatedType() == llvmCompiler->internalStructs["array"]) {
+        ArrayVariable *arrayVar = (ArrayVariable *)indexExpr->variable->evaluatesTo;
+        unshareArray(arrayPtr, getTypeFromVariable(arrayVar->items), arrayVar->items);
+    }
+}
+
 static void assignToIndexExpr(AssignStmt *assignStmt) {
     IndexExpr *indexExpr = (IndexExpr *)assignStmt->variable;
-    llvm::Value *value = compileExpression(assignStmt->value);
+    llvm::Value *value = loadScalar(compileExpression(assignStmt->value));
+    if (indexExpr->evaluatesTo->type == I64_VAR) {
+        value = widenInteger(value, builder->getInt64Ty());
+    }
     Variable *var = new Variable();
     if (indexExpr->variable->evaluatesTo->type == MAP_VAR) {
-        assignToMap(indexExpr, value);
+        assignToMap(indexExpr, value, assignStmt->value);
+        return;
+    }
+    if (indexExpr->variable->evaluatesTo->type == GRID_VAR) {
+        builder->CreateStore(loadAllocaInst(value), getPointerToGridIndex(indexExpr));
+        return;
+    }
+    if (indexExpr->variable->evaluatesTo->type == STR_VAR) {
+        llvm::Value *stringPtr = getStringPointer(compileExpression(indexExpr->variable));
+        builder->CreateCall(llvmCompiler->internalFuncs["unshareString"], {stringPtr});
+        // A char is a str of one, write its first byte
+        if (isStringTy(value)) {
+            value = builder->CreateLoad(builder->getInt8Ty(),
+                                        getStringData(llvmCompiler, builder, getStringPointer(value)));
+        }
+        value = loadAllocaInst(value);
+    } else {
+        unshareIndexedArray(indexExpr);
+    }
+    llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(value);
+    if (allocaInst && isUserStructTy(allocaInst->getAllocatedType())) {
+        value = loadAllocaInst(value);
+    } else {
+        value = boxItem(value, assignStmt->value);
+    }
+    if (LLVMStruct *strukt = lookupSoaStruct(indexExpr->variable->evaluatesTo)) {
+        llvm::Value *index = nullptr;
+        llvm::Value *array = loadSoaArray(indexExpr, index);
+        storeSoaElement(strukt, builder->CreateExtractValue(array, 0), builder->CreateExtractValue(array, 1), index,
+                        value);
         return;
     }
     // Check whether it's a map
     // Check whether key exists,
     //    If it does then just replace at the index
     //    If it doesn't, append both keys and values array
-    builder->CreateStore(value, getPointerToArrayIndex(indexExpr, var));
+    llvm::Value *itemPtr = getPointerToArrayIndex(indexExpr, var);
+    Variable *items = getArrayItemKinds(indexExpr->variable->evaluatesTo) == PLAIN_ITEMS
+                          ? nullptr
+                          : ((ArrayVariable *)indexExpr->variable->evaluatesTo)->items;
+    if (items == nullptr) {
+        builder->CreateStore(value, itemPtr);
+        return;
+    }
+    llvm::Value *previous = builder->CreateLoad(builder->getPtrTy(), itemPtr);
+    builder->CreateStore(value, itemPtr);
+    dropBox(previous, items);
 }
 
-static void assignToVarExpr(AssignStmt *assignStmt) {
-    llvm::Value *value = compileExpression(assignStmt->value);
+// Temporaries are moved into the variable. A variable read for the last time is too, unless it isn't released and
+// the variable it goes to is, then an item pointing at it can still read it
+static bool movesInto(AssignStmt *assignStmt, llvm::Value *value, llvm::Value *variable) {
+    if (isFresh(assignStmt->value)) {
+        return true;
+    }
+    return isMove(assignStmt->value) && (isReleased(value) || !isReleased(variable));
+}
+
+static void storeToVarExpr(AssignStmt *assignStmt, llvm::Value *value, llvm::Value *variable) {
     VarExpr *varExpr = (VarExpr *)assignStmt->variable;
-    llvm::Value *variable = lookupValue(varExpr->name, varExpr->line);
     VarType evalType = varExpr->evaluatesTo->type;
-    if (evalType == ARRAY_VAR || evalType == STR_VAR) {
-        llvm::AllocaInst *allocVar = llvm::dyn_cast<llvm::AllocaInst>(variable);
-        llvm::Value *loadedValue = builder->CreateLoad(llvmCompiler->internalStructs["array"], value);
-        Variable *var = findVariableByName(varExpr->name);
-        copyArray(allocVar, loadedValue, var);
+    llvm::AllocaInst *allocaValue = llvm::dyn_cast<llvm::AllocaInst>(value);
+    if ((evalType == STR_VAR || evalType == ARRAY_VAR) && allocaValue && movesInto(assignStmt, value, variable)) {
+        builder->CreateStore(loadAllocaInst(value), variable);
+        if (isReleased(value)) {
+            builder->CreateStore(llvm::Constant::getNullValue(allocaValue->getAllocatedType()), value);
+        }
+        return;
+    }
+    if (evalType == STR_VAR && llvm::dyn_cast<llvm::AllocaInst>(value)) {
+        shareString(variable, value);
+        return;
+    }
+    if (isStringTy(value)) {
+        storeStringValue(variable, value, assignStmt->value);
+        return;
+    }
+    if (evalType == ARRAY_VAR) {
+        if (isFixedArray(assignStmt->value)) {
+            copyArray(llvm::dyn_cast<llvm::AllocaInst>(variable), loadAllocaInst(value), varExpr->evaluatesTo);
+        } else if (value->getType()->isPointerTy()) {
+            shareArray(variable, value);
+        } else if (isOwnedResult(assignStmt->value)) {
+            builder->CreateStore(value, variable);
+        } else {
+            copyArray(llvm::dyn_cast<llvm::AllocaInst>(variable), value, findVariableByName(varExpr->name));
+        }
+        return;
+    }
+    // A set param is read through its pointer as a value, it's still the caller's
+    if (evalType == SET_VAR && (allocaValue || assignStmt->value->type == VAR_EXPR)) {
+        copySet(variable, getAggregatePointer(value), varExpr->evaluatesTo);
+        return;
+    }
+    if (evalType == GRID_VAR && !isFresh(assignStmt->value)) {
+        copyGrid(variable, getAggregatePointer(value), varExpr->evaluatesTo);
+        return;
+    }
+    if (evalType == BUILDER_VAR && (allocaValue || assignStmt->value->type == VAR_EXPR)) {
+        copyBuilder(variable, getAggregatePointer(value));
         return;
     }
 
+    if (evalType == I64_VAR) {
+        value = widenInteger(value, builder->getInt64Ty());
+    }
     builder->CreateStore(value, variable);
 }
 
+// A released variable gives up its previous value once the new one is stored, which may share the same buffer
+static void assignToVarExpr(AssignStmt *assignStmt) {
+    llvm::Value *value = loadScalar(compileExpression(assignStmt->value));
+    VarExpr *varExpr = (VarExpr *)assignStmt->variable;
+    llvm::Value *variable = lookupValue(varExpr->name, varExpr->line);
+    if (!isReleased(variable)) {
+        storeToVarExpr(assignStmt, value, variable);
+        return;
+    }
+    llvm::AllocaInst *previous = savePrevious(loadAllocaInst(variable), varExpr->evaluatesTo);
+    storeToVarExpr(assignStmt, value, variable);
+    releaseSlot(previous);
+}
+
 static llvm::Value *lookupStruct(DotExpr *dotExpr) {
     llvm::Value *value = compileExpression(dotExpr->name);
 
@@ -737,24 +1649,213 @@ static llvm::Value *lookupStruct(DotExpr *dotExpr) {
     return value;
 }
 
-static void storeArray(llvm::Type *elementType, llvm::AllocaInst *arrayInstance,
-                       std::vector<llvm::Value *> arrayItems) {
+static void storeArray(llvm::Type *elementType, llvm::Value *arrayInstance, std::vector<llvm::Value *> arrayItems,
+                       std::vector<Expr *> exprs) {
 
-    storeArrayInStruct(callMalloc(arrayItems.size() * 8), arrayInstance);
+    uint32_t itemStride = elementType ? getArrayItemStride(elementType) : 8;
+    LLVMStruct *strukt = elementType ? lookupStructByType(elementType) : nullptr;
+    uint64_t capacity = strukt && strukt->soa ? llvm::PowerOf2Ceil(arrayItems.size()) : arrayItems.size();
+    storeArrayInStruct(callMalloc(capacity * itemStride), arrayInstance);
     for (int i = 0; i < arrayItems.size(); ++i) {
-        storeArrayAtIndex(elementType, arrayItems[i], loadArrayFromArrayStruct(arrayInstance), i);
+        if (strukt && strukt->soa) {
+            storeSoaElement(strukt, loadArrayFromArrayStruct(arrayInstance), builder->getInt32(arrayItems.size()),
+                            builder->getInt32(i), loadAllocaInst(arrayItems[i]));
+        } else {
+            storeArrayAtIndex(elementType, arrayItems[i], exprs[i], loadArrayFromArrayStruct(arrayInstance), i);
+        }
     }
 
-    storeArraySizeInStruct(builder->getInt32(arrayItems.size()), arrayInstance);
+    storeArraySizeInStruct(builder->getInt64(arrayItems.size()), arrayInstance);
 }
 
-llvm::AllocaInst *createAndStoreArray(llvm::Type *type, std::vector<llvm::Value *> items) {
-    llvm::AllocaInst *instance = builder->CreateAlloca(llvmCompiler->internalStructs["array"], nullptr, "array");
-    storeArray(type, instance, items);
+// A map points at its arrays, they're on the heap since the slot of a literal is reused each time it's evaluated
+static llvm::Value *createMapArray(llvm::Type *type, std::vector<llvm::Value *> items, std::vector<Expr *> exprs) {
+    llvm::Type *arrayType = llvmCompiler->internalStructs["array"];
+    llvm::Value *instance = callMalloc(llvmCompiler->module->getDataLayout().getTypeAllocSize(arrayType));
+    builder->CreateStore(llvm::Constant::getNullValue(arrayType), instance);
+    storeArray(type, instance, items, exprs);
 
     return instance;
 }
 
+// Aggregates are either allocas or values, load or spill them to what the function takes
+static void matchArgumentsToFunction(llvm::Function *func, std::vector<llvm::Value *> &params) {
+    for (int i = 0; i < params.size() && i < func->arg_size(); ++i) {
+        if (!func->getArg(i)->getType()->isPointerTy()) {
+            params[i] = loadAllocaInst(widenInteger(params[i], func->getArg(i)->getType()));
+        } else if (params[i]->getType()->isStructTy()) {
+            llvm::AllocaInst *instance = createEntryAlloca(params[i]->getType());
+            builder->CreateStore(params[i], instance);
+            params[i] = instance;
+        }
+    }
+}
+
+// The callee fills in a slot of the caller's, the result is read from it like a returned value would be
+static llvm::Value *callWithReturnSlot(llvm::Function *func, std::vector<llvm::Value *> &params, CallExpr *callExpr) {
+    llvm::Type *returnType = func->getParamStructRetType(0);
+    llvm::AllocaInst *slot = createEntryAlloca(returnType);
+    params.insert(params.begin(), slot);
+    matchArgumentsToFunction(func, params);
+    llvm::CallInst *call = builder->CreateCall(func, params);
+    call->setAttributes(func->getAttributes());
+    if (callExpr->dropped) {
+        llvmFunction->results.push_back(slot);
+        llvmFunction->slotVariables[slot] = callExpr->evaluatesTo;
+    }
+    return builder->CreateLoad(returnType, slot);
+}
+
+// Anything in memory is copied over directly instead of going through a register
+static void storeReturnValue(llvm::Value *returnSlot, llvm::Value *value) {
+    llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(value);
+    if (!allocaInst) {
+        builder->CreateStore(value, returnSlot);
+        return;
+    }
+    uint64_t size = llvmCompiler->module->getDataLayout().getTypeAllocSize(allocaInst->getAllocatedType());
+    builder->CreateMemCpy(returnSlot, llvm::MaybeAlign(8), allocaInst, llvm::MaybeAlign(8), size);
+}
+
+static bool isConversionFunc(std::string name) {
+    return name == "to_int" || name == "to_i64" || name == "to_u8" || name == "to_i16" || name == "to_u32" ||
+           name == "to_float" || name == "to_double";
+}
+
+static bool isUnsigned(VarType type) { return type == U8_VAR || type == U32_VAR; }
+
+// u8 and u32 zero extend, everything else is sign extended
+static llvm::Value *convertNumber(llvm::Value *value, VarType from, Variable *to) {
+    llvm::Type *type = getTypeFromVariable(to);
+    bool fromFloat = value->getType()->isFloatingPointTy();
+    if (type->isFloatingPointTy()) {
+        if (fromFloat) {
+            return builder->CreateFPCast(value, type);
+        }
+        return isUnsigned(from) ? builder->CreateUIToFP(value, type) : builder->CreateSIToFP(value, type);
+    }
+    if (fromFloat) {
+        return isUnsigned(to->type) ? builder->CreateFPToUI(value, type) : builder->CreateFPToSI(value, type);
+    }
+    return isUnsigned(from) ? builder->CreateZExtOrTrunc(value, type) : builder->CreateSExtOrTrunc(value, type);
+}
+
+static llvm::Value *compileSlice(SliceExpr *sliceExpr) {
+    Variable *var = sliceExpr->variable->evaluatesTo;
+    if (lookupSoaStruct(var)) {
+        errorAt(sliceExpr->line, "Can't slice a soa array");
+    }
+    llvm::Value *source = getAggregatePointer(compileExpression(sliceExpr->variable));
+    // Strings and arrays both keep their size as the second field, an int bound is widened to it
+    llvm::Value *start = builder->getInt64(0);
+    if (sliceExpr->start) {
+        start = loadAllocaInst(widenInteger(compileExpression(sliceExpr->start), builder->getInt64Ty()));
+    }
+    llvm::Value *end = nullptr;
+    if (sliceExpr->end) {
+        end = loadAllocaInst(widenInteger(compileExpression(sliceExpr->end), builder->getInt64Ty()));
+    } else {
+        end = builder->CreateLoad(builder->getInt64Ty(),
+                                  builder->CreateStructGEP(getTypeFromVariable(var), source, 1));
+    }
+
+    llvm::AllocaInst *slice = createEntryAlloca(getTypeFromVariable(var), "slice");
+    if (var->type == STR_VAR) {
+        std::vector<llvm::Value *> params = {source, start, end, builder->getInt32(sliceExpr->line)};
+        builder->CreateStore(builder->CreateCall(llvmCompiler->internalFuncs["sliceString"], params), slice);
+        return slice;
+    }
+
+    uint32_t itemStride = getArrayItemStride(lookupArrayItemType(var));
+    if (isFixedArray(sliceExpr->variable)) {
+        // The buffer of a fixed size array can't be shared, slice a copy of the header and copy the items out
+        source = getAggregatePointer(loadAllocaInst(source));
+    }
+    std::vector<llvm::Value *> params = {source, start, end, builder->getInt32(itemStride),
+                                         builder->getInt32(sliceExpr->line)};
+    builder->CreateStore(builder->CreateCall(llvmCompiler->internalFuncs["sliceArray"], params), slice);
+    if (isFixedArray(sliceExpr->variable)) {
+        unshareArray(slice, lookupArrayItemType(var), ((ArrayVariable *)var)->items);
+    }
+    return slice;
+}
+
+static llvm::Value *compileGridCall(CallExpr *callExpr, std::vector<llvm::Value *> params) {
+    std::string name = callExpr->callee;
+    if (name == "new_grid") {
+        if (((GridVariable *)callExpr->evaluatesTo)->items == nullptr) {
+            errorAt(callExpr->line, "Can't tell the item type of this new grid, store it in a grid variable first");
+        }
+        llvm::Value *itemSize = builder->getInt32(getGridItemSize(callExpr->evaluatesTo));
+        return builder->CreateCall(llvmCompiler->internalFuncs["newGrid"],
+                                   {loadAllocaInst(params[0]), loadAllocaInst(params[1]), itemSize});
+    }
+    GridVariable *gridVar = (GridVariable *)callExpr->arguments[0]->evaluatesTo;
+    params[0] = getAggregatePointer(params[0]);
+    if (name == "rows" || name == "cols") {
+        llvm::Value *dimPtr =
+            builder->CreateStructGEP(llvmCompiler->internalStructs["grid"], params[0], name == "rows" ? 1 : 2);
+        return builder->CreateLoad(builder->getInt32Ty(), dimPtr);
+    }
+    if (name == "fill") {
+        VarType itemType = gridVar->items->type;
+        std::string suffix = itemType == INT_VAR ? "Int" : itemType == DOUBLE_VAR ? "Double" : "Bool";
+        return builder->CreateCall(llvmCompiler->internalFuncs["fillGrid" + suffix],
+                                   {params[0], loadAllocaInst(params[1])});
+    }
+    return builder->CreateCall(llvmCompiler->internalFuncs["copyGridRow"],
+                               {params[0], loadAllocaInst(params[1]), getAggregatePointer(params[2]),
+                                loadAllocaInst(params[3]), builder->getInt32(getGridItemSize(gridVar)),
+                                builder->getInt32(callExpr->line)});
+}
+
+// Sizes are i64, len checks that the size fits in an int unless built with --unchecked and len_i64 doesn't have to
+static llvm::Value *compileLen(CallExpr *callExpr, llvm::Value *arg) {
+    llvm::Type *type = getTypeFromVariable(callExpr->evaluatesTo);
+    Variable *var = callExpr->arguments[0]->evaluatesTo;
+    if (isFixedArray(callExpr->arguments[0])) {
+        return llvm::ConstantInt::get(type, ((ArrayVariable *)var)->fixedSize);
+    }
+    if (var->type == SET_VAR) {
+        llvm::Value *sizePtr =
+            builder->CreateStructGEP(llvmCompiler->internalStructs["set"], getAggregatePointer(arg), 2);
+        return builder->CreateSExt(builder->CreateLoad(builder->getInt32Ty(), sizePtr), type);
+    }
+    llvm::Function *func = llvmCompiler->internalFuncs["len"];
+    std::vector<llvm::Value *> params = {arg};
+    matchArgumentsToFunction(func, params);
+    llvm::Value *size = builder->CreateCall(func, params);
+    if (type->isIntegerTy(64)) {
+        return size;
+    }
+    if (!llvmCompiler->unchecked) {
+        checkRuntimeError(llvmCompiler, builder, builder->CreateICmpSGT(size, builder->getInt64(INT32_MAX)),
+                          LENGTH_ERROR, builder->getInt32(callExpr->line), {size});
+    }
+    return builder->CreateTrunc(size, type);
+}
+
+static llvm::Value *compileSetCall(CallExpr *callExpr, std::vector<llvm::Value *> params) {
+    SetVariable *setVar = (SetVariable *)callExpr->arguments[0]->evaluatesTo;
+    std::string suffix = setVar->items->type == STR_VAR ? "Str" : "Int";
+    std::string name = callExpr->callee;
+
+    params[0] = getAggregatePointer(params[0]);
+    if (name == "union" || name == "intersection" || name == "difference") {
+        params[1] = getAggregatePointer(params[1]);
+    } else if (params.size() > 1) {
+        params[1] = loadAllocaInst(params[1]);
+    }
+    name[0] = std::toupper(name[0]);
+
+    llvm::Value *result = builder->CreateCall(llvmCompiler->internalFuncs["set" + name + suffix], params);
+    // elements gives a new array, it's released with the statement if nothing keeps it
+    if (callExpr->dropped) {
+        llvmFunction->results.push_back(savePrevious(result, callExpr->evaluatesTo));
+    }
+    return result;
+}
+
 static std::string findStructName(Expr *expr) {
     switch (expr->type) {
     case DOT_EXPR: {
@@ -767,7 +1868,7 @@ static std::string findStructName(Expr *expr) {
     }
     case VAR_EXPR: {
         VarExpr *varExpr = (VarExpr *)expr;
-        Variable *var = findVariableByName(varExpr->name);
+        Variable *var = varExpr->evaluatesTo ? varExpr->evaluatesTo : findVariableByName(varExpr->name);
         while (var->type == ARRAY_VAR) {
             ArrayVariable *arrayVar = (ArrayVariable *)var;
             var = arrayVar->items;
@@ -794,14 +1895,28 @@ static void assignToDotExpr(AssignStmt *assignStmt) {
     std::string structName = findStructName(dotExpr);
     llvm::Value *structPtr = nullptr;
 
+    // Structs are stored inline in arrays so the field is written in place
     if (dotExpr->name->type == INDEX_EXPR) {
+        IndexExpr *indexExpr = (IndexExpr *)dotExpr->name;
         Variable *var = findVariableByName(structName);
-        structPtr = builder->CreateLoad(builder->getPtrTy(), getPointerToArrayIndex((IndexExpr *)dotExpr->name, var));
+        unshareIndexedArray(indexExpr);
+        if (LLVMStruct *strukt = lookupSoaStruct(indexExpr->variable->evaluatesTo)) {
+            llvm::Value *index = nullptr;
+            llvm::Value *array = loadSoaArray(indexExpr, index);
+            int field = lookupStructField(strukt, dotExpr->field);
+            llvm::Value *fieldPtr =
+                getSoaFieldPointer(strukt, builder->CreateExtractValue(array, 0), builder->CreateExtractValue(array, 1),
+                                   index, field);
+            llvm::Value *value = loadScalar(compileExpression(assignStmt->value));
+            builder->CreateStore(widenInteger(value, strukt->structType->getElementType(field)), fieldPtr);
+            return;
+        }
+        structPtr = getPointerToArrayIndex(indexExpr, var);
     } else {
         structPtr = compileExpression(dotExpr->name);
     }
 
-    llvm::Value *value = compileExpression(assignStmt->value);
+    llvm::Value *value = loadScalar(compileExpression(assignStmt->value));
 
     if (LLVMStruct *strukt = llvmCompiler->structs[structName]) {
         llvm::StructType *structType = strukt->structType;
@@ -814,6 +1929,36 @@ static void assignToDotExpr(AssignStmt *assignStmt) {
     }
 }
 
+// A literal printf format gives each str printed with '%s' its length as '%.*s', so it doesn't need a terminated copy.
+// Width and precision given as '*' take an argument of their own
+static std::string countStringFormats(std::string format, std::vector<bool> &strs, std::vector<bool> &counted) {
+    int arg = 1;
+    for (int i = 0; i < format.size(); ++i) {
+        if (format[i] != '%') {
+            continue;
+        }
+        int j = i + 1;
+        bool precision = false;
+        while (j < format.size() && std::string("-+ #0123456789.*hlLqjzt").find(format[j]) != std::string::npos) {
+            precision |= format[j] == '.';
+            arg += format[j] == '*';
+            ++j;
+        }
+        if (j < format.size() && format[j] == '%') {
+            i = j;
+            continue;
+        }
+        if (j < format.size() && format[j] == 's' && !precision && arg < strs.size() && strs[arg]) {
+            format.insert(j, ".*");
+            counted[arg] = true;
+            j += 2;
+        }
+        arg++;
+        i = j;
+    }
+    return format;
+}
+
 llvm::Value *compileExpression(Expr *expr) {
     switch (expr->type) {
     case BINARY_EXPR: {
@@ -823,7 +1968,11 @@ llvm::Value *compileExpression(Expr *expr) {
         llvm::Value *right = compileExpression(binaryExpr->right);
 
         if (isStringTy(left) && isStringTy(right)) {
-            return concatStrings(left, right);
+            llvm::Value *concatenated = concatStrings(left, right);
+            if (binaryExpr->dropped) {
+                llvmFunction->temporaries.push_back((llvm::AllocaInst *)concatenated);
+            }
+            return concatenated;
         }
         return binaryOp(left, right, binaryExpr->op, binaryExpr->line);
     }
@@ -853,6 +2002,25 @@ llvm::Value *compileExpression(Expr *expr) {
     }
     case DOT_EXPR: {
         DotExpr *dotExpr = (DotExpr *)expr;
+        // a[i].field only loads the field from the element
+        Variable *structVar = dotExpr->name->evaluatesTo;
+        if (dotExpr->name->type == INDEX_EXPR && structVar && structVar->type == STRUCT_VAR &&
+            ((IndexExpr *)dotExpr->name)->variable->evaluatesTo->type == ARRAY_VAR) {
+            IndexExpr *indexExpr = (IndexExpr *)dotExpr->name;
+            LLVMStruct *strukt = llvmCompiler->structs[((StructVariable *)structVar)->structName];
+            int field = lookupStructField(strukt, dotExpr->field);
+            if (strukt->soa) {
+                llvm::Value *index = nullptr;
+                llvm::Value *array = loadSoaArray(indexExpr, index);
+                return builder->CreateLoad(strukt->structType->getElementType(field),
+                                           getSoaFieldPointer(strukt, builder->CreateExtractValue(array, 0),
+                                                              builder->CreateExtractValue(array, 1), index, field));
+            }
+            Variable *var = nullptr;
+            llvm::Value *structPtr = getPointerToArrayIndex(indexExpr, var);
+            return builder->CreateLoad(strukt->structType->getElementType(field),
+                                       builder->CreateStructGEP(strukt->structType, structPtr, field));
+        }
         llvm::Value *value = lookupStruct(dotExpr);
         if (LLVMStruct *strukt = llvmCompiler->structs[value->getType()->getStructName().str()]) {
             for (int i = 0; i < strukt->fields.size(); i++) {
@@ -868,6 +2036,7 @@ llvm::Value *compileExpression(Expr *expr) {
 
         llvm::Value *left = loadAllocaInst(compileExpression(comparisonExpr->left));
         llvm::Value *right = loadAllocaInst(compileExpression(comparisonExpr->right));
+        castIntWidths(left, right);
 
         // Need to check fp as well, string equality, array equality,
         // map equality
@@ -891,8 +2060,8 @@ llvm::Value *compileExpression(Expr *expr) {
             }
             }
         }
-        castIntDouble(left, right);
-        if (left->getType()->isDoubleTy() && right->getType()->isDoubleTy()) {
+        castIntFloat(left, right);
+        if (left->getType()->isFloatingPointTy() && left->getType() == right->getType()) {
             switch (comparisonExpr->op) {
             case LESS_EQUAL_COMPARISON: {
                 return builder->CreateFCmpULE(left, right);
@@ -915,8 +2084,10 @@ llvm::Value *compileExpression(Expr *expr) {
     case UNARY_EXPR: {
         UnaryExpr *unaryExpr = (UnaryExpr *)expr;
         llvm::Value *value = loadAllocaInst(compileExpression(unaryExpr->right));
-        if (unaryExpr->op == NEG_UNARY && (value->getType()->isIntegerTy() || value->getType()->isDoubleTy())) {
-            return builder->CreateMul(value, builder->getInt32(-1));
+        if (unaryExpr->op == NEG_UNARY && value->getType()->isFloatingPointTy()) {
+            return builder->CreateFNeg(value);
+        } else if (unaryExpr->op == NEG_UNARY && value->getType()->isIntegerTy()) {
+            return builder->CreateNeg(value);
         } else {
             // Check value type?
             return builder->CreateXor(value, 1);
@@ -924,7 +2095,8 @@ llvm::Value *compileExpression(Expr *expr) {
     }
     case VAR_EXPR: {
         VarExpr *varExpr = (VarExpr *)expr;
-        return lookupValue(varExpr->name, varExpr->line);
+        llvm::Value *value = lookupValue(varExpr->name, varExpr->line);
+        return varExpr->copyOut ? copyOutOfRegion(value, varExpr->evaluatesTo) : value;
     }
     case INDEX_EXPR: {
         // ToDo if string -> create new one
@@ -932,16 +2104,24 @@ llvm::Value *compileExpression(Expr *expr) {
         Variable *var = new Variable();
         return loadIndex(indexExpr, var);
     }
+    case SLICE_EXPR: {
+        return compileSlice((SliceExpr *)expr);
+    }
     case INC_EXPR: {
         IncExpr *incExpr = (IncExpr *)expr;
         llvm::Value *value = compileExpression(incExpr->expr);
         if (llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(value)) {
             llvm::Value *loadedValue = builder->CreateLoad(allocaInst->getAllocatedType(), allocaInst);
             llvm::Value *valueOp = nullptr;
-            if (incExpr->op == INC) {
-                valueOp = builder->CreateAdd(loadedValue, builder->getInt32(1));
+            llvm::Type *type = loadedValue->getType();
+            if (type->isFloatingPointTy()) {
+                llvm::Value *one = llvm::ConstantFP::get(type, 1.0);
+                valueOp = incExpr->op == INC ? builder->CreateFAdd(loadedValue, one)
+                                             : builder->CreateFSub(loadedValue, one);
             } else {
-                valueOp = builder->CreateSub(loadedValue, builder->getInt32(1));
+                llvm::Value *one = llvm::ConstantInt::get(type, 1);
+                valueOp = incExpr->op == INC ? builder->CreateAdd(loadedValue, one)
+                                             : builder->CreateSub(loadedValue, one);
             }
             return builder->CreateStore(valueOp, value);
         }
@@ -963,9 +2143,8 @@ llvm::Value *compileExpression(Expr *expr) {
             arrayItems[i] = item;
         }
 
-        llvm::AllocaInst *arrayInstance =
-            builder->CreateAlloca(llvmCompiler->internalStructs["array"], nullptr, "array");
-        storeArray(elementType, arrayInstance, arrayItems);
+        llvm::AllocaInst *arrayInstance = createEntryAlloca(llvmCompiler->internalStructs["array"], "array");
+        storeArray(elementType, arrayInstance, arrayItems, arrayExpr->items);
 
         return arrayInstance;
     }
@@ -997,13 +2176,30 @@ llvm::Value *compileExpression(Expr *expr) {
             }
         }
 
-        llvm::AllocaInst *mapInstance = builder->CreateAlloca(llvmCompiler->internalStructs["map"], nullptr, "map");
+        llvm::AllocaInst *mapInstance = createEntryAlloca(llvmCompiler->internalStructs["map"], "map");
 
-        storeStructField(llvmCompiler->internalStructs["map"], mapInstance, createAndStoreArray(keyType, keys), 0);
-        storeStructField(llvmCompiler->internalStructs["map"], mapInstance, createAndStoreArray(valueType, values), 1);
+        llvm::StructType *mapType = llvmCompiler->internalStructs["map"];
+        storeStructField(mapType, mapInstance, createMapArray(keyType, keys, mapExpr->keys), 0);
+        storeStructField(mapType, mapInstance, createMapArray(valueType, values, mapExpr->values), 1);
 
         return mapInstance;
     }
+    case SET_EXPR: {
+        SetExpr *setExpr = (SetExpr *)expr;
+        SetVariable *setVar = (SetVariable *)setExpr->setVar;
+        std::string insertFunc = setVar->items->type == STR_VAR ? "setInsertStr" : "setInsertInt";
+
+        llvm::AllocaInst *setInstance = createEntryAlloca(llvmCompiler->internalStructs["set"], "set");
+        builder->CreateCall(llvmCompiler->internalFuncs["setInit"],
+                            {setInstance, builder->getInt32(getSetItemSize(setVar)), builder->getInt32(8)});
+
+        for (auto &item : setExpr->items) {
+            llvm::Value *value = loadAllocaInst(compileExpression(item));
+            builder->CreateCall(llvmCompiler->internalFuncs[insertFunc], {setInstance, value});
+        }
+
+        return setInstance;
+    }
     case CALL_EXPR: {
         CallExpr *callExpr = (CallExpr *)expr;
         int argSize = callExpr->arguments.size();
@@ -1018,11 +2214,40 @@ llvm::Value *compileExpression(Expr *expr) {
             params[i] = compileExpression(callExpr->arguments[i]);
         }
         if (name == "append") {
-            callAppend(params[0], params[1]);
+            if (isFixedArray(callExpr->arguments[1])) {
+                params[1] = copyFixedArray(llvm::dyn_cast<llvm::AllocaInst>(params[1]),
+                                           callExpr->arguments[1]->evaluatesTo);
+            }
+            llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(params[1]);
+            if (allocaInst && isUserStructTy(allocaInst->getAllocatedType())) {
+                params[1] = loadAllocaInst(params[1]);
+            } else {
+                params[1] = boxItem(params[1], callExpr->arguments[1]);
+            }
+            Variable *arrayVar = callExpr->arguments[0]->evaluatesTo;
+            params[1] = widenInteger(loadScalar(params[1]), lookupArrayItemType(arrayVar));
+            callAppend(params[0], params[1], ((ArrayVariable *)arrayVar)->items);
             return builder->getInt32(0);
         }
+        if (name == "move") {
+            return moveVariable(params[0]);
+        }
+        Variable *firstArg = argSize > 0 ? callExpr->arguments[0]->evaluatesTo : nullptr;
+        if (isConversionFunc(name) && !lookupFunction(name)) {
+            return convertNumber(loadAllocaInst(params[0]), firstArg->type, callExpr->evaluatesTo);
+        }
+        if ((firstArg && firstArg->type == GRID_VAR || name == "new_grid") && !lookupFunction(name)) {
+            return compileGridCall(callExpr, params);
+        }
+        if ((name == "len" || name == "len_i64") && !lookupFunction(name)) {
+            return compileLen(callExpr, params[0]);
+        }
+        if (firstArg && firstArg->type == SET_VAR && !lookupFunction(name)) {
+            return compileSetCall(callExpr, params);
+        }
         if (name == "key_exists") {
-            if (params[1]->getType()->isPointerTy()) {
+            if (isStringTy(params[1])) {
+                params[1] = getStringPointer(params[1]);
                 return builder->CreateCall(llvmCompiler->internalFuncs["strKeyExists"], params);
             } else {
                 return builder->CreateCall(llvmCompiler->internalFuncs["intKeyExists"], params);
@@ -1030,11 +2255,51 @@ llvm::Value *compileExpression(Expr *expr) {
         }
 
         if (llvmCompiler->internalFuncs.count(name)) {
-            return builder->CreateCall(llvmCompiler->internalFuncs[name], params);
+            llvm::Function *func = llvmCompiler->internalFuncs[name];
+            matchArgumentsToFunction(func, params);
+            llvm::Value *result = builder->CreateCall(func, params);
+            // build copies the buffer out, the string is new unlike what intern, keys and values hand out
+            if (callExpr->dropped && name == "build") {
+                llvmFunction->results.push_back(savePrevious(result, callExpr->evaluatesTo));
+            }
+            return result;
         }
 
         if (llvmCompiler->libraryFuncs.count(name)) {
+            std::vector<bool> strs(argSize, false);
             for (int i = 0; i < argSize; ++i) {
+                // Indexing a str also evaluates to str but is a single char
+                Variable *argVar = callExpr->arguments[i]->evaluatesTo;
+                strs[i] = argVar && argVar->type == STR_VAR && params[i]->getType() != builder->getInt8Ty();
+            }
+            std::vector<bool> counted(argSize, false);
+            LiteralExpr *format = argSize ? (LiteralExpr *)callExpr->arguments[0] : nullptr;
+            if (name == "printf" && format && format->type == LITERAL_EXPR && format->literalType == STR_LITERAL) {
+                std::string countedFormat = countStringFormats(format->literal, strs, counted);
+                if (!llvmCompiler->stringLiterals.count(countedFormat)) {
+                    llvmCompiler->stringLiterals[countedFormat] = builder->CreateGlobalString(countedFormat);
+                }
+                params[0] = llvmCompiler->stringLiterals[countedFormat];
+                strs[0] = false;
+            }
+
+            std::vector<llvm::Value *> args;
+            std::vector<llvm::Value *> copies;
+            for (int i = 0; i < argSize; ++i) {
+                Variable *argVar = callExpr->arguments[i]->evaluatesTo;
+                if (counted[i]) {
+                    llvm::Value *stringPtr = getStringPointer(params[i]);
+                    // printf takes the precision as an int
+                    args.push_back(builder->CreateTrunc(loadStringSize(stringPtr), builder->getInt32Ty()));
+                    args.push_back(getStringData(llvmCompiler, builder, stringPtr));
+                    continue;
+                }
+                if (strs[i]) {
+                    copies.push_back(
+                        builder->CreateCall(llvmCompiler->internalFuncs["cString"], {getStringPointer(params[i])}));
+                    args.push_back(copies.back());
+                    continue;
+                }
                 if (llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(params[i])) {
                     if (allocaInst->getAllocatedType()->isStructTy()) {
                         params[i] = loadArrayFromArrayStruct(allocaInst);
@@ -1042,14 +2307,290 @@ llvm::Value *compileExpression(Expr *expr) {
                         params[i] = builder->CreateLoad(allocaInst->getAllocatedType(), allocaInst);
                     }
                 }
+                // Variadic args are promoted to int and double like in C
+                if (argVar && (argVar->type == U8_VAR || argVar->type == I16_VAR)) {
+                    params[i] = isUnsigned(argVar->type) ? builder->CreateZExt(params[i], builder->getInt32Ty())
+                                                         : builder->CreateSExt(params[i], builder->getInt32Ty());
+                } else if (params[i]->getType()->isFloatTy()) {
+                    params[i] = builder->CreateFPExt(params[i], builder->getDoubleTy());
+                }
+                args.push_back(params[i]);
+            }
+            llvm::Value *result = builder->CreateCall(llvmCompiler->libraryFuncs[name], args);
+            for (auto &copy : copies) {
+                builder->CreateCall(llvmCompiler->internalFuncs["release"], {copy});
+            }
+            return result;
+        }
+
+        // A 'ref' param, one the function keeps or one whose items it writes can write to the caller's array.
+        // It can't be shared with anyone else then
+        FuncVariable *funcVar = (FuncVariable *)findVariableByName(name);
+        for (int i = 0; i < argSize; ++i) {
+            llvm::AllocaInst *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(params[i]);
+            bool writes = funcVar->params[i]->ref || i < funcVar->storesParams.size() && funcVar->storesParams[i] ||
+                          i < funcVar->writesParams.size() && funcVar->writesParams[i];
+            if (isFixedArray(callExpr->arguments[i])) {
+                params[i] = shareFixedArray(allocaInst);
+            } else if (callExpr->arguments[i]->type == SLICE_EXPR || !writes) {
+                continue;
+            } else if (allocaInst && allocaInst->getAllocatedType() == llvmCompiler->internalStructs["array"]) {
+                ArrayVariable *arrayVar = (ArrayVariable *)callExpr->arguments[i]->evaluatesTo;
+                unshareArray(allocaInst, getTypeFromVariable(arrayVar->items), arrayVar->items);
             }
-            return builder->CreateCall(llvmCompiler->libraryFuncs[name], params);
         }
 
         llvm::Function *func = lookupFunction(name);
-        return builder->CreateCall(func, params);
+        if (func->hasStructRetAttr()) {
+            return callWithReturnSlot(func, params, callExpr);
+        }
+        matchArgumentsToFunction(func, params);
+        llvm::Value *result = builder->CreateCall(func, params);
+        if (callExpr->dropped) {
+            llvmFunction->results.push_back(savePrevious(result, callExpr->evaluatesTo));
+        }
+        return result;
+    }
+    }
+}
+
+static llvm::Value *loadMapArray(llvm::Value *mapPtr, int field) {
+    llvm::Value *arrayPtr = builder->CreateStructGEP(llvmCompiler->internalStructs["map"], mapPtr, field);
+    return builder->CreateLoad(builder->getPtrTy(), arrayPtr);
+}
+
+// Maps are looped over as their keys and values arrays, strings as their bytes and sets as their slots and states
+static llvm::Value *loadLoopItems(llvm::Value *iterable, Variable *var, int field) {
+    if (var->type == STR_VAR) {
+        return getStringData(llvmCompiler, builder, iterable);
+    }
+    if (var->type == SET_VAR) {
+        llvm::Value *fieldPtr = builder->CreateStructGEP(llvmCompiler->internalStructs["set"], iterable, field);
+        return builder->CreateLoad(builder->getPtrTy(), fieldPtr);
+    }
+    llvm::Value *arrayPtr = var->type == MAP_VAR ? loadMapArray(iterable, field) : iterable;
+    return builder->CreateLoad(llvmCompiler->internalStructs["array"], arrayPtr);
+}
+
+// A set is looped over every slot, the empty and removed ones are skipped
+static llvm::Value *loadLoopSize(llvm::Value *iterable, Variable *var) {
+    if (var->type == STR_VAR) {
+        return loadStringSize(iterable);
     }
+    if (var->type == SET_VAR) {
+        llvm::Value *capacityPtr = builder->CreateStructGEP(llvmCompiler->internalStructs["set"], iterable, 4);
+        return builder->CreateSExt(builder->CreateLoad(builder->getInt32Ty(), capacityPtr), builder->getInt64Ty());
     }
+    return loadArraySizeFromArrayStruct(var->type == MAP_VAR ? loadMapArray(iterable, 0) : iterable);
+}
+
+// Strings and arrays share their buffer with the loop variable, it's only copied if either is written to
+static void storeLoopItem(llvm::AllocaInst *loopVar, Variable *items, llvm::Value *array, llvm::Value *index) {
+    llvm::Type *itemType = getTypeFromVariable(items);
+    LLVMStruct *strukt = lookupStructByType(itemType);
+    if (strukt && strukt->soa) {
+        builder->CreateStore(loadSoaElement(strukt, array, index), loopVar);
+        return;
+    }
+    llvm::Value *data = builder->CreateExtractValue(array, 0);
+    llvm::Value *itemPtr = builder->CreateInBoundsGEP(getArrayElementType(itemType), data, index);
+    if (items->type == STR_VAR) {
+        shareString(loopVar, builder->CreateLoad(builder->getPtrTy(), itemPtr));
+    } else if (items->type == ARRAY_VAR) {
+        shareArray(loopVar, builder->CreateLoad(builder->getPtrTy(), itemPtr));
+    } else {
+        builder->CreateStore(builder->CreateLoad(itemType, itemPtr), loopVar);
+    }
+}
+
+// A str item is marked as data the variable doesn't own, like an interned string it's copied before it's written to
+static void storeSetLoopItem(llvm::AllocaInst *loopVar, llvm::Value *slots, llvm::Value *index) {
+    llvm::Type *itemType = loopVar->getAllocatedType();
+    builder->CreateStore(builder->CreateLoad(itemType, builder->CreateInBoundsGEP(itemType, slots, index)), loopVar);
+    if (itemType != llvmCompiler->internalStructs["string"]) {
+        return;
+    }
+    // Inline contents live where the flag would go and are copied along with the header
+    llvm::Value *data = builder->CreateLoad(builder->getPtrTy(), builder->CreateStructGEP(itemType, loopVar, 0));
+    llvm::Value *flagPtr = getStringSharedFlag(llvmCompiler, builder, loopVar);
+    llvm::Value *flag = builder->CreateLoad(builder->getInt8Ty(), flagPtr);
+    builder->CreateStore(builder->CreateSelect(builder->CreateIsNull(data), flag, builder->getInt8(1)), flagPtr);
+}
+
+// Shared strings and arrays are released before the next item is shared with them
+static llvm::AllocaInst *createLoopVariable(Variable *var, std::string name, bool released) {
+    llvm::Type *type = getTypeFromVariable(var);
+    if (released && (var->type == STR_VAR || var->type == ARRAY_VAR)) {
+        return createReleasedSlot(var, name);
+    }
+    return createEntryAlloca(type, name);
+}
+
+// The length is read once and the index is known to be inside of it, so the items are read without bounds checks.
+// If the body uses what's looped over it can grow or shrink it, the items and length are read again then
+static void compileForEach(ForEachStmt *forEachStmt) {
+    Variable *var = forEachStmt->iterable->evaluatesTo;
+    llvm::Value *iterable = getAggregatePointer(compileExpression(forEachStmt->iterable));
+    llvm::Value *size = loadLoopSize(iterable, var);
+    bool pairs = var->type == MAP_VAR || var->type == SET_VAR;
+    llvm::Value *keys = loadLoopItems(iterable, var, 0);
+    llvm::Value *values = pairs ? loadLoopItems(iterable, var, 1) : keys;
+
+    llvm::AllocaInst *counter = createEntryAlloca(builder->getInt64Ty());
+    builder->CreateStore(builder->getInt64(0), counter);
+    llvmFunction->scopedVariables.push_back(std::vector<llvm::AllocaInst *>());
+    llvm::AllocaInst *keyVar = nullptr;
+    if (!forEachStmt->key.empty()) {
+        keyVar = createLoopVariable(forEachStmt->keyVar, forEachStmt->key, forEachStmt->released);
+        llvmFunction->scopedVariables.back().push_back(keyVar);
+    }
+    // A set's str items are headers it doesn't own, the loop variable borrows them the same way
+    bool released = forEachStmt->released && var->type != SET_VAR;
+    llvm::AllocaInst *itemVar = createLoopVariable(forEachStmt->itemVar, forEachStmt->item, released);
+    llvmFunction->scopedVariables.back().push_back(itemVar);
+
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", llvmFunction->function);
+    llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", llvmFunction->function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", llvmFunction->function);
+
+    builder->CreateBr(headerBlock);
+    builder->SetInsertPoint(headerBlock);
+    llvmFunction->exitBlock = new ExitBlock(llvmFunction->exitBlock, exitBlock, llvmFunction->branches.size());
+    llvm::Value *index = builder->CreateLoad(builder->getInt64Ty(), counter);
+    llvm::Value *condition = builder->CreateICmpSLT(index, size);
+    if (forEachStmt->reloads) {
+        condition = builder->CreateAnd(condition, builder->CreateICmpSLT(index, loadLoopSize(iterable, var)));
+    }
+    builder->CreateCondBr(condition, bodyBlock, exitBlock);
+    builder->SetInsertPoint(bodyBlock);
+
+    if (forEachStmt->reloads) {
+        keys = loadLoopItems(iterable, var, 0);
+        values = pairs ? loadLoopItems(iterable, var, 1) : keys;
+    }
+    // There's no continue, so the index can be stepped before the body
+    builder->CreateStore(builder->CreateAdd(index, builder->getInt64(1)), counter);
+    if (var->type == SET_VAR) {
+        llvm::BasicBlock *fullBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "full", llvmFunction->function);
+        llvm::Value *state =
+            builder->CreateLoad(builder->getInt8Ty(), builder->CreateInBoundsGEP(builder->getInt8Ty(), values, index));
+        builder->CreateCondBr(builder->CreateICmpEQ(state, builder->getInt8(1)), fullBlock, headerBlock);
+        builder->SetInsertPoint(fullBlock);
+    }
+    for (auto &loopVar : {keyVar, itemVar}) {
+        if (loopVar && isReleased(loopVar)) {
+            releaseSlot(loopVar);
+        }
+    }
+    if (var->type == SET_VAR) {
+        storeSetLoopItem(itemVar, keys, index);
+    } else if (var->type == STR_VAR) {
+        llvm::Value *byte = builder->CreateInBoundsGEP(builder->getInt8Ty(), keys, index);
+        builder->CreateStore(builder->CreateLoad(builder->getInt8Ty(), byte), itemVar);
+    } else if (var->type == MAP_VAR && keyVar == nullptr) {
+        storeLoopItem(itemVar, forEachStmt->itemVar, keys, index);
+    } else {
+        storeLoopItem(itemVar, forEachStmt->itemVar, values, index);
+    }
+    if (var->type == MAP_VAR && keyVar) {
+        storeLoopItem(keyVar, forEachStmt->keyVar, keys, index);
+    } else if (keyVar) {
+        // The key is an int, like what len returns
+        builder->CreateStore(builder->CreateTrunc(index, keyVar->getAllocatedType()), keyVar);
+    }
+
+    compileLoopBody(headerBlock, exitBlock, forEachStmt->body);
+    compileLoopExit(headerBlock, exitBlock);
+    for (auto &loopVar : {keyVar, itemVar}) {
+        if (loopVar && isReleased(loopVar)) {
+            releaseSlot(loopVar);
+        }
+    }
+
+    // Names are unique within a function, the next loop gets them back
+    for (auto &allocaInst : llvmFunction->scopedVariables.back()) {
+        allocaInst->setName("");
+    }
+    llvmFunction->scopedVariables.pop_back();
+}
+
+static void compileRegion(RegionStmt *regionStmt) {
+    if (regionStmt->suspended) {
+        llvm::Value *depth = suspendRegions(llvmCompiler, builder);
+        for (auto &bodyStmt : regionStmt->body) {
+            compileStatement(bodyStmt);
+        }
+        resumeRegions(llvmCompiler, builder, depth);
+        return;
+    }
+    llvm::AllocaInst *state = createEntryAlloca(llvm::ArrayType::get(builder->getPtrTy(), 3));
+    builder->CreateCall(llvmCompiler->internalFuncs["enterRegion"], {state});
+    llvmFunction->scopedVariables.push_back(std::vector<llvm::AllocaInst *>());
+    int released = llvmFunction->released.size();
+    for (auto &bodyStmt : regionStmt->body) {
+        compileStatement(bodyStmt);
+    }
+    // Counts are on the heap, and the slots can't be released after the arena they point into is gone
+    releaseSlots(released);
+    builder->CreateCall(llvmCompiler->internalFuncs["exitRegion"], {state});
+
+    for (auto &allocaInst : llvmFunction->scopedVariables.back()) {
+        allocaInst->setName("");
+    }
+    llvmFunction->scopedVariables.pop_back();
+}
+
+// The body indexes these arrays with the loop variable unchecked, i goes from its start up to the bound so it's
+// enough that the start isn't negative and the bound isn't past the end, if the loop runs at all.
+// The unsigned compare catches a negative bound as well
+static llvm::Value *compileRangeChecks(ForStmt *forStmt) {
+    VarStmt *varStmt = (VarStmt *)forStmt->initializer;
+    llvm::Value *start = loadScalar(lookupValue(varStmt->var->name, varStmt->line));
+    llvm::Value *bound = loadScalar(compileExpression(((ComparisonExpr *)forStmt->condition)->right));
+    llvm::Value *runs = compileExpression(forStmt->condition);
+    llvm::Value *negative = builder->CreateICmpSLT(start, builder->getInt32(0));
+
+    llvm::Value *outside = negative;
+    for (auto &array : forStmt->rangeChecks) {
+        llvm::Value *size = loadLoopSize(getAggregatePointer(compileExpression(array)), array->evaluatesTo);
+        outside = builder->CreateOr(outside, builder->CreateICmpUGT(widenInteger(bound, builder->getInt64Ty()), size));
+    }
+    releaseTemporaries();
+    return builder->CreateNot(builder->CreateAnd(runs, outside));
+}
+
+static void compileForLoop(ForStmt *forStmt) {
+    llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", llvmFunction->function);
+    llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", llvmFunction->function);
+    llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", llvmFunction->function);
+
+    compileLoopHeader(headerBlock, exitBlock, bodyBlock, forStmt->condition);
+    compileLoopBody(headerBlock, exitBlock, forStmt->body);
+    compileLoopExit(headerBlock, exitBlock, forStmt->increment);
+}
+
+// The range check doesn't exit, when it fails the loop runs a second copy of itself with its indices checked.
+// Whatever the body prints before the index that's out of bounds is still printed then
+static void compileVersionedLoop(ForStmt *forStmt) {
+    llvm::BasicBlock *fastBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "unchecked", llvmFunction->function);
+    llvm::BasicBlock *checkedBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "checked", llvmFunction->function);
+    llvm::BasicBlock *doneBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "done", llvmFunction->function);
+    builder->CreateCondBr(compileRangeChecks(forStmt), fastBlock, checkedBlock);
+
+    builder->SetInsertPoint(fastBlock);
+    compileForLoop(forStmt);
+    builder->CreateBr(doneBlock);
+
+    builder->SetInsertPoint(checkedBlock);
+    for (auto &indexExpr : forStmt->hoisted) {
+        indexExpr->checked = true;
+    }
+    compileForLoop(forStmt);
+    for (auto &indexExpr : forStmt->hoisted) {
+        indexExpr->checked = false;
+    }
+    builder->CreateBr(doneBlock);
+    builder->SetInsertPoint(doneBlock);
 }
 
 void compileStatement(Stmt *stmt) {
@@ -1057,6 +2598,7 @@ void compileStatement(Stmt *stmt) {
     case EXPR_STMT: {
         ExprStmt *exprStmt = (ExprStmt *)stmt;
         compileExpression(exprStmt->expression);
+        releaseTemporaries();
         break;
     }
     case COMP_ASSIGN_STMT: {
@@ -1067,6 +2609,10 @@ void compileStatement(Stmt *stmt) {
         llvm::Value *variable = builder->CreateLoad(allocaInst->getAllocatedType(), allocaInst);
         builder->CreateStore(binaryOp(compileExpression(compStmt->right), variable, compStmt->op, compStmt->line),
                              allocaInst);
+        if (isReleased(allocaInst)) {
+            releaseSlot(savePrevious(variable, nullptr));
+        }
+        releaseTemporaries();
         break;
     }
     case BREAK_STMT: {
@@ -1077,20 +2623,22 @@ void compileStatement(Stmt *stmt) {
         switch (assignStmt->variable->type) {
         case VAR_EXPR: {
             assignToVarExpr(assignStmt);
-            return;
+            break;
         }
         case INDEX_EXPR: {
             assignToIndexExpr(assignStmt);
-            return;
+            break;
         }
         case DOT_EXPR: {
             assignToDotExpr(assignStmt);
-            return;
+            break;
         }
         default: {
             errorAt(assignStmt->line, "Don't know how to assign to this expr?");
         }
         }
+        releaseTemporaries();
+        break;
     }
     case RETURN_STMT: {
         ReturnStmt *returnStmt = (ReturnStmt *)stmt;
@@ -1099,11 +2647,31 @@ void compileStatement(Stmt *stmt) {
             errorAt(returnStmt->line, "Can't return outside of a function");
         }
 
-        llvm::Value *returnValue = loadAllocaInst(compileExpression(returnStmt->value));
+        llvm::Value *returnValue = compileExpression(returnStmt->value);
+        if (isFixedArray(returnStmt->value)) {
+            returnValue = copyFixedArray(llvm::dyn_cast<llvm::AllocaInst>(returnValue), returnStmt->value->evaluatesTo);
+        } else {
+            returnValue = giveToCaller(returnStmt->value, returnValue);
+        }
+        if (llvm::Value *returnSlot = llvmFunction->returnSlot) {
+            storeReturnValue(returnSlot, returnValue);
+            storeRefArguments();
+            releaseTemporaries();
+            releaseSlots(0);
+            builder->CreateRetVoid();
+            break;
+        }
         // ToDo  better check for llvmCompiler
         // Check here if it's an allocaInst and then load it before sending
         // it back
         llvm::Type *expectedReturnType = llvmFunction->functionType->getReturnType();
+        returnValue = loadAllocaInst(widenInteger(returnValue, expectedReturnType));
+        if (expectedReturnType->isIntegerTy(32) && returnValue->getType()->isIntegerTy(64)) {
+            errorAt(returnStmt->line, "Can't return an i64 from an int function, convert it with to_int");
+        }
+        storeRefArguments();
+        releaseTemporaries();
+        releaseSlots(0);
         builder->CreateRet(returnValue);
         break;
     }
@@ -1112,7 +2680,22 @@ void compileStatement(Stmt *stmt) {
         Variable *var = varStmt->var;
         std::string varName = var->name;
 
+        if (var->type == ARRAY_VAR && ((ArrayVariable *)var)->fixedSize) {
+            llvmFunction->scopedVariables.back().push_back(createFixedArray(varStmt));
+            break;
+        }
+
+        // The initializer can't read the variable, so the value from the previous time through a loop goes first
+        llvm::AllocaInst *slot = nullptr;
+        if (varStmt->released) {
+            slot = createReleasedSlot(var, "");
+            releaseSlot(slot);
+        }
+
         llvm::Value *value = compileExpression(varStmt->initializer);
+        if (var->type == I64_VAR) {
+            value = widenInteger(value, builder->getInt64Ty());
+        }
 
         // if (!checkVariableValueMatch(var, value)) {
         //     printf("Invalid type mismatch in var declaration\nexpected: ");
@@ -1127,23 +2710,47 @@ void compileStatement(Stmt *stmt) {
 
         if (allocaInst != nullptr) {
             if (varStmt->initializer->type == VAR_EXPR) {
-                llvm::AllocaInst *allocaVar = builder->CreateAlloca(allocaInst->getAllocatedType(), nullptr, varName);
-                copyAllocation(allocaVar, allocaInst, var);
+                llvm::AllocaInst *allocaVar = createEntryAlloca(allocaInst->getAllocatedType(), varName);
+                if (isFixedArray(varStmt->initializer)) {
+                    copyArray(allocaVar, loadAllocaInst(allocaInst), var);
+                } else if (isMove(varStmt->initializer) && (isReleased(allocaInst) || !varStmt->released)) {
+                    // Only a released variable gives its buffer up, others can still be read through an item
+                    builder->CreateStore(loadAllocaInst(allocaInst), allocaVar);
+                    if (isReleased(allocaInst)) {
+                        builder->CreateStore(llvm::Constant::getNullValue(allocaVar->getAllocatedType()), allocaInst);
+                    }
+                } else {
+                    copyAllocation(allocaVar, allocaInst, var);
+                }
                 allocaInst = allocaVar;
             }
             allocaInst->setName(varName);
         } else {
-            allocaInst = builder->CreateAlloca(value->getType(), nullptr, varName);
+            allocaInst = createEntryAlloca(value->getType(), varName);
 
-            if (value->getType() == llvmCompiler->internalStructs["array"]) {
+            if (value->getType() == llvmCompiler->internalStructs["array"] && !isOwnedResult(varStmt->initializer)) {
                 copyArray(allocaInst, value, var);
+            } else if (isStringTy(value)) {
+                storeStringValue(allocaInst, value, varStmt->initializer);
+            } else if (var->type == SET_VAR && varStmt->initializer->type == VAR_EXPR) {
+                copySet(allocaInst, getAggregatePointer(value), var);
+            } else if (var->type == GRID_VAR && !isFresh(varStmt->initializer)) {
+                copyGrid(allocaInst, getAggregatePointer(value), var);
+            } else if (var->type == BUILDER_VAR && varStmt->initializer->type == VAR_EXPR) {
+                copyBuilder(allocaInst, getAggregatePointer(value));
             } else {
                 builder->CreateStore(value, allocaInst);
             }
         }
 
+        if (slot && slot->getAllocatedType() == allocaInst->getAllocatedType()) {
+            builder->CreateStore(loadAllocaInst(allocaInst), slot);
+            allocaInst->setName("");
+            slot->setName(varName);
+            allocaInst = slot;
+        }
         llvmFunction->scopedVariables.back().push_back(allocaInst);
-
+        releaseTemporaries();
         break;
     }
     case WHILE_STMT: {
@@ -1161,16 +2768,20 @@ void compileStatement(Stmt *stmt) {
     }
     case FOR_STMT: {
         ForStmt *forStmt = (ForStmt *)stmt;
-
-        llvm::BasicBlock *headerBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "header", llvmFunction->function);
-        llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "body", llvmFunction->function);
-        llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "exit", llvmFunction->function);
-
         compileStatement(forStmt->initializer);
-        compileLoopHeader(headerBlock, exitBlock, bodyBlock, forStmt->condition);
-        compileLoopBody(headerBlock, exitBlock, forStmt->body);
-        compileLoopExit(headerBlock, exitBlock, forStmt->increment);
-
+        if (forStmt->rangeChecks.empty() || llvmCompiler->unchecked) {
+            compileForLoop(forStmt);
+        } else {
+            compileVersionedLoop(forStmt);
+        }
+        break;
+    }
+    case FOR_EACH_STMT: {
+        compileForEach((ForEachStmt *)stmt);
+        break;
+    }
+    case REGION_STMT: {
+        compileRegion((RegionStmt *)stmt);
         break;
     }
     case STRUCT_STMT: {
@@ -1186,11 +2797,15 @@ void compileStatement(Stmt *stmt) {
         }
 
         llvmCompiler->structs[structName] = new LLVMStruct(fieldTypes, structName, fieldNames, llvmCompiler->ctx);
+        if (structStmt->soa) {
+            layoutColumns(llvmCompiler->structs[structName]);
+        }
         break;
     }
     case IF_STMT: {
         IfStmt *ifStmt = (IfStmt *)stmt;
         llvm::Value *condition = compileExpression(ifStmt->condition);
+        releaseTemporaries();
 
         llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "then", llvmFunction->function);
         llvm::BasicBlock *elseBlock = llvm::BasicBlock::Create(*llvmCompiler->ctx, "else", llvmFunction->function);
@@ -1231,11 +2846,14 @@ void compileStatement(Stmt *stmt) {
         }
 
         if (!returned) {
-            if (!llvmFunction->functionType->getReturnType()->isVoidTy()) {
+            if (!llvmFunction->functionType->getReturnType()->isVoidTy() || llvmFunction->returnSlot) {
                 errorAt(funcStmt->line, ("Non-void function does not return a value in " + funcStmt->name).c_str());
             }
+            storeRefArguments();
+            releaseSlots(0);
             builder->CreateRetVoid();
         }
+        llvmFunction->allocaPoint->eraseFromParent();
 
         llvmCompiler->callableFunctions.push_back(llvmFunction->function);
         llvmFunction = llvmFunction->enclosing;
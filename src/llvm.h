@@ -13,9 +13,12 @@ class ExitBlock {
   public:
     ExitBlock *prev;
     llvm::BasicBlock *exitBlock;
-    ExitBlock(ExitBlock *prev, llvm::BasicBlock *exitBlock) {
+    // If branches open when the loop was entered, a break releases what the body and the ones inside it declared
+    int branches;
+    ExitBlock(ExitBlock *prev, llvm::BasicBlock *exitBlock, int branches) {
         this->prev = prev;
         this->exitBlock = exitBlock;
+        this->branches = branches;
     }
 };
 
@@ -24,9 +27,17 @@ class LLVMStruct {
   public:
     llvm::StructType *structType;
     std::vector<std::string> fields;
+    // Arrays of soa structs store each field in its own column,
+    // column i starts at capacity * columnOffsets[i] bytes into the buffer
+    bool soa;
+    std::vector<uint32_t> columnOffsets;
+    std::vector<int> columnOrder;
+    uint32_t columnStride;
     LLVMStruct(std::vector<llvm::Type *> fieldTypes, std::string structName, std::vector<std::string> fields,
                llvm::LLVMContext *ctx) {
         this->fields = fields;
+        this->soa = false;
+        this->columnStride = 0;
         this->structType = llvm::StructType::create(*ctx, fieldTypes, structName);
     }
 };
@@ -38,8 +49,27 @@ class LLVMFunction {
     LLVMFunction *enclosing;
     std::vector<std::vector<llvm::AllocaInst *>> scopedVariables;
     std::map<std::string, int> functionArguments;
+    // Arrays, maps and structs are passed as read-only pointers to the caller's value, this is the type each points at
+    std::map<std::string, llvm::Type *> pointerArguments;
+    // Returned arrays, maps and structs are stored through the sret pointer the caller passes first
+    llvm::Value *returnSlot;
+    // 'ref' params are loaded into a slot of their own on entry and stored back to the caller's variable on return
+    std::vector<std::pair<llvm::AllocaInst *, llvm::Value *>> refArguments;
     std::map<llvm::Value *, llvm::Type *> arrayElements;
+    // Slots of variables holding a counted reference, they're released when the function returns
+    std::vector<llvm::AllocaInst *> released;
+    // Where the released slots of each open if branch or loop body start, they're released when it ends
+    std::vector<int> branches;
+    // Concatenations nothing keeps, they have a single owner so their buffer is freed outright after the statement
+    std::vector<llvm::AllocaInst *> temporaries;
+    // Call results nothing keeps, a function can hand back a shared or static buffer so these are dropped instead
+    std::vector<llvm::AllocaInst *> results;
+    // What the released slots and results hold, an array drops the items in its boxes along with its buffer
+    std::map<llvm::AllocaInst *, Variable *> slotVariables;
     llvm::BasicBlock *entryBlock;
+    // Every alloca is inserted above this placeholder at the top of the entry block, it's removed once the function is
+    // done
+    llvm::Instruction *allocaPoint;
     ExitBlock *exitBlock;
     llvm::Function *function;
     llvm::FunctionType *functionType;
@@ -48,12 +78,15 @@ class LLVMFunction {
                  std::map<std::string, int> funcArgs, llvm::LLVMContext *ctx, llvm::Module *module) {
         this->broke = false;
         this->exitBlock = nullptr;
+        this->returnSlot = nullptr;
         this->enclosing = enclosing;
         this->functionType = funcType;
         this->function = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, name, *module);
         this->scopedVariables = std::vector<std::vector<llvm::AllocaInst *>>(1);
         this->functionArguments = funcArgs;
         this->entryBlock = llvm::BasicBlock::Create(*ctx, "entry", this->function);
+        llvm::Type *i32 = llvm::Type::getInt32Ty(*ctx);
+        this->allocaPoint = new llvm::BitCastInst(llvm::UndefValue::get(i32), i32, "allocapoint", this->entryBlock);
     }
 };
 
@@ -65,12 +98,14 @@ class LLVMCompiler {
     std::map<std::string, llvm::StructType *> internalStructs;
     std::map<std::string, llvm::FunctionCallee> libraryFuncs;
     std::map<std::string, llvm::Function *> internalFuncs;
+    std::map<std::string, llvm::Constant *> stringLiterals;
     llvm::Module *module;
     std::vector<std::map<std::string, Variable *>> variables;
-    std::vector<llvm::AllocaInst *> strings;
     std::map<std::string, LLVMStruct *> structs;
+    // --unchecked, indexing isn't bounds checked at all
+    bool unchecked;
 };
-void initCompiler(std::vector<std::map<std::string, Variable *>> variables);
+void initCompiler(std::vector<std::map<std::string, Variable *>> variables, bool unchecked = false);
 void compile(std::vector<Stmt *> stmts);
 llvm::Value *compileExpression(Expr *expr);
 void compileStatement(Stmt *stmt);
@@ -16,14 +16,23 @@ static std::string readFile(const char *path) {
 }
 
 int main(int argc, const char *argv[]) {
-    if (argc == 1) {
+    const char *path = nullptr;
+    bool unchecked = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--unchecked") {
+            unchecked = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == nullptr) {
         printf("Need file name\n");
         exit(1);
     }
-    std::string source = readFile(argv[1]);
+    std::string source = readFile(path);
     Compiler *compiler = compile(source);
 
-    initCompiler(compiler->variables);
+    initCompiler(compiler->variables, unchecked);
     compile(compiler->statements);
     system("lli out.ll");
 
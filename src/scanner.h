@@ -40,6 +40,11 @@ typedef enum {
 
     // Datatypes
     TOKEN_INT_TYPE,    // int 1
+    TOKEN_I64_TYPE,    // i64
+    TOKEN_U8_TYPE,     // u8
+    TOKEN_I16_TYPE,    // i16
+    TOKEN_U32_TYPE,    // u32
+    TOKEN_FLOAT_TYPE,  // f32
     TOKEN_DOUBLE_TYPE, // float 2
     TOKEN_STR_TYPE,    // str 3
     TOKEN_BOOL_TYPE,   // bool 4
@@ -47,6 +52,9 @@ typedef enum {
     TOKEN_ARRAY_TYPE,  // array 6
     TOKEN_STRUCT_TYPE, // struct
     TOKEN_NIL,         // nil 7
+    TOKEN_SET_TYPE,     // set
+    TOKEN_BUILDER_TYPE, // builder
+    TOKEN_GRID_TYPE,    // grid
 
     // Keywords.
     TOKEN_PRINT,
@@ -55,6 +63,7 @@ typedef enum {
     TOKEN_FOR,
     TOKEN_FUN,
     TOKEN_IF,
+    TOKEN_IN,
     TOKEN_RETURN,
     TOKEN_TRUE,
     TOKEN_WHILE,
@@ -62,6 +71,9 @@ typedef enum {
     TOKEN_OR,
     TOKEN_VAR,
     TOKEN_BREAK,
+    TOKEN_SOA,
+    TOKEN_REGION,
+    TOKEN_REF,
     TOKEN_ERROR,
 
     TOKEN_EOF
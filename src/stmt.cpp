@@ -47,6 +47,21 @@ void freeStmt(Stmt *stmt) {
         }
         break;
     }
+    case FOR_EACH_STMT: {
+        ForEachStmt *forEachStmt = (ForEachStmt *)stmt;
+        freeExpr(forEachStmt->iterable);
+        for (auto &s : forEachStmt->body) {
+            freeStmt(s);
+        }
+        break;
+    }
+    case REGION_STMT: {
+        RegionStmt *regionStmt = (RegionStmt *)stmt;
+        for (auto &s : regionStmt->body) {
+            freeStmt(s);
+        }
+        break;
+    }
     case STRUCT_STMT: {
         StructStmt *structStmt = (StructStmt *)stmt;
         break;
@@ -11,10 +11,12 @@ enum StatementType {
     VAR_STMT,
     WHILE_STMT,
     FOR_STMT,
+    FOR_EACH_STMT,
     STRUCT_STMT,
     IF_STMT,
     FUNC_STMT,
-    BREAK_STMT
+    BREAK_STMT,
+    REGION_STMT
 };
 
 class Stmt {
@@ -75,6 +77,8 @@ class VarStmt : public Stmt {
   public:
     Variable *var;
     Expr *initializer;
+    // Set when the buffer is never stored where it isn't counted, the variable releases it when it's done with it
+    bool released = false;
     VarStmt(int line) { this->line = line; }
 };
 
@@ -111,12 +115,61 @@ class ForStmt : public Stmt {
     Expr *condition;
     Stmt *increment;
     std::vector<Stmt *> body;
+    // Arrays the body indexes unchecked, they're checked against the loop's range once before it starts
+    std::vector<Expr *> rangeChecks;
+    // The indices that aren't checked, the loop is compiled again with them checked for when the range check fails
+    std::vector<IndexExpr *> hoisted;
     ForStmt(int line) {
         this->type = FOR_STMT;
         this->initializer = nullptr;
         this->condition = nullptr;
         this->increment = nullptr;
         this->body = std::vector<Stmt *>();
+        this->rangeChecks = std::vector<Expr *>();
+        this->hoisted = std::vector<IndexExpr *>();
+        this->line = line;
+    }
+};
+
+// 'for (item in iterable)' or 'for (key, item in iterable)', the key is the index for arrays and strings
+class ForEachStmt : public Stmt {
+  private:
+  public:
+    std::string key;
+    std::string item;
+    Variable *keyVar;
+    Variable *itemVar;
+    Expr *iterable;
+    bool reloads;
+    // Like VarStmt, the key and item give up their reference to the previous item before taking the next one
+    bool released;
+    std::vector<Stmt *> body;
+    ForEachStmt(std::string key, std::string item, Expr *iterable, int line) {
+        this->type = FOR_EACH_STMT;
+        this->key = key;
+        this->item = item;
+        this->keyVar = nullptr;
+        this->itemVar = nullptr;
+        this->iterable = iterable;
+        this->reloads = false;
+        this->released = false;
+        this->body = std::vector<Stmt *>();
+        this->line = line;
+    }
+};
+
+// 'region { ... }', everything allocated in the body is freed together when it ends.
+// Statements in it that store into variables from outside are wrapped in a suspended region, which allocates on the
+// heap again so the stored value outlives the region
+class RegionStmt : public Stmt {
+  private:
+  public:
+    std::vector<Stmt *> body;
+    bool suspended;
+    RegionStmt(bool suspended, int line) {
+        this->type = REGION_STMT;
+        this->suspended = suspended;
+        this->body = std::vector<Stmt *>();
         this->line = line;
     }
 };
@@ -126,8 +179,10 @@ class StructStmt : public Stmt {
   public:
     std::string name;
     std::vector<Variable *> fields;
+    bool soa;
     StructStmt(std::string name, int line) {
         this->name = name;
+        this->soa = false;
         this->type = STRUCT_STMT;
         this->fields = std::vector<Variable *>();
         this->line = line;
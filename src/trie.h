@@ -12,7 +12,8 @@ class Node {
     Node(int depth, char value) {
         this->type = TOKEN_IDENTIFIER;
         this->value = value;
-        this->children = std::vector<Node *>(26);
+        // a-z followed by 0-9
+        this->children = std::vector<Node *>(36);
         std::fill(this->children.begin(), this->children.end(), nullptr);
     }
 };
@@ -20,22 +21,36 @@ class Node {
 class Trie {
   private:
     Node *head;
+    static int childIndex(char c) { return isdigit(c) ? 26 + c - '0' : 'z' - c; }
+
     std::map<std::string, TokenType> INIT_KEYWORDS = {{"and", TOKEN_AND},
                                                       {"arr", TOKEN_ARRAY_TYPE},
                                                       {"break", TOKEN_BREAK},
                                                       {"bool", TOKEN_BOOL_TYPE},
+                                                      {"builder", TOKEN_BUILDER_TYPE},
                                                       {"double", TOKEN_DOUBLE_TYPE},
                                                       {"false", TOKEN_FALSE},
+                                                      {"float", TOKEN_FLOAT_TYPE},
                                                       {"for", TOKEN_FOR},
                                                       {"fun", TOKEN_FUN},
+                                                      {"grid", TOKEN_GRID_TYPE},
                                                       {"else", TOKEN_ELSE},
                                                       {"int", TOKEN_INT_TYPE},
+                                                      {"i64", TOKEN_I64_TYPE},
+                                                      {"u8", TOKEN_U8_TYPE},
+                                                      {"i16", TOKEN_I16_TYPE},
+                                                      {"u32", TOKEN_U32_TYPE},
                                                       {"if", TOKEN_IF},
+                                                      {"in", TOKEN_IN},
                                                       {"map", TOKEN_MAP_TYPE},
                                                       {"nil", TOKEN_NIL},
                                                       {"or", TOKEN_OR},
                                                       {"print", TOKEN_PRINT},
+                                                      {"ref", TOKEN_REF},
+                                                      {"region", TOKEN_REGION},
                                                       {"return", TOKEN_RETURN},
+                                                      {"set", TOKEN_SET_TYPE},
+                                                      {"soa", TOKEN_SOA},
                                                       {"str", TOKEN_STR_TYPE},
                                                       {"struct", TOKEN_STRUCT_TYPE},
                                                       {"true", TOKEN_TRUE},
@@ -50,11 +65,11 @@ class Trie {
             return curr->type;
         }
 
-        if ((!isalpha(keyword[depth]) || isupper(keyword[depth]))) {
+        if ((!isalnum(keyword[depth]) || isupper(keyword[depth]))) {
             return TOKEN_IDENTIFIER;
         }
 
-        int idx = 'z' - keyword[depth++];
+        int idx = childIndex(keyword[depth++]);
         return findNode(keyword, depth, curr->children[idx]);
     }
     void addNode(std::string keyword, TokenType type, int depth, Node *curr) {
@@ -63,7 +78,7 @@ class Trie {
             return;
         }
 
-        int idx = 'z' - keyword[depth++];
+        int idx = childIndex(keyword[depth++]);
         if (curr->children[idx] == nullptr) {
             curr->children[idx] = new Node(depth, keyword[depth - 1]);
         }
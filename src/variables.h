@@ -4,14 +4,37 @@
 #include <string>
 #include <vector>
 
-enum VarType { FUNC_VAR, STR_VAR, INT_VAR, DOUBLE_VAR, BOOL_VAR, MAP_VAR, ARRAY_VAR, STRUCT_VAR, NIL_VAR };
+enum VarType {
+    FUNC_VAR,
+    STR_VAR,
+    INT_VAR,
+    I64_VAR,
+    U8_VAR,
+    I16_VAR,
+    U32_VAR,
+    FLOAT_VAR,
+    DOUBLE_VAR,
+    BOOL_VAR,
+    MAP_VAR,
+    SET_VAR,
+    BUILDER_VAR,
+    GRID_VAR,
+    ARRAY_VAR,
+    STRUCT_VAR,
+    NIL_VAR
+};
 
 class Variable {
   private:
   public:
     std::string name;
     VarType type;
-    Variable(std::string name = "never assigned name :)") { this->name = name; }
+    // Set on function params declared 'ref', the function works on the caller's variable
+    bool ref;
+    Variable(std::string name = "never assigned name :)") {
+        this->name = name;
+        this->ref = false;
+    }
 };
 
 class FuncVariable : public Variable {
@@ -19,6 +42,10 @@ class FuncVariable : public Variable {
   public:
     Variable *returnType;
     std::vector<Variable *> params;
+    // Set for the params the function can store somewhere that outlives the call, empty for builtins
+    std::vector<bool> storesParams;
+    // Set for the params whose items the function writes, the caller's value is written through them
+    std::vector<bool> writesParams;
     FuncVariable(std::string name, Variable *returnType, std::vector<Variable *> params) {
         this->name = name;
         this->type = FUNC_VAR;
@@ -31,10 +58,16 @@ class ArrayVariable : public Variable {
   private:
   public:
     Variable *items;
+    // Size of a 'T[N]' array, known at compile time. 0 for arrays that can grow
+    int fixedSize;
+    // Set when an 'arr[T]' is given a fixed size because it never outlives the function, it's still checked at runtime
+    bool onStack;
     ArrayVariable(std::string name) {
         this->name = name;
         this->type = ARRAY_VAR;
         this->items = nullptr;
+        this->fixedSize = 0;
+        this->onStack = false;
     }
 };
 
@@ -64,4 +97,27 @@ class MapVariable : public Variable {
     }
 };
 
+// A two dimensional array in one row major buffer
+class GridVariable : public Variable {
+  private:
+  public:
+    Variable *items;
+    GridVariable(std::string name) {
+        this->name = name;
+        this->type = GRID_VAR;
+        this->items = nullptr;
+    }
+};
+
+class SetVariable : public Variable {
+  private:
+  public:
+    Variable *items;
+    SetVariable(std::string name) {
+        this->name = name;
+        this->type = SET_VAR;
+        this->items = nullptr;
+    }
+};
+
 #endif
@@ -95,7 +95,7 @@ TEST(TestScanner, TestLiterals) {
 }
 
 TEST(TestScanner, TestKeywords) {
-    const char *source = "struct print break else false for fun if nil return true while and or var";
+    const char *source = "struct print break else false for fun if nil return true while and or var soa";
     Scanner *scanner = nullptr;
     scanner = (Scanner *)malloc(sizeof(Scanner));
     initScanner(scanner, source);
@@ -116,6 +116,7 @@ TEST(TestScanner, TestKeywords) {
         (Token){"and", 3, 0, TOKEN_AND},
         (Token){"or", 2, 0, TOKEN_OR},
         (Token){"var", 3, 0, TOKEN_VAR},
+        (Token){"soa", 3, 0, TOKEN_SOA},
         (Token){"EOF", 3, 0, TOKEN_EOF},
     };
     for (int i = 0; i < tokens.size(); i++) {
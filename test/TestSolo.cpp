@@ -96,15 +96,16 @@ int main() {
 
     std::string index9 = "var a:map[int, int] = {1:1, 2:2}; a[3];";
     nmbr_of_tests++;
-    runTest("Index - Invalid idx int map", index9, "Key didn't exist\n", failed);
+    runTest("Index - Invalid idx int map", index9, "[line 1] Key didn't exist\n", failed);
 
     std::string index10 = "var a:map[str, int] = {\"Hi\":1, \"Hey\":2}; a[\"H\"];";
     nmbr_of_tests++;
-    runTest("Index - Invalid idx str map", index10, "Key didn't exist\n", failed);
+    runTest("Index - Invalid idx str map", index10, "[line 1] Key didn't exist\n", failed);
 
     std::string index11 = "var a:arr[int] = [1,2]; a[2];";
     nmbr_of_tests++;
-    runTest("Index - Invalid idx int array", index11, "Trying to index outside of array\nsize: 2\nidx: 2\n", failed);
+    runTest("Index - Invalid idx int array", index11, "[line 1] Trying to index outside of array\nsize: 2\nidx: 2\n",
+            failed);
 
     // Assign to index
     std::string assignIndex1 =
@@ -170,6 +171,21 @@ int main() {
     nmbr_of_tests++;
     runTest("Concat - 2 strings", conc1, "Hi Mom", failed);
 
+    std::string conc2 =
+        "var a: str = \"Hi\" + \" \"; var b: str = a + \"Mom\"; printf(\"%s %d %d\", b, len(a), len(b));";
+    nmbr_of_tests++;
+    runTest("Concat - len of concatenated strings", conc2, "Hi Mom 3 6", failed);
+
+    std::string conc3 = "var a: str = \"short\"; var b: str = a + \" with a long tail\"; var c: str = b; "
+                        "printf(\"%s %s %d %c\", a, c, len(b), b[6]);";
+    nmbr_of_tests++;
+    runTest("Concat - inline to heap string", conc3, "short short with a long tail 22 w", failed);
+
+    std::string conc4 = "var m: map[str, int] = {\"k\": 1, \"a key longer than fifteen bytes\": 2}; m[\"x\"] = 3; "
+                        "printf(\"%d %d %d\", m[\"k\"], m[\"a key longer than fifteen bytes\"], m[\"x\"]);";
+    nmbr_of_tests++;
+    runTest("Concat - inline and heap map keys", conc4, "1 2 3", failed);
+
     // FP test
     std::string fp1 = "var a: double = 5.0 * 2.5; printf(\"%lf\", a);";
     nmbr_of_tests++;
@@ -247,7 +263,7 @@ int main() {
 
     std::string internal2 = "var a: str = \"Hello World\"; printf(\"%d\", len(a));";
     nmbr_of_tests++;
-    runTest("Internal - len str", internal2, "12", failed);
+    runTest("Internal - len str", internal2, "11", failed);
 
     std::string internal3 = "var m: map[int, int] = {1:1, 2:2, 3:5}; var a: arr[int] = keys(m); printf(\"%d\", a[2]);";
     nmbr_of_tests++;
@@ -278,7 +294,7 @@ int main() {
     std::string internal9 =
         "var s: str = readfile(\"./test_file.txt\"); printf(\"%s\", s);";
     nmbr_of_tests++;
-    runTest("Internal - readfile", internal9, "This is a test file", failed);
+    runTest("Internal - readfile", internal9, "This is a test file\n", failed);
 
     // map tests
     std::string map1 = "var m:map[int, int] = {0:0}; m[1] = 5; printf(\"%d\", m[1]);";
@@ -297,6 +313,430 @@ int main() {
     nmbr_of_tests++;
     runTest("Map - key exists str", map4, "0 1", failed);
 
+    // set tests
+    std::string set1 = "var s:set[int] = {1, 2, 2, 3, 1}; printf(\"%d\", len(s));";
+    nmbr_of_tests++;
+    runTest("Set - Duplicates", set1, "3", failed);
+
+    std::string set2 = "var s:set[int] = {}; insert(s, 4); insert(s, 5); var r: bool = remove(s, 4); printf(\"%d "
+                       "%d %d %d\", r, remove(s, 4), contains(s, 4), contains(s, 5));";
+    nmbr_of_tests++;
+    runTest("Set - Insert remove contains", set2, "1 0 0 1", failed);
+
+    std::string set3 = "var a:set[int] = {1, 2, 3}; var b:set[int] = {2, 3, 4, 5}; printf(\"%d %d %d\", "
+                       "len(union(a, b)), len(intersection(a, b)), len(difference(b, a)));";
+    nmbr_of_tests++;
+    runTest("Set - Union intersection difference", set3, "5 2 2", failed);
+
+    std::string set4 = "var s:set[str] = {\"Hi\", \"Mom\", \"Hi\"}; var a: arr[str] = elements(s); printf(\"%d %d "
+                       "%d\", len(a), contains(s, \"Mom\"), contains(s, \"Mum\"));";
+    nmbr_of_tests++;
+    runTest("Set - Str elements", set4, "2 1 0", failed);
+
+    std::string set5 = "var s:set[int] = {}; var i: int = 0; while(i < 100){insert(s, i * 7); i++;} i = 0; "
+                       "while(i < 50){remove(s, i * 14); i++;} var a: arr[int] = elements(s); printf(\"%d %d %d\", "
+                       "len(s), len(a), contains(s, 693));";
+    nmbr_of_tests++;
+    runTest("Set - Grow", set5, "50 50 1", failed);
+
+    std::string set6 = "var a:set[int] = {1}; var b:set[int] = a; insert(b, 2); printf(\"%d %d\", len(a), len(b));";
+    nmbr_of_tests++;
+    runTest("Set - Copy", set6, "1 2", failed);
+
+    std::string set7 = "fun has(s: set[str], x: str) -> bool {return contains(s, x);} var s:set[str] = {\"Hi\"}; "
+                       "printf(\"%d %d\", has(s, \"Hi\"), has(s, \"Mom\"));";
+    nmbr_of_tests++;
+    runTest("Set - Func param", set7, "1 0", failed);
+
+    std::string set8 =
+        "fun addAll(ref s: set[int], n: int) -> nil { for (var i: int = 0; i < n; i++) { insert(s, i); insert(s, i); "
+        "} } fun evens(n: int) -> set[int] { var s: set[int] = {}; for (var i: int = 0; i < n; i += 2) { insert(s, "
+        "i); } return s; } var s: set[int] = {1}; addAll(s, 40); var e: set[int] = evens(10); printf(\"%d %d %d %d\", "
+        "len(s), contains(s, 39), len(e), contains(e, 4));";
+    nmbr_of_tests++;
+    runTest("Set - Ref param grows the caller's set", set8, "40 1 5 1", failed);
+
+    std::string set9 =
+        "fun grow(s: set[int]) -> int { var t: set[int] = s; for (var i: int = 0; i < 100; i++) { insert(t, i + 10); "
+        "} var u: set[int] = {}; u = s; insert(u, 5000); return len(t) + len(u); } var s: set[int] = {1, 2, 3}; "
+        "printf(\"%d %d %d\", grow(s), len(s), contains(s, 2));";
+    nmbr_of_tests++;
+    runTest("Set - Copy of a param", set9, "107 3 1", failed);
+
+    std::string set10 =
+        "fun sum(s: set[int]) -> int { var t: int = 0; for (x in s) { t += x; } return t; } var s: set[int] = {}; for "
+        "(var i: int = 0; i < 100; i++) { insert(s, i); } remove(s, 50); var n: int = 0; for (x in s) { n++; } var "
+        "words: set[str] = {\"a word that is long enough for the heap\", \"b\"}; var longest: str = \"\"; for (w in "
+        "words) { if (len(w) > len(longest)) { longest = w; } w[0] = \"X\"; } var m: int = 0; for (w in "
+        "union(words, {\"d\"})) { m++; } printf(\"%d %d %s %d %d\", sum(s), n, longest, m, contains(words, \"b\"));";
+    nmbr_of_tests++;
+    runTest("Set - Looped over directly", set10, "4900 99 a word that is long enough for the heap 3 1", failed);
+
+    // builder tests
+    std::string builder1 = "var b: builder = {}; push(b, \"Hi\"); push(b, \" \"); push_int(b, 42); push(b, \" \"); "
+                           "push_double(b, 1.5); printf(\"%s\", build(b));";
+    nmbr_of_tests++;
+    runTest("Builder - Push str int double", builder1, "Hi 42 1.500000", failed);
+
+    std::string builder2 = "var b: builder = {}; var i: int = 0; while(i < 100){push(b, \"abc\"); i++;} var s: str = "
+                           "build(b); push(b, \"d\"); printf(\"%d %d %c\", len(s), len(build(b)), s[299]);";
+    nmbr_of_tests++;
+    runTest("Builder - Grow and build twice", builder2, "300 301 c", failed);
+
+    std::string builder3 = "var b: builder = {}; push(b, \"ab\"); var c: builder = b; push(c, \"cd\"); push(b, \"x\"); "
+                           "var d: builder = {}; d = c; push(d, \"!\"); printf(\"%s %s %s\", build(b), build(c), "
+                           "build(d));";
+    nmbr_of_tests++;
+    runTest("Builder - Copies have their own buffer", builder3, "abx abcd abcd!", failed);
+
+    std::string builder4 =
+        "fun pad(ref b: builder, n: int) -> nil { for (var i: int = 0; i < n; i++) { push(b, \"q\"); } } fun "
+        "ends(b: builder) -> str { var c: builder = b; push(c, \"!\"); return build(c); } var b: builder = {}; push(b, "
+        "\"a\"); pad(b, 100); var s: str = ends(b); push(b, \"z\"); printf(\"%d %d %c %c\", len(build(b)), len(s), "
+        "s[101], build(b)[101]);";
+    nmbr_of_tests++;
+    runTest("Builder - Pushed to through a ref param", builder4, "102 102 ! z", failed);
+
+    // intern tests
+    std::string intern1 = "var a: str = \"customer-0000000001\"; var b: str = intern(\"customer-\" + \"0000000001\"); "
+                          "var c: str = intern(a); var up: str = \"C\"; b[0] = up[0]; printf(\"%s %s\", b, c);";
+    nmbr_of_tests++;
+    runTest("Intern - Writing to an interned string copies it", intern1,
+            "Customer-0000000001 customer-0000000001", failed);
+
+    std::string intern2 = "var m: map[str, int] = {\"customer-0000000001\": 1, \"b\": 2}; var k: str = \"customer-\" + "
+                          "\"0000000001\"; m[k] = 3; printf(\"%d %d %d\", m[\"customer-0000000001\"], m[\"b\"], "
+                          "len(keys(m)));";
+    nmbr_of_tests++;
+    runTest("Intern - Map keys", intern2, "3 2 2", failed);
+
+    // copy on write tests
+    std::string cow1 = "var a: arr[int] = [1, 2, 3]; var b: arr[int] = a; var c: arr[int] = b; b[0] = 10; "
+                       "append(c, 4); a[1] = 20; printf(\"%d %d %d %d %d %d %d\", a[0], b[0], c[0], a[1], b[1], "
+                       "len(a), len(c));";
+    nmbr_of_tests++;
+    runTest("COW - Shared arrays copy on first write", cow1, "1 10 1 20 2 3 4", failed);
+
+    std::string cow2 = "var s: str = \"a string on the \" + \"heap\"; var t: str = s; var u: str = t; var up: str = "
+                       "\"X\"; t[0] = up[0]; s[1] = up[0]; printf(\"%s|%s|%s\", s, t, u);";
+    nmbr_of_tests++;
+    runTest("COW - Shared strings copy on first write", cow2,
+            "aXstring on the heap|X string on the heap|a string on the heap", failed);
+
+    // move tests
+    std::string move1 = "var a: arr[int] = [1, 2, 3]; var b: arr[int] = a; var c: arr[int] = b; c[0] = 9; "
+                        "var p: arr[int] = [1]; var q: arr[int] = p; q[0] = 5; printf(\"%d %d %d %d\", c[0], len(c), "
+                        "p[0], q[0]);";
+    nmbr_of_tests++;
+    runTest("Move - Last use hands over the buffer", move1, "9 3 1 5", failed);
+
+    std::string move2 = "var x: str = \"a string on the heap\"; var y: str = move(x); var a: arr[int] = [1, 2]; "
+                        "var b: arr[int] = []; b = move(a); printf(\"%d %s %d %d\", len(x), y, len(a), b[1]);";
+    nmbr_of_tests++;
+    runTest("Move - Explicit move empties the source", move2, "0 a string on the heap 0 2", failed);
+
+    // struct array tests
+    std::string structArr1 = "struct p { x: int; y: double; }; var a: arr[p] = [p(1, 1.5), p(2, 2.5)]; a[1].x = 5; "
+                             "append(a, p(3, 3.5)); printf(\"%d %d %d %.1lf\", a[0].x, a[1].x, len(a), a[2].y);";
+    nmbr_of_tests++;
+    runTest("Struct array - Fields are read and written in place", structArr1, "1 5 3 3.5", failed);
+
+    std::string structArr2 = "struct p { x: int; y: double; }; var a: arr[p] = [p(1, 1.5)]; var b: arr[p] = a; "
+                             "b[0].x = 9; var q: p = b[0]; q.x = 7; printf(\"%d %d %d\", a[0].x, b[0].x, q.x);";
+    nmbr_of_tests++;
+    runTest("Struct array - Elements are copied by value", structArr2, "1 9 7", failed);
+
+    // soa tests
+    std::string soa1 = "soa struct p { b: bool; y: double; x: int; }; var a: arr[p] = [p(true, 1.5, 1), p(false, 2.5, "
+                       "2)]; append(a, p(true, 3.5, 3)); a[0].y = 0.5; var q: p = a[1]; a[2] = q; printf(\"%.1lf %d "
+                       "%d %d\", a[0].y, a[1].x, a[2].x, len(a));";
+    nmbr_of_tests++;
+    runTest("Soa - Fields are stored in columns", soa1, "0.5 2 2 3", failed);
+
+    std::string soa2 = "soa struct p { x: int; y: double; }; var a: arr[p] = [p(1, 1.5), p(2, 2.5)]; var b: arr[p] = "
+                       "a; b[1].x = 5; var s: int = 0; for (var i: int = 0; i < len(b); i = i + 1) { s = s + b[i].x; "
+                       "} printf(\"%d %d\", s, a[1].x);";
+    nmbr_of_tests++;
+    runTest("Soa - Field loop over a copied array", soa2, "6 2", failed);
+
+    std::string soa3 = "soa struct p { b: bool; y: double; x: int; }; var a: arr[p] = [p(true, 0.5, 0)]; for (var i: "
+                       "int = 1; i < 1000; i++) { append(a, p(i < 500, 0.5, i)); } var b: arr[p] = a; append(b, "
+                       "p(true, 0.5, 1000)); var s: int = 0; var t: int = 0; for (v in b) { s += v.x; if (v.b) { t++; "
+                       "} } printf(\"%d %d %d %.1lf %d\", len(a), s, t, a[999].y, b[1000].x);";
+    nmbr_of_tests++;
+    runTest("Soa - Appends grow the columns", soa3, "1000 500500 501 0.5 1000", failed);
+
+    // grid tests
+    std::string grid1 = "var g: grid[int] = new_grid(3, 4); fill(g, 2); g[1, 2] = 7; var s: int = 0; for (var i: int = "
+                        "0; i < rows(g); i = i + 1) { for (var j: int = 0; j < cols(g); j = j + 1) { s = s + g[i, j]; "
+                        "} } printf(\"%d %d %d\", s, g[1, 2], g[0, 3]);";
+    nmbr_of_tests++;
+    runTest("Grid - Fill, index and shape", grid1, "29 7 2", failed);
+
+    std::string grid2 = "var g: grid[double] = new_grid(2, 3); g[0, 1] = 1.5; var h: grid[double] = g; h[0, 1] = 2.5; "
+                        "copy_row(g, 1, h, 0); printf(\"%.1lf %.1lf %.1lf\", g[0, 1], h[0, 1], g[1, 1]);";
+    nmbr_of_tests++;
+    runTest("Grid - Copies and row copies", grid2, "1.5 2.5 2.5", failed);
+
+    std::string grid3 =
+        "fun make(n: int) -> grid[int] { return new_grid(n, n); } fun total(g: grid[int]) -> int { var t: int = 0; for "
+        "(var i: int = 0; i < rows(g); i++) { for (var j: int = 0; j < cols(g); j++) { t += g[i, j]; } } return t; } "
+        "fun bump(ref g: grid[int]) -> nil { fill(g, 1); g[1, 1] = 5; } fun same(g: grid[int]) -> grid[int] { return "
+        "g; } var g: grid[int] = make(3); bump(g); var h: grid[int] = same(g); h[0, 0] = 100; for (var i: int = 0; i < "
+        "100; i++) { var t: grid[int] = make(20); t[0, 0] = i; } printf(\"%d %d %d\", total(g), total(h), "
+        "total(new_grid(2, 2)));";
+    nmbr_of_tests++;
+    runTest("Grid - Passed, returned and written through 'ref'", grid3, "13 112 0", failed);
+
+    // fixed size array tests
+    std::string fixed1 = "fun sum() -> int { var a: int[4] = [1, 2, 3, 4]; var s: int = 0; for (var i: int = 0; i < "
+                         "len(a); i = i + 1) { a[i] = a[i] * 2; s = s + a[i]; } return s; } printf(\"%d\", sum());";
+    nmbr_of_tests++;
+    runTest("Fixed array - Index and len in a function", fixed1, "20", failed);
+
+    std::string fixed2 = "fun make() -> arr[int] { var a: int[3] = [7, 8]; return a; } var b: double[3] = [1.5]; "
+                         "var c: arr[double] = b; c[1] = 2.5; var m: arr[int] = make(); append(m, 9); printf(\"%.1lf "
+                         "%.1lf %d %d %d\", b[1], c[1], len(m), m[1], m[3]);";
+    nmbr_of_tests++;
+    runTest("Fixed array - Copies are growable", fixed2, "0.0 2.5 4 8 9", failed);
+
+    // slice tests
+    std::string slice1 = "var a: arr[int] = [1, 2, 3, 4, 5, 6]; var s: arr[int] = a[1:4]; a[1] = 20; s[1] = 30; "
+                         "append(s, 7); printf(\"%d %d %d %d %d %d\", len(s), s[0], s[1], a[2], len(a[:2]), "
+                         "len(a[4:]));";
+    nmbr_of_tests++;
+    runTest("Slice - Arrays copy before either side is written", slice1, "4 2 30 3 2 2", failed);
+
+    std::string slice2 = "var t: str = \"hello there, general kenobi\"; var u: str = t[13:]; u[0] = \"G\"; "
+                         "printf(\"%s %d %s|%s\", t[6:11], len(t[:5]), u, t);";
+    nmbr_of_tests++;
+    runTest("Slice - Strings", slice2, "there 5 General kenobi|hello there, general kenobi", failed);
+
+    std::string slice3 = "var s: str = \"a string that is on the heap\"; var f: str = \"%s|%s\"; printf(\"[%s] [%6s] "
+                         "[%-4s] [%.3s] 100%% [%*d] \", s[2:8], s[9:13], s[0:2], s, 3, 7); printf(f, s[17:19], "
+                         "s[0:1]);";
+    nmbr_of_tests++;
+    runTest("Slice - Printed with their length", slice3, "[string] [  that] [a   ] [a s] 100% [  7] on|a", failed);
+
+    // i64 tests
+    std::string i641 = "var big: i64 = 3000000000; var small: int = 7; var sum: i64 = big + small; sum += 5; sum++; "
+                       "var xs: arr[i64] = [1, 5000000000]; append(xs, small); xs[0] = big; printf(\"%ld %ld %ld "
+                       "%d\", sum, xs[0], xs[1] + xs[2], big > small);";
+    nmbr_of_tests++;
+    runTest("i64 - Arithmetic and arrays", i641, "3000000013 3000000000 5000000007 1", failed);
+
+    std::string i642 = "fun scale(v: i64, by: int) -> i64 { return v * by; } var p: i64 = scale(1000000000, 6); "
+                       "var d: double = p * 0.5; printf(\"%ld %d %ld %ld\", p, to_int(p / 1000), to_i64(d), -p);";
+    nmbr_of_tests++;
+    runTest("i64 - Params, returns and conversions", i642, "6000000000 6000000 3000000000 -6000000000", failed);
+
+    std::string i643 = "var xs: arr[int] = [1, 2, 3, 4, 5]; var s: str = \"hello world\"; var i: i64 = 1; var n: i64 "
+                       "= len_i64(xs); var ys: arr[int] = xs[i:n]; printf(\"%d %ld %d %s %d %c\", xs[i], n, len(ys), "
+                       "s[i:5], len(s), s[i]);";
+    nmbr_of_tests++;
+    runTest("i64 - Index, slice and len_i64", i643, "2 5 4 ello 11 e", failed);
+
+    // narrow integer tests
+    std::string narrow1 = "var px: arr[u8] = [0, 128, 255]; append(px, 7); px[0] = px[1] + px[2]; var h: arr[u32] = [0, "
+                          "0]; h[1] = h[1] + 1; var s: i16 = -300; printf(\"%d %d %d %d %d %ld\", px[0], px[3], "
+                          "to_int(px[1]) + to_int(px[2]), h[1], s, to_i64(to_u32(4000000000)));";
+    nmbr_of_tests++;
+    runTest("Narrow ints - Arrays wrap and widen explicitly", narrow1, "127 7 383 1 -300 4000000000", failed);
+
+    std::string narrow2 = "struct px{r: u8; w: i16;}; var p: px = px(1, -5); p.r = 200; var m: map[int, u8] = {1: 3}; "
+                          "m[7] = 9; m[1] = 250; var d: map[int, double] = {1: 1.5, 2: 2.5}; printf(\"%d %d %d %d "
+                          "%.1lf %d\", p.r, p.w, m[1], m[7], d[2], to_u8(300));";
+    nmbr_of_tests++;
+    runTest("Narrow ints - Struct fields and map values", narrow2, "200 -5 250 9 2.5 44", failed);
+
+    // float tests
+    std::string float1 = "var f: float = 1.5; var g: float = f * 2.0 + 0.25; g++; var xs: arr[float] = [0.5, 1.5]; "
+                         "append(xs, g); xs[1] = xs[1] * f; var d: double = to_double(g) + 0.5; printf(\"%.2f %.2f "
+                         "%.2f %.2lf %d\", g, xs[1], xs[2], d, to_int(g));";
+    nmbr_of_tests++;
+    runTest("Float - Arithmetic and arrays", float1, "4.25 2.25 4.25 4.75 4", failed);
+
+    std::string float2 = "struct s{a: float; b: double;}; var v: s = s(2.5, 3.25); v.a = v.a * 2.0; var m: map[int, "
+                         "float] = {1: 0.5}; m[2] = 4.5; var h: float = to_float(v.b); printf(\"%.2f %.2lf %.2f "
+                         "%.2f\", v.a, v.b, m[2], h);";
+    nmbr_of_tests++;
+    runTest("Float - Struct fields, map values and conversions", float2, "5.00 3.25 4.50 3.25", failed);
+
+    // for each tests
+    std::string forEach1 = "var a: arr[int] = [1, 2, 3, 4]; var sum: int = 0; for (i, x in a) { if (x == 4) { break; "
+                           "} sum += i * x; } var n: int = 0; for (c in \"hello\") { if (c == to_u8(108)) { n += 1; "
+                           "} } var b: arr[int] = [1, 2]; for (x in b) { append(b, x); } printf(\"%d %d %d\", sum, "
+                           "n, len(b));";
+    nmbr_of_tests++;
+    runTest("For each - Arrays and strings", forEach1, "8 2 4", failed);
+
+    std::string forEach2 = "var m: map[str, int] = {\"a\": 1, \"b\": 2}; for (k, v in m) { printf(\"%s=%d \", k, "
+                           "v); } var ws: arr[str] = [\"ab\", \"cd\"]; var s: str = \"\"; for (w in ws) { s = s + "
+                           "w; } for (k in m) { s = s + k; } printf(\"%s\", s);";
+    nmbr_of_tests++;
+    runTest("For each - Maps and strings items", forEach2, "a=1 b=2 abcdab", failed);
+
+    // bounds check tests
+    std::string bounds1 = "var a: arr[int] = [1, 2, 3]; var sum: int = 0; for (var i: int = 0; i < len(a); i++) { sum "
+                          "+= a[i]; if (i == 0) { append(a, 4); } } var n: int = 5; for (var j: int = 0; j < n; j++) "
+                          "{ if (j < 4) { sum += a[j]; } } printf(\"%d\", sum);";
+    nmbr_of_tests++;
+    runTest("Bounds checks - Loops over len and guarded indices", bounds1, "20", failed);
+
+    std::string bounds2 = "fun total(xs: arr[int], n: int) -> int { var t: int = 0; for (var i: int = 0; i < n; i++) { "
+                          "t += xs[i]; } return t; } var a: arr[int] = [1, 2]; printf(\"%d \", total(a, 2)); "
+                          "printf(\"%d\", total(a, 3));";
+    nmbr_of_tests++;
+    runTest("Bounds checks - Hoisted range check", bounds2, "3 [line 1] Trying to index outside of array\nsize: 2\nidx: 2\n",
+            failed);
+
+    std::string bounds3 = "var a: arr[int] = [1, 2, 3, 4, 5]; var sum: int = 0; for (var i: int = 0; i < 10; i++) { "
+                          "printf(\"%d \", i); sum += a[i]; }";
+    nmbr_of_tests++;
+    runTest("Bounds checks - Failed range check keeps the loop's output", bounds3,
+            "0 1 2 3 4 5 [line 1] Trying to index outside of array\nsize: 5\nidx: 5\n", failed);
+
+    // region tests
+    std::string region1 = "var names: arr[str] = []; var longest: str = \"\"; var total: int = 0; for (w in [\"ab\", "
+                          "\"abcdefgh\", \"abc\"]) { region { var s: str = w + w + w; var ns: arr[int] = [len(s)]; "
+                          "append(names, s); total += ns[0]; if (len(s) > len(longest)) { longest = s; } } } "
+                          "printf(\"%d %s %s\", total, names[0], longest);";
+    nmbr_of_tests++;
+    runTest("Region - Values copied out of a loop", region1, "39 ababab abcdefghabcdefghabcdefgh", failed);
+
+    std::string region2 = "struct p{x:int;}; var ps: arr[p] = []; var o: str = \"\"; region { var a: str = \"outer "
+                          "region string\"; var qs: arr[p] = [p(1), p(2)]; region { var b: str = \" and inner\"; o = "
+                          "a + b; append(ps, qs[1]); } ps = qs; } printf(\"%s %d %d\", o, len(ps), ps[1].x);";
+    nmbr_of_tests++;
+    runTest("Region - Nested regions", region2, "outer region string and inner 2 2", failed);
+
+    // refcount tests
+    std::string refcount1 = "fun make(n: int) -> arr[int] { var a: arr[int] = []; for (var i: int = 0; i < n; i++) { "
+                            "append(a, i); } return a; } fun keep(s: str) -> str { return s; } var total: int = 0; "
+                            "var last: str = \"\"; for (var i: int = 0; i < 1000; i++) { var s: str = \"a string on "
+                            "the heap \" + \"!\"; var a: arr[int] = make(5); s = keep(s) + \"?\"; last = s; total += "
+                            "a[4] + len(s); } printf(\"%d %s\", total, last);";
+    nmbr_of_tests++;
+    runTest("Refcount - Values released in a loop", refcount1, "27000 a string on the heap !?", failed);
+
+    std::string refcount2 = "var out: arr[str] = []; var s: str = \"a string that is shared\" + \"!\"; var t: str = s; "
+                            "s = s + \"?\"; var u: str = t; append(out, u); var nums: arr[int] = [1, 2, 3]; var more: "
+                            "arr[int] = nums; nums = [4]; printf(\"%s %s %s %d %d\", s, t, out[0], len(more), "
+                            "nums[0]);";
+    nmbr_of_tests++;
+    runTest("Refcount - Shared values outlive a released owner", refcount2,
+            "a string that is shared!? a string that is shared! a string that is shared! 3 4", failed);
+
+    std::string refcount3 = "var total: int = 0; var last: str = \"\"; for (var i: int = 0; i < 1000; i++) { var w: "
+                            "arr[str] = [\"a string that is on the heap\", \"b\"]; var table: arr[arr[str]] = [w, "
+                            "[\"c\"]]; var copy: arr[arr[str]] = table; copy[0][1] = \"d\"; table[1] = w; var m: "
+                            "map[str, arr[str]] = {\"key\": w}; m[last + \"key\"] = table[1]; m[\"key\"] = [\"e\"]; "
+                            "append(w, \"f\"); last = table[1][0]; total += len(table[0]) + len(copy[0][1]) + "
+                            "len(m[\"key\"]); } printf(\"%d %s\", total, last);";
+    nmbr_of_tests++;
+    runTest("Refcount - Boxed items are dropped with their array", refcount3, "4000 a string that is on the heap",
+            failed);
+
+    std::string refcount4 = "var a: str = \"first part of a long string\"; var s: str = (a + \" and more\")[6:30]; var "
+                            "t: str = \"another long string on the heap\"; var u: str = t[8:19]; t = \"replaced\"; "
+                            "u[0] = \"L\"; var w: arr[str] = [\"one heap string here!!!!\", \"two heap string "
+                            "here!!!!\", \"three\"]; var v: arr[str] = w[1:3]; w = []; v[0] = \"changed\"; "
+                            "printf(\"%s|%s|%s %s\", s, u, v[0], v[1]);";
+    nmbr_of_tests++;
+    runTest("Refcount - Slices keep the source buffer alive", refcount4,
+            "part of a long string an|Long string|changed three", failed);
+
+    std::string refcount5 = "fun grow(ref s: set[int], n: int) -> nil { for (var i: int = 0; i < n; i++) { insert(s, "
+                            "i); } } fun first(s: set[int]) -> set[int] { return s; } var total: int = 0; for (var i: "
+                            "int = 0; i < 1000; i++) { var s: set[int] = {1, 2, 3}; grow(s, 40); var t: set[int] = s; "
+                            "t = union(t, {100, 200}); s = t; var f: set[int] = first(t); var b: builder = {}; "
+                            "push_int(b, len(elements(f))); var c: builder = b; b = c; total += len(elements(s)) + "
+                            "len(build(b)); } printf(\"%d\", total);";
+    nmbr_of_tests++;
+    runTest("Refcount - Sets and builders released in a loop", refcount5, "44000", failed);
+
+    // scope tests
+    std::string scope1 = "fun wrap(s: str) -> str { return \"[\" + s + \"]\"; } fun find(word: str, target: str) -> "
+                         "str { for (var i: int = 0; i < 3; i++) { if (len(word + target) > 30 + i) { var hit: str = "
+                         "wrap(word) + \" is long enough\"; return hit; } } return \"none\"; } var words: arr[str] = "
+                         "[\"short\", \"a word that is rather long\"]; var found: str = \"\"; var n: int = 0; while "
+                         "(n < 10) { if (len(wrap(words[0]) + \"padding to go past sixteen\") > 20) { var seen: str = "
+                         "wrap(words[1]) + \" seen\"; found = seen; if (n > 2) { var extra: str = seen + \" again\"; "
+                         "break; } } wrap(\"discarded result that is long\"); n++; } printf(\"%d %s %s\", n, found, "
+                         "find(words[1], \" and a target\"));";
+    nmbr_of_tests++;
+    runTest("Scope - Branches and temporaries are freed on every path", scope1,
+            "3 [a word that is rather long] seen [a word that is rather long] is long enough", failed);
+
+    std::string scope2 = "fun pick(words: arr[str]) -> str { var found: str = \"\"; for (w in words) { var seen: str "
+                         "= w + \" seen in the loop body\"; if (len(seen) > 30) { var extra: arr[str] = [seen, w]; "
+                         "found = extra[0]; break; } found = seen; } return found; } var kept: arr[str] = []; var n: "
+                         "int = 0; while (n < 3) { var line: str = \"line number that is long \" + \"x\"; var parts: "
+                         "arr[str] = [line, \"second\"]; append(kept, parts[0]); n++; if (n == 2) { var last: str = "
+                         "line + \" at two\"; append(kept, last); break; } } for (var i: int = 0; i < 2; i++) { var "
+                         "m: map[str, arr[str]] = {\"k\": [\"a value in the map that is long\"]}; var v: arr[str] = "
+                         "m[\"k\"]; append(kept, v[0]); } printf(\"%s|%d|%s|%s\", pick([\"ab\", \"a much longer word "
+                         "here\"]), len(kept), kept[2], kept[4]);";
+    nmbr_of_tests++;
+    runTest("Scope - Loop bodies are released every iteration and on break", scope2,
+            "a much longer word here seen in the loop body|5|line number that is long x at two|a value in the map that "
+            "is long",
+            failed);
+
+    std::string scope3 = "var total: int = 0; var n: int = 0; while (n < 2000) { var s: set[int] = {n, n + 1}; for "
+                         "(var i: int = 0; i < 200; i++) { insert(s, i); } var b: builder = {}; for (var j: int = 0; "
+                         "j < 200; j++) { push_int(b, j); } n++; if (n == 1999) { var u: set[int] = union(s, "
+                         "{5000}); var c: builder = b; total += len(elements(u)) + len(build(c)); break; } total += "
+                         "len(elements(s)); } var last: set[int] = {1, 2}; var lb: builder = {}; push_int(lb, total); "
+                         "printf(\"%d %s %d\", total, build(lb), len(elements(last)));";
+    nmbr_of_tests++;
+    runTest("Scope - Sets and builders in a loop body are released", scope3, "403890 403890 2", failed);
+
+    // stack array tests
+    std::string stack1 = "fun add_all(a: arr[int]) -> int { var s: int = 0; for (x in a) { s += x; } return s; } fun "
+                         "weigh(n: int) -> int { var w: arr[int] = [n, n + 1, n + 2]; w[1] = 10; var c: arr[int] = w; "
+                         "c[0] = 0; return w[0] + w[1] + len(w) + c[0]; } var p: arr[int] = [1, 2, 3]; "
+                         "printf(\"%d %d\", weigh(5), add_all(p));";
+    nmbr_of_tests++;
+    runTest("Stack arrays - Local literals behave like heap arrays", stack1, "18 6", failed);
+
+    // alloca tests
+    std::string alloca1 = "struct p{x:int;}; var n: int = 0; var last: arr[str] = []; for (var i: int = 0; i < "
+                          "1000000; i++) { var s: str = \"a literal in a long loop\"; var q: p = p(i); n += len(s) + "
+                          "q.x - i; if (i > 999997) { append(last, s); } } printf(\"%d %d %s\", n, len(last), "
+                          "last[1]);";
+    nmbr_of_tests++;
+    runTest("Allocas - Long loops reuse their slots", alloca1, "24000000 2 a literal in a long loop", failed);
+
+    // aggregate argument tests
+    std::string aggregate1 =
+        "struct big{a:int; b:int; c:int; d:int; e:double;}; fun sumBig(x: big) -> int { return x.a + x.b + x.c + x.d; "
+        "} fun makeBig(n: int) -> big { return big(n, n + 1, n + 2, n + 3, 1.0); } fun grow(xs: arr[int], n: int) -> "
+        "arr[int] { var ys: arr[int] = xs; append(ys, n); return ys; } fun upTo(n: int) -> arr[int] { if (n == 0) { "
+        "return []; } var r: arr[int] = upTo(n - 1); append(r, n); return r; } var s: int = 0; for (var i: int = 0; i "
+        "< 10; i++) { s += sumBig(makeBig(i)); } var xs: arr[int] = [1, 2]; var ys: arr[int] = grow(xs, 3); var b: big "
+        "= makeBig(7); printf(\"%d %d %d %d %d\", s, len(xs), len(ys), len(upTo(5)), b.d);";
+    nmbr_of_tests++;
+    runTest("Aggregate arguments - Passed and returned through pointers", aggregate1, "240 2 3 5 10", failed);
+
+    // ref param tests
+    std::string ref1 =
+        "struct acc{n:int; total:int;}; fun fillWith(ref xs: arr[int], v: int, n: int) -> nil { for (var i: int = 0; "
+        "i < n; i++) { append(xs, v - i); } } fun sortIn(ref xs: arr[int]) -> nil { for (var i: int = 0; i < len(xs); "
+        "i++) { for (var j: int = i + 1; j < len(xs); j++) { if (xs[j] < xs[i]) { var t: int = xs[i]; xs[i] = xs[j]; "
+        "xs[j] = t; } } } } fun add(ref a: acc, v: int) -> bool { a.n = a.n + 1; a.total = a.total + v; return v > 5; "
+        "} var xs: arr[int] = [5]; fillWith(xs, 9, 3); sortIn(xs); var a: acc = acc(0, 0); add(a, 4); add(a, 6); "
+        "printf(\"%d %d %d %d %d\", len(xs), xs[0], xs[3], a.n, a.total);";
+    nmbr_of_tests++;
+    runTest("Ref params - Arrays and structs updated in place", ref1, "4 5 9 2 10", failed);
+
+    std::string ref2 =
+        "fun g(p: arr[int]) -> nil { p[0] = 42; } fun h(p: arr[int]) -> nil { g(p); } var y: arr[int] = [1]; var z: "
+        "arr[int] = y; g(y); var a: arr[int] = [1]; var b: arr[int] = a; h(a); printf(\"%d %d %d %d\", y[0], z[0], "
+        "a[0], b[0]);";
+    nmbr_of_tests++;
+    runTest("Ref params - Item writes don't reach copies of the argument", ref2, "42 1 42 1", failed);
+
     printf("\nRan %d tests\n", nmbr_of_tests);
     if (failed.size() == 0) {
         printf("All test passed\n");